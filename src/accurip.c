@@ -22,6 +22,7 @@
 #include "accurip.h"
 #include "cyanrip_log.h"
 #include "bytestream.h"
+#include "cache.h"
 
 #define ACCURIP_DB_BASE_URL "http://www.accuraterip.com/accuraterip"
 
@@ -54,109 +55,106 @@ static int get_accurip_ids(cyanrip_ctx *ctx, uint32_t *id_type_1, uint32_t *id_t
     return audio_tracks;
 }
 
-typedef struct RecvCtx {
-    cyanrip_ctx *ctx;
-    uint8_t *data;
-    size_t size;
-} RecvCtx;
-
-static size_t receive_data(void *buffer, size_t size, size_t nb, void *opaque)
-{
-    RecvCtx *rctx = opaque;
-
-    rctx->data = av_realloc(rctx->data, rctx->size + (size * nb));
-    memcpy(rctx->data + rctx->size, buffer, size * nb);
-    rctx->size += size * nb;
-
-    return size * nb;
-}
-
 static int cmp_conf(const void *a, const void *b)
 {
     return ((CRIPAccuDBEntry *)a)->confidence - ((CRIPAccuDBEntry *)b)->confidence;
 }
 
-int crip_fill_accurip(cyanrip_ctx *ctx)
+int crip_accurip_start(cyanrip_ctx *ctx)
 {
-    int ret = 0;
-    char errbuf[CURL_ERROR_SIZE];
-    RecvCtx rctx = { .ctx = ctx };
-
     if (ctx->settings.disable_accurip)
         return 0;
 
-    CURL *curl_ctx = curl_easy_init();
-
     /* Get both accurip disc IDs */
     uint32_t id_type_1, id_type_2;
     int audio_tracks = get_accurip_ids(ctx, &id_type_1, &id_type_2);
 
-    /* Get CDDB ID */
+    /* Get CDDB ID, complained about once the lookup is finished */
     const char *cddb_id_str = dict_get(ctx->meta, "cddb");
-    if (!cddb_id_str) {
-        cyanrip_log(ctx, 0, "Unable to get AccuRIP DB data: missing CDDB ID!\n");
-        goto end;
-    }
+    if (!cddb_id_str)
+        return 0;
+
+    ctx->ar_req = av_mallocz(sizeof(*ctx->ar_req));
+    if (!ctx->ar_req)
+        return AVERROR(ENOMEM);
 
     /* Format all the data in the needed way */
     uint32_t cddb_id = strtoul(cddb_id_str, NULL, 16);
     char id_type_1_s[9] = { 0 };
     snprintf(id_type_1_s, sizeof(id_type_1_s), "%08x", id_type_1);
 
-    /* Finally compose the URL */
-    char request_url[512] = { 0 };
-    snprintf(request_url, sizeof(request_url), "%s/%c/%c/%c/dBAR-%.3d-%s-%08x-%08x.bin",
-             ACCURIP_DB_BASE_URL,
-             id_type_1_s[7], id_type_1_s[6], id_type_1_s[5],
+    /* Finally compose the URL, the file name alone identifies the disc */
+    CRIPFetchReq *req = ctx->ar_req;
+    snprintf(req->cache_key, sizeof(req->cache_key), "dBAR-%.3d-%s-%08x-%08x.bin",
              audio_tracks, id_type_1_s, id_type_2, cddb_id);
+    snprintf(req->url, sizeof(req->url), "%s/%c/%c/%c/%s",
+             crip_lookup_url("CYANRIP_ACCURIP_URL", ACCURIP_DB_BASE_URL),
+             id_type_1_s[7], id_type_1_s[6], id_type_1_s[5], req->cache_key);
+    req->cache_type = "accuraterip";
 
-    curl_easy_setopt(curl_ctx, CURLOPT_URL, request_url);
+    return crip_cache_fetch_start(ctx, req);
+}
 
-    char user_agent[256] = { 0 };
-    sprintf(user_agent, "cyanrip/%s ( https://github.com/cyanreg/cyanrip )", PROJECT_VERSION_STRING);
-    curl_easy_setopt(curl_ctx, CURLOPT_USERAGENT, user_agent);
+void crip_accurip_free(cyanrip_ctx *ctx)
+{
+    if (!ctx->ar_req)
+        return;
 
-    curl_easy_setopt(curl_ctx, CURLOPT_WRITEFUNCTION, receive_data);
-    curl_easy_setopt(curl_ctx, CURLOPT_WRITEDATA, &rctx);
+    crip_fetch_wait(ctx->shared->fetch, ctx->ar_req);
+    crip_fetch_req_free(ctx->ar_req);
+    av_freep(&ctx->ar_req);
+}
 
-    curl_easy_setopt(curl_ctx, CURLOPT_ERRORBUFFER, errbuf);
-    curl_easy_setopt(curl_ctx, CURLOPT_FAILONERROR, 1L); /* Explode on errors */
+int crip_fill_accurip(cyanrip_ctx *ctx)
+{
+    int ret = 0;
+    CRIPFetchReq *req = ctx->ar_req;
 
-    CURLcode res = curl_easy_perform(curl_ctx);
-    if (res != CURLE_OK) {
+    if (ctx->settings.disable_accurip)
+        return 0;
+
+    if (!req) {
+        cyanrip_log(ctx, 0, "Unable to get AccuRIP DB data: missing CDDB ID!\n");
+        goto end;
+    }
+
+    uint32_t id_type_1, id_type_2;
+    int audio_tracks = get_accurip_ids(ctx, &id_type_1, &id_type_2);
+    uint32_t cddb_id = strtoul(dict_get(ctx->meta, "cddb"), NULL, 16);
+
+    crip_cache_fetch_wait(ctx, req);
+
+    if (req->res != CURLE_OK) {
         /* Filter out the majority of 404 errors here */
-        if (res == CURLE_HTTP_RETURNED_ERROR) {
+        if (req->res == CURLE_HTTP_RETURNED_ERROR) {
             cyanrip_log(ctx, 0, "Unable to get AccuRIP DB data: missing entry!\n");
             ctx->ar_db_status = CYANRIP_ACCUDB_NOT_FOUND;
             goto end;
         }
 
         /* Different error */
-        size_t len = strlen(errbuf);
+        size_t len = strlen(req->errbuf);
         if (len)
             cyanrip_log(ctx, 0, "Unable to get AccuRIP DB data: %s%s",
-                        errbuf, ((errbuf[len - 1] != '\n') ? "\n" : ""));
+                        req->errbuf, ((req->errbuf[len - 1] != '\n') ? "\n" : ""));
         else
             cyanrip_log(ctx, 0, "Unable to get AccuRIP DB data: %s\n!\n",
-                        curl_easy_strerror(res));
+                        curl_easy_strerror(req->res));
         ctx->ar_db_status = CYANRIP_ACCUDB_ERROR;
         goto end;
     }
 
-    /* Get content type, if not possible we probably have an error somewhere */
-    char *content_type = NULL;
-    res = curl_easy_getinfo(curl_ctx, CURLINFO_CONTENT_TYPE, &content_type);
-    if (res != CURLE_OK) {
-        cyanrip_log(ctx, 0, "Unable to get AccuRIP DB data: %s\n!\n",
-                    curl_easy_strerror(res));
+    /* Without a content type, we probably have an error somewhere */
+    if (!req->content_type) {
+        cyanrip_log(ctx, 0, "Unable to get AccuRIP DB data: no content type!\n");
         goto end;
     }
 
     /* If we have a binary we're pretty sure we've found a match */
-    if (strcmp(content_type, "application/octet-stream")) {
+    if (strcmp(req->content_type, "application/octet-stream")) {
         /* Atrocious heuristics to determine whether we have an error or binary data, don't look */
-        char *html_loc = strstr((const char *)rctx.data, "html");
-        if (html_loc && (html_loc - (char *)rctx.data) < 64) {
+        char *html_loc = req->data ? strstr((const char *)req->data, "html") : NULL;
+        if (html_loc && (html_loc - (char *)req->data) < 64) {
             /* If we have "html" in the first 64 bytes its likely an error.
              * This is painful to write. */
             cyanrip_log(ctx, 0, "Unable to get AccuRIP DB data: missing entry!\n");
@@ -166,19 +164,19 @@ int crip_fill_accurip(cyanrip_ctx *ctx)
     }
 
     GetByteContext gbc = { 0 };
-    bytestream2_init(&gbc, rctx.data, rctx.size);
+    bytestream2_init(&gbc, req->data, req->size);
 
     ctx->ar_db_status = CYANRIP_ACCUDB_FOUND;
 
     int entry_size = 1 + 12 + audio_tracks * (1 + 8);
 
-    if (rctx.size % entry_size) {
+    if (req->size % entry_size) {
         cyanrip_log(ctx, 0, "AccuRIP DB data error, got unexpected number of bytes!\n");
         ctx->ar_db_status = CYANRIP_ACCUDB_ERROR;
         goto end;
     }
 
-    int nb_entries = rctx.size / entry_size;
+    int nb_entries = req->size / entry_size;
 
     for (int i = 0; i < nb_entries; i++) {
         if (bytestream2_get_byte(&gbc) != audio_tracks ||
@@ -223,8 +221,7 @@ int crip_fill_accurip(cyanrip_ctx *ctx)
     }
 
 end:
-    curl_easy_cleanup(curl_ctx);
-    av_free(rctx.data);
+    crip_accurip_free(ctx);
 
     return ret;
 }
@@ -244,3 +241,9 @@ int crip_find_ar(cyanrip_track *t, uint32_t checksum, int is_450)
 
     return -1;
 }
+
+int crip_ar_verified(cyanrip_track *t)
+{
+    return crip_find_ar(t, t->acurip_checksum_v1, 0) > 0 ||
+           crip_find_ar(t, t->acurip_checksum_v2, 0) > 0;
+}
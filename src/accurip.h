@@ -20,5 +20,16 @@
 
 #include <cyanrip_main.h>
 
+/* Starts looking up the disc in the AccurateRip DB, needs the disc IDs */
+int crip_accurip_start(cyanrip_ctx *ctx);
+
+/* Waits for the lookup, and fills in the entries of each track */
 int crip_fill_accurip(cyanrip_ctx *ctx);
+
+/* Drops a lookup which was never waited on */
+void crip_accurip_free(cyanrip_ctx *ctx);
+
 int crip_find_ar(cyanrip_track *t, uint32_t checksum, int is_450);
+
+/* Whether either checksum of the track is in the database */
+int crip_ar_verified(cyanrip_track *t);
@@ -0,0 +1,558 @@
+/*
+ * This file is part of cyanrip.
+ *
+ * cyanrip is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * cyanrip is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with cyanrip; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include <pthread.h>
+
+#include <libavcodec/avcodec.h>
+#include <libavformat/avio.h>
+#include <libavutil/intreadwrite.h>
+#include <libavutil/md5.h>
+#include <libavutil/mem.h>
+
+#include "archive.h"
+#include "enc_pool.h"
+#include "flac_frame.h"
+#include "cyanrip_log.h"
+#include "utils.h"
+
+#define HUNK_SIZE (CRIP_ARCHIVE_HUNK_SECTORS*CDIO_CD_FRAMESIZE_RAW)
+
+enum CRIPArchiveHunkState {
+    HUNK_EMPTY = 0,
+    HUNK_FILLING,
+    HUNK_SUBMITTED,
+};
+
+enum CRIPArchiveSectorState {
+    SECTOR_UNREAD = 0,
+    SECTOR_READ,
+    SECTOR_FLAGGED, /* Not read cleanly, or paranoia couldn't verify it */
+};
+
+static const char *const sector_state_names[] = {
+    [SECTOR_UNREAD]  = "unread",
+    [SECTOR_READ]    = "read",
+    [SECTOR_FLAGGED] = "flagged",
+};
+
+typedef struct CRIPArchiveHunk {
+    CRIPEncJob job; /* Must be first */
+    struct CRIPArchive *s;
+    int idx;
+    uint8_t *pcm; /* Silence where nothing was written */
+    uint64_t *written; /* Bitmask of the samples written */
+    int size;
+    int filled; /* Samples written */
+    struct CRIPArchiveHunk *next;
+} CRIPArchiveHunk;
+
+/* Where a hunk ended up in the file */
+typedef struct CRIPArchiveEntry {
+    int64_t pos;
+    int size;
+    uint8_t md5[16];
+} CRIPArchiveEntry;
+
+struct CRIPArchive {
+    cyanrip_ctx *ctx;
+    FILE *f;
+    int64_t pos;
+
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+
+    lsn_t start_lsn;
+    int nb_sectors;
+    int nb_hunks;
+
+    uint8_t *hunk_state;
+    CRIPArchiveHunk **filling;
+    CRIPArchiveEntry *entries;
+    uint8_t *sector_state;
+
+    CRIPArchiveHunk *submitted; /* Freed once all are done */
+    int in_flight;
+    int max_in_flight;
+    int status;
+};
+
+static int hunk_size(CRIPArchive *s, int idx)
+{
+    int sectors = FFMIN(s->nb_sectors - idx*CRIP_ARCHIVE_HUNK_SECTORS,
+                        CRIP_ARCHIVE_HUNK_SECTORS);
+    return sectors*CDIO_CD_FRAMESIZE_RAW;
+}
+
+static int receive_packets(AVCodecContext *avctx, AVPacket *pkt, AVIOContext *pb,
+                           int *min_size, int *max_size)
+{
+    int ret;
+
+    while ((ret = avcodec_receive_packet(avctx, pkt)) >= 0) {
+        /* The STREAMINFO update at the end is done separately */
+        if (pkt->size) {
+            avio_write(pb, pkt->data, pkt->size);
+            *min_size = *min_size ? FFMIN(*min_size, pkt->size) : pkt->size;
+            *max_size = FFMAX(*max_size, pkt->size);
+        }
+        av_packet_unref(pkt);
+    }
+
+    return ret == AVERROR(EAGAIN) ? 0 : ret;
+}
+
+/* Encodes a hunk as a FLAC stream of its own */
+static int encode_hunk(CRIPArchiveHunk *h, uint8_t **out, int *out_size,
+                       uint8_t md5[16])
+{
+    const AVCodec *codec = avcodec_find_encoder(AV_CODEC_ID_FLAC);
+    AVCodecContext *avctx = NULL;
+    AVFrame *frame = NULL;
+    AVPacket *pkt = NULL;
+    AVIOContext *pb = NULL;
+    int min_size = 0, max_size = 0;
+    int nb_samples = h->size >> 2;
+    int ret;
+
+    if (!codec)
+        return AVERROR_ENCODER_NOT_FOUND;
+
+    avctx = avcodec_alloc_context3(codec);
+    frame = av_frame_alloc();
+    pkt = av_packet_alloc();
+    if (!avctx || !frame || !pkt) {
+        ret = AVERROR(ENOMEM);
+        goto end;
+    }
+
+    avctx->sample_fmt = AV_SAMPLE_FMT_S16;
+    avctx->sample_rate = 44100;
+    avctx->time_base = (AVRational){ 1, 44100 };
+    avctx->frame_size = CRIP_ARCHIVE_FRAME_SAMPLES;
+    avctx->compression_level = crip_fmt_info[CYANRIP_FORMAT_FLAC].compression_level;
+    avctx->ch_layout = (AVChannelLayout)AV_CHANNEL_LAYOUT_STEREO;
+
+    ret = avcodec_open2(avctx, codec, NULL);
+    if (ret < 0)
+        goto end;
+    if (avctx->extradata_size < CRIP_FLAC_STREAMINFO_SIZE) {
+        ret = AVERROR_BUG;
+        goto end;
+    }
+
+    ret = avio_open_dyn_buf(&pb);
+    if (ret < 0)
+        goto end;
+
+    /* STREAMINFO, the only and so last metadata block */
+    avio_write(pb, "fLaC", 4);
+    avio_w8(pb, 0x80);
+    avio_wb24(pb, CRIP_FLAC_STREAMINFO_SIZE);
+    avio_write(pb, avctx->extradata, CRIP_FLAC_STREAMINFO_SIZE);
+
+    for (int i = 0;; i += avctx->frame_size) {
+        if (i < nb_samples) {
+            frame->format = AV_SAMPLE_FMT_S16;
+            frame->sample_rate = 44100;
+            frame->nb_samples = FFMIN(avctx->frame_size, nb_samples - i);
+            ret = av_channel_layout_copy(&frame->ch_layout, &avctx->ch_layout);
+            if (ret >= 0)
+                ret = av_frame_get_buffer(frame, 0);
+            if (ret < 0)
+                goto end;
+
+            const uint8_t *src = h->pcm + 4*i;
+#if CONFIG_BIG_ENDIAN
+            int16_t *dst = (int16_t *)frame->data[0];
+            for (int j = 0; j < 2*frame->nb_samples; j++)
+                dst[j] = AV_RL16(src + 2*j);
+#else
+            memcpy(frame->data[0], src, 4*frame->nb_samples);
+#endif
+            ret = avcodec_send_frame(avctx, frame);
+            av_frame_unref(frame);
+        } else {
+            ret = avcodec_send_frame(avctx, NULL);
+        }
+        if (ret < 0)
+            goto end;
+
+        ret = receive_packets(avctx, pkt, pb, &min_size, &max_size);
+        if (ret == AVERROR_EOF)
+            break;
+        else if (ret < 0)
+            goto end;
+    }
+
+    /* CD audio is little-endian, as FLAC hashes it */
+    av_md5_sum(md5, h->pcm, h->size);
+
+    *out_size = avio_close_dyn_buf(pb, out);
+    pb = NULL;
+    if (!*out) {
+        ret = AVERROR(ENOMEM);
+        goto end;
+    }
+    crip_flac_streaminfo_update(*out + 8, min_size, max_size, nb_samples, md5);
+    ret = 0;
+
+end:
+    if (pb) {
+        uint8_t *tmp;
+        avio_close_dyn_buf(pb, &tmp);
+        av_free(tmp);
+    }
+    av_packet_free(&pkt);
+    av_frame_free(&frame);
+    avcodec_free_context(&avctx);
+    return ret;
+}
+
+/* Encodes and writes a hunk, run by the encoding workers */
+static int hunk_step(CRIPEncJob *job)
+{
+    CRIPArchiveHunk *h = (CRIPArchiveHunk *)job;
+    CRIPArchive *s = h->s;
+    uint8_t *buf = NULL, md5[16];
+    int size = 0;
+
+    cyanrip_set_thread_ctx(s->ctx);
+
+    int ret = encode_hunk(h, &buf, &size, md5);
+    av_freep(&h->pcm);
+    av_freep(&h->written);
+
+    pthread_mutex_lock(&s->lock);
+    if (ret >= 0 && !s->status) {
+        if (fwrite(buf, 1, size, s->f) != size) {
+            ret = AVERROR(EIO);
+        } else {
+            CRIPArchiveEntry *e = &s->entries[h->idx];
+            e->pos = s->pos;
+            e->size = size;
+            memcpy(e->md5, md5, sizeof(md5));
+            s->pos += size;
+        }
+    }
+    if (ret < 0 && !s->status)
+        s->status = ret;
+    s->in_flight--;
+    pthread_cond_broadcast(&s->cond);
+    pthread_mutex_unlock(&s->lock);
+
+    if (ret < 0)
+        cyanrip_log(s->ctx, 0, "Error writing archive image hunk %i: %s!\n",
+                    h->idx, av_err2str(ret));
+
+    av_free(buf);
+
+    return AVERROR_EOF;
+}
+
+/* Must be called with the lock held */
+static void submit_hunk(CRIPArchive *s, CRIPArchiveHunk *h)
+{
+    while (s->in_flight >= s->max_in_flight)
+        pthread_cond_wait(&s->cond, &s->lock);
+
+    s->filling[h->idx] = NULL;
+    s->hunk_state[h->idx] = HUNK_SUBMITTED;
+    h->s = s;
+    h->next = s->submitted;
+    s->submitted = h;
+    s->in_flight++;
+
+    crip_enc_job_start(s->ctx->shared->enc_pool, &h->job, hunk_step);
+}
+
+int crip_archive_open(cyanrip_ctx *ctx, CRIPArchive **s)
+{
+    int ret;
+    CRIPArchive *ar = av_mallocz(sizeof(*ar));
+    if (!ar)
+        return AVERROR(ENOMEM);
+
+    ar->ctx = ctx;
+    ar->start_lsn = ctx->start_lsn;
+    ar->nb_sectors = ctx->end_lsn - ctx->start_lsn + 1;
+    ar->nb_hunks = (ar->nb_sectors + CRIP_ARCHIVE_HUNK_SECTORS - 1) / CRIP_ARCHIVE_HUNK_SECTORS;
+    ar->max_in_flight = FFMAX(2*crip_enc_pool_nb_workers(ctx->shared->enc_pool), 4);
+
+    ar->hunk_state = av_mallocz(ar->nb_hunks);
+    ar->filling = av_calloc(ar->nb_hunks, sizeof(*ar->filling));
+    ar->entries = av_calloc(ar->nb_hunks, sizeof(*ar->entries));
+    ar->sector_state = av_mallocz(ar->nb_sectors);
+    if (!ar->hunk_state || !ar->filling || !ar->entries || !ar->sector_state) {
+        ret = AVERROR(ENOMEM);
+        goto fail;
+    }
+
+    char *path = crip_get_path(ctx, CRIP_PATH_ARCHIVE, 1,
+                               &crip_fmt_info[ctx->settings.outputs[0]], NULL);
+    if (!path) {
+        ret = AVERROR(ENOMEM);
+        goto fail;
+    }
+
+    ar->f = fopen(path, "wb");
+    if (!ar->f) {
+        ret = AVERROR(errno);
+        cyanrip_log(ctx, 0, "Unable to open archive image \"%s\": %s!\n", path,
+                    av_err2str(ret));
+        av_free(path);
+        goto fail;
+    }
+    av_free(path);
+
+    if (fwrite("CRIPARC1", 1, 8, ar->f) != 8) {
+        ret = AVERROR(EIO);
+        goto fail;
+    }
+    ar->pos = 8;
+
+    pthread_mutex_init(&ar->lock, NULL);
+    pthread_cond_init(&ar->cond, NULL);
+
+    *s = ar;
+
+    return 0;
+
+fail:
+    if (ar->f)
+        fclose(ar->f);
+    av_free(ar->sector_state);
+    av_free(ar->entries);
+    av_free(ar->filling);
+    av_free(ar->hunk_state);
+    av_free(ar);
+    return ret;
+}
+
+/* Copies the samples from first on which weren't written yet, returns how
+ * many that were */
+static int hunk_fill(CRIPArchiveHunk *h, int first, int nb, const uint8_t *src)
+{
+    int copied = 0;
+
+    for (int i = first; i < first + nb;) {
+        int written = (h->written[i >> 6] >> (i & 63)) & 1;
+        int run = 1;
+        while (i + run < first + nb &&
+               ((h->written[(i + run) >> 6] >> ((i + run) & 63)) & 1) == written)
+            run++;
+
+        if (!written) {
+            memcpy(h->pcm + 4*i, src + 4*(i - first), 4*run);
+            for (int j = i; j < i + run; j++)
+                h->written[j >> 6] |= UINT64_C(1) << (j & 63);
+            copied += run;
+        }
+
+        i += run;
+    }
+
+    return copied;
+}
+
+int crip_archive_write(CRIPArchive *s, int64_t sample, const uint8_t *data, int bytes)
+{
+    int64_t start = (sample - (int64_t)s->start_lsn*(CDIO_CD_FRAMESIZE_RAW >> 2))*4;
+    int64_t pos = FFMAX(start, 0);
+    int64_t end = FFMIN(start + bytes, (int64_t)s->nb_sectors*CDIO_CD_FRAMESIZE_RAW);
+    int ret = 0;
+
+    pthread_mutex_lock(&s->lock);
+
+    while (pos < end && !s->status) {
+        int idx = pos / HUNK_SIZE;
+        int64_t hunk_start = (int64_t)idx*HUNK_SIZE;
+        int len = FFMIN(end, hunk_start + hunk_size(s, idx)) - pos;
+
+        /* Samples written more than once keep what was written first, which
+         * for a hunk already submitted is all of them */
+        if (s->hunk_state[idx] == HUNK_SUBMITTED) {
+            pos += len;
+            continue;
+        }
+
+        CRIPArchiveHunk *h = s->filling[idx];
+        if (!h) {
+            h = av_mallocz(sizeof(*h));
+            if (h) {
+                h->pcm = av_mallocz(hunk_size(s, idx));
+                h->written = av_calloc((hunk_size(s, idx)/4 + 63)/64,
+                                       sizeof(*h->written));
+            }
+            if (!h || !h->pcm || !h->written) {
+                if (h) {
+                    av_free(h->pcm);
+                    av_free(h->written);
+                }
+                av_free(h);
+                ret = AVERROR(ENOMEM);
+                break;
+            }
+            h->idx = idx;
+            h->size = hunk_size(s, idx);
+            s->filling[idx] = h;
+            s->hunk_state[idx] = HUNK_FILLING;
+        }
+
+        h->filled += hunk_fill(h, (pos - hunk_start)/4, len/4, data + (pos - start));
+        if (h->filled == h->size/4)
+            submit_hunk(s, h);
+
+        pos += len;
+    }
+
+    if (!ret)
+        ret = s->status;
+
+    pthread_mutex_unlock(&s->lock);
+
+    return ret;
+}
+
+void crip_archive_sectors_read(CRIPArchive *s, lsn_t lsn, const uint8_t *flags, int nb)
+{
+    pthread_mutex_lock(&s->lock);
+    for (int i = 0; i < nb; i++) {
+        int idx = lsn + i - s->start_lsn;
+        if (idx < 0 || idx >= s->nb_sectors)
+            continue;
+        s->sector_state[idx] = (flags && flags[i]) ? SECTOR_FLAGGED : SECTOR_READ;
+    }
+    pthread_mutex_unlock(&s->lock);
+}
+
+static void write_index(CRIPArchive *s)
+{
+    cyanrip_ctx *ctx = s->ctx;
+    FILE *f = s->f;
+    const char *mcn = dict_get(ctx->meta, "disc_mcn");
+    const char *discid = dict_get(ctx->meta, "musicbrainz_discid");
+
+    fprintf(f, "CYANRIP ARCHIVE 1\n");
+    fprintf(f, "FORMAT 44100 2 16\n");
+    fprintf(f, "OFFSET %i\n", ctx->settings.offset);
+    fprintf(f, "LSN %i %i\n", ctx->start_lsn, ctx->end_lsn);
+    fprintf(f, "HUNK_SECTORS %i\n", CRIP_ARCHIVE_HUNK_SECTORS);
+    if (mcn)
+        fprintf(f, "MCN %s\n", mcn);
+    if (discid)
+        fprintf(f, "DISCID %s\n", discid);
+
+    /* The TOC as the disc has it */
+    track_t first = cdio_get_first_track_num(ctx->cdio);
+    for (int i = 0; i < ctx->nb_cd_tracks; i++) {
+        track_t nb = first + i;
+        lsn_t pregap = cdio_get_track_pregap_lsn(ctx->cdio, nb);
+        const char *isrc = NULL;
+        int preemphasis = 0;
+        int audio = cdio_cddap_track_audiop(ctx->drive, nb);
+
+        for (int j = 0; j < ctx->nb_tracks; j++) {
+            cyanrip_track *t = &ctx->tracks[j];
+            if (t->cd_track_number != nb)
+                continue;
+            isrc = isrc ? isrc : dict_get(t->meta, "isrc");
+            preemphasis |= t->preemphasis;
+        }
+
+        lsn_t last = cdio_get_track_last_lsn(ctx->cdio, nb);
+        if (last == CDIO_INVALID_LSN)
+            last = ctx->end_lsn;
+
+        fprintf(f, "TRACK %i %s %i %i %i %s %i\n", nb, audio ? "AUDIO" : "DATA",
+                pregap == CDIO_INVALID_LSN ? -1 : pregap,
+                cdio_get_track_lsn(ctx->cdio, nb), last, isrc ? isrc : "-", preemphasis);
+    }
+
+    /* The samples each of the ripped tracks is made of */
+    for (int i = 0; i < ctx->nb_tracks; i++) {
+        cyanrip_track *t = &ctx->tracks[i];
+        if (t->track_is_data)
+            continue;
+        fprintf(f, "SAMPLES %i %"PRIi64" %zu\n", t->number,
+                (int64_t)(t->nominal_start_lsn - s->start_lsn)*(CDIO_CD_FRAMESIZE_RAW >> 2),
+                t->nb_samples);
+    }
+
+    for (int i = 0; i < s->nb_hunks; i++) {
+        CRIPArchiveEntry *e = &s->entries[i];
+        if (!e->size)
+            continue;
+        fprintf(f, "HUNK %i %"PRIi64" %i ", i, e->pos, e->size);
+        for (int j = 0; j < 16; j++)
+            fprintf(f, "%02x", e->md5[j]);
+        fprintf(f, "\n");
+    }
+
+    for (int i = 0; i < s->nb_sectors;) {
+        int state = s->sector_state[i], run = 1;
+        while (i + run < s->nb_sectors && s->sector_state[i + run] == state)
+            run++;
+        fprintf(f, "SECTORS %i %i %s\n", s->start_lsn + i, run, sector_state_names[state]);
+        i += run;
+    }
+}
+
+int crip_archive_close(CRIPArchive **s)
+{
+    CRIPArchive *ar = *s;
+    if (!ar)
+        return 0;
+
+    /* Partly written hunks, e.g. around data tracks or dropped pregaps */
+    pthread_mutex_lock(&ar->lock);
+    for (int i = 0; i < ar->nb_hunks; i++)
+        if (ar->filling[i])
+            submit_hunk(ar, ar->filling[i]);
+    pthread_mutex_unlock(&ar->lock);
+
+    while (ar->submitted) {
+        CRIPArchiveHunk *h = ar->submitted;
+        ar->submitted = h->next;
+        crip_enc_job_wait(ar->ctx->shared->enc_pool, &h->job);
+        av_free(h);
+    }
+
+    int ret = ar->status;
+    if (!ret) {
+        uint8_t footer[16];
+        memcpy(footer, "CRIPIDX1", 8);
+        AV_WL64(footer + 8, ar->pos);
+
+        write_index(ar);
+        if (ferror(ar->f) ||
+            fwrite(footer, 1, sizeof(footer), ar->f) != sizeof(footer))
+            ret = AVERROR(EIO);
+    }
+    if (fclose(ar->f) && !ret)
+        ret = AVERROR(EIO);
+
+    pthread_cond_destroy(&ar->cond);
+    pthread_mutex_destroy(&ar->lock);
+    av_free(ar->sector_state);
+    av_free(ar->entries);
+    av_free(ar->filling);
+    av_free(ar->hunk_state);
+    av_freep(s);
+
+    return ret;
+}
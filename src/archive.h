@@ -0,0 +1,48 @@
+/*
+ * This file is part of cyanrip.
+ *
+ * cyanrip is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * cyanrip is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with cyanrip; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#pragma once
+
+#include "cyanrip_main.h"
+
+/* Sectors of audio in each hunk of an archive image */
+#define CRIP_ARCHIVE_HUNK_SECTORS 64
+
+/* Samples per FLAC frame, so that hunks are made of whole frames */
+#define CRIP_ARCHIVE_FRAME_SAMPLES (8*(CDIO_CD_FRAMESIZE_RAW >> 2))
+
+typedef struct CRIPArchive CRIPArchive;
+
+/* Opens an archive image of the disc, the offset corrected audio from
+ * ctx->start_lsn to ctx->end_lsn in independent FLAC coded hunks, which get
+ * encoded by the encoding workers as they fill up. */
+int crip_archive_open(cyanrip_ctx *ctx, CRIPArchive **s);
+
+/* Adds bytes of audio starting at the given sample of the disc, offset
+ * corrected. Anything outside of the disc is ignored, as are samples which
+ * were already written. May block while too many hunks are waiting to be
+ * encoded. Thread safe. */
+int crip_archive_write(CRIPArchive *s, int64_t sample, const uint8_t *data, int bytes);
+
+/* Records how nb sectors from lsn onwards were read, flags as returned by
+ * the reader, NULL if they were read cleanly. Thread safe. */
+void crip_archive_sectors_read(CRIPArchive *s, lsn_t lsn, const uint8_t *flags, int nb);
+
+/* Encodes whatever's left, padding partly written hunks with silence, then
+ * writes the index with the TOC, ISRCs and what was read of each sector. */
+int crip_archive_close(CRIPArchive **s);
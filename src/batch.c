@@ -0,0 +1,155 @@
+/*
+ * This file is part of cyanrip.
+ *
+ * cyanrip is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * cyanrip is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with cyanrip; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include <dirent.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include <libavformat/avformat.h>
+#include <libavutil/avstring.h>
+#include <libavutil/file.h>
+#include <libavutil/mem.h>
+
+#include "batch.h"
+#include "os_compat.h"
+
+static int add_image(char ***images, int *nb_images, char *path)
+{
+    if (!path)
+        return AVERROR(ENOMEM);
+
+    char **tmp = av_realloc_array(*images, *nb_images + 1, sizeof(*tmp));
+    if (!tmp) {
+        av_free(path);
+        return AVERROR(ENOMEM);
+    }
+
+    tmp[(*nb_images)++] = path;
+    *images = tmp;
+
+    return 0;
+}
+
+static int cmp_path(const void *a, const void *b)
+{
+    return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+static int list_dir(const char *path, char ***images, int *nb_images)
+{
+    int ret = 0;
+    DIR *dir = opendir(path);
+    if (!dir)
+        return AVERROR(errno);
+
+    struct dirent *e;
+    while ((e = readdir(dir))) {
+        if (e->d_name[0] == '.' || !av_match_ext(e->d_name, "cue,nrg,toc"))
+            continue;
+        ret = add_image(images, nb_images, av_asprintf("%s/%s", path, e->d_name));
+        if (ret < 0)
+            break;
+    }
+
+    closedir(dir);
+
+    if (*nb_images)
+        qsort(*images, *nb_images, sizeof(**images), cmp_path);
+
+    return ret;
+}
+
+static int list_file(const char *path, char ***images, int *nb_images)
+{
+    uint8_t *buf;
+    size_t size;
+    int ret = av_file_map(path, &buf, &size, 0, NULL);
+    if (ret < 0)
+        return ret;
+
+    char *text = av_malloc(size + 1);
+    if (text) {
+        memcpy(text, buf, size);
+        text[size] = '\0';
+    }
+    av_file_unmap(buf, size);
+    if (!text)
+        return AVERROR(ENOMEM);
+
+    const char *slash = strrchr(path, '/');
+
+    for (char *line = text, *next; line; line = next) {
+        next = strchr(line, '\n');
+        if (next)
+            *next++ = '\0';
+
+        line += strspn(line, " \t");
+        size_t len = strcspn(line, "\r");
+        while (len && (line[len - 1] == ' ' || line[len - 1] == '\t'))
+            len--;
+        if (!len || line[0] == '#')
+            continue;
+
+        char *image;
+        if (line[0] == '/' || !slash)
+            image = av_strndup(line, len);
+        else
+            image = av_asprintf("%.*s/%.*s", (int)(slash - path), path, (int)len, line);
+
+        ret = add_image(images, nb_images, image);
+        if (ret < 0)
+            break;
+    }
+
+    av_free(text);
+
+    return ret;
+}
+
+int crip_batch_list(const char *path, char ***images, int *nb_images)
+{
+    cyanrip_stat_t st;
+    int ret;
+
+    *images = NULL;
+    *nb_images = 0;
+
+    if (cyanrip_stat(path, &st))
+        return AVERROR(errno);
+
+    if (S_ISDIR(st.st_mode))
+        ret = list_dir(path, images, nb_images);
+    else
+        ret = list_file(path, images, nb_images);
+
+    if (ret < 0)
+        crip_batch_free(images, *nb_images);
+
+    return ret;
+}
+
+void crip_batch_free(char ***images, int nb_images)
+{
+    if (!images || !*images)
+        return;
+
+    for (int i = 0; i < nb_images; i++)
+        av_free((*images)[i]);
+    av_freep(images);
+}
@@ -0,0 +1,27 @@
+/*
+ * This file is part of cyanrip.
+ *
+ * cyanrip is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * cyanrip is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with cyanrip; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#pragma once
+
+/* Lists the disc images to rip in a batch. path is either a directory, in
+ * which case every CUE sheet, NRG and TOC file in it is listed, sorted by
+ * name, or a file listing one image per line. Blank lines and lines starting
+ * with # are skipped, relative paths are relative to the list. */
+int crip_batch_list(const char *path, char ***images, int *nb_images);
+
+void crip_batch_free(char ***images, int nb_images);
@@ -0,0 +1,291 @@
+/*
+ * This file is part of cyanrip.
+ *
+ * cyanrip is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * cyanrip is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with cyanrip; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <time.h>
+
+#include <libavutil/bprint.h>
+#include <libavutil/random_seed.h>
+#include <libavutil/sha.h>
+
+#include "cache.h"
+#include "cyanrip_log.h"
+#include "os_compat.h"
+
+#define CACHE_HEADER "cyanrip cache 1\n"
+
+/* Where the entry for key lives, and creates the directories leading to it */
+static char *entry_path(cyanrip_ctx *ctx, const char *type, const char *key,
+                        int create_dirs)
+{
+    uint8_t digest[32];
+    char hex[2*sizeof(digest) + 1];
+    AVBPrint buf;
+
+    struct AVSHA *sha = av_sha_alloc();
+    if (!sha)
+        return NULL;
+    av_sha_init(sha, 256);
+    av_sha_update(sha, (const uint8_t *)key, strlen(key));
+    av_sha_final(sha, digest);
+    av_free(sha);
+
+    for (int i = 0; i < sizeof(digest); i++)
+        snprintf(hex + 2*i, 3, "%02x", digest[i]);
+
+    av_bprint_init(&buf, 0, AV_BPRINT_SIZE_UNLIMITED);
+
+    av_bprintf(&buf, "%s", ctx->settings.cache_dir);
+    if (create_dirs)
+        mkdir(buf.str, 0700);
+    av_bprintf(&buf, "%c%s", OS_DIR_CHAR, type);
+    if (create_dirs)
+        mkdir(buf.str, 0700);
+    av_bprintf(&buf, "%c%.2s", OS_DIR_CHAR, hex);
+    if (create_dirs)
+        mkdir(buf.str, 0700);
+    av_bprintf(&buf, "%c%s", OS_DIR_CHAR, hex);
+
+    char *path = NULL;
+    av_bprint_finalize(&buf, &path);
+
+    return path;
+}
+
+static int read_file(const char *path, uint8_t **data, size_t *size)
+{
+    FILE *f = fopen(path, "rb");
+    if (!f)
+        return errno == ENOENT ? 0 : AVERROR(errno);
+
+    AVBPrint buf;
+    av_bprint_init(&buf, 0, AV_BPRINT_SIZE_UNLIMITED);
+
+    char tmp[4096];
+    size_t len;
+    while ((len = fread(tmp, 1, sizeof(tmp), f)))
+        av_bprint_append_data(&buf, tmp, len);
+    int err = ferror(f);
+    fclose(f);
+
+    if (err || !av_bprint_is_complete(&buf)) {
+        av_bprint_finalize(&buf, NULL);
+        return err ? AVERROR(EIO) : AVERROR(ENOMEM);
+    }
+
+    *size = buf.len;
+    av_bprint_finalize(&buf, (char **)data);
+
+    return 1;
+}
+
+int crip_cache_get(cyanrip_ctx *ctx, const char *type, const char *key,
+                   uint8_t **data, size_t *size, char **content_type)
+{
+    int ret;
+    uint8_t *file = NULL;
+    size_t file_size = 0;
+
+    *data = NULL;
+    *size = 0;
+    *content_type = NULL;
+
+    if (!ctx->settings.cache_dir)
+        return CRIP_CACHE_MISS;
+
+    char *path = entry_path(ctx, type, key, 0);
+    if (!path)
+        return AVERROR(ENOMEM);
+
+    ret = read_file(path, &file, &file_size);
+    av_free(path);
+    if (ret <= 0)
+        return ret;
+
+    ret = CRIP_CACHE_MISS;
+    if (strncmp((char *)file, CACHE_HEADER, strlen(CACHE_HEADER)))
+        goto end;
+
+    /* Header lines, up to an empty one */
+    int64_t stored = 0;
+    int found = -1, key_matches = 0;
+    char *ctype = NULL;
+    char *line = (char *)file + strlen(CACHE_HEADER);
+    char *payload = NULL;
+    while (line < (char *)file + file_size) {
+        char *next = strchr(line, '\n');
+        if (!next)
+            goto end;
+        *next = '\0';
+
+        if (!*line) {
+            payload = next + 1;
+            break;
+        } else if (!strncmp(line, "time ", 5)) {
+            stored = strtoll(line + 5, NULL, 10);
+        } else if (!strncmp(line, "status ", 7)) {
+            found = !strcmp(line + 7, "found");
+        } else if (!strncmp(line, "content-type ", 13)) {
+            ctype = line + 13;
+        } else if (!strncmp(line, "key ", 4)) {
+            key_matches = !strcmp(line + 4, key);
+        }
+
+        line = next + 1;
+    }
+
+    if (!payload || found < 0 || !key_matches)
+        goto end;
+
+    /* Anything is better than nothing when offline */
+    int64_t age = (int64_t)time(NULL) - stored;
+    if (!ctx->settings.offline && ctx->settings.cache_ttl &&
+        age > (int64_t)ctx->settings.cache_ttl*24*60*60)
+        goto end;
+
+    if (!found) {
+        ret = CRIP_CACHE_NOT_FOUND;
+        goto end;
+    }
+
+    *size = file_size - (payload - (char *)file);
+    *data = av_malloc(*size + 1);
+    if (ctype)
+        *content_type = av_strdup(ctype);
+    if (!*data || (ctype && !*content_type)) {
+        av_freep(data);
+        av_freep(content_type);
+        ret = AVERROR(ENOMEM);
+        goto end;
+    }
+    memcpy(*data, payload, *size);
+    (*data)[*size] = '\0';
+
+    ret = CRIP_CACHE_HIT;
+
+end:
+    av_free(file);
+    return ret;
+}
+
+int crip_cache_put(cyanrip_ctx *ctx, const char *type, const char *key,
+                   const uint8_t *data, size_t size, const char *content_type)
+{
+    int ret = 0;
+
+    if (!ctx->settings.cache_dir)
+        return 0;
+
+    char *path = entry_path(ctx, type, key, 1);
+    char *tmp = path ? av_asprintf("%s.%08x.tmp", path, av_get_random_seed()) : NULL;
+    if (!tmp) {
+        av_free(path);
+        return AVERROR(ENOMEM);
+    }
+
+    FILE *f = fopen(tmp, "wb");
+    if (!f) {
+        ret = AVERROR(errno);
+        goto end;
+    }
+
+    fprintf(f, CACHE_HEADER);
+    fprintf(f, "time %"PRIi64"\n", (int64_t)time(NULL));
+    fprintf(f, "status %s\n", data ? "found" : "missing");
+    if (content_type)
+        fprintf(f, "content-type %s\n", content_type);
+    fprintf(f, "key %s\n\n", key);
+    if (data)
+        fwrite(data, 1, size, f);
+
+    int err = ferror(f);
+    if (fclose(f) || err) {
+        ret = AVERROR(EIO);
+        remove(tmp);
+        goto end;
+    }
+
+    /* Readers only ever see whole entries */
+#ifdef _WIN32
+    remove(path);
+#endif
+    if (rename(tmp, path)) {
+        ret = AVERROR(errno);
+        remove(tmp);
+    }
+
+end:
+    if (ret < 0)
+        cyanrip_log(ctx, 0, "Unable to cache lookup \"%s\": %s!\n", key, av_err2str(ret));
+    av_free(tmp);
+    av_free(path);
+    return ret;
+}
+
+int crip_cache_fetch_start(cyanrip_ctx *ctx, CRIPFetchReq *req)
+{
+    if (req->cache_type) {
+        int ret = crip_cache_get(ctx, req->cache_type, req->cache_key,
+                                 &req->data, &req->size, &req->content_type);
+        if (ret == CRIP_CACHE_HIT) {
+            req->res = CURLE_OK;
+            req->response_code = 200;
+            req->effective_url = av_strdup(req->url);
+            req->cached = 1;
+            return req->effective_url ? 0 : AVERROR(ENOMEM);
+        } else if (ret == CRIP_CACHE_NOT_FOUND) {
+            req->res = CURLE_HTTP_RETURNED_ERROR;
+            req->response_code = 404;
+            req->cached = 1;
+            return 0;
+        }
+    }
+
+    if (ctx->settings.offline) {
+        req->res = CURLE_COULDNT_CONNECT;
+        snprintf(req->errbuf, sizeof(req->errbuf), "not cached, and offline");
+        req->cached = 1;
+        return 0;
+    }
+
+    return crip_fetch_start(ctx->shared->fetch, req);
+}
+
+void crip_cache_fetch_wait(cyanrip_ctx *ctx, CRIPFetchReq *req)
+{
+    crip_fetch_wait(ctx->shared->fetch, req);
+
+    if (req->cached || !req->cache_type || !req->started)
+        return;
+    req->cached = 1;
+
+    if (req->res == CURLE_OK)
+        crip_cache_put(ctx, req->cache_type, req->cache_key,
+                       req->data, req->size, req->content_type);
+    else if (req->res == CURLE_HTTP_RETURNED_ERROR && req->response_code == 404)
+        crip_cache_put(ctx, req->cache_type, req->cache_key, NULL, 0, NULL);
+}
+
+const char *crip_lookup_url(const char *env, const char *def)
+{
+    const char *url = getenv(env);
+    return url && *url ? url : def;
+}
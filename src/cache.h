@@ -0,0 +1,54 @@
+/*
+ * This file is part of cyanrip.
+ *
+ * cyanrip is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * cyanrip is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with cyanrip; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#pragma once
+
+#include "cyanrip_main.h"
+#include "fetch.h"
+
+/* Lookup responses kept on disk between runs, under the cache directory set
+ * with -g. Each entry is a file named after the SHA-256 of its key, written
+ * to a temporary file first and renamed into place, so several cyanrip
+ * processes can share the same cache. */
+
+enum CRIPCacheResult {
+    CRIP_CACHE_MISS = 0,
+    CRIP_CACHE_HIT,
+    CRIP_CACHE_NOT_FOUND, /* The server said it doesn't have it */
+};
+
+/* Returns one of the above, or a negative error. Expired entries are
+ * misses, unless offline. data gets NUL terminated, content_type may be
+ * NULL, both must be freed. */
+int crip_cache_get(cyanrip_ctx *ctx, const char *type, const char *key,
+                   uint8_t **data, size_t *size, char **content_type);
+
+/* Stores a response, data NULL if the server didn't have it */
+int crip_cache_put(cyanrip_ctx *ctx, const char *type, const char *key,
+                   const uint8_t *data, size_t size, const char *content_type);
+
+/* Starts a request, unless the cache has it, or cyanrip is offline, in which
+ * case it's done right away. Only cached if req->cache_type is set. */
+int crip_cache_fetch_start(cyanrip_ctx *ctx, CRIPFetchReq *req);
+
+/* Waits for a request, and caches what the server replied */
+void crip_cache_fetch_wait(cyanrip_ctx *ctx, CRIPFetchReq *req);
+
+/* Base URL of a lookup server, which the environment variable replaces,
+ * e.g. with a file:// stand-in for testing */
+const char *crip_lookup_url(const char *env, const char *def);
@@ -0,0 +1,571 @@
+/*
+ * This file is part of cyanrip.
+ *
+ * cyanrip is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * cyanrip is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with cyanrip; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include <libavutil/common.h>
+#include <libavutil/cpu.h>
+#include <libavutil/intreadwrite.h>
+
+#include "checksums.h"
+#include "pressing.h"
+
+#ifdef HAVE_X86_SIMD
+#include <cpuid.h>
+#include <immintrin.h>
+#endif
+
+#ifdef HAVE_AARCH64_SIMD
+#include <arm_neon.h>
+#if defined(__linux__)
+#include <sys/auxv.h>
+#elif defined(_WIN32)
+#include <windows.h>
+#endif
+#endif
+
+/* The checksum of the 450th sector is used for offset detection */
+#define AR_450_START (450 * (CDIO_CD_FRAMESIZE_RAW >> 2))
+#define AR_450_END   (451 * (CDIO_CD_FRAMESIZE_RAW >> 2))
+
+static av_always_inline void process_c(cyanrip_checksum_ctx *s, const uint8_t *data,
+                                       int nb, uint32_t mult, int ar)
+{
+    s->eac_crc = av_crc(s->eac_ctx, s->eac_crc, data, nb*4);
+
+    uint32_t sum_1 = s->acu_sum_1, sum_2 = s->acu_sum_2;
+    int peak = s->sample_peak;
+
+    for (int j = 0; j < nb; j++) {
+        uint32_t val = AV_RL32(&data[j*4]);
+        peak = FFMAX(peak, abs((int16_t)AV_RL16(&data[j*4 + 0])));
+        peak = FFMAX(peak, abs((int16_t)AV_RL16(&data[j*4 + 2])));
+        if (ar) {
+            uint64_t tmp = (uint64_t)val * (uint64_t)(mult + j);
+            sum_1 += (uint32_t)tmp;
+            sum_2 += (uint32_t)tmp + (uint32_t)(tmp >> 32);
+        }
+    }
+
+    s->acu_sum_1 = sum_1;
+    s->acu_sum_2 = sum_2;
+    s->sample_peak = peak;
+}
+
+static void process_c_plain(cyanrip_checksum_ctx *s, const uint8_t *data,
+                            int nb, uint32_t mult)
+{
+    process_c(s, data, nb, mult, 0);
+}
+
+static void process_c_ar(cyanrip_checksum_ctx *s, const uint8_t *data,
+                         int nb, uint32_t mult)
+{
+    process_c(s, data, nb, mult, 1);
+}
+
+#ifdef HAVE_X86_SIMD
+/* The CRC gets folded 64 bytes at a time with carry-less multiplies, as in
+ * Intel's "Fast CRC Computation for Generic Polynomials Using PCLMULQDQ",
+ * with the constants for the bit-reflected CRC-32 polynomial. The same 64
+ * bytes, 16 samples, feed the AccurateRip sums and the peak. */
+#define CRC_FOLD_CONSTANTS                                                    \
+    const __m128i k1k2 = _mm_set_epi64x(0x01c6e41596, 0x0154442bd4);         \
+    const __m128i k3k4 = _mm_set_epi64x(0x00ccaa009e, 0x01751997d0);         \
+    const __m128i k5k0 = _mm_set_epi64x(0x0000000000, 0x0163cd6124);         \
+    const __m128i poly = _mm_set_epi64x(0x01f7011641, 0x01db710641);         \
+    const __m128i mask32 = _mm_setr_epi32(~0, 0, ~0, 0);
+
+#define CRC_FOLD(x, k, in)                                                    \
+    do {                                                                      \
+        __m128i lo_ = _mm_clmulepi64_si128(x, k, 0x00);                       \
+        x = _mm_clmulepi64_si128(x, k, 0x11);                                 \
+        x = _mm_xor_si128(_mm_xor_si128(x, lo_), in);                         \
+    } while (0)
+
+/* Folds the 4 lanes into one, then Barrett reduces down to 32 bits */
+#define CRC_REDUCE(crc, c0, c1, c2, c3)                                       \
+    do {                                                                      \
+        __m128i x_ = c0, t_;                                                  \
+        CRC_FOLD(x_, k3k4, c1);                                               \
+        CRC_FOLD(x_, k3k4, c2);                                               \
+        CRC_FOLD(x_, k3k4, c3);                                               \
+        t_ = _mm_clmulepi64_si128(x_, k3k4, 0x10);                            \
+        x_ = _mm_xor_si128(_mm_srli_si128(x_, 8), t_);                        \
+        t_ = _mm_srli_si128(x_, 4);                                           \
+        x_ = _mm_clmulepi64_si128(_mm_and_si128(x_, mask32), k5k0, 0x00);     \
+        x_ = _mm_xor_si128(x_, t_);                                           \
+        t_ = _mm_clmulepi64_si128(_mm_and_si128(x_, mask32), poly, 0x10);     \
+        t_ = _mm_clmulepi64_si128(_mm_and_si128(t_, mask32), poly, 0x00);     \
+        crc = _mm_extract_epi32(_mm_xor_si128(x_, t_), 1);                    \
+    } while (0)
+
+__attribute__((target("sse4.1,pclmul")))
+static av_always_inline void process_sse4(cyanrip_checksum_ctx *s, const uint8_t *data,
+                                          int nb, uint32_t mult, int ar)
+{
+    const int blocks = nb >> 4;
+    if (blocks < 1) {
+        process_c(s, data, nb, mult, ar);
+        return;
+    }
+
+    CRC_FOLD_CONSTANTS
+
+    __m128i c0 = _mm_loadu_si128((const __m128i *)(data + 0x00));
+    __m128i c1 = _mm_loadu_si128((const __m128i *)(data + 0x10));
+    __m128i c2 = _mm_loadu_si128((const __m128i *)(data + 0x20));
+    __m128i c3 = _mm_loadu_si128((const __m128i *)(data + 0x30));
+
+    __m128i sum_1 = _mm_setzero_si128(), sum_2 = _mm_setzero_si128();
+    __m128i peak = _mm_setzero_si128();
+    __m128i m = _mm_add_epi32(_mm_set1_epi32(mult), _mm_setr_epi32(0, 1, 2, 3));
+    const __m128i m_step = _mm_set1_epi32(4);
+
+#define SSE4_SAMPLES(v)                                                       \
+    do {                                                                      \
+        peak = _mm_max_epu16(peak, _mm_abs_epi16(v));                         \
+        if (ar) {                                                             \
+            __m128i ev_ = _mm_mul_epu32(v, m);                                \
+            __m128i od_ = _mm_mul_epu32(_mm_srli_epi64(v, 32),                \
+                                        _mm_srli_epi64(m, 32));               \
+            sum_1 = _mm_add_epi32(sum_1, _mm_mullo_epi32(v, m));              \
+            sum_2 = _mm_add_epi32(sum_2, _mm_add_epi32(ev_, od_));            \
+            m = _mm_add_epi32(m, m_step);                                     \
+        }                                                                     \
+    } while (0)
+
+    SSE4_SAMPLES(c0);
+    SSE4_SAMPLES(c1);
+    SSE4_SAMPLES(c2);
+    SSE4_SAMPLES(c3);
+
+    c0 = _mm_xor_si128(c0, _mm_cvtsi32_si128(s->eac_crc));
+
+    for (int i = 1; i < blocks; i++) {
+        const uint8_t *src = data + i*64;
+        __m128i v0 = _mm_loadu_si128((const __m128i *)(src + 0x00));
+        __m128i v1 = _mm_loadu_si128((const __m128i *)(src + 0x10));
+        __m128i v2 = _mm_loadu_si128((const __m128i *)(src + 0x20));
+        __m128i v3 = _mm_loadu_si128((const __m128i *)(src + 0x30));
+
+        CRC_FOLD(c0, k1k2, v0);
+        CRC_FOLD(c1, k1k2, v1);
+        CRC_FOLD(c2, k1k2, v2);
+        CRC_FOLD(c3, k1k2, v3);
+
+        SSE4_SAMPLES(v0);
+        SSE4_SAMPLES(v1);
+        SSE4_SAMPLES(v2);
+        SSE4_SAMPLES(v3);
+    }
+
+#undef SSE4_SAMPLES
+
+    CRC_REDUCE(s->eac_crc, c0, c1, c2, c3);
+
+    peak = _mm_max_epu16(peak, _mm_srli_si128(peak, 8));
+    peak = _mm_max_epu16(peak, _mm_srli_si128(peak, 4));
+    peak = _mm_max_epu16(peak, _mm_srli_si128(peak, 2));
+    s->sample_peak = FFMAX(s->sample_peak, _mm_extract_epi16(peak, 0));
+
+    if (ar) {
+        sum_1 = _mm_add_epi32(sum_1, _mm_srli_si128(sum_1, 8));
+        sum_1 = _mm_add_epi32(sum_1, _mm_srli_si128(sum_1, 4));
+        sum_2 = _mm_add_epi32(sum_2, _mm_srli_si128(sum_2, 8));
+        sum_2 = _mm_add_epi32(sum_2, _mm_srli_si128(sum_2, 4));
+        s->acu_sum_1 += _mm_cvtsi128_si32(sum_1);
+        s->acu_sum_2 += _mm_cvtsi128_si32(sum_2);
+    }
+
+    if (nb & 15)
+        process_c(s, data + blocks*64, nb & 15, mult + blocks*16, ar);
+}
+
+__attribute__((target("sse4.1,pclmul")))
+static void process_sse4_plain(cyanrip_checksum_ctx *s, const uint8_t *data,
+                               int nb, uint32_t mult)
+{
+    process_sse4(s, data, nb, mult, 0);
+}
+
+__attribute__((target("sse4.1,pclmul")))
+static void process_sse4_ar(cyanrip_checksum_ctx *s, const uint8_t *data,
+                            int nb, uint32_t mult)
+{
+    process_sse4(s, data, nb, mult, 1);
+}
+
+__attribute__((target("avx2,pclmul")))
+static av_always_inline void process_avx2(cyanrip_checksum_ctx *s, const uint8_t *data,
+                                          int nb, uint32_t mult, int ar)
+{
+    const int blocks = nb >> 4;
+    if (blocks < 1) {
+        process_c(s, data, nb, mult, ar);
+        return;
+    }
+
+    CRC_FOLD_CONSTANTS
+
+    __m256i lo = _mm256_loadu_si256((const __m256i *)(data + 0x00));
+    __m256i hi = _mm256_loadu_si256((const __m256i *)(data + 0x20));
+    __m128i c0 = _mm256_castsi256_si128(lo);
+    __m128i c1 = _mm256_extracti128_si256(lo, 1);
+    __m128i c2 = _mm256_castsi256_si128(hi);
+    __m128i c3 = _mm256_extracti128_si256(hi, 1);
+
+    __m256i sum_1 = _mm256_setzero_si256(), sum_2 = _mm256_setzero_si256();
+    __m256i peak = _mm256_setzero_si256();
+    __m256i m = _mm256_add_epi32(_mm256_set1_epi32(mult),
+                                 _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+    const __m256i m_step = _mm256_set1_epi32(8);
+
+#define AVX2_SAMPLES(v)                                                       \
+    do {                                                                      \
+        peak = _mm256_max_epu16(peak, _mm256_abs_epi16(v));                   \
+        if (ar) {                                                             \
+            __m256i ev_ = _mm256_mul_epu32(v, m);                             \
+            __m256i od_ = _mm256_mul_epu32(_mm256_srli_epi64(v, 32),          \
+                                           _mm256_srli_epi64(m, 32));         \
+            sum_1 = _mm256_add_epi32(sum_1, _mm256_mullo_epi32(v, m));        \
+            sum_2 = _mm256_add_epi32(sum_2, _mm256_add_epi32(ev_, od_));      \
+            m = _mm256_add_epi32(m, m_step);                                  \
+        }                                                                     \
+    } while (0)
+
+    AVX2_SAMPLES(lo);
+    AVX2_SAMPLES(hi);
+
+    c0 = _mm_xor_si128(c0, _mm_cvtsi32_si128(s->eac_crc));
+
+    for (int i = 1; i < blocks; i++) {
+        const uint8_t *src = data + i*64;
+        lo = _mm256_loadu_si256((const __m256i *)(src + 0x00));
+        hi = _mm256_loadu_si256((const __m256i *)(src + 0x20));
+
+        CRC_FOLD(c0, k1k2, _mm256_castsi256_si128(lo));
+        CRC_FOLD(c1, k1k2, _mm256_extracti128_si256(lo, 1));
+        CRC_FOLD(c2, k1k2, _mm256_castsi256_si128(hi));
+        CRC_FOLD(c3, k1k2, _mm256_extracti128_si256(hi, 1));
+
+        AVX2_SAMPLES(lo);
+        AVX2_SAMPLES(hi);
+    }
+
+#undef AVX2_SAMPLES
+
+    CRC_REDUCE(s->eac_crc, c0, c1, c2, c3);
+
+    __m128i p = _mm_max_epu16(_mm256_castsi256_si128(peak),
+                              _mm256_extracti128_si256(peak, 1));
+    p = _mm_max_epu16(p, _mm_srli_si128(p, 8));
+    p = _mm_max_epu16(p, _mm_srli_si128(p, 4));
+    p = _mm_max_epu16(p, _mm_srli_si128(p, 2));
+    s->sample_peak = FFMAX(s->sample_peak, _mm_extract_epi16(p, 0));
+
+    if (ar) {
+        __m128i s1 = _mm_add_epi32(_mm256_castsi256_si128(sum_1),
+                                   _mm256_extracti128_si256(sum_1, 1));
+        __m128i s2 = _mm_add_epi32(_mm256_castsi256_si128(sum_2),
+                                   _mm256_extracti128_si256(sum_2, 1));
+        s1 = _mm_add_epi32(s1, _mm_srli_si128(s1, 8));
+        s1 = _mm_add_epi32(s1, _mm_srli_si128(s1, 4));
+        s2 = _mm_add_epi32(s2, _mm_srli_si128(s2, 8));
+        s2 = _mm_add_epi32(s2, _mm_srli_si128(s2, 4));
+        s->acu_sum_1 += _mm_cvtsi128_si32(s1);
+        s->acu_sum_2 += _mm_cvtsi128_si32(s2);
+    }
+
+    if (nb & 15)
+        process_c(s, data + blocks*64, nb & 15, mult + blocks*16, ar);
+}
+
+__attribute__((target("avx2,pclmul")))
+static void process_avx2_plain(cyanrip_checksum_ctx *s, const uint8_t *data,
+                               int nb, uint32_t mult)
+{
+    process_avx2(s, data, nb, mult, 0);
+}
+
+__attribute__((target("avx2,pclmul")))
+static void process_avx2_ar(cyanrip_checksum_ctx *s, const uint8_t *data,
+                            int nb, uint32_t mult)
+{
+    process_avx2(s, data, nb, mult, 1);
+}
+
+/* lavu has no flag for it */
+static int have_pclmul(void)
+{
+    unsigned int eax, ebx, ecx, edx;
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+        return 0;
+    return !!(ecx & bit_PCLMUL);
+}
+#endif
+
+#ifdef HAVE_AARCH64_SIMD
+/* The same folding as the x86 kernels, with PMULL doing the carry-less
+ * multiplies, which isn't part of the base ISA */
+#ifdef __clang__
+#define PMULL_TARGET __attribute__((target("aes")))
+#else
+#define PMULL_TARGET __attribute__((target("+crypto")))
+#endif
+
+#define NEON_CLMUL(a, b)                                                      \
+    vreinterpretq_u64_p128(vmull_p64((poly64_t)(a), (poly64_t)(b)))
+
+#define NEON_CRC_FOLD(x, k, in)                                               \
+    do {                                                                      \
+        uint64x2_t lo_ = NEON_CLMUL(vgetq_lane_u64(x, 0),                     \
+                                    vgetq_lane_u64(k, 0));                    \
+        x = NEON_CLMUL(vgetq_lane_u64(x, 1), vgetq_lane_u64(k, 1));           \
+        x = veorq_u64(veorq_u64(x, lo_), in);                                 \
+    } while (0)
+
+#define NEON_CRC_REDUCE(crc, c0, c1, c2, c3)                                  \
+    do {                                                                      \
+        uint64x2_t x_ = c0, t_;                                               \
+        NEON_CRC_FOLD(x_, k3k4, c1);                                          \
+        NEON_CRC_FOLD(x_, k3k4, c2);                                          \
+        NEON_CRC_FOLD(x_, k3k4, c3);                                          \
+        t_ = NEON_CLMUL(vgetq_lane_u64(x_, 0), vgetq_lane_u64(k3k4, 1));      \
+        x_ = veorq_u64(vcombine_u64(vget_high_u64(x_), vcreate_u64(0)), t_);  \
+        t_ = vreinterpretq_u64_u8(vextq_u8(vreinterpretq_u8_u64(x_),          \
+                                           vdupq_n_u8(0), 4));                \
+        x_ = NEON_CLMUL(vgetq_lane_u64(x_, 0) & UINT32_MAX, 0x0163cd6124);    \
+        x_ = veorq_u64(x_, t_);                                               \
+        t_ = NEON_CLMUL(vgetq_lane_u64(x_, 0) & UINT32_MAX, 0x01f7011641);    \
+        t_ = NEON_CLMUL(vgetq_lane_u64(t_, 0) & UINT32_MAX, 0x01db710641);    \
+        crc = vgetq_lane_u32(vreinterpretq_u32_u64(veorq_u64(x_, t_)), 1);    \
+    } while (0)
+
+PMULL_TARGET
+static av_always_inline void process_neon(cyanrip_checksum_ctx *s, const uint8_t *data,
+                                          int nb, uint32_t mult, int ar)
+{
+    const int blocks = nb >> 4;
+    if (blocks < 1) {
+        process_c(s, data, nb, mult, ar);
+        return;
+    }
+
+    const uint64x2_t k1k2 = vcombine_u64(vcreate_u64(0x0154442bd4),
+                                         vcreate_u64(0x01c6e41596));
+    const uint64x2_t k3k4 = vcombine_u64(vcreate_u64(0x01751997d0),
+                                         vcreate_u64(0x00ccaa009e));
+
+    uint64x2_t c0 = vreinterpretq_u64_u8(vld1q_u8(data + 0x00));
+    uint64x2_t c1 = vreinterpretq_u64_u8(vld1q_u8(data + 0x10));
+    uint64x2_t c2 = vreinterpretq_u64_u8(vld1q_u8(data + 0x20));
+    uint64x2_t c3 = vreinterpretq_u64_u8(vld1q_u8(data + 0x30));
+
+    static const uint32_t ramp[4] = { 0, 1, 2, 3 };
+    uint32x4_t sum_1 = vdupq_n_u32(0), sum_2 = vdupq_n_u32(0);
+    uint16x8_t peak = vdupq_n_u16(0);
+    uint32x4_t m = vaddq_u32(vdupq_n_u32(mult), vld1q_u32(ramp));
+    const uint32x4_t m_step = vdupq_n_u32(4);
+
+#define NEON_SAMPLES(v)                                                       \
+    do {                                                                      \
+        uint32x4_t v_ = vreinterpretq_u32_u64(v);                             \
+        peak = vmaxq_u16(peak, vreinterpretq_u16_s16(                         \
+                                   vabsq_s16(vreinterpretq_s16_u64(v))));     \
+        if (ar) {                                                             \
+            uint64x2_t lo_ = vmull_u32(vget_low_u32(v_), vget_low_u32(m));    \
+            uint64x2_t hi_ = vmull_high_u32(v_, m);                           \
+            sum_1 = vmlaq_u32(sum_1, v_, m);                                  \
+            sum_2 = vaddq_u32(sum_2, vaddq_u32(vreinterpretq_u32_u64(lo_),    \
+                                               vreinterpretq_u32_u64(hi_)));  \
+            m = vaddq_u32(m, m_step);                                         \
+        }                                                                     \
+    } while (0)
+
+    NEON_SAMPLES(c0);
+    NEON_SAMPLES(c1);
+    NEON_SAMPLES(c2);
+    NEON_SAMPLES(c3);
+
+    c0 = veorq_u64(c0, vcombine_u64(vcreate_u64(s->eac_crc), vcreate_u64(0)));
+
+    for (int i = 1; i < blocks; i++) {
+        const uint8_t *src = data + i*64;
+        uint64x2_t v0 = vreinterpretq_u64_u8(vld1q_u8(src + 0x00));
+        uint64x2_t v1 = vreinterpretq_u64_u8(vld1q_u8(src + 0x10));
+        uint64x2_t v2 = vreinterpretq_u64_u8(vld1q_u8(src + 0x20));
+        uint64x2_t v3 = vreinterpretq_u64_u8(vld1q_u8(src + 0x30));
+
+        NEON_CRC_FOLD(c0, k1k2, v0);
+        NEON_CRC_FOLD(c1, k1k2, v1);
+        NEON_CRC_FOLD(c2, k1k2, v2);
+        NEON_CRC_FOLD(c3, k1k2, v3);
+
+        NEON_SAMPLES(v0);
+        NEON_SAMPLES(v1);
+        NEON_SAMPLES(v2);
+        NEON_SAMPLES(v3);
+    }
+
+#undef NEON_SAMPLES
+
+    NEON_CRC_REDUCE(s->eac_crc, c0, c1, c2, c3);
+
+    s->sample_peak = FFMAX(s->sample_peak, vmaxvq_u16(peak));
+
+    if (ar) {
+        s->acu_sum_1 += vaddvq_u32(sum_1);
+        s->acu_sum_2 += vaddvq_u32(sum_2);
+    }
+
+    if (nb & 15)
+        process_c(s, data + blocks*64, nb & 15, mult + blocks*16, ar);
+}
+
+PMULL_TARGET
+static void process_neon_plain(cyanrip_checksum_ctx *s, const uint8_t *data,
+                               int nb, uint32_t mult)
+{
+    process_neon(s, data, nb, mult, 0);
+}
+
+PMULL_TARGET
+static void process_neon_ar(cyanrip_checksum_ctx *s, const uint8_t *data,
+                            int nb, uint32_t mult)
+{
+    process_neon(s, data, nb, mult, 1);
+}
+
+/* lavu has no flag for it either */
+static int have_pmull(void)
+{
+#if defined(__linux__)
+    return !!(getauxval(AT_HWCAP) & HWCAP_PMULL);
+#elif defined(__APPLE__)
+    return 1;
+#elif defined(_WIN32)
+    return IsProcessorFeaturePresent(PF_ARM_V8_CRYPTO_INSTRUCTIONS_AVAILABLE);
+#else
+    return 0;
+#endif
+}
+#endif
+
+void crip_checksum_dsp_init(CRIPChecksumDSP *dsp, int cpu_flags)
+{
+    dsp->process    = process_c_plain;
+    dsp->process_ar = process_c_ar;
+
+#ifdef HAVE_X86_SIMD
+    if (!have_pclmul())
+        return;
+
+    if (cpu_flags & AV_CPU_FLAG_SSE4) {
+        dsp->process    = process_sse4_plain;
+        dsp->process_ar = process_sse4_ar;
+    }
+    if (cpu_flags & AV_CPU_FLAG_AVX2) {
+        dsp->process    = process_avx2_plain;
+        dsp->process_ar = process_avx2_ar;
+    }
+#endif
+
+#ifdef HAVE_AARCH64_SIMD
+    if ((cpu_flags & AV_CPU_FLAG_NEON) && have_pmull()) {
+        dsp->process    = process_neon_plain;
+        dsp->process_ar = process_neon_ar;
+    }
+#endif
+}
+
+void crip_init_checksum_ctx(cyanrip_ctx *ctx, cyanrip_checksum_ctx *s, cyanrip_track *t)
+{
+    crip_checksum_dsp_init(&s->dsp, av_get_cpu_flags());
+
+    s->eac_ctx   = av_crc_get_table(AV_CRC_32_IEEE_LE);
+    s->eac_crc   = UINT32_MAX;
+    s->acu_start = 0;
+    s->acu_end   = t->nb_samples;
+    s->acu_mult  = 1;
+    s->acu_sum_1 = 0x0;
+    s->acu_sum_1_450 = 0x0;
+    s->acu_sum_2 = 0x0;
+    s->sample_peak = 0;
+
+    t->computed_crcs = 0;
+
+    if (t->acurip_track_is_first)
+        s->acu_start += (CDIO_CD_FRAMESIZE_RAW * 5) >> 2;
+    if (t->acurip_track_is_last)
+        s->acu_end   -= (CDIO_CD_FRAMESIZE_RAW * 5) >> 2;
+
+    /* Not worth it without anything to match against */
+    s->pressing = NULL;
+    if (t->ar_db_status == CYANRIP_ACCUDB_FOUND &&
+        crip_pressing_reset(&t->pressing, t->nb_samples, s->acu_start, s->acu_end) >= 0)
+        s->pressing = t->pressing;
+}
+
+void crip_process_checksums(cyanrip_checksum_ctx *s, const uint8_t *data, int bytes)
+{
+    if (!bytes)
+        return;
+
+    /* Split into the runs of samples before, within and after the range
+     * AccurateRip covers, rather than checking every sample. The first and
+     * last tracks skip 5 sectors at either end. */
+    const int nb = bytes >> 2;
+    const int64_t first = s->acu_mult;
+    const int ar_start = av_clip64((int64_t)s->acu_start - first, 0, nb);
+    const int ar_end   = av_clip64((int64_t)s->acu_end - first + 1, ar_start, nb);
+
+    if (ar_start)
+        s->dsp.process(s, data, ar_start, first);
+    if (ar_end > ar_start)
+        s->dsp.process_ar(s, data + ar_start*4, ar_end - ar_start, first + ar_start);
+    if (nb > ar_end)
+        s->dsp.process(s, data + ar_end*4, nb - ar_end, first + ar_end);
+
+    if (bytes & 3)
+        s->eac_crc = av_crc(s->eac_ctx, s->eac_crc, data + nb*4, bytes & 3);
+
+    /* The 450th sector never spans more than 588 samples */
+    const int w_start = av_clip64(AR_450_START + 1 - first, 0, nb);
+    const int w_end   = av_clip64(AR_450_END + 1 - first, w_start, nb);
+    for (int j = w_start; j < w_end; j++)
+        s->acu_sum_1_450 += AV_RL32(&data[j*4]) * (uint32_t)(first + j - AR_450_START);
+
+    if (s->pressing)
+        crip_pressing_add(s->pressing, data, nb);
+
+    s->acu_mult += nb;
+}
+
+void crip_finalize_checksums(cyanrip_checksum_ctx *s, cyanrip_track *t)
+{
+    t->computed_crcs = 1;
+    t->eac_crc = s->eac_crc ^ UINT32_MAX;
+    t->acurip_checksum_v1 = s->acu_sum_1;
+    t->acurip_checksum_v1_450 = s->acu_sum_1_450;
+    t->acurip_checksum_v2 = s->acu_sum_2;
+
+    if (s->pressing)
+        crip_pressing_finish(s->pressing, s->acu_sum_1);
+
+    /* The greatest sample absolute value is abs(INT16_MIN) = 32768 */
+    t->sample_peak_rel_amp = (double)s->sample_peak/32768.0;
+}
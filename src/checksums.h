@@ -23,7 +23,21 @@
 
 #include "cyanrip_main.h"
 
-typedef struct cyanrip_checksum_ctx {
+typedef struct cyanrip_checksum_ctx cyanrip_checksum_ctx;
+
+/* Processes nb samples, updating the EAC CRC and the sample peak, and with
+ * the _ar variant the AccurateRip sums, the first sample having a
+ * multiplier of mult. Picked at runtime depending on the CPU. */
+typedef void (*crip_checksum_fn)(cyanrip_checksum_ctx *s, const uint8_t *data,
+                                 int nb, uint32_t mult);
+
+typedef struct CRIPChecksumDSP {
+    crip_checksum_fn process;
+    crip_checksum_fn process_ar;
+} CRIPChecksumDSP;
+
+struct cyanrip_checksum_ctx {
+    CRIPChecksumDSP dsp;
     const AVCRC *eac_ctx;
     uint32_t eac_crc;
     uint32_t acu_start;
@@ -32,59 +46,16 @@ typedef struct cyanrip_checksum_ctx {
     uint32_t acu_sum_1;
     uint32_t acu_sum_1_450;
     uint32_t acu_sum_2;
-} cyanrip_checksum_ctx;
-
-static inline void crip_init_checksum_ctx(cyanrip_ctx *ctx, cyanrip_checksum_ctx *s, cyanrip_track *t)
-{
-    s->eac_ctx   = av_crc_get_table(AV_CRC_32_IEEE_LE);
-    s->eac_crc   = UINT32_MAX;
-    s->acu_start = 0;
-    s->acu_end   = t->nb_samples;
-    s->acu_mult  = 1;
-    s->acu_sum_1 = 0x0;
-    s->acu_sum_1_450 = 0x0;
-    s->acu_sum_2 = 0x0;
-
-    t->computed_crcs = 0;
-
-    if (t->acurip_track_is_first)
-        s->acu_start += (CDIO_CD_FRAMESIZE_RAW * 5) >> 2;
-    if (t->acurip_track_is_last)
-        s->acu_end   -= (CDIO_CD_FRAMESIZE_RAW * 5) >> 2;
-}
+    int sample_peak;
+    struct CRIPPressing *pressing; /* Kept by the track, may be NULL */
+};
 
-static inline void crip_process_checksums(cyanrip_checksum_ctx *s, const uint8_t *data, int bytes)
-{
-    if (!bytes)
-        return;
+/* Sets up the kernels for the given AV_CPU_FLAG_ flags */
+void crip_checksum_dsp_init(CRIPChecksumDSP *dsp, int cpu_flags);
 
-    s->eac_crc = av_crc(s->eac_ctx, s->eac_crc, data, bytes);
+void crip_init_checksum_ctx(cyanrip_ctx *ctx, cyanrip_checksum_ctx *s, cyanrip_track *t);
 
-    /* Loop over samples */
-    for (int j = 0; j < (bytes >> 2); j++) {
-        if (s->acu_mult >= s->acu_start && s->acu_mult <= s->acu_end) {
-            uint32_t val = AV_RL32(&data[j*4]);
-            uint64_t tmp = (uint64_t)val  * (uint64_t)s->acu_mult;
-            uint32_t lo  = (uint32_t)(tmp & (uint64_t)UINT32_MAX);
-            uint32_t hi  = (uint32_t)(tmp / (uint64_t)0x100000000);
-            s->acu_sum_1 += s->acu_mult * val;
-            s->acu_sum_2 += hi;
-            s->acu_sum_2 += lo;
-        }
-        if (((s->acu_mult - 1) >= (450 * (CDIO_CD_FRAMESIZE_RAW >> 2))) &&
-            ((s->acu_mult - 1)  < (451 * (CDIO_CD_FRAMESIZE_RAW >> 2)))) {
-            uint32_t mult = s->acu_mult - (450 * (CDIO_CD_FRAMESIZE_RAW >> 2));
-            s->acu_sum_1_450 += AV_RL32(&data[j*4]) * mult;
-        }
-        s->acu_mult++;
-    }
-}
+void crip_process_checksums(cyanrip_checksum_ctx *s, const uint8_t *data, int bytes);
 
-static inline void crip_finalize_checksums(cyanrip_checksum_ctx *s, cyanrip_track *t)
-{
-    t->computed_crcs = 1;
-    t->eac_crc = s->eac_crc ^ UINT32_MAX;
-    t->acurip_checksum_v1 = s->acu_sum_1;
-    t->acurip_checksum_v1_450 = s->acu_sum_1_450;
-    t->acurip_checksum_v2 = s->acu_sum_2;
-}
+/* Also sets the track's sample peak */
+void crip_finalize_checksums(cyanrip_checksum_ctx *s, cyanrip_track *t);
@@ -18,9 +18,10 @@
 
 #include <curl/curl.h>
 #include <libavformat/avformat.h>
-#include <libavutil/base64.h>
+#include <libavutil/common.h>
 
 #include "coverart.h"
+#include "cache.h"
 #include "cyanrip_log.h"
 #include "utils.h"
 
@@ -84,11 +85,15 @@ int crip_save_art(cyanrip_ctx *ctx, CRIPArt *art, const cyanrip_out_fmt *fmt)
     }
 
     AVPacket *pkt = av_packet_clone(art->pkt);
+    if (!pkt) {
+        ret = AVERROR(ENOMEM);
+        goto fail;
+    }
     pkt->stream_index = st->index;
 
     ret = av_interleaved_write_frame(avf, pkt);
     av_packet_free(&pkt);
-    if ((ret = av_interleaved_write_frame(avf, pkt)) < 0) {
+    if (ret < 0) {
         cyanrip_log(ctx, 0, "Error writing picture packet: %s!\n", av_err2str(ret));
         goto fail;
     }
@@ -123,57 +128,41 @@ void crip_free_art(CRIPArt *art)
     av_dict_free(&art->meta);
 }
 
-static size_t receive_image(void *buffer, size_t size, size_t nb, void *opaque)
+/* Queues the download of a Cover Art DB image of the release, or own_url */
+static int fetch_start(cyanrip_ctx *ctx, CRIPFetchReq *req, const char *release_id,
+                       const char *type, int info_only, const char *own_url)
 {
-    CRIPArt *art = opaque;
-
-    uint8_t *new_data = av_realloc(art->data, art->size + (size * nb));
-    if (!new_data)
-        return 0;
-
-    memcpy(new_data + art->size, buffer, size * nb);
-
-    art->data  = new_data;
-    art->size += size * nb;
-
-    return size * nb;
-}
-
-static int fetch_image(cyanrip_ctx *ctx, CURL *curl_ctx, CRIPArt *art,
-                       const char *release_id, const char *type, int info_only,
-                       const char *own_url)
-{
-    int ret;
-    char errbuf[CURL_ERROR_SIZE];
-
-    char temp[4096];
     if (!own_url) {
-        snprintf(temp, sizeof(temp), "%s/%s/%s",
-                 COVERART_DB_URL_BASE, release_id, type);
-        curl_easy_setopt(curl_ctx, CURLOPT_URL, temp);
+        snprintf(req->url, sizeof(req->url), "%s/%s/%s",
+                 crip_lookup_url("CYANRIP_COVERART_URL", COVERART_DB_URL_BASE),
+                 release_id, type);
+        snprintf(req->cache_key, sizeof(req->cache_key), "%s/%s", release_id, type);
     } else {
-        curl_easy_setopt(curl_ctx, CURLOPT_URL, own_url);
+        av_strlcpy(req->url, own_url, sizeof(req->url));
     }
 
-    char user_agent[256] = { 0 };
-    sprintf(user_agent, "cyanrip/%s ( https://github.com/cyanreg/cyanrip )", PROJECT_VERSION_STRING);
-    curl_easy_setopt(curl_ctx, CURLOPT_USERAGENT, user_agent);
-
-    curl_easy_setopt(curl_ctx, CURLOPT_WRITEFUNCTION, receive_image);
-    curl_easy_setopt(curl_ctx, CURLOPT_WRITEDATA, art);
-
-    curl_easy_setopt(curl_ctx, CURLOPT_ERRORBUFFER, errbuf);
-    curl_easy_setopt(curl_ctx, CURLOPT_FAILONERROR, 1L); /* Explode on errors */
-
+    /* Without following the redirect, only checks whether there's an image */
     if (!info_only) {
         cyanrip_log(ctx, 0, "Downloading %s cover art...\n", type);
-        curl_easy_setopt(curl_ctx, CURLOPT_FOLLOWLOCATION, 1L);
+        req->follow_location = 1;
+        if (!own_url)
+            req->cache_type = "coverart";
     }
 
-    CURLcode res = curl_easy_perform(curl_ctx);
-    if (res != CURLE_OK) {
+    return crip_cache_fetch_start(ctx, req);
+}
+
+/* Waits for a download, and moves the image into art */
+static int fetch_finish(cyanrip_ctx *ctx, CRIPFetchReq *req, CRIPArt *art,
+                        const char *type, int info_only, int own_url)
+{
+    int ret;
+
+    crip_cache_fetch_wait(ctx, req);
+
+    if (req->res != CURLE_OK) {
         /* Filter out the majority of 404 errors here */
-        if (res == CURLE_HTTP_RETURNED_ERROR) {
+        if (req->res == CURLE_HTTP_RETURNED_ERROR) {
             cyanrip_log(ctx, 0, "Unable to get cover art \"%s\": not found!\n", type);
             crip_free_art(art);
             ret = own_url ? AVERROR(EINVAL) : 0;
@@ -181,72 +170,132 @@ static int fetch_image(cyanrip_ctx *ctx, CURL *curl_ctx, CRIPArt *art,
         }
 
         /* Different error */
-        size_t len = strlen(errbuf);
+        size_t len = strlen(req->errbuf);
         if (len)
             cyanrip_log(ctx, 0, "Unable to get cover art \"%s\": %s%s!\n",
-                        type, errbuf, ((errbuf[len - 1] != '\n') ? "\n" : ""));
+                        type, req->errbuf, ((req->errbuf[len - 1] != '\n') ? "\n" : ""));
         else
             cyanrip_log(ctx, 0, "Unable to get cover art \"%s\": %s\n!\n",
-                        type, curl_easy_strerror(res));
+                        type, curl_easy_strerror(req->res));
         ret = AVERROR(EINVAL);
         goto end;
     }
 
-    /* Get content type, if not possible we probably have an error somewhere */
-    char *content_type = NULL;
-    res = curl_easy_getinfo(curl_ctx, CURLINFO_CONTENT_TYPE, &content_type);
-    if (res != CURLE_OK) {
-        cyanrip_log(ctx, 0, "Unable to get cover art \"%s\": %s\n!\n",
-                    type, curl_easy_strerror(res));
+    /* Without a content type or URL, we probably have an error somewhere */
+    if (!req->content_type || !req->effective_url) {
+        cyanrip_log(ctx, 0, "Unable to get cover art \"%s\": incomplete response!\n",
+                    type);
         ret = AVERROR(EINVAL);
         goto end;
     }
 
-    /* Response code */
-    long response_code = 0;
-    res = curl_easy_getinfo(curl_ctx, CURLINFO_RESPONSE_CODE, &response_code);
-    if (res != CURLE_OK) {
-        cyanrip_log(ctx, 0, "Unable to get cover art \"%s\": %s\n!\n",
-                    type, curl_easy_strerror(res));
-        ret = AVERROR(EINVAL);
-        goto end;
+    ret = req->size;
+
+    /* The image is demuxed straight from the downloaded bytes */
+    if (!info_only) {
+        av_free(art->data);
+        art->data = req->data;
+        art->size = req->size;
+        req->data = NULL;
     }
 
-    /* Get the URL */
-    char *final_url = NULL;
-    res = curl_easy_getinfo(curl_ctx, CURLINFO_EFFECTIVE_URL, &final_url);
-    if (res != CURLE_OK) {
-        cyanrip_log(ctx, 0, "Unable to get cover art \"%s\": %s\n!\n",
-                    type, curl_easy_strerror(res));
-        ret = AVERROR(EINVAL);
-        goto end;
+    av_free(art->source_url);
+    art->source_url = req->effective_url;
+    req->effective_url = NULL;
+
+end:
+    crip_fetch_req_free(req);
+
+    return ret;
+}
+
+typedef struct ArtReader {
+    const uint8_t *data;
+    size_t size;
+    size_t pos;
+} ArtReader;
+
+static int art_read(void *opaque, uint8_t *buf, int buf_size)
+{
+    ArtReader *r = opaque;
+    size_t left = r->size - r->pos;
+    if (!left)
+        return AVERROR_EOF;
+
+    buf_size = FFMIN(buf_size, left);
+    memcpy(buf, r->data + r->pos, buf_size);
+    r->pos += buf_size;
+
+    return buf_size;
+}
+
+static int64_t art_seek(void *opaque, int64_t offset, int whence)
+{
+    ArtReader *r = opaque;
+
+    switch (whence & ~AVSEEK_FORCE) {
+    case AVSEEK_SIZE:
+        return r->size;
+    case SEEK_SET:
+        break;
+    case SEEK_CUR:
+        offset += r->pos;
+        break;
+    case SEEK_END:
+        offset += r->size;
+        break;
+    default:
+        return AVERROR(EINVAL);
     }
 
-    ret = art->size;
+    if (offset < 0 || offset > r->size)
+        return AVERROR(EINVAL);
 
-    if (info_only) {
-        av_freep(&art->data);
-        art->size = 0;
-    } else {
-        char header[99];
-        snprintf(header, sizeof(header), "data:%s;base64,", content_type);
+    r->pos = offset;
 
-        size_t data_len = AV_BASE64_SIZE(art->size);
-        char *data = av_mallocz(strlen(header) + data_len);
-        memcpy(data, header, strlen(header));
+    return offset;
+}
 
-        av_base64_encode(data + strlen(header), data_len, art->data, art->size);
+/* Reads a local image whole, to be demuxed the same way as downloaded ones */
+static int read_local_image(cyanrip_ctx *ctx, CRIPArt *art)
+{
+    AVIOContext *pb = NULL;
+    int ret = avio_open(&pb, art->source_url, AVIO_FLAG_READ);
+    if (ret < 0)
+        goto end;
 
-        av_free(art->data);
-        art->data = data;
-        art->size = data_len;
+    int64_t size = avio_size(pb);
+    if (size < 0) {
+        ret = size;
+        goto end;
+    } else if (size > INT_MAX) {
+        ret = AVERROR(EFBIG);
+        goto end;
     }
 
-    art->source_url = av_strdup(final_url);
+    av_freep(&art->data);
+    art->data = av_malloc(size + 1);
+    if (!art->data) {
+        ret = AVERROR(ENOMEM);
+        goto end;
+    }
+
+    ret = avio_read(pb, art->data, size);
+    if (ret >= 0 && ret != size)
+        ret = AVERROR(EIO);
+    if (ret < 0) {
+        av_freep(&art->data);
+        goto end;
+    }
+
+    art->size = size;
+    ret = 0;
 
 end:
-    if (res < 0)
-        crip_free_art(art);
+    if (ret < 0)
+        cyanrip_log(ctx, 0, "Unable to read \"%s\": %s!\n", art->source_url,
+                    av_err2str(ret));
+    avio_closep(&pb);
 
     return ret;
 }
@@ -255,12 +304,33 @@ static int demux_image(cyanrip_ctx *ctx, CRIPArt *art, int info_only)
 {
     int ret = 0;
     AVFormatContext *avf = NULL;
-    const char *in_url = art->data ? (const char *)art->data : art->source_url;
+    AVIOContext *pb = NULL;
+
+    if (!art->data && (ret = read_local_image(ctx, art)) < 0)
+        return ret;
+
+    /* Fed to lavf from memory, rather than copied into a data: URL */
+    ArtReader reader = { .data = art->data, .size = art->size };
+    uint8_t *io_buf = av_malloc(4096);
+    if (io_buf)
+        pb = avio_alloc_context(io_buf, 4096, 0, &reader, art_read, NULL, art_seek);
+    if (!pb) {
+        av_free(io_buf);
+        ret = AVERROR(ENOMEM);
+        goto end;
+    }
+
+    avf = avformat_alloc_context();
+    if (!avf) {
+        ret = AVERROR(ENOMEM);
+        goto end;
+    }
+    avf->pb = pb;
 
-    ret = avformat_open_input(&avf, in_url, NULL, NULL);
+    ret = avformat_open_input(&avf, NULL, NULL, NULL);
     if (ret < 0) {
-        cyanrip_log(ctx, 0, "Unable to open \"%s\": %s!\n", art->data ? "(data)" : in_url,
-                    av_err2str(ret));
+        cyanrip_log(ctx, 0, "Unable to open \"%s\": %s!\n",
+                    art->source_url ? art->source_url : "(data)", av_err2str(ret));
         goto end;
     }
 
@@ -315,15 +385,20 @@ static int demux_image(cyanrip_ctx *ctx, CRIPArt *art, int info_only)
         goto end;
     }
 
-    avformat_close_input(&avf);
+    /* Every encoder takes a reference to it, rather than a copy */
+    ret = av_packet_make_refcounted(art->pkt);
+    if (ret < 0)
+        goto end;
 
+    /* The packet is all that's needed from now on */
     av_freep(&art->data);
     art->size = 0;
 
-    return 0;
-
 end:
     avformat_close_input(&avf);
+    if (pb)
+        av_freep(&pb->buffer);
+    avio_context_free(&pb);
 
     return ret;
 }
@@ -343,6 +418,15 @@ static int string_is_url(const char *src)
 int crip_fill_coverart(cyanrip_ctx *ctx, int info_only)
 {
     int err = 0;
+    int front = -1, back = -1;
+    const int nb_own = ctx->nb_cover_arts;
+    static const char *front_ids[] = { "front", "front-250", "front-500", "front-1200" };
+    static const char *back_ids[] = { "back", "back-250", "back-500", "back-1200" };
+
+    /* All downloads are started at once */
+    CRIPFetchReq *reqs = av_calloc(FF_ARRAY_ELEMS(ctx->cover_arts), sizeof(*reqs));
+    if (!reqs)
+        return AVERROR(ENOMEM);
 
     int have_front = 0;
     int have_back = 0;
@@ -352,33 +436,55 @@ int crip_fill_coverart(cyanrip_ctx *ctx, int info_only)
         have_back |= !strcmp(title, "Back");
     }
 
-    CURL *curl_ctx = curl_easy_init();
-
     if (!have_front || !have_back) {
         const char *release_id = dict_get(ctx->meta, "musicbrainz_albumid");
         if (!release_id && !ctx->settings.disable_coverart_db) {
             cyanrip_log(ctx, 0, "Release ID unavailable, cannot search Cover Art DB!\n");
-        } else if (!ctx->settings.disable_coverart_db) {
-            int has_err = 0;
-            if (!have_front) {
-                static const char *cover_ids[] = { "front", "front-250", "front-500", "front-1200" };
-                has_err = fetch_image(ctx, curl_ctx, &ctx->cover_arts[ctx->nb_cover_arts], release_id, cover_ids[ctx->settings.coverart_lookup_size], info_only, NULL);
-                if (has_err > 0) {
-                    av_dict_set(&ctx->cover_arts[ctx->nb_cover_arts].meta, "title", "Front", 0);
-                    av_dict_set(&ctx->cover_arts[ctx->nb_cover_arts].meta, "source", "Cover Art DB", 0);
-                    ctx->cover_arts[ctx->nb_cover_arts].extension = av_strdup("jpg");
-                    ctx->nb_cover_arts++;
-                }
+        } else if (!ctx->settings.disable_coverart_db && !have_front &&
+                   nb_own + 2 <= FF_ARRAY_ELEMS(ctx->cover_arts)) {
+            /* The back is only used if there's a front too */
+            front = nb_own;
+            fetch_start(ctx, &reqs[front], release_id,
+                        front_ids[ctx->settings.coverart_lookup_size], info_only, NULL);
+            if (!have_back) {
+                back = nb_own + 1;
+                fetch_start(ctx, &reqs[back], release_id,
+                            back_ids[ctx->settings.coverart_lookup_size], info_only, NULL);
             }
-            if (!have_back && (has_err > 0)) {
-                static const char *cover_ids[] = { "back", "back-250", "back-500", "back-1200" };
-                has_err = fetch_image(ctx, curl_ctx, &ctx->cover_arts[ctx->nb_cover_arts], release_id, cover_ids[ctx->settings.coverart_lookup_size], info_only, NULL);
-                if (has_err > 0) {
-                    av_dict_set(&ctx->cover_arts[ctx->nb_cover_arts].meta, "title", "Back", 0);
-                    av_dict_set(&ctx->cover_arts[ctx->nb_cover_arts].meta, "source", "Cover Art DB", 0);
-                    ctx->cover_arts[ctx->nb_cover_arts].extension = av_strdup("jpg");
-                    ctx->nb_cover_arts++;
-                }
+        }
+    }
+
+    for (int i = 0; i < nb_own; i++) {
+        CRIPArt *art = &ctx->cover_arts[i];
+
+        /* If its a url, we haven't downloaded it from CADB and we're not info printing */
+        if (string_is_url(art->source_url) && !art->data && !info_only) {
+            err = fetch_start(ctx, &reqs[i], NULL, dict_get(art->meta, "title"), 0,
+                              art->source_url);
+            if (err < 0)
+                goto end;
+        }
+    }
+
+    if (front >= 0) {
+        int has_err = fetch_finish(ctx, &reqs[front], &ctx->cover_arts[front],
+                                   front_ids[ctx->settings.coverart_lookup_size],
+                                   info_only, 0);
+        if (has_err > 0) {
+            av_dict_set(&ctx->cover_arts[ctx->nb_cover_arts].meta, "title", "Front", 0);
+            av_dict_set(&ctx->cover_arts[ctx->nb_cover_arts].meta, "source", "Cover Art DB", 0);
+            ctx->cover_arts[ctx->nb_cover_arts].extension = av_strdup("jpg");
+            ctx->nb_cover_arts++;
+        }
+        if (back >= 0 && has_err > 0) {
+            has_err = fetch_finish(ctx, &reqs[back], &ctx->cover_arts[back],
+                                   back_ids[ctx->settings.coverart_lookup_size],
+                                   info_only, 0);
+            if (has_err > 0) {
+                av_dict_set(&ctx->cover_arts[ctx->nb_cover_arts].meta, "title", "Back", 0);
+                av_dict_set(&ctx->cover_arts[ctx->nb_cover_arts].meta, "source", "Cover Art DB", 0);
+                ctx->cover_arts[ctx->nb_cover_arts].extension = av_strdup("jpg");
+                ctx->nb_cover_arts++;
             }
         }
     }
@@ -388,9 +494,8 @@ int crip_fill_coverart(cyanrip_ctx *ctx, int info_only)
         const char *title = dict_get(ctx->cover_arts[i].meta, "title");
         int is_url = string_is_url(source_url);
 
-        /* If its a url, we haven't downloaded it from CADB and we're not info printing */
-        if (is_url && !ctx->cover_arts[i].data && !info_only) {
-            err = fetch_image(ctx, curl_ctx, &ctx->cover_arts[i], NULL, title, 0, source_url);
+        if (i < nb_own && reqs[i].url[0]) {
+            err = fetch_finish(ctx, &reqs[i], &ctx->cover_arts[i], title, 0, 1);
             if (err < 0)
                 goto end;
         }
@@ -403,7 +508,11 @@ int crip_fill_coverart(cyanrip_ctx *ctx, int info_only)
     }
 
 end:
-    curl_easy_cleanup(curl_ctx);
+    for (int i = 0; i < FF_ARRAY_ELEMS(ctx->cover_arts); i++) {
+        crip_fetch_wait(ctx->shared->fetch, &reqs[i]);
+        crip_fetch_req_free(&reqs[i]);
+    }
+    av_free(reqs);
 
     return err;
 }
@@ -411,7 +520,22 @@ end:
 int crip_fill_track_coverart(cyanrip_ctx *ctx, int info_only)
 {
     int err = 0;
-    CURL *curl_ctx = curl_easy_init();
+
+    /* All downloads are started at once */
+    CRIPFetchReq *reqs = av_calloc(ctx->nb_tracks, sizeof(*reqs));
+    if (!reqs)
+        return ctx->nb_tracks ? AVERROR(ENOMEM) : 0;
+
+    for (int i = 0; i < ctx->nb_tracks; i++) {
+        CRIPArt *art = &ctx->tracks[i].art;
+
+        /* If its a url, we haven't downloaded it from CADB and we're not info printing */
+        if (art->source_url && string_is_url(art->source_url) && !art->data && !info_only) {
+            err = fetch_start(ctx, &reqs[i], NULL, "track", 0, art->source_url);
+            if (err < 0)
+                goto end;
+        }
+    }
 
     for (int i = 0; i < ctx->nb_tracks; i++) {
         if (!ctx->tracks[i].art.source_url)
@@ -420,9 +544,8 @@ int crip_fill_track_coverart(cyanrip_ctx *ctx, int info_only)
         char *source_url = ctx->tracks[i].art.source_url;
         int is_url = string_is_url(source_url);
 
-        /* If its a url, we haven't downloaded it from CADB and we're not info printing */
-        if (is_url && !ctx->tracks[i].art.data && !info_only) {
-            err = fetch_image(ctx, curl_ctx, &ctx->tracks[i].art, NULL, "track", 0, source_url);
+        if (reqs[i].url[0]) {
+            err = fetch_finish(ctx, &reqs[i], &ctx->tracks[i].art, "track", 0, 1);
             if (err < 0)
                 goto end;
         }
@@ -435,7 +558,11 @@ int crip_fill_track_coverart(cyanrip_ctx *ctx, int info_only)
     }
 
 end:
-    curl_easy_cleanup(curl_ctx);
+    for (int i = 0; i < ctx->nb_tracks; i++) {
+        crip_fetch_wait(ctx->shared->fetch, &reqs[i]);
+        crip_fetch_req_free(&reqs[i]);
+    }
+    av_free(reqs);
 
     return err;
 }
@@ -26,12 +26,17 @@
 #include <libswresample/swresample.h>
 #include <libavfilter/buffersink.h>
 #include <libavfilter/buffersrc.h>
+#include <libavutil/intreadwrite.h>
+#include <libavutil/md5.h>
 #include <libavutil/opt.h>
 
-#include "fifo_frame.h"
-#include "fifo_packet.h"
+#include "enc_pool.h"
+#include "flac_frame.h"
+#include "frame_ring.h"
 #include "cyanrip_encode.h"
 #include "cyanrip_log.h"
+#include "loudness.h"
+#include "replaygain.h"
 #include "os_compat.h"
 
 #if CONFIG_BIG_ENDIAN
@@ -44,35 +49,73 @@
 #define AV_CODEC_ID_PCM_F64 AV_CODEC_ID_PCM_F64LE
 #endif
 
-
-typedef enum {
-    MUTEX_STATUS_NOT_INITIALIZED,
-    MUTEX_STATUS_ACQUIRED,
-    MUTEX_STATUS_FREE,
-} mutex_status_t;
+/* Encodes up to this many frames before letting the other jobs run */
+#define ENC_FRAMES_PER_STEP 4
+
+/* FLAC frames per chunk, when encoding in chunks */
+#define FLAC_CHUNK_FRAMES 64
+
+/* A piece of a track, encoded on its own by a separate encoder */
+typedef struct cyanrip_enc_chunk {
+    CRIPEncJob job; /* Must be first */
+    struct cyanrip_enc_ctx *s;
+    AVCodecContext *avctx;
+    AVFrame *frames[FLAC_CHUNK_FRAMES];
+    int nb_frames;
+    int nb_sent;
+    AVPacket *pkts[FLAC_CHUNK_FRAMES];
+    int nb_pkts;
+    int status;
+    atomic_int done;
+    struct cyanrip_enc_chunk *next;
+} cyanrip_enc_chunk;
 
 struct cyanrip_enc_ctx {
+    CRIPEncJob job; /* Must be first */
+    int job_started;
     cyanrip_ctx *ctx;
-    AVBufferRef *fifo;
-    pthread_t thread;
-    int thread_started;
+    AVBufferRef *ring; /* Shared by all encoders of the track */
+    int ring_reader;
     AVFormatContext *avf;
     SwrContext *swr;
+    int swr_drained;
+    int deemphasis;
     AVCodecContext *out_avctx;
+    AVPacket *out_pkt;
+    int flushing;
     atomic_int status;
     atomic_int quit;
+    atomic_int done; /* Set once the file has been completely written */
     int audio_stream_index;
     cyanrip_track *t;
 
-    mutex_status_t mutex_status;
-    pthread_mutex_t lock;
-
     AVStream *st_aud;
     AVStream *st_img;
+    enum cyanrip_output_formats format;
     const cyanrip_out_fmt *cfmt;
-    int separate_writeout;
-    AVBufferRef *packet_fifo;
     AVPacket *cover_art_pkt;
+
+    /* Chunked FLAC encoding, the chunks get muxed in order */
+    int chunked;
+    cyanrip_enc_chunk *chunk; /* Being filled */
+    cyanrip_enc_chunk *chunks_head;
+    cyanrip_enc_chunk *chunks_tail;
+    int nb_chunks;
+    int max_chunks;
+    int chunks_ending;
+    int chunks_ret;
+    atomic_int chunks_abort;
+    struct AVMD5 *md5;
+    int64_t nb_samples;
+    uint32_t nb_flac_frames;
+    int min_frame_size;
+    int max_frame_size;
+};
+
+/* Resamplers of finished encoders, taken over by the next track's */
+struct cyanrip_enc_cache {
+    pthread_mutex_t lock;
+    SwrContext *swr[CYANRIP_FORMATS_NB][2]; /* Without and with deemphasis */
 };
 
 typedef struct cyanrip_filt_ctx {
@@ -84,7 +127,15 @@ typedef struct cyanrip_filt_ctx {
 
 struct cyanrip_dec_ctx {
     cyanrip_filt_ctx filt;
-    cyanrip_filt_ctx peak;
+    CRIPLoudness loudness;
+
+    /* Sectors get gathered into frames of frame_size samples, from a pool */
+    AVBufferPool *pool;
+    int frame_size;
+    AVFrame *pending;
+
+    /* Read by all the track's encoders */
+    AVBufferRef *ring;
 };
 
 void cyanrip_print_codecs(void)
@@ -316,10 +367,10 @@ static void cyanrip_free_filt_ctx(cyanrip_ctx *ctx, cyanrip_filt_ctx *filt_ctx,
 {
     if (filt_ctx->graph) {
         if (capture)
-            cyanrip_set_av_log_capture(ctx, 1, AV_LOG_INFO);
+            cyanrip_set_av_log_capture(1, AV_LOG_INFO);
         avfilter_graph_free(&filt_ctx->graph);
         if (capture)
-            cyanrip_set_av_log_capture(ctx, 0, 0);
+            cyanrip_set_av_log_capture(0, 0);
     }
 }
 
@@ -331,13 +382,16 @@ void cyanrip_free_dec_ctx(cyanrip_ctx *ctx, cyanrip_dec_ctx **s)
     cyanrip_dec_ctx *dec_ctx = *s;
 
     cyanrip_free_filt_ctx(ctx, &dec_ctx->filt, 0);
-    cyanrip_free_filt_ctx(ctx, &dec_ctx->peak, 0);
+
+    av_frame_free(&dec_ctx->pending);
+    av_buffer_pool_uninit(&dec_ctx->pool);
+    av_buffer_unref(&dec_ctx->ring);
 
     av_freep(s);
 }
 
 static int init_filtering(cyanrip_ctx *ctx, cyanrip_filt_ctx *s,
-                          int hdcd, int deemphasis, int peak)
+                          int hdcd, int deemphasis)
 {
     int ret = 0;
     AVFilterInOut *inputs = NULL;
@@ -362,81 +416,79 @@ static int init_filtering(cyanrip_ctx *ctx, cyanrip_filt_ctx *s,
         goto fail;
     }
 
-    if (!peak) {
-        const AVFilter *abuffersink = avfilter_get_by_name("abuffersink");
-        /* Options must be set between allocation and init, non-runtime
-         * option changes on initialized objects are rejected */
-        s->buffersink_ctx = avfilter_graph_alloc_filter(s->graph, abuffersink, "out");
-        if (!s->buffersink_ctx) {
-            ret = AVERROR(ENOMEM);
-            cyanrip_log(ctx, 0, "Error creating filter sink: %s!\n", av_err2str(ret));
-            goto fail;
-        }
+    const AVFilter *abuffersink = avfilter_get_by_name("abuffersink");
+    /* Options must be set between allocation and init, non-runtime
+     * option changes on initialized objects are rejected */
+    s->buffersink_ctx = avfilter_graph_alloc_filter(s->graph, abuffersink, "out");
+    if (!s->buffersink_ctx) {
+        ret = AVERROR(ENOMEM);
+        cyanrip_log(ctx, 0, "Error creating filter sink: %s!\n", av_err2str(ret));
+        goto fail;
+    }
 
 #if LIBAVFILTER_VERSION_INT >= AV_VERSION_INT(10, 6, 100)
-        /* Buffersink switched to array-type options in lavfi 10.6.100
-         * (FFmpeg 7.1); the int-list options were later removed */
-        if (hdcd || deemphasis) {
-            const enum AVSampleFormat out_sample_fmt = hdcd ? AV_SAMPLE_FMT_S32 :
-                                                              AV_SAMPLE_FMT_DBLP;
-            ret = av_opt_set_array(s->buffersink_ctx, "sample_formats",
-                                   AV_OPT_SEARCH_CHILDREN, 0, 1,
-                                   AV_OPT_TYPE_SAMPLE_FMT, &out_sample_fmt);
-            if (ret < 0) {
-                cyanrip_log(ctx, 0, "Error setting filter sample format: %s!\n", av_err2str(ret));
-                goto fail;
-            }
-        }
-
-        ret = av_opt_set(s->buffersink_ctx, "channel_layouts", "stereo",
-                         AV_OPT_SEARCH_CHILDREN);
-        if (ret < 0) {
-            cyanrip_log(ctx, 0, "Error setting filter channel layout: %s!\n", av_err2str(ret));
-            goto fail;
-        }
-
-        const int out_sample_rate = 44100;
-        ret = av_opt_set_array(s->buffersink_ctx, "samplerates",
+    /* Buffersink switched to array-type options in lavfi 10.6.100
+     * (FFmpeg 7.1); the int-list options were later removed */
+    if (hdcd || deemphasis) {
+        const enum AVSampleFormat out_sample_fmt = hdcd ? AV_SAMPLE_FMT_S32 :
+                                                          AV_SAMPLE_FMT_DBLP;
+        ret = av_opt_set_array(s->buffersink_ctx, "sample_formats",
                                AV_OPT_SEARCH_CHILDREN, 0, 1,
-                               AV_OPT_TYPE_INT, &out_sample_rate);
-        if (ret < 0) {
-            cyanrip_log(ctx, 0, "Error setting filter sample rate: %s!\n", av_err2str(ret));
-            goto fail;
-        }
-#else
-        static const enum AVSampleFormat out_sample_fmts_hdcd[] = { AV_SAMPLE_FMT_S32, -1 };
-        static const enum AVSampleFormat out_sample_fmts_deemph[] = { AV_SAMPLE_FMT_DBLP, -1 };
-
-        ret = av_opt_set_int_list(s->buffersink_ctx, "sample_fmts",
-                                  hdcd ? out_sample_fmts_hdcd :
-                                  deemphasis ? out_sample_fmts_deemph :
-                                  NULL,
-                                  -1, AV_OPT_SEARCH_CHILDREN);
+                               AV_OPT_TYPE_SAMPLE_FMT, &out_sample_fmt);
         if (ret < 0) {
             cyanrip_log(ctx, 0, "Error setting filter sample format: %s!\n", av_err2str(ret));
             goto fail;
         }
+    }
 
-        ret = av_opt_set(s->buffersink_ctx, "ch_layouts", "stereo", AV_OPT_SEARCH_CHILDREN);
-        if (ret < 0) {
-            cyanrip_log(ctx, 0, "Error setting filter channel layout: %s!\n", av_err2str(ret));
-            goto fail;
-        }
+    ret = av_opt_set(s->buffersink_ctx, "channel_layouts", "stereo",
+                     AV_OPT_SEARCH_CHILDREN);
+    if (ret < 0) {
+        cyanrip_log(ctx, 0, "Error setting filter channel layout: %s!\n", av_err2str(ret));
+        goto fail;
+    }
 
-        static const int out_sample_rates[] = { 44100, -1 };
-        ret = av_opt_set_int_list(s->buffersink_ctx, "sample_rates", out_sample_rates, -1,
-                                  AV_OPT_SEARCH_CHILDREN);
-        if (ret < 0) {
-            cyanrip_log(ctx, 0, "Error setting filter sample rate: %s!\n", av_err2str(ret));
-            goto fail;
-        }
+    const int out_sample_rate = 44100;
+    ret = av_opt_set_array(s->buffersink_ctx, "samplerates",
+                           AV_OPT_SEARCH_CHILDREN, 0, 1,
+                           AV_OPT_TYPE_INT, &out_sample_rate);
+    if (ret < 0) {
+        cyanrip_log(ctx, 0, "Error setting filter sample rate: %s!\n", av_err2str(ret));
+        goto fail;
+    }
+#else
+    static const enum AVSampleFormat out_sample_fmts_hdcd[] = { AV_SAMPLE_FMT_S32, -1 };
+    static const enum AVSampleFormat out_sample_fmts_deemph[] = { AV_SAMPLE_FMT_DBLP, -1 };
+
+    ret = av_opt_set_int_list(s->buffersink_ctx, "sample_fmts",
+                              hdcd ? out_sample_fmts_hdcd :
+                              deemphasis ? out_sample_fmts_deemph :
+                              NULL,
+                              -1, AV_OPT_SEARCH_CHILDREN);
+    if (ret < 0) {
+        cyanrip_log(ctx, 0, "Error setting filter sample format: %s!\n", av_err2str(ret));
+        goto fail;
+    }
+
+    ret = av_opt_set(s->buffersink_ctx, "ch_layouts", "stereo", AV_OPT_SEARCH_CHILDREN);
+    if (ret < 0) {
+        cyanrip_log(ctx, 0, "Error setting filter channel layout: %s!\n", av_err2str(ret));
+        goto fail;
+    }
+
+    static const int out_sample_rates[] = { 44100, -1 };
+    ret = av_opt_set_int_list(s->buffersink_ctx, "sample_rates", out_sample_rates, -1,
+                              AV_OPT_SEARCH_CHILDREN);
+    if (ret < 0) {
+        cyanrip_log(ctx, 0, "Error setting filter sample rate: %s!\n", av_err2str(ret));
+        goto fail;
+    }
 #endif
 
-        ret = avfilter_init_str(s->buffersink_ctx, NULL);
-        if (ret < 0) {
-            cyanrip_log(ctx, 0, "Error initializing filter sink: %s!\n", av_err2str(ret));
-            goto fail;
-        }
+    ret = avfilter_init_str(s->buffersink_ctx, NULL);
+    if (ret < 0) {
+        cyanrip_log(ctx, 0, "Error initializing filter sink: %s!\n", av_err2str(ret));
+        goto fail;
     }
 
     outputs = avfilter_inout_alloc();
@@ -449,22 +501,17 @@ static int init_filtering(cyanrip_ctx *ctx, cyanrip_filt_ctx *s,
     outputs->pad_idx       = 0;
     outputs->next          = NULL;
 
-    if (!peak) {
-        inputs = avfilter_inout_alloc();
-        if (!inputs) {
-            ret = AVERROR(ENOMEM);
-            goto fail;
-        }
-        inputs->name          = av_strdup("out");
-        inputs->filter_ctx    = s->buffersink_ctx;
-        inputs->pad_idx       = 0;
-        inputs->next          = NULL;
+    inputs = avfilter_inout_alloc();
+    if (!inputs) {
+        ret = AVERROR(ENOMEM);
+        goto fail;
     }
+    inputs->name          = av_strdup("out");
+    inputs->filter_ctx    = s->buffersink_ctx;
+    inputs->pad_idx       = 0;
+    inputs->next          = NULL;
 
-    const char *filter_desc = hdcd ? "hdcd" :
-                              deemphasis ? "aemphasis=type=cd" :
-                              peak ? "ebur128=peak=true,anullsink" :
-                              NULL;
+    const char *filter_desc = hdcd ? "hdcd" : "aemphasis=type=cd";
 
     ret = avfilter_graph_parse_ptr(s->graph, filter_desc, &inputs, &outputs, NULL);
     if (ret < 0) {
@@ -502,15 +549,29 @@ int cyanrip_create_dec_ctx(cyanrip_ctx *ctx, cyanrip_dec_ctx **s,
 
         ret = init_filtering(ctx, &dec_ctx->filt,
                              ctx->settings.decode_hdcd,
-                             (ctx->settings.deemphasis && t->preemphasis) || ctx->settings.force_deemphasis,
-                             0);
+                             (ctx->settings.deemphasis && t->preemphasis) || ctx->settings.force_deemphasis);
         if (ret < 0)
             goto fail;
     }
 
-    ret = init_filtering(ctx, &dec_ctx->peak, 0, 0, 1);
-    if (ret < 0)
+    crip_loudness_init(&dec_ctx->loudness);
+
+    dec_ctx->frame_size = ctx->settings.frame_size;
+    dec_ctx->pool = av_buffer_pool_init(dec_ctx->frame_size*4, NULL);
+    if (!dec_ctx->pool) {
+        ret = AVERROR(ENOMEM);
         goto fail;
+    }
+
+    /* Enough for the slowest encoder to fall about 15 seconds behind */
+    int ring_size = 4;
+    while (ring_size*dec_ctx->frame_size < 15*44100)
+        ring_size <<= 1;
+    dec_ctx->ring = cr_frame_ring_create(ring_size);
+    if (!dec_ctx->ring) {
+        ret = AVERROR(ENOMEM);
+        goto fail;
+    }
 
     *s = dec_ctx;
 
@@ -522,52 +583,35 @@ fail:
 }
 
 static int push_frame_to_encs(cyanrip_ctx *ctx, cyanrip_enc_ctx **enc_ctx,
-                              int num_enc, AVFrame *frame)
+                              int num_enc, cyanrip_dec_ctx *dec_ctx, AVFrame *frame)
 {
-    int ret;
-
     for (int i = 0; i < num_enc; i++) {
         int status = atomic_load(&enc_ctx[i]->status);
         if (status < 0)
             return status;
+    }
 
-        ret = cr_frame_fifo_push(enc_ctx[i]->fifo, frame);
-        if (ret < 0) {
-            cyanrip_log(ctx, 0, "Error pushing frame to FIFO: %s!\n", av_err2str(ret));
-            return ret;
-        }
+    /* Blocks while the slowest encoder is a whole ring behind */
+    int ret = cr_frame_ring_push(dec_ctx->ring, frame);
+    if (ret < 0) {
+        cyanrip_log(ctx, 0, "Error pushing frame to the encoders: %s!\n", av_err2str(ret));
+        return ret;
     }
 
+    for (int i = 0; i < num_enc; i++)
+        crip_enc_job_kick(ctx->shared->enc_pool, &enc_ctx[i]->job);
+
     return 0;
 }
 
 static int filter_frame(cyanrip_ctx *ctx, cyanrip_enc_ctx **enc_ctx,
-                        int num_enc, cyanrip_dec_ctx *dec_ctx, AVFrame *frame,
-                        int calc_global_peak)
+                        int num_enc, cyanrip_dec_ctx *dec_ctx, AVFrame *frame)
 {
     int ret = 0;
     AVFrame *dec_frame = NULL;
 
-    ret = av_buffersrc_add_frame_flags(dec_ctx->peak.buffersrc_ctx, frame,
-                                       AV_BUFFERSRC_FLAG_NO_CHECK_FORMAT |
-                                       AV_BUFFERSRC_FLAG_KEEP_REF | AV_BUFFERSRC_FLAG_PUSH);
-    if (ret < 0) {
-        cyanrip_log(ctx, 0, "Error filtering frame: %s!\n", av_err2str(ret));
-        goto fail;
-    }
-
-    if (frame && calc_global_peak) {
-        ret = av_buffersrc_add_frame_flags(ctx->peak_ctx->peak.buffersrc_ctx, frame,
-                                           AV_BUFFERSRC_FLAG_NO_CHECK_FORMAT |
-                                           AV_BUFFERSRC_FLAG_KEEP_REF | AV_BUFFERSRC_FLAG_PUSH);
-        if (ret < 0) {
-            cyanrip_log(ctx, 0, "Error filtering frame: %s!\n", av_err2str(ret));
-            goto fail;
-        }
-    }
-
     if (!dec_ctx->filt.buffersrc_ctx)
-        return push_frame_to_encs(ctx, enc_ctx, num_enc, frame);
+        return push_frame_to_encs(ctx, enc_ctx, num_enc, dec_ctx, frame);
 
     ret = av_buffersrc_add_frame_flags(dec_ctx->filt.buffersrc_ctx, frame,
                                        AV_BUFFERSRC_FLAG_NO_CHECK_FORMAT |
@@ -579,7 +623,7 @@ static int filter_frame(cyanrip_ctx *ctx, cyanrip_enc_ctx **enc_ctx,
 
     ret = avfilter_graph_request_oldest(dec_ctx->filt.graph);
     if (ret == AVERROR_EOF) {
-        return push_frame_to_encs(ctx, enc_ctx, num_enc, NULL);
+        return push_frame_to_encs(ctx, enc_ctx, num_enc, dec_ctx, NULL);
     } else if (ret < 0) {
         cyanrip_log(ctx, 0, "Error filtering frame: %s!\n", av_err2str(ret));
         goto fail;
@@ -601,13 +645,13 @@ static int filter_frame(cyanrip_ctx *ctx, cyanrip_enc_ctx **enc_ctx,
         } else if (ret == AVERROR_EOF) {
             av_frame_free(&dec_frame);
             ret = 0;
-            return push_frame_to_encs(ctx, enc_ctx, num_enc, NULL);
+            return push_frame_to_encs(ctx, enc_ctx, num_enc, dec_ctx, NULL);
         } else if (ret < 0) {
             cyanrip_log(ctx, 0, "Error filtering frame: %s!\n", av_err2str(ret));
             goto fail;
         }
 
-        push_frame_to_encs(ctx, enc_ctx, num_enc, dec_frame);
+        push_frame_to_encs(ctx, enc_ctx, num_enc, dec_ctx, dec_frame);
         av_frame_free(&dec_frame);
     }
 
@@ -615,52 +659,99 @@ fail:
     return ret;
 }
 
-int cyanrip_send_pcm_to_encoders(cyanrip_ctx *ctx, cyanrip_enc_ctx **enc_ctx,
-                                 int num_enc, cyanrip_dec_ctx *dec_ctx,
-                                 const uint8_t *data, int bytes,
-                                 int calc_global_peak)
+static int alloc_pending_frame(cyanrip_ctx *ctx, cyanrip_dec_ctx *dec_ctx)
 {
-    int ret = 0;
-    AVFrame *frame = NULL;
-
-    if (!data && !bytes)
-        goto send;
-    else if (!bytes)
-        return 0;
+    AVFrame *frame = av_frame_alloc();
+    if (!frame)
+        goto fail;
 
-    frame = av_frame_alloc();
-    if (!frame) {
-        cyanrip_log(ctx, 0, "Error allocating frame!\n");
-        ret = AVERROR(ENOMEM);
+    frame->buf[0] = av_buffer_pool_get(dec_ctx->pool);
+    if (!frame->buf[0])
         goto fail;
-    }
 
+    frame->data[0] = frame->buf[0]->data;
+    frame->linesize[0] = frame->buf[0]->size;
     frame->sample_rate = 44100;
-    frame->nb_samples = bytes >> 2;
+    frame->nb_samples = 0;
     frame->ch_layout = (AVChannelLayout)AV_CHANNEL_LAYOUT_STEREO;
     frame->format = AV_SAMPLE_FMT_S16;
 
-    ret = av_frame_get_buffer(frame, 0);
-    if (ret < 0) {
-        cyanrip_log(ctx, 0, "Error allocating frame: %s!\n", av_err2str(ret));
-        goto fail;
-    }
+    dec_ctx->pending = frame;
 
-    memcpy(frame->data[0], data, bytes);
+    return 0;
 
-send:
-    ret = filter_frame(ctx, enc_ctx, num_enc, dec_ctx, frame, calc_global_peak);
 fail:
+    cyanrip_log(ctx, 0, "Error allocating frame!\n");
     av_frame_free(&frame);
+    return AVERROR(ENOMEM);
+}
+
+static int send_pending_frame(cyanrip_ctx *ctx, cyanrip_enc_ctx **enc_ctx,
+                              int num_enc, cyanrip_dec_ctx *dec_ctx)
+{
+    AVFrame *frame = dec_ctx->pending;
+    if (!frame)
+        return 0;
+
+    /* The buffer goes back to the pool once the filters and encoders
+     * are done with every reference to it */
+    dec_ctx->pending = NULL;
+    int ret = filter_frame(ctx, enc_ctx, num_enc, dec_ctx, frame);
+    av_frame_free(&frame);
+
     return ret;
 }
 
+int cyanrip_send_pcm_to_encoders(cyanrip_ctx *ctx, cyanrip_enc_ctx **enc_ctx,
+                                 int num_enc, cyanrip_dec_ctx *dec_ctx,
+                                 const uint8_t *data, int bytes)
+{
+    int ret = 0;
+
+    /* Flush, whatever is left over goes out as a short frame */
+    if (!data && !bytes) {
+        ret = send_pending_frame(ctx, enc_ctx, num_enc, dec_ctx);
+        if (ret < 0)
+            return ret;
+        return filter_frame(ctx, enc_ctx, num_enc, dec_ctx, NULL);
+    }
+
+    crip_loudness_process(&dec_ctx->loudness, data, bytes);
+
+    while (bytes >= 4) {
+        if (!dec_ctx->pending) {
+            ret = alloc_pending_frame(ctx, dec_ctx);
+            if (ret < 0)
+                return ret;
+        }
+
+        AVFrame *frame = dec_ctx->pending;
+        int nb_samples = FFMIN(bytes >> 2, dec_ctx->frame_size - frame->nb_samples);
+
+        memcpy(frame->data[0] + frame->nb_samples*4, data, nb_samples*4);
+        frame->nb_samples += nb_samples;
+        data += nb_samples*4;
+        bytes -= nb_samples*4;
+
+        if (frame->nb_samples == dec_ctx->frame_size) {
+            ret = send_pending_frame(ctx, enc_ctx, num_enc, dec_ctx);
+            if (ret < 0)
+                return ret;
+        }
+    }
+
+    return 0;
+}
+
 void cyanrip_immediate_stop_encoding(cyanrip_ctx *ctx, cyanrip_track *t)
 {
     for (int i = 0; i < ctx->settings.outputs_num; i++) {
         cyanrip_enc_ctx *s = t->enc_ctx[i];
-        if (s)
+        if (s) {
             atomic_store(&s->quit, 1);
+            if (s->job_started)
+                crip_enc_job_kick(ctx->shared->enc_pool, &s->job);
+        }
     }
 }
 
@@ -668,37 +759,68 @@ int cyanrip_reset_encoding(cyanrip_ctx *ctx, cyanrip_track *t)
 {
     cyanrip_immediate_stop_encoding(ctx, t);
 
-    for (int i = 0; i < ctx->settings.outputs_num; i++) {
-        cyanrip_enc_ctx *s = t->enc_ctx[i];
-
-        if (s->mutex_status == MUTEX_STATUS_ACQUIRED) {
-            pthread_mutex_unlock(&s->lock);
-            s->mutex_status = MUTEX_STATUS_FREE;
-        }
-    }
-
     for (int i = 0; i < ctx->settings.outputs_num; i++)
         cyanrip_end_track_encoding(&t->enc_ctx[i]);
 
-    for (int i = 0; i < ctx->settings.outputs_num; i++)
-        cyanrip_init_track_encoding(ctx, &t->enc_ctx[i], t,
-                                    ctx->settings.outputs[i]);
+    /* Filter state and track loudness must not carry over either */
+    cyanrip_free_dec_ctx(ctx, &t->dec_ctx);
+    int ret = cyanrip_create_dec_ctx(ctx, &t->dec_ctx, t);
+    if (ret < 0)
+        return ret;
+
+    for (int i = 0; i < ctx->settings.outputs_num; i++) {
+        ret = cyanrip_init_track_encoding(ctx, &t->enc_ctx[i], t,
+                                          ctx->settings.outputs[i]);
+        if (ret < 0)
+            return ret;
+    }
 
     return 0;
 }
 
+/* The same summary lavfi's ebur128 filter prints */
+static void log_loudness(cyanrip_ctx *ctx, const CRIPLoudnessResults *r)
+{
+    cyanrip_log(ctx, 0, "Summary:\n\n"
+                "  Integrated loudness:\n"
+                "    I:         %5.1f LUFS\n"
+                "    Threshold: %5.1f LUFS\n\n"
+                "  Loudness range:\n"
+                "    LRA:       %5.1f LU\n"
+                "    Threshold: %5.1f LUFS\n"
+                "    LRA low:   %5.1f LUFS\n"
+                "    LRA high:  %5.1f LUFS\n\n"
+                "  True peak:\n"
+                "    Peak:      %5.1f dBFS\n",
+                r->integrated, r->threshold, r->range, r->range_threshold,
+                r->range_low, r->range_high, r->true_peak);
+}
+
 int cyanrip_finalize_encoding(cyanrip_ctx *ctx, cyanrip_track *t)
 {
-    AVFilterContext *filt_ctx = t->dec_ctx->peak.graph->filters[1];
+    CRIPLoudness *loudness = &t->dec_ctx->loudness;
+    CRIPLoudnessResults r;
+
+    crip_loudness_flush(loudness);
+    crip_loudness_results(&loudness->stats, &r);
+
+    t->ebu_integrated  = r.integrated;
+    t->ebu_range       = r.range;
+    t->ebu_lra_low     = r.range_low;
+    t->ebu_lra_high    = r.range_high;
+    t->ebu_sample_peak = r.sample_peak;
+    t->ebu_true_peak   = r.true_peak;
 
-    av_opt_get_double(filt_ctx, "integrated", AV_OPT_SEARCH_CHILDREN, &t->ebu_integrated);
-    av_opt_get_double(filt_ctx, "range", AV_OPT_SEARCH_CHILDREN, &t->ebu_range);
-    av_opt_get_double(filt_ctx, "lra_low", AV_OPT_SEARCH_CHILDREN, &t->ebu_lra_low);
-    av_opt_get_double(filt_ctx, "lra_high", AV_OPT_SEARCH_CHILDREN, &t->ebu_lra_high);
-    av_opt_get_double(filt_ctx, "sample_peak", AV_OPT_SEARCH_CHILDREN, &t->ebu_sample_peak);
-    av_opt_get_double(filt_ctx, "true_peak", AV_OPT_SEARCH_CHILDREN, &t->ebu_true_peak);
+    /* Only the rip which was kept counts towards the album */
+    if (ctx->album_loudness)
+        crip_loudness_merge(ctx->album_loudness, &loudness->stats);
 
-    cyanrip_free_filt_ctx(ctx, &t->dec_ctx->peak, 1);
+    /* A resumed rip needs it for the album too */
+    av_freep(&t->loudness);
+    if (ctx->journal)
+        t->loudness = av_memdup(&loudness->stats, sizeof(loudness->stats));
+
+    log_loudness(ctx, &r);
     if (ctx->settings.decode_hdcd)
         cyanrip_log(ctx, 0, "\n  ");
     else
@@ -710,60 +832,32 @@ int cyanrip_finalize_encoding(cyanrip_ctx *ctx, cyanrip_track *t)
 
 int cyanrip_initialize_ebur128(cyanrip_ctx *ctx)
 {
-    int ret = 0;
-
-    cyanrip_dec_ctx *dec_ctx = av_mallocz(sizeof(*dec_ctx));
-    if (!dec_ctx)
+    ctx->album_loudness = av_mallocz(sizeof(*ctx->album_loudness));
+    if (!ctx->album_loudness)
         return AVERROR(ENOMEM);
-    ctx->peak_ctx = dec_ctx;
-
-    ret = init_filtering(ctx, &dec_ctx->peak, 0, 0, 1);
-    if (ret < 0)
-        goto fail;
 
     return 0;
-
-fail:
-    cyanrip_finalize_ebur128(ctx, 0);
-    return ret;
 }
 
 int cyanrip_finalize_ebur128(cyanrip_ctx *ctx, int log)
 {
-    cyanrip_dec_ctx *dec_ctx = ctx->peak_ctx;
-
-    if (!log)
-        goto end;
-
-    AVFilterContext *filt_ctx = dec_ctx->peak.graph->filters[1];
-
-    int ret = av_buffersrc_add_frame_flags(dec_ctx->peak.buffersrc_ctx, NULL,
-                                           AV_BUFFERSRC_FLAG_NO_CHECK_FORMAT |
-                                           AV_BUFFERSRC_FLAG_KEEP_REF | AV_BUFFERSRC_FLAG_PUSH);
-    if (ret < 0) {
-        cyanrip_log(ctx, 0, "Error filtering frame: %s!\n", av_err2str(ret));
-        cyanrip_free_filt_ctx(ctx, &dec_ctx->peak, 0);
-        av_freep(ctx->peak_ctx);
-        return ret;
-    }
-
-    av_opt_get_double(filt_ctx, "integrated", AV_OPT_SEARCH_CHILDREN, &ctx->ebu_integrated);
-    av_opt_get_double(filt_ctx, "range", AV_OPT_SEARCH_CHILDREN, &ctx->ebu_range);
-    av_opt_get_double(filt_ctx, "lra_low", AV_OPT_SEARCH_CHILDREN, &ctx->ebu_lra_low);
-    av_opt_get_double(filt_ctx, "lra_high", AV_OPT_SEARCH_CHILDREN, &ctx->ebu_lra_high);
-    av_opt_get_double(filt_ctx, "sample_peak", AV_OPT_SEARCH_CHILDREN, &ctx->ebu_sample_peak);
-    av_opt_get_double(filt_ctx, "true_peak", AV_OPT_SEARCH_CHILDREN, &ctx->ebu_true_peak);
-
-    cyanrip_log(ctx, 0, "Album Loudness ");
-
-end:
-    if (ctx->peak_ctx) {
-        cyanrip_free_filt_ctx(ctx, &ctx->peak_ctx->peak, log);
-        if (log)
-            cyanrip_log(ctx, 0, "\n");
+    if (log && ctx->album_loudness) {
+        CRIPLoudnessResults r;
+        crip_loudness_results(ctx->album_loudness, &r);
+
+        ctx->ebu_integrated  = r.integrated;
+        ctx->ebu_range       = r.range;
+        ctx->ebu_lra_low     = r.range_low;
+        ctx->ebu_lra_high    = r.range_high;
+        ctx->ebu_sample_peak = r.sample_peak;
+        ctx->ebu_true_peak   = r.true_peak;
+
+        cyanrip_log(ctx, 0, "Album Loudness ");
+        log_loudness(ctx, &r);
+        cyanrip_log(ctx, 0, "\n");
     }
 
-    av_freep(&ctx->peak_ctx);
+    av_freep(&ctx->album_loudness);
 
     return 0;
 }
@@ -799,7 +893,7 @@ static SwrContext *setup_init_swr(cyanrip_ctx *ctx, AVCodecContext *out_avctx,
     return swr;
 }
 
-static int64_t get_next_audio_pts(cyanrip_enc_ctx *ctx, AVFrame *in)
+static int64_t get_next_audio_pts(cyanrip_enc_ctx *ctx, const AVFrame *in)
 {
     const int64_t m = (int64_t)44100 * ctx->out_avctx->sample_rate;
     const int64_t b = (int64_t)ctx->out_avctx->time_base.num * m;
@@ -815,18 +909,22 @@ static int64_t get_next_audio_pts(cyanrip_enc_ctx *ctx, AVFrame *in)
     return out_pts;
 }
 
-static int audio_process_frame(cyanrip_enc_ctx *ctx, AVFrame **input, int flush)
+/* The input is only read, swr keeps what it needs of it */
+static int audio_process_frame(cyanrip_enc_ctx *ctx, const AVFrame *input,
+                               AVFrame **output, int flush)
 {
     int ret;
     int frame_size = ctx->out_avctx->frame_size;
 
-    int64_t resampled_frame_pts = get_next_audio_pts(ctx, *input);
+    *output = NULL;
 
-    /* Resample the frame, can be NULL */
-    ret = swr_convert_frame(ctx->swr, NULL, *input);
+    if (ctx->swr_drained)
+        return 0;
 
-    av_frame_free(input);
+    int64_t resampled_frame_pts = get_next_audio_pts(ctx, input);
 
+    /* Resample the frame, can be NULL */
+    ret = swr_convert_frame(ctx->swr, NULL, input);
     if (ret < 0) {
         av_log(ctx, AV_LOG_ERROR, "Error pushing audio for resampling: %s!\n", av_err2str(ret));
         return ret;
@@ -839,15 +937,12 @@ static int audio_process_frame(cyanrip_enc_ctx *ctx, AVFrame **input, int flush)
             frame_size = out_samples;
         else if (!out_samples || ((frame_size) && (out_samples < frame_size)))
             return AVERROR(EAGAIN);
-    } else if (!frame_size && ctx->swr) {
+    } else if (!frame_size) {
         frame_size = swr_get_out_samples(ctx->swr, 0);
         if (!frame_size)
             return 0;
     }
 
-    if (flush && !ctx->swr)
-        return 0;
-
     AVFrame *out_frame = NULL;
     if (!(out_frame = av_frame_alloc())) {
         av_log(ctx, AV_LOG_ERROR, "Error allocating frame!\n");
@@ -878,17 +973,46 @@ static int audio_process_frame(cyanrip_enc_ctx *ctx, AVFrame **input, int flush)
         return ret;
     }
 
-    /* swr has been drained */
+    /* swr has been drained, it's kept for the next track */
     if (!out_frame->nb_samples) {
         av_frame_free(&out_frame);
-        swr_free(&ctx->swr);
+        ctx->swr_drained = 1;
     }
 
-    *input = out_frame;
+    *output = out_frame;
 
     return 0;
 }
 
+static void chunk_free(cyanrip_enc_chunk **c)
+{
+    if (!c || !*c)
+        return;
+
+    for (int i = 0; i < (*c)->nb_frames; i++)
+        av_frame_free(&(*c)->frames[i]);
+    for (int i = 0; i < (*c)->nb_pkts; i++)
+        av_packet_free(&(*c)->pkts[i]);
+    avcodec_free_context(&(*c)->avctx);
+
+    av_freep(c);
+}
+
+/* None of the chunks may still be encoding */
+static void free_chunks(cyanrip_enc_ctx *s)
+{
+    while (s->chunks_head) {
+        cyanrip_enc_chunk *c = s->chunks_head;
+        s->chunks_head = c->next;
+        chunk_free(&c);
+    }
+    s->chunks_tail = NULL;
+    s->nb_chunks = 0;
+
+    chunk_free(&s->chunk);
+    av_freep(&s->md5);
+}
+
 int cyanrip_end_track_encoding(cyanrip_enc_ctx **s)
 {
     cyanrip_enc_ctx *ctx;
@@ -897,33 +1021,32 @@ int cyanrip_end_track_encoding(cyanrip_enc_ctx **s)
 
     ctx = *s;
 
-    if (ctx->mutex_status == MUTEX_STATUS_ACQUIRED) {
-        pthread_mutex_unlock(&ctx->lock);
-        ctx->mutex_status = MUTEX_STATUS_FREE;
-    }
-
     /* Send EOF, needed in case we haven't sent it yet and the user cancels. */
-    cr_frame_fifo_push(ctx->fifo, NULL);
-    if (ctx->thread_started)
-        pthread_join(ctx->thread, NULL);
-    if (ctx->mutex_status != MUTEX_STATUS_NOT_INITIALIZED)
-        pthread_mutex_destroy(&ctx->lock);
+    cr_frame_ring_push(ctx->ring, NULL);
+    if (ctx->job_started) {
+        CRIPEncPool *pool = ctx->ctx->shared->enc_pool;
+        crip_enc_job_kick(pool, &ctx->job);
+        crip_enc_job_wait(pool, &ctx->job);
+    }
 
+    /* Only left if the encoder never ran */
     swr_free(&ctx->swr);
-
     avcodec_free_context(&ctx->out_avctx);
+    av_packet_free(&ctx->out_pkt);
+    free_chunks(ctx);
 
     if (ctx->avf)
         avio_closep(&ctx->avf->pb);
     avformat_free_context(ctx->avf);
 
-    av_buffer_unref(&ctx->fifo);
-    av_buffer_unref(&ctx->packet_fifo);
+    av_buffer_unref(&ctx->ring);
     av_packet_free(&ctx->cover_art_pkt);
 
     atomic_store(&ctx->quit, 0);
 
     int status = ctx->status;
+    if (!status)
+        status = atomic_load(&ctx->done);
     av_freep(s);
     return status;
 }
@@ -942,178 +1065,588 @@ static int open_output(cyanrip_ctx *ctx, cyanrip_enc_ctx *s)
         goto fail;
     }
 
-    /* Mux cover image */
+    /* Mux cover image, the muxer takes over our reference to it */
     if (s->cover_art_pkt) {
-        AVPacket *pkt = av_packet_clone(s->cover_art_pkt);
-        pkt->stream_index = s->st_img->index;
-        if ((ret = av_interleaved_write_frame(s->avf, pkt)) < 0) {
+        s->cover_art_pkt->stream_index = s->st_img->index;
+        if ((ret = av_interleaved_write_frame(s->avf, s->cover_art_pkt)) < 0) {
             cyanrip_log(ctx, 0, "Error writing picture packet: %s!\n", av_err2str(ret));
             goto fail;
         }
-        av_packet_free(&pkt);
     }
 
 fail:
     return ret;
 }
 
-static void *cyanrip_track_encoding(void *ctx)
+static struct cyanrip_enc_cache *enc_cache_get(cyanrip_ctx *ctx)
 {
-    cyanrip_enc_ctx *s = ctx;
-    int ret = 0, flushing = 0;
+    if (!ctx->enc_cache) {
+        ctx->enc_cache = av_mallocz(sizeof(*ctx->enc_cache));
+        if (!ctx->enc_cache)
+            return NULL;
+        pthread_mutex_init(&ctx->enc_cache->lock, NULL);
+    }
 
-    /* Allocate output packet */
-    AVPacket *out_pkt = av_packet_alloc();
-    if (!out_pkt) {
-        ret = AVERROR(ENOMEM);
-        cyanrip_log(s->ctx, 0, "Error while encoding: %s!\n", av_err2str(ret));
-        goto fail;
+    return ctx->enc_cache;
+}
+
+/* Called once encoding has ended, from the worker */
+static void enc_cache_put(cyanrip_enc_ctx *s)
+{
+    struct cyanrip_enc_cache *c = s->ctx->enc_cache;
+
+    pthread_mutex_lock(&c->lock);
+    if (!c->swr[s->format][s->deemphasis])
+        FFSWAP(SwrContext *, c->swr[s->format][s->deemphasis], s->swr);
+    pthread_mutex_unlock(&c->lock);
+
+    avcodec_free_context(&s->out_avctx);
+    swr_free(&s->swr);
+}
+
+void cyanrip_free_enc_cache(cyanrip_ctx *ctx)
+{
+    struct cyanrip_enc_cache *c = ctx->enc_cache;
+    if (!c)
+        return;
+
+    for (int i = 0; i < CYANRIP_FORMATS_NB; i++) {
+        swr_free(&c->swr[i][0]);
+        swr_free(&c->swr[i][1]);
     }
 
+    pthread_mutex_destroy(&c->lock);
+    av_freep(&ctx->enc_cache);
+}
+
+/* Writes the trailer, unless encoding failed */
+static int end_encoding(cyanrip_enc_ctx *s, int ret)
+{
+    if (ret >= 0) {
+        ret = av_write_trailer(s->avf);
+        if (ret < 0)
+            cyanrip_log(s->ctx, 0, "Error writing trailer: %s!\n", av_err2str(ret));
+    }
+
+    /* Tracks can number in the hundreds, don't keep them all open */
+    if (ret >= 0) {
+        ret = avio_closep(&s->avf->pb);
+        if (ret < 0)
+            cyanrip_log(s->ctx, 0, "Error closing file: %s!\n", av_err2str(ret));
+    }
+
+    if (ret >= 0)
+        atomic_store(&s->done, 1);
+
+    /* Don't hold back the other encoders */
+    cr_frame_ring_remove_reader(s->ring, s->ring_reader);
+
+    enc_cache_put(s);
+    av_packet_free(&s->out_pkt);
+    free_chunks(s);
+
+    atomic_store(&s->status, ret);
+
+    return AVERROR_EOF;
+}
+
+static int mux_packet(cyanrip_enc_ctx *s, AVPacket *pkt)
+{
+    int sid = s->audio_stream_index;
+    pkt->stream_index = sid;
+
+    AVRational src_tb = s->out_avctx->time_base;
+    AVRational dst_tb = s->avf->streams[sid]->time_base;
+
+    /* Rescale timestamps to container */
+    av_packet_rescale_ts(pkt, src_tb, dst_tb);
+
+    /* Send frame to lavf */
+    int ret = av_interleaved_write_frame(s->avf, pkt);
+    if (ret < 0)
+        cyanrip_log(s->ctx, 0, "Error writing packet: %s!\n", av_err2str(ret));
+
+    /* Reset the packet */
+    av_packet_unref(pkt);
+
+    return ret;
+}
+
+/* Returns AVERROR_EOF once the encoder has been drained */
+static int write_packets(cyanrip_enc_ctx *s)
+{
     while (!atomic_load(&s->quit)) {
+        int ret = avcodec_receive_packet(s->out_avctx, s->out_pkt);
+        if (ret == AVERROR_EOF) {
+            return ret;
+        } else if (ret == AVERROR(EAGAIN)) {
+            return 0;
+        } else if (ret < 0) {
+            cyanrip_log(s->ctx, 0, "Error while encoding: %s!\n", av_err2str(ret));
+            return ret;
+        }
+
+        ret = mux_packet(s, s->out_pkt);
+        if (ret < 0)
+            return ret;
+    }
+
+    return 0;
+}
+
+/* Encodes what the ring has, run by the encoding workers */
+static int encode_step(CRIPEncJob *job)
+{
+    cyanrip_enc_ctx *s = (cyanrip_enc_ctx *)job;
+    int ret;
+
+    cyanrip_set_thread_ctx(s->ctx);
+
+    for (int i = 0; i < ENC_FRAMES_PER_STEP; i++) {
+        const AVFrame *in_frame = NULL;
         AVFrame *out_frame = NULL;
 
-        if (!flushing) {
-            out_frame = cr_frame_fifo_pop(s->fifo);
-            flushing = !out_frame;
+        if (atomic_load(&s->quit))
+            return end_encoding(s, 0);
+
+        if (!s->flushing) {
+            ret = cr_frame_ring_try_peek(s->ring, s->ring_reader, &in_frame);
+            if (ret == AVERROR(EAGAIN))
+                return ret;
+            s->flushing = ret == AVERROR_EOF;
         }
 
-        ret = audio_process_frame(ctx, &out_frame, flushing);
+        ret = audio_process_frame(s, in_frame, &out_frame, s->flushing);
+        if (in_frame)
+            cr_frame_ring_release(s->ring, s->ring_reader);
         if (ret == AVERROR(EAGAIN))
             continue;
         else if (ret)
-            goto fail;
+            return end_encoding(s, ret);
 
         /* Give frame */
         ret = avcodec_send_frame(s->out_avctx, out_frame);
         av_frame_free(&out_frame);
         if (ret < 0) {
             cyanrip_log(s->ctx, 0, "Error encoding: %s!\n", av_err2str(ret));
-            goto fail;
+            return end_encoding(s, ret);
         }
 
-        /* Return loop */
-        while (!atomic_load(&s->quit)) {
-            ret = avcodec_receive_packet(s->out_avctx, out_pkt);
-            if (ret == AVERROR_EOF) {
-                ret = 0;
-                goto write_trailer;
-            } else if (ret == AVERROR(EAGAIN)) {
-                ret = 0;
-                break;
-            } else if (ret < 0) {
-                cyanrip_log(s->ctx, 0, "Error while encoding: %s!\n", av_err2str(ret));
-                goto fail;
-            }
+        ret = write_packets(s);
+        if (ret == AVERROR_EOF)
+            return end_encoding(s, 0);
+        else if (ret < 0)
+            return end_encoding(s, ret);
+    }
 
-            int sid = s->audio_stream_index;
-            out_pkt->stream_index = sid;
+    return 0;
+}
 
-            AVRational src_tb = s->out_avctx->time_base;
-            AVRational dst_tb = s->avf->streams[sid]->time_base;
+/* Chunks return their packets in the order their encoder output them */
+static int chunk_receive_packets(cyanrip_enc_chunk *c)
+{
+    for (;;) {
+        AVPacket *pkt = av_packet_alloc();
+        if (!pkt)
+            return AVERROR(ENOMEM);
 
-            /* Rescale timestamps to container */
-            av_packet_rescale_ts(out_pkt, src_tb, dst_tb);
+        int ret = avcodec_receive_packet(c->avctx, pkt);
+        if (ret < 0) {
+            av_packet_free(&pkt);
+            return ret == AVERROR(EAGAIN) ? 0 : ret;
+        }
 
-            if (s->separate_writeout) {
-                /* Put encoded frame in FIFO */
-                ret = cr_packet_fifo_push(s->packet_fifo, out_pkt);
-                if (ret < 0) {
-                    cyanrip_log(ctx, 0, "Error pushing packet to FIFO: %s!\n", av_err2str(ret));
-                    goto fail;
-                }
-            } else {
-                /* Send frame to lavf */
-                ret = av_interleaved_write_frame(s->avf, out_pkt);
-                if (ret < 0) {
-                    cyanrip_log(s->ctx, 0, "Error writing packet: %s!\n", av_err2str(ret));
-                    goto fail;
-                }
-             }
-
-            /* Reset the packet */
-            av_packet_unref(out_pkt);
+        /* The STREAMINFO update at the end, only the whole track's counts */
+        if (!pkt->size) {
+            av_packet_free(&pkt);
+            continue;
+        }
+
+        if (c->nb_pkts == FLAC_CHUNK_FRAMES) {
+            av_packet_free(&pkt);
+            return AVERROR_BUG;
         }
+        c->pkts[c->nb_pkts++] = pkt;
     }
+}
 
-write_trailer:
-    av_packet_free(&out_pkt);
+/* Encodes a chunk with an encoder of its own, run by the encoding workers */
+static int chunk_step(CRIPEncJob *job)
+{
+    cyanrip_enc_chunk *c = (cyanrip_enc_chunk *)job;
+    cyanrip_enc_ctx *s = c->s;
+    int ret = 0;
 
-    if (s->separate_writeout) {
-        ret = cr_packet_fifo_push(s->packet_fifo, NULL);
-        if (ret < 0) {
-            cyanrip_log(ctx, 0, "Error pushing packet to FIFO: %s!\n", av_err2str(ret));
-            goto fail;
+    cyanrip_set_thread_ctx(s->ctx);
+
+    if (!c->avctx) {
+        const AVCodec *codec = s->out_avctx->codec;
+        c->avctx = setup_out_avctx(s->ctx, s->avf, codec, s->cfmt,
+                                   s->ctx->settings.decode_hdcd, s->deemphasis);
+        if (!c->avctx) {
+            ret = AVERROR(ENOMEM);
+            goto end;
         }
 
-        if (atomic_load(&s->quit))
-            goto fail;
+        ret = avcodec_open2(c->avctx, codec, NULL);
+        if (ret < 0)
+            goto end;
 
-        pthread_mutex_lock(&s->lock);
-        pthread_mutex_unlock(&s->lock);
+        /* Frames were cut to the size of the track's encoder */
+        if (c->avctx->frame_size != s->out_avctx->frame_size) {
+            ret = AVERROR_BUG;
+            goto end;
+        }
+    }
 
-        if (atomic_load(&s->quit))
-            goto fail;
+    for (int i = 0; i < ENC_FRAMES_PER_STEP; i++) {
+        if (atomic_load(&s->chunks_abort)) {
+            ret = AVERROR_EXIT;
+            goto end;
+        }
 
-        if ((ret = open_output(s->ctx, s)) < 0) {
-            cyanrip_log(s->ctx, 0, "Error writing to file: %s!\n", av_err2str(ret));
-            goto fail;
+        /* NULL once all frames have been sent, to drain it */
+        AVFrame *frame = NULL;
+        if (c->nb_sent < c->nb_frames)
+            FFSWAP(AVFrame *, frame, c->frames[c->nb_sent]);
+        ret = avcodec_send_frame(c->avctx, frame);
+        av_frame_free(&frame);
+        if (ret < 0)
+            goto end;
+        c->nb_sent++;
+
+        ret = chunk_receive_packets(c);
+        if (ret == AVERROR_EOF) {
+            ret = 0;
+            goto end;
+        } else if (ret < 0) {
+            goto end;
         }
+    }
 
-        while (!atomic_load(&s->quit) && (out_pkt = cr_packet_fifo_pop(s->packet_fifo))) {
-            /* Send frames to lavf */
-            ret = av_interleaved_write_frame(s->avf, out_pkt);
-            av_packet_free(&out_pkt);
-            if (ret < 0) {
-                cyanrip_log(s->ctx, 0, "Error writing packet: %s!\n", av_err2str(ret));
-                goto fail;
-            }
+    return 0;
+
+end:
+    if (ret < 0 && ret != AVERROR_EXIT)
+        cyanrip_log(s->ctx, 0, "Error encoding chunk: %s!\n", av_err2str(ret));
+
+    c->status = ret;
+    avcodec_free_context(&c->avctx);
+
+    atomic_store(&c->done, 1);
+    crip_enc_job_kick(s->ctx->shared->enc_pool, &s->job);
+
+    return AVERROR_EOF;
+}
+
+static int chunk_submit(cyanrip_enc_ctx *s)
+{
+    cyanrip_enc_chunk *c = s->chunk;
+    if (!c)
+        return 0;
+
+    s->chunk = NULL;
+    c->s = s;
+    atomic_init(&c->done, 0);
+
+    if (s->chunks_tail)
+        s->chunks_tail->next = c;
+    else
+        s->chunks_head = c;
+    s->chunks_tail = c;
+    s->nb_chunks++;
+
+    crip_enc_job_start(s->ctx->shared->enc_pool, &c->job, chunk_step);
+
+    return 0;
+}
+
+/* Hashes what the encoder would have, little-endian samples of the coded depth */
+static void flac_md5_update(cyanrip_enc_ctx *s, const AVFrame *frame)
+{
+    int nb_samples = frame->nb_samples*frame->ch_layout.nb_channels;
+    int shift = 32 - s->out_avctx->bits_per_raw_sample;
+    uint8_t buf[3*256];
+
+    if (frame->format == AV_SAMPLE_FMT_S16 && !CONFIG_BIG_ENDIAN) {
+        av_md5_update(s->md5, frame->data[0], nb_samples*2);
+        return;
+    }
+
+    for (int i = 0; i < nb_samples; i += 256) {
+        int len = FFMIN(nb_samples - i, 256);
+        if (frame->format == AV_SAMPLE_FMT_S16) {
+            const int16_t *src = (const int16_t *)frame->data[0] + i;
+            for (int j = 0; j < len; j++)
+                AV_WL16(buf + 2*j, src[j]);
+            av_md5_update(s->md5, buf, 2*len);
+        } else {
+            const int32_t *src = (const int32_t *)frame->data[0] + i;
+            for (int j = 0; j < len; j++)
+                AV_WL24(buf + 3*j, src[j] >> shift);
+            av_md5_update(s->md5, buf, 3*len);
         }
     }
+}
 
-    if ((ret = av_write_trailer(s->avf)) < 0) {
-        cyanrip_log(s->ctx, 0, "Error writing trailer: %s!\n", av_err2str(ret));
-        goto fail;
+static int chunk_add_frame(cyanrip_enc_ctx *s, AVFrame *frame)
+{
+    if (!s->chunk) {
+        s->chunk = av_mallocz(sizeof(*s->chunk));
+        if (!s->chunk) {
+            av_frame_free(&frame);
+            return AVERROR(ENOMEM);
+        }
     }
 
-fail:
-    av_packet_free(&out_pkt);
+    flac_md5_update(s, frame);
+    s->nb_samples += frame->nb_samples;
 
-    atomic_store(&s->status, ret);
+    s->chunk->frames[s->chunk->nb_frames++] = frame;
+    if (s->chunk->nb_frames == FLAC_CHUNK_FRAMES)
+        return chunk_submit(s);
 
-    return NULL;
+    return 0;
 }
 
-int cyanrip_writeout_track(cyanrip_ctx *ctx, cyanrip_enc_ctx *s)
+/* Frames of each chunk are numbered from 0 */
+static int mux_chunk_packet(cyanrip_enc_ctx *s, const AVPacket *pkt)
 {
-    if (!s)
-        return 0;
+    AVPacket *out = s->out_pkt;
+
+    int ret = av_new_packet(out, pkt->size + CRIP_FLAC_RENUMBER_GROWTH);
+    if (ret < 0)
+        return ret;
+
+    ret = crip_flac_frame_renumber(out->data, pkt->data, pkt->size,
+                                   s->nb_flac_frames);
+    if (ret < 0) {
+        cyanrip_log(s->ctx, 0, "Invalid FLAC frame in chunk: %s!\n", av_err2str(ret));
+        av_packet_unref(out);
+        return ret;
+    }
+    av_shrink_packet(out, ret);
+
+    ret = av_packet_copy_props(out, pkt);
+    if (ret < 0) {
+        av_packet_unref(out);
+        return ret;
+    }
 
-    if (s->mutex_status == MUTEX_STATUS_ACQUIRED) {
-        pthread_mutex_unlock(&s->lock);
-        s->mutex_status = MUTEX_STATUS_FREE;
+    if (!s->nb_flac_frames || out->size < s->min_frame_size)
+        s->min_frame_size = out->size;
+    s->max_frame_size = FFMAX(s->max_frame_size, out->size);
+    s->nb_flac_frames++;
+
+    return mux_packet(s, out);
+}
+
+/* Muxes the chunks which are done, in order */
+static int mux_chunks(cyanrip_enc_ctx *s)
+{
+    int ret = 0;
+
+    while (s->chunks_head && atomic_load(&s->chunks_head->done)) {
+        cyanrip_enc_chunk *c = s->chunks_head;
+
+        /* Only returns once the worker has let go of it */
+        crip_enc_job_wait(s->ctx->shared->enc_pool, &c->job);
+
+        s->chunks_head = c->next;
+        if (!s->chunks_head)
+            s->chunks_tail = NULL;
+        s->nb_chunks--;
+
+        if (!ret && !s->chunks_ending)
+            ret = c->status;
+        for (int i = 0; i < c->nb_pkts && !ret && !s->chunks_ending; i++)
+            ret = mux_chunk_packet(s, c->pkts[i]);
+
+        chunk_free(&c);
+    }
+
+    return ret;
+}
+
+/* The same STREAMINFO update the encoder sends once drained */
+static int mux_streaminfo(cyanrip_enc_ctx *s)
+{
+    if (s->out_avctx->extradata_size < CRIP_FLAC_STREAMINFO_SIZE)
+        return AVERROR_BUG;
+
+    AVPacket *pkt = s->out_pkt;
+    uint8_t *streaminfo = av_packet_new_side_data(pkt, AV_PKT_DATA_NEW_EXTRADATA,
+                                                  CRIP_FLAC_STREAMINFO_SIZE);
+    if (!streaminfo)
+        return AVERROR(ENOMEM);
+
+    uint8_t md5[16];
+    av_md5_final(s->md5, md5);
+
+    memcpy(streaminfo, s->out_avctx->extradata, CRIP_FLAC_STREAMINFO_SIZE);
+    crip_flac_streaminfo_update(streaminfo, s->min_frame_size, s->max_frame_size,
+                                s->nb_samples, md5);
+
+    pkt->pts = pkt->dts = s->nb_samples;
+
+    return mux_packet(s, pkt);
+}
+
+/* Stops taking frames, and ends once no chunk is encoding anymore */
+static int end_chunks(cyanrip_enc_ctx *s, int ret)
+{
+    if (!s->chunks_ending) {
+        s->chunks_ending = 1;
+        s->chunks_ret = ret;
+        atomic_store(&s->chunks_abort, 1);
+    }
+
+    /* The last chunk to finish kicks */
+    if (s->chunks_head)
+        return AVERROR(EAGAIN);
+
+    return end_encoding(s, s->chunks_ret);
+}
+
+/* Hands the frames out in chunks, which get encoded in parallel */
+static int encode_chunks_step(CRIPEncJob *job)
+{
+    cyanrip_enc_ctx *s = (cyanrip_enc_ctx *)job;
+    int ret;
+
+    cyanrip_set_thread_ctx(s->ctx);
+
+    ret = mux_chunks(s);
+    if (ret < 0 || s->chunks_ending)
+        return end_chunks(s, ret);
+    else if (atomic_load(&s->quit))
+        return end_chunks(s, 0);
+
+    for (int i = 0; i < ENC_FRAMES_PER_STEP; i++) {
+        const AVFrame *in_frame = NULL;
+        AVFrame *out_frame = NULL;
+
+        /* Done with the input, wait for the chunks to finish in order */
+        if (s->swr_drained) {
+            chunk_submit(s);
+            if (s->chunks_head)
+                return AVERROR(EAGAIN);
+            ret = mux_streaminfo(s);
+            return end_encoding(s, ret);
+        }
+
+        /* Kicked when one finishes */
+        if (s->nb_chunks >= s->max_chunks)
+            return AVERROR(EAGAIN);
+
+        if (!s->flushing) {
+            ret = cr_frame_ring_try_peek(s->ring, s->ring_reader, &in_frame);
+            if (ret == AVERROR(EAGAIN))
+                return ret;
+            s->flushing = ret == AVERROR_EOF;
+        }
+
+        ret = audio_process_frame(s, in_frame, &out_frame, s->flushing);
+        if (in_frame)
+            cr_frame_ring_release(s->ring, s->ring_reader);
+        if (ret == AVERROR(EAGAIN))
+            continue;
+        else if (ret)
+            return end_chunks(s, ret);
+
+        if (out_frame) {
+            ret = chunk_add_frame(s, out_frame);
+            if (ret < 0)
+                return end_chunks(s, ret);
+        }
     }
 
     return 0;
 }
 
+int cyanrip_track_encoding_done(cyanrip_ctx *ctx, cyanrip_track *t)
+{
+    int done = 1;
+
+    for (int i = 0; i < ctx->settings.outputs_num; i++) {
+        cyanrip_enc_ctx *s = t->enc_ctx[i];
+        if (!s)
+            return 0;
+
+        int status = atomic_load(&s->status);
+        if (status < 0)
+            return status;
+
+        done &= atomic_load(&s->done);
+    }
+
+    return done;
+}
+
+int cyanrip_update_replaygain(cyanrip_ctx *ctx, cyanrip_track *t)
+{
+    int ret = 0;
+
+    /* Encoders of tracks which didn't finish ripping never got flushed */
+    if (!t->ripped && !t->restored)
+        return 0;
+
+    for (int i = 0; i < ctx->settings.outputs_num; i++) {
+        const cyanrip_out_fmt *cfmt = &crip_fmt_info[ctx->settings.outputs[i]];
+        cyanrip_enc_ctx *s = t->enc_ctx[i];
+
+        /* Restored tracks have no encoders, their files are already there */
+        if (s) {
+            if (s->job_started)
+                crip_enc_job_wait(ctx->shared->enc_pool, &s->job);
+            if (!atomic_load(&s->done))
+                continue;
+        }
+
+        char *path = crip_get_path(ctx, CRIP_PATH_TRACK, 0, cfmt, t);
+        if (!path)
+            return AVERROR(ENOMEM);
+
+        int err = crip_replaygain_patch(path, cfmt->lavf_name, t->meta);
+        if (err < 0) {
+            cyanrip_log(ctx, 0, "Unable to update the ReplayGain tags of %s: %s!\n",
+                        path, av_err2str(err));
+            ret = err;
+        }
+
+        av_free(path);
+    }
+
+    return ret;
+}
+
 int cyanrip_init_track_encoding(cyanrip_ctx *ctx, cyanrip_enc_ctx **enc_ctx,
                                 cyanrip_track *t, enum cyanrip_output_formats format)
 {
     int ret = 0;
     const cyanrip_out_fmt *cfmt = &crip_fmt_info[format];
     cyanrip_enc_ctx *s = av_mallocz(sizeof(*s));
+    if (!s)
+        return AVERROR(ENOMEM);
     int deemphasis = (ctx->settings.deemphasis && t->preemphasis) || ctx->settings.force_deemphasis;
 
     const AVCodec *out_codec = NULL;
 
-    s->mutex_status = MUTEX_STATUS_NOT_INITIALIZED;
+    struct cyanrip_enc_cache *cache = enc_cache_get(ctx);
+    if (!cache) {
+        av_free(s);
+        return AVERROR(ENOMEM);
+    }
+
     s->t = t;
     s->ctx = ctx;
+    s->format = format;
     s->cfmt = cfmt;
-    s->separate_writeout = ctx->settings.enable_replaygain;
+    s->deemphasis = !!deemphasis;
     atomic_init(&s->status, 0);
+    atomic_init(&s->done, 0);
     atomic_init(&s->quit, 0);
+    atomic_init(&s->chunks_abort, 0);
 
     char *filename = crip_get_path(ctx, CRIP_PATH_TRACK, 1, cfmt, t);
 
@@ -1167,9 +1700,19 @@ int cyanrip_init_track_encoding(cyanrip_ctx *ctx, cyanrip_enc_ctx **enc_ctx,
                     title && !strcmp(title, "Back") ? "Cover (back)" :
                                                       "Cover (front)", 0);
 
+        /* A reference, the image itself is shared by all encoders */
         s->cover_art_pkt = av_packet_clone(art->pkt);
+        if (!s->cover_art_pkt) {
+            ret = AVERROR(ENOMEM);
+            goto fail;
+        }
     }
 
+    /* A resampler left over by a previous track is already set up */
+    pthread_mutex_lock(&cache->lock);
+    FFSWAP(SwrContext *, s->swr, cache->swr[format][s->deemphasis]);
+    pthread_mutex_unlock(&cache->lock);
+
     /* Find encoder */
     if (cfmt->codec == AV_CODEC_ID_NONE)
         out_codec = avcodec_find_encoder(ctx->settings.decode_hdcd ?
@@ -1189,6 +1732,7 @@ int cyanrip_init_track_encoding(cyanrip_ctx *ctx, cyanrip_enc_ctx **enc_ctx,
                                    ctx->settings.decode_hdcd, deemphasis);
     if (!s->out_avctx) {
         cyanrip_log(ctx, 0, "Unable to init output avctx!\n");
+        ret = AVERROR(ENOMEM);
         goto fail;
     }
 
@@ -1217,43 +1761,67 @@ int cyanrip_init_track_encoding(cyanrip_ctx *ctx, cyanrip_enc_ctx **enc_ctx,
         goto fail;
     }
 
-    /* SWR */
-    s->swr = setup_init_swr(ctx, s->out_avctx,
-                            ctx->settings.decode_hdcd, deemphasis);
-    if (!s->swr)
-        goto fail;
-
-    /* FIFO */
-    s->fifo = cr_frame_fifo_create(-1, FRAME_FIFO_BLOCK_NO_INPUT);
-    if (!s->fifo)
-        goto fail;
+    /* SWR, a drained one only needs to be reset */
+    if (s->swr && swr_init(s->swr) < 0)
+        swr_free(&s->swr);
+    if (!s->swr) {
+        s->swr = setup_init_swr(ctx, s->out_avctx,
+                                ctx->settings.decode_hdcd, deemphasis);
+        if (!s->swr) {
+            ret = AVERROR(ENOMEM);
+            goto fail;
+        }
+    }
 
-    /* File write lock */
-    ret = pthread_mutex_init(&s->lock, NULL);
-    if (ret != 0) {
-        ret = AVERROR(ret);
+    s->out_pkt = av_packet_alloc();
+    if (!s->out_pkt) {
+        ret = AVERROR(ENOMEM);
         goto fail;
     }
-    pthread_mutex_lock(&s->lock);
-    s->mutex_status = MUTEX_STATUS_ACQUIRED;
 
-    /* Packet fifo */
-    if (s->separate_writeout) {
-        s->packet_fifo = cr_packet_fifo_create(-1, 0);
-        if (!s->packet_fifo)
-            goto fail;
-    } else {
-        ret = open_output(ctx, s);
-        if (ret < 0)
+    /* FLAC frames only depend on their own samples, so pieces of the track
+     * can be encoded at once, and stitched together bit-exactly */
+    s->chunked = ctx->settings.chunked_flac && format == CYANRIP_FORMAT_FLAC &&
+                 s->out_avctx->frame_size &&
+                 (s->out_avctx->sample_fmt == AV_SAMPLE_FMT_S16 ||
+                  s->out_avctx->sample_fmt == AV_SAMPLE_FMT_S32);
+    if (s->chunked) {
+        s->md5 = av_md5_alloc();
+        if (!s->md5) {
+            ret = AVERROR(ENOMEM);
             goto fail;
+        }
+        av_md5_init(s->md5);
+        s->max_chunks = crip_enc_pool_nb_workers(ctx->shared->enc_pool) + 1;
     }
 
-    ret = pthread_create(&s->thread, NULL, cyanrip_track_encoding, s);
-    if (ret != 0) {
-        ret = AVERROR(ret);
+    /* The gain isn't known yet, reserve room for it */
+    if (ctx->settings.enable_replaygain) {
+        crip_replaygain_meta(&t->meta, "TRACK", NAN, 0.0, 0.0);
+        crip_replaygain_meta(&t->meta, "ALBUM", NAN, 0.0, 0.0);
+    }
+
+    ret = open_output(ctx, s);
+    if (ret < 0)
+        goto fail;
+
+    /* Read what the track's decoding context sends */
+    s->ring = av_buffer_ref(t->dec_ctx->ring);
+    if (!s->ring) {
+        ret = AVERROR(ENOMEM);
+        goto fail;
+    }
+
+    s->ring_reader = cr_frame_ring_add_reader(s->ring);
+    if (s->ring_reader < 0) {
+        ret = s->ring_reader;
+        av_buffer_unref(&s->ring);
         goto fail;
     }
-    s->thread_started = 1;
+
+    crip_enc_job_start(ctx->shared->enc_pool, &s->job,
+                       s->chunked ? encode_chunks_step : encode_step);
+    s->job_started = 1;
 
     av_free(ffpath);
     av_free(filename);
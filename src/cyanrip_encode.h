@@ -23,6 +23,10 @@
 typedef struct cyanrip_dec_ctx cyanrip_dec_ctx;
 typedef struct cyanrip_enc_ctx cyanrip_enc_ctx;
 
+/* Default number of samples per frame sent to the filters and encoders,
+ * 16 sectors */
+#define CRIP_FRAME_SAMPLES (16*588)
+
 void cyanrip_print_codecs(void);
 int cyanrip_validate_fmt(const char *fmt);
 const char *cyanrip_fmt_desc(enum cyanrip_output_formats format);
@@ -32,10 +36,11 @@ int cyanrip_create_dec_ctx(cyanrip_ctx *ctx, cyanrip_dec_ctx **s,
                            cyanrip_track *t);
 int cyanrip_init_track_encoding(cyanrip_ctx *ctx, cyanrip_enc_ctx **enc_ctx,
                                 cyanrip_track *t, enum cyanrip_output_formats format);
+/* Data gets buffered until a whole frame is gathered, call with NULL data
+ * and 0 bytes at the end of the track to flush */
 int cyanrip_send_pcm_to_encoders(cyanrip_ctx *ctx, cyanrip_enc_ctx **enc_ctx,
                                  int num_enc, cyanrip_dec_ctx *dec_ctx,
-                                 const uint8_t *data, int bytes,
-                                 int calc_global_peak);
+                                 const uint8_t *data, int bytes);
 
 void cyanrip_immediate_stop_encoding(cyanrip_ctx *ctx, cyanrip_track *t);
 int cyanrip_reset_encoding(cyanrip_ctx *ctx, cyanrip_track *t);
@@ -44,7 +49,19 @@ int cyanrip_finalize_encoding(cyanrip_ctx *ctx, cyanrip_track *t);
 int cyanrip_initialize_ebur128(cyanrip_ctx *ctx);
 int cyanrip_finalize_ebur128(cyanrip_ctx *ctx, int log);
 
-int cyanrip_writeout_track(cyanrip_ctx *ctx, cyanrip_enc_ctx *enc_ctx);
+/* Waits for the files of a ripped or restored track to be written, then
+ * overwrites the placeholder ReplayGain values in them with those in its
+ * metadata */
+int cyanrip_update_replaygain(cyanrip_ctx *ctx, cyanrip_track *t);
+
+/* Returns 1 once all of a track's files have been written, 0 if that's still
+ * underway, or the error that stopped it. Never blocks. */
+int cyanrip_track_encoding_done(cyanrip_ctx *ctx, cyanrip_track *t);
 
+/* Returns 1 if the file was completely written, 0 if not (cancelled), or
+ * the error that stopped it */
 int cyanrip_end_track_encoding(cyanrip_enc_ctx **s);
 void cyanrip_free_dec_ctx(cyanrip_ctx *ctx, cyanrip_dec_ctx **s);
+
+/* Once all of the tracks' encoders have ended */
+void cyanrip_free_enc_cache(cyanrip_ctx *ctx);
@@ -21,6 +21,7 @@
 #include <pthread.h>
 
 #include <libavutil/avutil.h>
+#include <libavutil/bprint.h>
 #include <libavutil/sha512.h>
 #include <libavutil/base64.h>
 
@@ -88,6 +89,14 @@ void cyanrip_log_track_end(cyanrip_ctx *ctx, cyanrip_track *t)
             cyanrip_log(ctx, 0, "\n");
     }
 
+    if (ctx->settings.rip_strategy == CRIP_STRATEGY_BURST && t->computed_crcs) {
+        cyanrip_log(ctx, 0, "  Rip strategy:  %s\n",
+                    t->strategy == CRIP_TRACK_BURST ? "burst (verified by AccurateRip)" :
+                    t->strategy == CRIP_TRACK_BURST_RERIPPED ? "secure (burst rip not verified by AccurateRip)" :
+                    t->strategy == CRIP_TRACK_SECURE_NO_AR ? "secure (not in AccurateRip database)" :
+                    "secure");
+    }
+
     cyanrip_log(ctx, 0, "\n  Properties:\n");
 
     if (t->track_is_data) {
@@ -104,6 +113,12 @@ void cyanrip_log_track_end(cyanrip_ctx *ctx, cyanrip_track *t)
     cyanrip_log(ctx, 0, "    Samples:     %u\n", t->nb_samples);
     cyanrip_log(ctx, 0, "    Frames:      %u\n", t->end_lsn_sig - t->start_lsn_sig + 1);
     cyanrip_log(ctx, 0, "    Sample peak: %.6f\n", t->sample_peak_rel_amp);
+    if (t->read_stats.sectors)
+        cyanrip_log(ctx, 0, "    Read buffer: %.1f sectors on average (max %i), "
+                    "drive waited %" PRId64 " times, processing waited %" PRId64 " times\n",
+                    (double)t->read_stats.depth_sum / t->read_stats.sectors,
+                    t->read_stats.max_depth, t->read_stats.reader_waits,
+                    t->read_stats.consumer_waits);
 
     print_offsets(ctx, t);
 
@@ -111,7 +126,10 @@ void cyanrip_log_track_end(cyanrip_ctx *ctx, cyanrip_track *t)
 
     if (t->computed_crcs) {
         cyanrip_log(ctx, 0, "\n  EAC CRC32:     %08X", t->eac_crc);
-        if (t->total_repeats)
+        if (t->total_repeats && ctx->settings.ripping_retries)
+            cyanrip_log(ctx, 0, " (after %i rips, %i sectors re-read, %i unmatched)\n",
+                        t->total_repeats, t->reread_sectors, t->disputed_sectors);
+        else if (t->total_repeats)
             cyanrip_log(ctx, 0, " (after %i rips)\n", t->total_repeats);
         else
             cyanrip_log(ctx, 0, "\n");
@@ -253,6 +271,10 @@ void cyanrip_log_start_report(cyanrip_ctx *ctx)
         cyanrip_log(ctx, 0, "Paranoia level: %s\n", "none");
     else
         cyanrip_log(ctx, 0, "Paranoia level: %i\n", ctx->settings.paranoia_level);
+    if (ctx->image)
+        cyanrip_log(ctx, 0, "Image access:   mapped, read without paranoia\n");
+    if (ctx->settings.rip_strategy == CRIP_STRATEGY_BURST)
+        cyanrip_log(ctx, 0, "Rip strategy:   burst, secure re-rip if not AccurateRip verified\n");
     cyanrip_log(ctx, 0, "Frame retries:  %i\n", ctx->settings.max_retries);
     cyanrip_log(ctx, 0, "HDCD decoding:  %s\n", ctx->settings.decode_hdcd ? "enabled" : "disabled");
 
@@ -316,8 +338,7 @@ void cyanrip_log_finish_report(cyanrip_ctx *ctx)
         for (int i = 0; i < ctx->nb_tracks; i++) {
             cyanrip_track *t = &ctx->tracks[i];
             if (t->ar_db_status == CYANRIP_ACCUDB_FOUND) {
-                if ((crip_find_ar(t, t->acurip_checksum_v1, 0) > 0) ||
-                    (crip_find_ar(t, t->acurip_checksum_v2, 0) > 0))
+                if (crip_ar_verified(t))
                     accurip_verified++;
                 else if (crip_find_ar(t, t->acurip_checksum_v1_450, 1) > (3*(t->ar_db_max_confidence+1)/4) &&
                          t->acurip_checksum_v1_450)
@@ -328,6 +349,38 @@ void cyanrip_log_finish_report(cyanrip_ctx *ctx)
         if (accurip_partial)
             cyanrip_log(ctx, 0, "Tracks ripped partially accurately: %i/%i\n",
                         accurip_partial, ctx->nb_tracks - accurip_verified);
+
+        int pressing = 0;
+        for (int i = 0; i < ctx->nb_tracks; i++)
+            pressing += !!ctx->tracks[i].nb_pressing_matches;
+        if (pressing) {
+            cyanrip_log(ctx, 0, "Tracks matching another pressing: %i/%i\n",
+                        pressing, ctx->nb_tracks - accurip_verified);
+            for (int i = 0; i < ctx->nb_tracks; i++) {
+                cyanrip_track *t = &ctx->tracks[i];
+                if (!t->nb_pressing_matches)
+                    continue;
+                cyanrip_log(ctx, 0, "  Track %i at offset", t->number);
+                for (int j = 0; j < t->nb_pressing_matches; j++) {
+                    CRIPPressingMatch *m = &t->pressing_matches[j];
+                    cyanrip_log(ctx, 0, "%s %c%i (confidence %i%s)", j ? "," : "",
+                                m->offset >= 0 ? '+' : '-', abs(m->offset), m->confidence,
+                                m->partial ? ", 450th sector only" : "");
+                }
+                cyanrip_log(ctx, 0, "\n");
+            }
+        }
+        if (ctx->settings.rip_strategy == CRIP_STRATEGY_BURST) {
+            int burst = 0, reripped = 0;
+            for (int i = 0; i < ctx->nb_tracks; i++) {
+                burst    += ctx->tracks[i].strategy == CRIP_TRACK_BURST;
+                reripped += ctx->tracks[i].strategy == CRIP_TRACK_BURST_RERIPPED;
+            }
+            cyanrip_log(ctx, 0, "Tracks accepted from burst rips: %i/%i", burst, ctx->nb_tracks);
+            if (reripped)
+                cyanrip_log(ctx, 0, " (%i re-ripped securely)", reripped);
+            cyanrip_log(ctx, 0, "\n");
+        }
         cyanrip_log(ctx, 0, "\n");
     }
 
@@ -335,14 +388,14 @@ void cyanrip_log_finish_report(cyanrip_ctx *ctx)
     cyanrip_log(ctx, 0, "Paranoia status counts:\n");
 
 #define PCHECK(PROP)                                                           \
-    if (paranoia_status[PARANOIA_CB_ ## PROP]) {                               \
+    if (ctx->paranoia_status[PARANOIA_CB_ ## PROP]) {                          \
         const char *pstr = "  " #PROP ": ";                                  \
         cyanrip_log(ctx, 0, "%s", pstr);                                       \
         int padding = strlen("  FIXUP_DROPPED: ") - strlen(pstr);            \
         for (int i = 0; i < padding; i++)                                      \
             cyanrip_log(ctx, 0, " ");                                          \
-        cyanrip_log(ctx, 0, "%lu\n", paranoia_status[PARANOIA_CB_ ## PROP]);   \
-        has_status |= !!paranoia_status[PARANOIA_CB_ ## PROP];                 \
+        cyanrip_log(ctx, 0, "%lu\n", ctx->paranoia_status[PARANOIA_CB_ ## PROP]); \
+        has_status |= !!ctx->paranoia_status[PARANOIA_CB_ ## PROP];            \
     }
 
     PCHECK(READ)
@@ -365,6 +418,12 @@ void cyanrip_log_finish_report(cyanrip_ctx *ctx)
 
 #undef PCHECK
 
+    if (ctx->media_poll_interval)
+        cyanrip_log(ctx, 0, "Media change polls: %i (every %i ms), changes: %i\n",
+                    atomic_load(&ctx->media_polls), ctx->media_poll_interval,
+                    atomic_load(&ctx->media_changes));
+    else
+        cyanrip_log(ctx, 0, "Media change polls: none (unsupported by the drive)\n");
     cyanrip_log(ctx, 0, "Ripping errors: %i\n", ctx->total_error_count);
     cyanrip_log(ctx, 0, "Ripping finished at %s\n", t_s);
 }
@@ -434,48 +493,95 @@ fail:
     av_free(shactx);
 }
 
-static cyanrip_ctx *av_global_ctx = NULL;
+static int av_capture_users = 0;
 static int av_max_log_level = AV_LOG_QUIET;
 static pthread_mutex_t log_lock = PTHREAD_MUTEX_INITIALIZER;
 
-static void av_log_capture(void *ptr, int lvl, const char *format,
-                           va_list args)
+static pthread_key_t thread_ctx_key;
+static pthread_once_t thread_ctx_once = PTHREAD_ONCE_INIT;
+
+static void thread_ctx_key_init(void)
 {
-    pthread_mutex_lock(&log_lock);
+    pthread_key_create(&thread_ctx_key, NULL);
+}
 
-    if (lvl > av_max_log_level)
-        goto end;
+void cyanrip_set_thread_ctx(cyanrip_ctx *ctx)
+{
+    pthread_once(&thread_ctx_once, thread_ctx_key_init);
+    pthread_setspecific(thread_ctx_key, ctx);
+}
+
+cyanrip_ctx *cyanrip_get_thread_ctx(void)
+{
+    pthread_once(&thread_ctx_once, thread_ctx_key_init);
+    return pthread_getspecific(thread_ctx_key);
+}
 
-    if (av_global_ctx) {
-        for (int i = 0; i < av_global_ctx->settings.outputs_num; i++) {
-            if (!av_global_ctx->logfile[i])
+/* Must be called with the log lock held */
+static void log_print(cyanrip_ctx *ctx, const char *format, va_list args)
+{
+    if (ctx) {
+        for (int i = 0; i < ctx->settings.outputs_num; i++) {
+            if (!ctx->logfile[i])
                 continue;
 
             va_list args2;
             va_copy(args2, args);
-            vfprintf(av_global_ctx->logfile[i], format, args2);
+            vfprintf(ctx->logfile[i], format, args2);
             va_end(args2);
         }
     }
 
-    vprintf(format, args);
+    if (!ctx || !ctx->log_prefix[0]) {
+        vprintf(format, args);
+        return;
+    }
+
+    /* Lines from several drives get interleaved, so say whose each one is */
+    AVBPrint buf;
+    av_bprint_init(&buf, 0, AV_BPRINT_SIZE_UNLIMITED);
+    av_vbprintf(&buf, format, args);
+
+    for (const char *str = buf.str; *str;) {
+        size_t len = strcspn(str, "\r\n");
+        if (len && ctx->log_line_start)
+            fputs(ctx->log_prefix, stdout);
+        fwrite(str, 1, len, stdout);
+        str += len;
+
+        if (*str) {
+            fputc(*str++, stdout);
+            ctx->log_line_start = 1;
+        } else if (len) {
+            ctx->log_line_start = 0;
+        }
+    }
+
+    av_bprint_finalize(&buf, NULL);
+}
+
+static void av_log_capture(void *ptr, int lvl, const char *format,
+                           va_list args)
+{
+    pthread_mutex_lock(&log_lock);
+
+    if (lvl <= av_max_log_level)
+        log_print(cyanrip_get_thread_ctx(), format, args);
 
-end:
     pthread_mutex_unlock(&log_lock);
 }
 
-void cyanrip_set_av_log_capture(cyanrip_ctx *ctx, int enable,
-                                int max_av_lvl)
+void cyanrip_set_av_log_capture(int enable, int max_av_lvl)
 {
     pthread_mutex_lock(&log_lock);
 
+    /* Several drives may want the capture at once */
     if (enable) {
-        av_global_ctx = ctx;
         av_max_log_level = max_av_lvl;
-        av_log_set_callback(av_log_capture);
-    } else {
+        if (!av_capture_users++)
+            av_log_set_callback(av_log_capture);
+    } else if (!--av_capture_users) {
         av_log_set_callback(av_log_default_callback);
-        av_global_ctx = NULL;
         av_max_log_level = AV_LOG_QUIET;
     }
 
@@ -489,22 +595,24 @@ void cyanrip_log(cyanrip_ctx *ctx, int verbose, const char *format, ...)
     va_list args;
     va_start(args, format);
 
-    if (ctx) {
-        for (int i = 0; i < ctx->settings.outputs_num; i++) {
-            if (!ctx->logfile[i])
-                continue;
-
-            va_list args2;
-            va_copy(args2, args);
-            vfprintf(ctx->logfile[i], format, args2);
-            va_end(args2);
-        }
-    }
-
-    vprintf(format, args);
+    log_print(ctx, format, args);
     fflush(stdout);
 
     va_end(args);
 
     pthread_mutex_unlock(&log_lock);
 }
+
+void cyanrip_log_progress(cyanrip_ctx *ctx, int redraw, const char *line)
+{
+    pthread_mutex_lock(&log_lock);
+
+    if (redraw)
+        fputc('\r', stdout);
+    fputs(ctx->log_prefix, stdout);
+    fputs(line, stdout);
+    ctx->log_line_start = 0;
+    fflush(stdout);
+
+    pthread_mutex_unlock(&log_lock);
+}
@@ -27,7 +27,16 @@ void cyanrip_log_start_report(cyanrip_ctx *ctx);
 void cyanrip_log_finish_report(cyanrip_ctx *ctx);
 void cyanrip_log_track_end(cyanrip_ctx *ctx, cyanrip_track *t);
 
-void cyanrip_set_av_log_capture(cyanrip_ctx *ctx, int enable,
-                                int max_av_lvl);
+/* FFmpeg messages go to the logs of the thread's context */
+void cyanrip_set_av_log_capture(int enable, int max_av_lvl);
+
+/* Sets the context of the disc the calling thread works on, which messages
+ * without one (FFmpeg's, paranoia's status callbacks) get attributed to */
+void cyanrip_set_thread_ctx(cyanrip_ctx *ctx);
+cyanrip_ctx *cyanrip_get_thread_ctx(void);
 
 void cyanrip_log(cyanrip_ctx *ctx, int verbose, const char *format, ...);
+
+/* Terminal only. Prints a whole progress line for the drive, over the last
+ * one if redraw is set. */
+void cyanrip_log_progress(cyanrip_ctx *ctx, int redraw, const char *line);
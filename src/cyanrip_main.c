@@ -17,6 +17,7 @@
  */
 
 #include <time.h>
+#include <stdarg.h>
 #include <sys/stat.h>
 
 #ifdef _WIN32
@@ -26,6 +27,8 @@
 #include <libavutil/bprint.h>
 #include <libavutil/avstring.h>
 #include <libavutil/time.h>
+#include <libavutil/cpu.h>
+#include <curl/curl.h>
 
 #include "cyanrip_main.h"
 #include "cyanrip_log.h"
@@ -39,6 +42,19 @@
 #include "accurip.h"
 #include "os_compat.h"
 #include "cyanrip_encode.h"
+#include "enc_pool.h"
+#include "reader.h"
+#include "vote.h"
+#include "offset.h"
+#include "pressing.h"
+#include "journal.h"
+#include "loudness.h"
+#include "replaygain.h"
+#include "monitor.h"
+#include "image.h"
+#include "batch.h"
+#include "archive.h"
+#include "fetch.h"
 
 static char cyanrip_helpstr[128];
 
@@ -54,7 +70,10 @@ static int genopt_nb_vals(GenOpt *opts_list, int n, const char *name)
     return 0;
 }
 
-int quit_now = 0;
+/* Every drive being ripped stops on SIGINT, so the handler needs this */
+static CRIPShared crip_shared;
+
+#define CRIP_MAX_DRIVES 16
 
 const cyanrip_out_fmt crip_fmt_info[] = {
     [CYANRIP_FORMAT_FLAC]     = { "flac",     "FLAC", "flac",  "flac",  1, 11, 1, AV_CODEC_ID_FLAC,      },
@@ -72,14 +91,9 @@ const cyanrip_out_fmt crip_fmt_info[] = {
     [CYANRIP_FORMAT_PCM]      = { "pcm",      "PCM",  "pcm",   "s16le", 0,  0, 1, AV_CODEC_ID_NONE,      },
 };
 
-static int get_media_changed(CdIo_t *cdio) {
-    const int ret = cdio_get_media_changed(cdio);
-    return ret != 0 && ret != DRIVER_OP_UNSUPPORTED;
-}
-
 static void free_track(cyanrip_ctx *ctx, cyanrip_track *t)
 {
-    if (quit_now)
+    if (crip_quit(ctx))
         cyanrip_immediate_stop_encoding(ctx, t);
 
     for (int i = 0; i < ctx->settings.outputs_num; i++)
@@ -90,6 +104,8 @@ static void free_track(cyanrip_ctx *ctx, cyanrip_track *t)
     crip_free_art(&t->art);
     av_dict_free(&t->meta);
     av_free(t->ar_db_entries);
+    av_freep(&t->loudness);
+    crip_pressing_free(&t->pressing);
 }
 
 static void cyanrip_ctx_end(cyanrip_ctx **s)
@@ -99,27 +115,42 @@ static void cyanrip_ctx_end(cyanrip_ctx **s)
         return;
     ctx = *s;
 
+    /* Only left open if ripping stopped early */
+    crip_archive_close(&ctx->archive);
+    crip_accurip_free(ctx);
+    crip_reader_spin_up_wait(ctx);
+
     for (int i = 0; i < ctx->nb_tracks; i++)
         free_track(ctx, &ctx->tracks[i]);
+    cyanrip_free_enc_cache(ctx);
 
     for (int i = 0; i < ctx->nb_cover_arts; i++)
         crip_free_art(&ctx->cover_arts[i]);
 
     cyanrip_finalize_ebur128(ctx, 0);
     av_free(ctx->mb_submission_url);
+    crip_naming_free(ctx);
 
+    crip_monitor_stop(&ctx->monitor);
+
+    crip_reader_stream_stop(ctx);
+    crip_image_close(&ctx->image);
     if (ctx->paranoia)
         cdio_paranoia_free(ctx->paranoia);
     if (ctx->drive)
         cdio_cddap_close_no_free_cdio(ctx->drive);
     if (ctx->settings.eject_on_success_rip && !ctx->total_error_count &&
-        (ctx->mcap & CDIO_DRIVE_CAP_MISC_EJECT) && ctx->cdio && !quit_now)
+        (ctx->mcap & CDIO_DRIVE_CAP_MISC_EJECT) && ctx->cdio && !crip_quit(ctx))
         cdio_eject_media(&ctx->cdio);
     else if (ctx->cdio)
         cdio_destroy(ctx->cdio);
 
     free(ctx->settings.dev_path);
     av_dict_free(&ctx->meta);
+
+    if (cyanrip_get_thread_ctx() == ctx)
+        cyanrip_set_thread_ctx(NULL);
+
     av_freep(&ctx);
 
     *s = NULL;
@@ -164,17 +195,20 @@ static CdIo_t *cyanrip_open_dev(const char *dev_path)
     return cdio_open(dev_path, DRIVER_UNKNOWN);
 }
 
-static int cyanrip_ctx_init(cyanrip_ctx **s, cyanrip_settings *settings)
+static int cyanrip_ctx_init(cyanrip_ctx **s, cyanrip_settings *settings,
+                            CRIPShared *shared, const char *log_prefix)
 {
     cyanrip_ctx *ctx = av_mallocz(sizeof(cyanrip_ctx));
 
     memcpy(&ctx->settings, settings, sizeof(cyanrip_settings));
+    ctx->shared = shared;
+    av_strlcpy(ctx->log_prefix, log_prefix, sizeof(ctx->log_prefix));
+    ctx->log_line_start = 1;
+    cyanrip_set_thread_ctx(ctx);
 
     if (ctx->settings.print_info_only)
         ctx->settings.eject_on_success_rip = 0;
 
-    cdio_init();
-
     if (!ctx->settings.dev_path) {
         ctx->settings.dev_path = cdio_get_default_device(NULL);
         if (!ctx->settings.dev_path) {
@@ -307,6 +341,13 @@ static int cyanrip_ctx_init(cyanrip_ctx **s, cyanrip_settings *settings)
         }
     }
 
+    /* Images whose sectors are stored contiguously get read directly */
+    ret = crip_image_open(ctx, &ctx->image);
+    if (ret < 0) {
+        cyanrip_ctx_end(&ctx);
+        return ret;
+    }
+
     for (int i = 0; i < ctx->nb_cd_tracks; i++) {
         cyanrip_track *t = &ctx->tracks[i];
         if (t->track_is_data)
@@ -323,56 +364,29 @@ static int cyanrip_ctx_init(cyanrip_ctx **s, cyanrip_settings *settings)
         break;
     }
 
-    /* For hot removal detection - init this so we can detect changes */
-    get_media_changed(ctx->cdio);
+    /* For hot removal detection */
+    ret = crip_monitor_start(ctx, &ctx->monitor);
+    if (ret < 0) {
+        cyanrip_log(ctx, 0, "Unable to start the drive monitor: %s!\n", av_err2str(ret));
+        cyanrip_ctx_end(&ctx);
+        return ret;
+    }
 
     *s = ctx;
     return 0;
 }
 
-#define REPLAYGAIN_REF_LOUDNESS (-18.0)
-
-static int crip_replaygain_meta_track(cyanrip_ctx *ctx, cyanrip_track *t)
+static void crip_replaygain_meta_track(cyanrip_track *t)
 {
-    char temp[32];
-
-    snprintf(temp, sizeof(temp), "%.2f dB", REPLAYGAIN_REF_LOUDNESS - t->ebu_integrated);
-    av_dict_set(&t->meta, "REPLAYGAIN_TRACK_GAIN", temp, 0);
-
-    av_dict_set_int(&t->meta, "R128_TRACK_GAIN", lrintf((REPLAYGAIN_REF_LOUDNESS - t->ebu_integrated + 5) * 256), 0);
-
-    snprintf(temp, sizeof(temp), "%.2f dB", t->ebu_range);
-    av_dict_set(&t->meta, "REPLAYGAIN_TRACK_RANGE", temp, 0);
-
-    snprintf(temp, sizeof(temp), "%.6f", powf(10, t->ebu_true_peak / 20.0));
-    av_dict_set(&t->meta, "REPLAYGAIN_TRACK_PEAK", temp, 0);
-
-    snprintf(temp, sizeof(temp), "%.2f LUFS", REPLAYGAIN_REF_LOUDNESS);
-    av_dict_set(&t->meta, "REPLAYGAIN_REFERENCE_LOUDNESS", temp, 0);
-
-    return 0;
+    crip_replaygain_meta(&t->meta, "TRACK", t->ebu_integrated,
+                         t->ebu_range, t->ebu_true_peak);
 }
 
-static int crip_replaygain_meta_album(cyanrip_ctx *ctx)
+static void crip_replaygain_meta_album(cyanrip_ctx *ctx)
 {
-    char temp[32];
-
-    for (int i = 0; i < ctx->nb_cd_tracks; i++) {
-        cyanrip_track *t = &ctx->tracks[i];
-
-        snprintf(temp, sizeof(temp), "%.2f dB", REPLAYGAIN_REF_LOUDNESS - ctx->ebu_integrated);
-        av_dict_set(&t->meta, "REPLAYGAIN_ALBUM_GAIN", temp, 0);
-
-        av_dict_set_int(&t->meta, "R128_ALBUM_GAIN", lrintf((REPLAYGAIN_REF_LOUDNESS - ctx->ebu_integrated + 5) * 256), 0);
-
-        snprintf(temp, sizeof(temp), "%.2f dB", ctx->ebu_range);
-        av_dict_set(&t->meta, "REPLAYGAIN_ALBUM_RANGE", temp, 0);
-
-        snprintf(temp, sizeof(temp), "%.6f", powf(10, ctx->ebu_true_peak / 20.0));
-        av_dict_set(&t->meta, "REPLAYGAIN_ALBUM_PEAK", temp, 0);
-    }
-
-    return 0;
+    for (int i = 0; i < ctx->nb_cd_tracks; i++)
+        crip_replaygain_meta(&ctx->tracks[i].meta, "ALBUM", ctx->ebu_integrated,
+                             ctx->ebu_range, ctx->ebu_true_peak);
 }
 
 static void crip_fill_mcn(cyanrip_ctx *ctx)
@@ -411,170 +425,196 @@ static void copy_album_to_track_meta(cyanrip_ctx *ctx)
 
 static const uint8_t silent_frame[CDIO_CD_FRAMESIZE_RAW] = { 0 };
 
-uint64_t paranoia_status[PARANOIA_CB_FINISHED + 1] = { 0 };
+typedef struct CRIPOffsetTrack {
+    CRIPOffsetSearch *search;
+    uint8_t *mem;
+    int range; /* Sectors loaded on either side of the 450th */
+} CRIPOffsetTrack;
 
-static void status_cb(long int n, paranoia_cb_mode_t status)
+static int read_offset_sectors(cyanrip_ctx *ctx, uint8_t *dst, lsn_t start, int nb)
 {
-    if (status >= PARANOIA_CB_READ && status <= PARANOIA_CB_FINISHED)
-        paranoia_status[status]++;
+    if (ctx->image) {
+        for (int i = 0, n; i < nb; i += n) {
+            n = nb - i;
+            const uint8_t *src = crip_image_sectors(ctx->image, start + i, &n);
+            if (src)
+                memcpy(dst + (size_t)i*CDIO_CD_FRAMESIZE_RAW, src, (size_t)n*CDIO_CD_FRAMESIZE_RAW);
+            else
+                memset(dst + (size_t)i*CDIO_CD_FRAMESIZE_RAW, 0, (size_t)n*CDIO_CD_FRAMESIZE_RAW);
+        }
+        return 0;
+    }
+
+    cdio_paranoia_seek(ctx->paranoia, start, SEEK_SET);
+    for (int i = 0; i < nb; i++) {
+        int err;
+        const uint8_t *data = crip_read_frame(ctx, &err);
+        ctx->total_error_count += err;
+        memcpy(dst + i*CDIO_CD_FRAMESIZE_RAW, data, CDIO_CD_FRAMESIZE_RAW);
+        if (atomic_load(&ctx->media_changed)) {
+            cyanrip_log(ctx, 0, "Drive media changed, stopping!\n");
+            return AVERROR(EINVAL);
+        } else if (crip_quit(ctx)) {
+            cyanrip_log(ctx, 0, "Stopping, offset finding incomplete!\n");
+            return AVERROR_EXIT;
+        }
+    }
+
+    return 0;
 }
 
-static const uint8_t *cyanrip_read_frame(cyanrip_ctx *ctx)
+/* Grows the data loaded around the 450th sector to range, only reading
+ * the sectors which haven't been already */
+static int load_offset_data(cyanrip_ctx *ctx, CRIPOffsetTrack *ot, lsn_t center,
+                            int range)
 {
-    int err = 0;
-    char *msg = NULL;
+    int ret, old = ot->range, grow = range - old;
 
-    const uint8_t *data;
-    data = (void *)cdio_paranoia_read_limited(ctx->paranoia, &status_cb,
-                                              ctx->settings.max_retries);
+    uint8_t *mem = av_malloc((size_t)2*range*CDIO_CD_FRAMESIZE_RAW);
+    if (!mem)
+        return AVERROR(ENOMEM);
 
-    msg = cdio_cddap_errors(ctx->drive);
-    if (msg) {
-        cyanrip_log(ctx, 0, "\ncdio error: %s\n", msg);
-        cdio_cddap_free_messages(msg);
-        err = 1;
-    }
+    ret = read_offset_sectors(ctx, mem, center - range, grow);
+    if (ret < 0)
+        goto fail;
 
-    if (!data) {
-        if (!msg) {
-            cyanrip_log(ctx, 0, "\nFrame read failed!\n");
-            err = 1;
-        }
-        data = silent_frame;
-    }
+    if (old)
+        memcpy(mem + (size_t)grow*CDIO_CD_FRAMESIZE_RAW, ot->mem,
+               (size_t)2*old*CDIO_CD_FRAMESIZE_RAW);
 
-    ctx->total_error_count += err;
+    ret = read_offset_sectors(ctx, mem + (size_t)(range + old)*CDIO_CD_FRAMESIZE_RAW,
+                              center + old, grow);
+    if (ret < 0)
+        goto fail;
 
-    return data;
+    av_free(ot->mem);
+    ot->mem = mem;
+    ot->range = range;
+
+    return 0;
+
+fail:
+    av_free(mem);
+    return ret;
 }
 
-static int search_for_offset(cyanrip_track *t, int *offset_found,
-                             const uint8_t *mem, int dir,
-                             int guess, int bytes)
+/* Only the entries everyone agrees on are of any use */
+static int init_offset_search(cyanrip_track *t, CRIPOffsetTrack *ot)
 {
-    if (guess) {
-        const uint8_t *start_addr = mem + guess*4;
-        uint32_t accurip_v1 = 0x0;
-        for (int j = 0; j < (CDIO_CD_FRAMESIZE_RAW >> 2); j++)
-            accurip_v1 += AV_RL32(&start_addr[j*4]) * (j + 1);
-        if (crip_find_ar(t, accurip_v1, 1) == t->ar_db_max_confidence && accurip_v1) {
-            *offset_found = guess;
-            return 1;
-        }
-    }
-
-    for (int byte_off = ((dir < 0) * 4); byte_off < bytes; byte_off += 4) {
-        if (quit_now)
-            return 0;
+    uint32_t *checksums = av_malloc_array(t->ar_db_nb_entries, sizeof(*checksums));
+    if (!checksums)
+        return AVERROR(ENOMEM);
 
-        int offset = dir * (byte_off >> 2);
-        if (guess == offset)
-            continue;
+    int nb = 0;
+    for (int i = 0; i < t->ar_db_nb_entries; i++)
+        if (t->ar_db_entries[i].confidence == t->ar_db_max_confidence)
+            checksums[nb++] = t->ar_db_entries[i].checksum_450;
 
-        const uint8_t *start_addr = mem + dir * byte_off;
-        uint32_t accurip_v1 = 0x0;
-        for (int j = 0; j < (CDIO_CD_FRAMESIZE_RAW >> 2); j++)
-            accurip_v1 += AV_RL32(&start_addr[j*4]) * (j + 1);
-        if (crip_find_ar(t, accurip_v1, 1) == t->ar_db_max_confidence && accurip_v1) {
-            *offset_found = offset;
-            return 1;
-        }
-    }
+    int ret = crip_offset_search_alloc(&ot->search, checksums, nb);
+    av_free(checksums);
 
-    return 0;
+    return ret;
 }
 
 static void search_for_drive_offset(cyanrip_ctx *ctx, int range)
 {
-    int had_ar = 0, did_check = 0;
+    int had_ar = 0, did_check = 0, stopped = 0;
     int offset_found = 0, offset_found_samples = 0;
-    uint8_t *mem = av_malloc(2 * range * CDIO_CD_FRAMESIZE_RAW);
 
     if (ctx->ar_db_status != CYANRIP_ACCUDB_FOUND)
-        goto end;
+        return;
 
-    for (int t_idx = 0; t_idx < ctx->nb_tracks; t_idx++) {
-        cyanrip_track *t = &ctx->tracks[t_idx];
-        lsn_t start = cdio_get_track_lsn(ctx->cdio, t_idx + 1);
-        lsn_t end = cdio_get_track_last_lsn(ctx->cdio, t_idx + 1);
+    CRIPOffsetTrack *tracks = av_calloc(ctx->nb_tracks, sizeof(*tracks));
+    if (!tracks)
+        return;
 
-        if (ctx->tracks[t_idx].ar_db_status != CYANRIP_ACCUDB_FOUND)
-            continue;
-        else
-            had_ar |= 1;
+    for (;; range *= 2) {
+        did_check = 0;
 
-        if ((end - start) < (450 + range))
-            continue;
+        for (int t_idx = 0; t_idx < ctx->nb_tracks; t_idx++) {
+            cyanrip_track *t = &ctx->tracks[t_idx];
+            CRIPOffsetTrack *ot = &tracks[t_idx];
+            lsn_t start = cdio_get_track_lsn(ctx->cdio, t_idx + 1);
+            lsn_t end = cdio_get_track_last_lsn(ctx->cdio, t_idx + 1);
 
-        did_check |= 1;
+            if (ctx->tracks[t_idx].ar_db_status != CYANRIP_ACCUDB_FOUND)
+                continue;
+            else
+                had_ar |= 1;
 
-        /* Set start/end ranges */
-        start += 450 - range;
-        end = start + 2*range;
+            if ((end - start) < (450 + range))
+                continue;
 
-        size_t bytes = 0;
+            did_check |= 1;
 
-        cyanrip_log(ctx, 0, "Loading data for track %i...\n", t_idx + 1);
-        cdio_paranoia_seek(ctx->paranoia, start, SEEK_SET);
-        for (int i = 0; i < 2*range; i++) {
-            const uint8_t *data = cyanrip_read_frame(ctx);
-            memcpy(mem + bytes, data, CDIO_CD_FRAMESIZE_RAW);
-            bytes += CDIO_CD_FRAMESIZE_RAW;
-            if (quit_now) {
-                cyanrip_log(ctx, 0, "Stopping, offset finding incomplete!\n");
+            int ret = 0;
+            if (!ot->search)
+                ret = init_offset_search(t, ot);
+            if (ret >= 0) {
+                cyanrip_log(ctx, 0, "Loading data for track %i...\n", t_idx + 1);
+                ret = load_offset_data(ctx, ot, start + 450, range);
+            }
+            if (ret == AVERROR(ENOMEM))
+                cyanrip_log(ctx, 0, "Error allocating memory for offset finding!\n");
+            if (ret < 0) {
+                stopped = 1;
                 goto end;
             }
-        }
 
-        int found, offset;
-        int dir = (offset_found && (offset_found_samples < 0)) ? -1 : +1;
-
-        cyanrip_log(ctx, 0, "Data loaded, searching for offsets...\n");
-
-        found = search_for_offset(t, &offset, mem + (bytes >> 1), dir, offset_found_samples,
-                                  range * CDIO_CD_FRAMESIZE_RAW);
-        if (!found)
-            found = search_for_offset(t, &offset, mem + (bytes >> 1), -dir, 0,
-                                      range * CDIO_CD_FRAMESIZE_RAW);
-
-        if (!found) {
-            cyanrip_log(ctx, 0, "Nothing found for track %i%s\n", t_idx + 1,
-                        t_idx != (ctx->nb_tracks - 1) ? ", trying another track" : "");
-        } else if (!offset_found) {
-            offset_found_samples = offset;
-            offset_found++;
-            cyanrip_log(ctx, 0, "Offset of %c%i found in track %i%s\n",
-                        offset >= 0 ? '+' : '-', abs(offset), t_idx + 1,
-                        t_idx != (ctx->nb_tracks - 1) ? ", trying to confirm with another track" : "");
-        } else if (offset_found_samples == offset) {
-            offset_found++;
-            cyanrip_log(ctx, 0, "Offset of %c%i confirmed (confidence: %i) in track %i%s\n",
-                        offset >= 0 ? '+' : '-', abs(offset), offset_found, t_idx + 1,
-                        t_idx != (ctx->nb_tracks - 1) ? ", trying to confirm with another track" : "");
-        } else {
-            cyanrip_log(ctx, 0, "New offset of %c%i found at track %i, scrapping old offset of %c%i%s\n",
-                        offset >= 0 ? '+' : '-', abs(offset), t_idx + 1,
-                        offset_found_samples >= 0 ? '+' : '-', abs(offset_found_samples),
-                        t_idx != (ctx->nb_tracks - 1) ? ", trying to confirm with another track" : "");
-            offset_found_samples = offset;
-            offset_found = 1;
+            int offset;
+            int dir = (offset_found && (offset_found_samples < 0)) ? -1 : +1;
+
+            cyanrip_log(ctx, 0, "Data loaded, searching for offsets...\n");
+
+            int found = crip_offset_search(ot->search, ot->mem, range*(CDIO_CD_FRAMESIZE_RAW >> 2),
+                                           offset_found_samples, dir, &offset);
+
+            if (!found) {
+                cyanrip_log(ctx, 0, "Nothing found for track %i%s\n", t_idx + 1,
+                            t_idx != (ctx->nb_tracks - 1) ? ", trying another track" : "");
+            } else if (!offset_found) {
+                offset_found_samples = offset;
+                offset_found++;
+                cyanrip_log(ctx, 0, "Offset of %c%i found in track %i%s\n",
+                            offset >= 0 ? '+' : '-', abs(offset), t_idx + 1,
+                            t_idx != (ctx->nb_tracks - 1) ? ", trying to confirm with another track" : "");
+            } else if (offset_found_samples == offset) {
+                offset_found++;
+                cyanrip_log(ctx, 0, "Offset of %c%i confirmed (confidence: %i) in track %i%s\n",
+                            offset >= 0 ? '+' : '-', abs(offset), offset_found, t_idx + 1,
+                            t_idx != (ctx->nb_tracks - 1) ? ", trying to confirm with another track" : "");
+            } else {
+                cyanrip_log(ctx, 0, "New offset of %c%i found at track %i, scrapping old offset of %c%i%s\n",
+                            offset >= 0 ? '+' : '-', abs(offset), t_idx + 1,
+                            offset_found_samples >= 0 ? '+' : '-', abs(offset_found_samples),
+                            t_idx != (ctx->nb_tracks - 1) ? ", trying to confirm with another track" : "");
+                offset_found_samples = offset;
+                offset_found = 1;
+            }
         }
+
+        if (offset_found || !had_ar || !did_check)
+            break;
+
+        /* What's been loaded so far gets reused */
+        cyanrip_log(ctx, 0, "Was not able to find drive offset with a radius of %i frames"
+                    ", trying again with a larger radius...\n", range);
     }
 
 end:
-    av_free(mem);
+    for (int i = 0; i < ctx->nb_tracks; i++) {
+        crip_offset_search_free(&tracks[i].search);
+        av_free(tracks[i].mem);
+    }
+    av_free(tracks);
 
-    if (!offset_found) {
-        if (!had_ar) {
+    if (stopped) {
+        return;
+    } else if (!offset_found) {
+        if (!had_ar)
             cyanrip_log(ctx, 0, "No track had AccuRip entry, cannot find offset!\n");
-        } else if (had_ar && !did_check) {
+        else
             cyanrip_log(ctx, 0, "No track was long enough, unable to find drive offset!\n");
-        } else {
-            cyanrip_log(ctx, 0, "Was not able to find drive offset with a radius of %i frames"
-                        ", trying again with a larger radius...\n", range);
-            search_for_drive_offset(ctx, 2*range);
-        }
-        return;
     } else {
         cyanrip_log(ctx, 0, "Drive offset of %c%i found (confidence: %i)!\n",
                     offset_found_samples >= 0 ? '+' : '-', abs(offset_found_samples), offset_found);
@@ -583,6 +623,8 @@ end:
 
 static void track_read_extra(cyanrip_ctx *ctx, cyanrip_track *t)
 {
+    crip_reader_lock_drive(ctx);
+
     if (!t->track_is_data) {
         /* ISRC code */
         if (!ctx->disregard_cd_isrc && (ctx->rcap & CDIO_DRIVE_CAP_READ_ISRC) && !dict_get(t->meta, "isrc")) {
@@ -612,166 +654,42 @@ static void track_read_extra(cyanrip_ctx *ctx, cyanrip_track *t)
             }
         }
     }
-}
-
-static double sample_peak_rel_amp(const uint8_t *data, const int bytes)
-{
-    const int16_t* samples = (int16_t*)data;
-    const int sample_num = bytes / 2;
-
-    int sample_peak = 0;
-    for (int i = 0; i < sample_num; ++i) {
-        sample_peak = FFMAX(sample_peak, abs(samples[i]));
-    }
 
-    /* The greatest sample absolute value is abs(INT16_MIN) = 32768 */
-    return (double)sample_peak/32768.0;
+    crip_reader_unlock_drive(ctx);
 }
 
-static int cyanrip_rip_track(cyanrip_ctx *ctx, cyanrip_track *t)
-{
-    int ret = 0;
-    int line_len = 0;
-    int max_line_len = 0;
+typedef struct CRIPProgress {
     char line[4096];
+    int line_len;
+    int max_line_len;
+    int start_err;
+    int64_t last_read;
+} CRIPProgress;
+
+/* Prints the progress line. If nb sectors were just read, an ETA gets
+ * printed too, with pending sectors to read on top of the rest of the disc. */
+static void print_progress(cyanrip_ctx *ctx, CRIPProgress *p, int nb, int pending,
+                           const char *fmt, ...)
+{
+    va_list args;
+    int redraw = p->line_len > 0;
 
-    if (t->track_is_data) {
-        cyanrip_log(ctx, 0, "Track %i is data:\n", t->number);
-        cyanrip_log_track_end(ctx, t);
-        cyanrip_cue_track(ctx, t);
-        return 0;
-    }
-
-    /* Set creation time at the start of ripping */
-    track_set_creation_time(ctx, t);
-
-    uint32_t start_frames_read;
-    uint32_t *last_checksums = NULL;
-    uint32_t nb_last_checksums = 0;
-    uint32_t repeat_mode_encode = 0;
-    uint32_t total_repeats = 0;
-    int calc_global_peak_set = 0;
-    int calc_global_peak = !ctx->settings.ripping_retries;
-repeat_ripping:;
-    const int frames_before_disc_start = t->frames_before_disc_start;
-    const int frames = t->frames;
-    const int frames_after_disc_end = t->frames_after_disc_end;
-    const ptrdiff_t offs = t->partial_frame_byte_offs;
-    start_frames_read = ctx->frames_read;
-
-    cdio_paranoia_seek(ctx->paranoia, t->start_lsn, SEEK_SET);
-
-    int start_err = ctx->total_error_count;
-
-    /* Checksum */
-    cyanrip_checksum_ctx checksum_ctx;
-    crip_init_checksum_ctx(ctx, &checksum_ctx, t);
-
-    /* Reset sample peak for this attempt - a bad sample from a discarded
-     * (non-matching) repeat ripping pass must not stick around forever. */
-    t->sample_peak_rel_amp = 0.0;
-
-    /* Fill with silence to maintain track length */
-    for (int i = 0; i < frames_before_disc_start; i++) {
-        int bytes = CDIO_CD_FRAMESIZE_RAW;
-        const uint8_t *data = silent_frame;
-
-        if (!i && offs) {
-            data += CDIO_CD_FRAMESIZE_RAW + offs;
-            bytes = -offs;
-        }
-
-        crip_process_checksums(&checksum_ctx, data, bytes);
-
-        if (!ctx->settings.ripping_retries || repeat_mode_encode) {
-            ret = cyanrip_send_pcm_to_encoders(ctx, t->enc_ctx, ctx->settings.outputs_num,
-                                               t->dec_ctx, data, bytes, calc_global_peak);
-            if (ret) {
-                cyanrip_log(ctx, 0, "Error in decoding/sending frame: %s\n", av_err2str(ret));
-                goto fail;
-            }
-        }
-    }
-
-    int64_t frame_last_read = av_gettime_relative();
-
-    /* Read the actual CD data */
-    for (int i = 0; i < frames; i++) {
-        /* Detect disc removals */
-        if (get_media_changed(ctx->cdio)) {
-            cyanrip_log(ctx, 0, "\nDrive media changed, stopping!\n");
-            ret = AVERROR(EINVAL);
-            goto fail;
-        }
-
-        /* Flush paranoia cache if overreading into lead-out - no idea why */
-        if ((t->start_lsn + i) > ctx->end_lsn)
-            cdio_paranoia_seek(ctx->paranoia, t->start_lsn + i, SEEK_SET);
-
-        int bytes = CDIO_CD_FRAMESIZE_RAW;
-        const uint8_t *data = cyanrip_read_frame(ctx);
-
-        /* Account for partial frames caused by the offset */
-        if (offs > 0) {
-            if (!i) {
-                data  += offs;
-                bytes -= offs;
-            } else if ((i == (frames - 1)) && !frames_after_disc_end) {
-                bytes = offs;
-            }
-        } else if (offs < 0) {
-            if (!i && !frames_before_disc_start) {
-                data += CDIO_CD_FRAMESIZE_RAW + offs;
-                bytes = -offs;
-            } else if (i == (frames - 1)) {
-                bytes += offs;
-            }
-        }
-
-        /* Stop now if requested */
-        if (quit_now) {
-            cyanrip_log(ctx, 0, "\nStopping, ripping incomplete!\n");
-            break;
-        }
-
-        /* Update checksums */
-        crip_process_checksums(&checksum_ctx, data, bytes);
-
-         /* Update sample peak */
-        t->sample_peak_rel_amp = FFMAX(sample_peak_rel_amp(data, bytes), t->sample_peak_rel_amp);
-
-        /* Decode and encode */
-        if (!ctx->settings.ripping_retries || repeat_mode_encode) {
-            ret = cyanrip_send_pcm_to_encoders(ctx, t->enc_ctx, ctx->settings.outputs_num,
-                                               t->dec_ctx, data, bytes, calc_global_peak);
-            if (ret < 0) {
-                cyanrip_log(ctx, 0, "\nError in decoding/sending frame: %s\n", av_err2str(ret));
-                goto fail;
-            }
-        }
-
-        if (line_len > 0) {
-            cyanrip_log(NULL, 0, "\r", line);
-            line_len = 0;
-        }
-
-        /* Report progress */
-        line_len += snprintf(line, sizeof(line),
-                             "Ripping%strack %i, progress - %0.2f%%",
-                             (!ctx->settings.ripping_retries || repeat_mode_encode) ? " and encoding " : " ",
-                             t->number, ((double)(i + 1)/frames)*100.0f);
+    p->line_len = 0;
 
-        ctx->frames_read++;
+    va_start(args, fmt);
+    p->line_len += vsnprintf(p->line, sizeof(p->line), fmt, args);
+    va_end(args);
 
+    if (nb) {
         int64_t cur_time   = av_gettime_relative();
-        int64_t frame_diff = cur_time - frame_last_read;
-        frame_last_read = cur_time;
+        int64_t frame_diff = (cur_time - p->last_read) / nb;
+        p->last_read = cur_time;
 
         int64_t diff = cr_sliding_win(&ctx->eta_ctx, frame_diff, cur_time,
                                       av_make_q(1, 1000000),
                                       1000000LL * 1200LL, 1);
 
-        int64_t seconds = (ctx->frames_to_read - ctx->frames_read) * diff;
+        int64_t seconds = (ctx->frames_to_read - ctx->frames_read + pending) * diff;
 
         int hours = 0;
         while (seconds >= (3600LL * 1000000LL)) {
@@ -798,840 +716,1064 @@ repeat_ripping:;
         }
 
         if (hours)
-            line_len += snprintf(line + line_len, sizeof(line) - line_len,
-                                 ", ETA - %ih %im", hours, minutes);
+            p->line_len += snprintf(p->line + p->line_len, sizeof(p->line) - p->line_len,
+                                    ", ETA - %ih %im", hours, minutes);
         else if (minutes)
-            line_len += snprintf(line + line_len, sizeof(line) - line_len,
-                                 ", ETA - %im", minutes);
+            p->line_len += snprintf(p->line + p->line_len, sizeof(p->line) - p->line_len,
+                                    ", ETA - %im", minutes);
         else
-            line_len += snprintf(line + line_len, sizeof(line) - line_len,
-                                 ", ETA - %" PRId64 "s", seconds);
-
-        if (ctx->total_error_count - start_err)
-            line_len += snprintf(line + line_len, sizeof(line) - line_len,
-                                 ", errors - %i", ctx->total_error_count - start_err);
-
-        max_line_len = FFMAX(line_len, max_line_len);
-        if (line_len < max_line_len) {
-            for (int c = line_len; c < max_line_len; c++)
-                line_len += snprintf(line + line_len, sizeof(line) - line_len, " ");
-        }
-
-        cyanrip_log(NULL, 0, "%s", line);
+            p->line_len += snprintf(p->line + p->line_len, sizeof(p->line) - p->line_len,
+                                    ", ETA - %" PRId64 "s", seconds);
     }
 
-    /* Fill with silence to maintain track length */
-    for (int i = 0; i < frames_after_disc_end; i++) {
-        int bytes = CDIO_CD_FRAMESIZE_RAW;
-        const uint8_t *data = silent_frame;
-
-        if ((i == (frames_after_disc_end - 1)) && offs)
-            bytes = offs;
-
-        crip_process_checksums(&checksum_ctx, data, bytes);
+    if (ctx->total_error_count - p->start_err)
+        p->line_len += snprintf(p->line + p->line_len, sizeof(p->line) - p->line_len,
+                                ", errors - %i", ctx->total_error_count - p->start_err);
 
-        if (!ctx->settings.ripping_retries || repeat_mode_encode) {
-            ret = cyanrip_send_pcm_to_encoders(ctx, t->enc_ctx, ctx->settings.outputs_num,
-                                               t->dec_ctx, data, bytes, calc_global_peak);
-            if (ret < 0) {
-                cyanrip_log(ctx, 0, "Error in decoding/sending frame: %s\n", av_err2str(ret));
-                goto fail;
-            }
-        }
+    p->max_line_len = FFMAX(p->line_len, p->max_line_len);
+    if (p->line_len < p->max_line_len) {
+        for (int c = p->line_len; c < p->max_line_len; c++)
+            p->line_len += snprintf(p->line + p->line_len, sizeof(p->line) - p->line_len, " ");
     }
 
-    calc_global_peak = 0;
+    cyanrip_log_progress(ctx, redraw, p->line);
+}
 
-    crip_finalize_checksums(&checksum_ctx, t);
+/* Repeat ripping. Every pass reads only the sectors which have not yet been
+ * read identically ripping_retries + 1 times, everything else stays put. */
+static int vote_track(cyanrip_ctx *ctx, cyanrip_track *t, CRIPVote *vote,
+                      CRIPProgress *p)
+{
+    int ret = 0;
+    CRIPReader *reader = NULL;
+    const int votes_needed = ctx->settings.ripping_retries + 1;
+    int pass;
 
-    if (ctx->settings.ripping_retries) {
-        int matches = 0;
-        for (int i = 0; i < nb_last_checksums; i++)
-            matches += last_checksums[i] == checksum_ctx.eac_crc;
+    t->reread_sectors = 0;
 
-        total_repeats++;
-        if (matches >= ctx->settings.ripping_retries) {
-            cyanrip_log(ctx, 0, "\nDone; (%i out of %i matches for current checksum %08X)\n",
-                        matches, ctx->settings.ripping_retries, checksum_ctx.eac_crc);
-            goto finalize_ripping;
+    for (pass = 0;; pass++) {
+        int disputed = crip_vote_disputed(vote);
+        if (!disputed) {
+            cyanrip_log(ctx, 0, "\nDone; (all sectors matched %i times)\n", votes_needed);
+            break;
         }
-        if (total_repeats >= ctx->settings.max_retries) {
-            cyanrip_log(ctx, 0, "\nDone; (no matches found, but hit repeat limit of %i)\n",
+        if (pass && pass >= ctx->settings.max_retries) {
+            cyanrip_log(ctx, 0, "\nDone; (%i sectors did not match %i times, but hit "
+                        "repeat limit of %i)\n", disputed, votes_needed,
                         ctx->settings.max_retries);
-            goto finalize_ripping;
+            break;
         }
 
-        /* If the next match may be the last one, start encoding */
-        if ((matches + 1) >= ctx->settings.ripping_retries ||
-            (total_repeats + 1) >= ctx->settings.max_retries) {
-            repeat_mode_encode = 1;
-            if (!calc_global_peak_set) {
-                calc_global_peak_set = 1;
-                calc_global_peak = 1;
-            }
+        /* Sum up what this pass has to read, for the progress */
+        int to_read = 0, first = -1;
+        for (int start = 0, len; (len = crip_vote_next_run(vote, &start)); start += len) {
+            first = first < 0 ? start : first;
+            to_read += len;
         }
 
-        cyanrip_log(ctx, 0, "\nRepeating ripping (%i out of %i matches for current checksum %08X)\n",
-                    matches, ctx->settings.ripping_retries, checksum_ctx.eac_crc);
-
-        last_checksums = av_realloc(last_checksums,
-                                    (nb_last_checksums + 1)*sizeof(*last_checksums));
-        if (!last_checksums) {
-            ret = AVERROR(ENOMEM);
-            goto end;
+        if (pass) {
+            cyanrip_log(ctx, 0, "\nRepeating ripping (%i sectors matched fewer than "
+                        "%i times)\n", disputed, votes_needed);
+            crip_reader_flush_cache(ctx, t->start_lsn + first);
         }
 
-        last_checksums[nb_last_checksums] = checksum_ctx.eac_crc;
-        nb_last_checksums++;
+        int done = 0;
+        for (int start = 0, len; (len = crip_vote_next_run(vote, &start)); start += len) {
+            ret = crip_reader_start(ctx, &reader, t->start_lsn + start, len,
+                                    !ctx->settings.paranoia_level);
+            if (ret < 0) {
+                cyanrip_log(ctx, 0, "Error starting reader: %s\n", av_err2str(ret));
+                goto end;
+            }
 
-        int err = cyanrip_reset_encoding(ctx, t);
-        if (err < 0) {
-            cyanrip_log(ctx, 0, "Error in encoding: %s\n", av_err2str(err));
-            ret = err;
-            goto end;
-        }
+            p->last_read = av_gettime_relative();
 
-        ctx->frames_read = start_frames_read;
-        goto repeat_ripping;
-    }
+            for (int i = 0; i < len;) {
+                const uint8_t *data, *flags;
+                int nb, read_err;
 
-finalize_ripping:
-    cyanrip_log(NULL, 0, "\nFlushing encoders...\n");
+                ret = crip_reader_get(reader, &data, &flags, &nb, &read_err);
+                if (ret == AVERROR(EINVAL)) {
+                    cyanrip_log(ctx, 0, "\nDrive media changed, stopping!\n");
+                    goto end;
+                } else if (ret < 0 || crip_quit(ctx)) {
+                    ret = 0;
+                    cyanrip_log(ctx, 0, "\nStopping, ripping incomplete!\n");
+                    goto end;
+                }
 
-    /* Flush encoders */
-    ret = cyanrip_send_pcm_to_encoders(ctx, t->enc_ctx, ctx->settings.outputs_num,
-                                       t->dec_ctx, NULL, 0, 0);
-    if (ret) {
-        cyanrip_log(ctx, 0, "Error sending flush signal to encoders: %s\n", av_err2str(ret));
-        return ret;
-    }
+                ctx->total_error_count += read_err;
 
-fail:
-    if (!ret && !quit_now) {
-        if (ctx->total_error_count - start_err)
-            cyanrip_log(ctx, 0, "Track %i ripped and encoded with errors.\n", t->number);
-        else
-            cyanrip_log(ctx, 0, "Track %i ripped and encoded successfully!\n", t->number);
+                for (int j = 0; j < nb; j++)
+                    crip_vote_add(vote, start + i + j, data + j*CDIO_CD_FRAMESIZE_RAW,
+                                  flags[j]);
+                if (ctx->archive)
+                    crip_archive_sectors_read(ctx->archive, t->start_lsn + start + i,
+                                              flags, nb);
+
+                crip_reader_release(reader, nb);
+                i += nb;
+                done += nb;
+
+                /* Only the first pass counts towards the disc */
+                if (pass)
+                    t->reread_sectors += nb;
+                else
+                    ctx->frames_read += nb;
+
+                if (pass)
+                    print_progress(ctx, p, nb, to_read - done,
+                                   "Re-reading track %i, pass %i - %0.2f%%",
+                                   t->number, pass + 1, ((double)done/to_read)*100.0f);
+                else
+                    print_progress(ctx, p, nb, 0,
+                                   "Ripping track %i, progress - %0.2f%%",
+                                   t->number, ((double)done/to_read)*100.0f);
+            }
+
+            crip_reader_stop(&reader, &t->read_stats);
+        }
     }
 
 end:
-    av_free(last_checksums);
+    crip_reader_stop(&reader, &t->read_stats);
 
-    t->total_repeats = total_repeats;
-    if (!quit_now && !ret) {
-        cyanrip_finalize_encoding(ctx, t);
-        if (ctx->settings.enable_replaygain)
-            crip_replaygain_meta_track(ctx, t);
-        cyanrip_log_track_end(ctx, t);
-        cyanrip_cue_track(ctx, t);
-    } else {
-        ctx->total_error_count++;
-    }
+    t->total_repeats = pass;
+    t->disputed_sectors = crip_vote_disputed(vote);
 
     return ret;
 }
 
-static void on_quit_signal(int signo)
+/* Checksums and encodes PCM, archiving it first if needed */
+static int send_pcm(cyanrip_ctx *ctx, cyanrip_track *t,
+                    cyanrip_checksum_ctx *checksum_ctx, const uint8_t *data, int bytes)
 {
-    if (quit_now) {
-        cyanrip_log(NULL, 0, "Force quitting\n");
-        exit(1);
+    if (ctx->archive) {
+        /* The AccurateRip multiplier counts the samples of the track so far */
+        int64_t sample = (int64_t)t->nominal_start_lsn*(CDIO_CD_FRAMESIZE_RAW >> 2) +
+                         checksum_ctx->acu_mult - 1;
+        int ret = crip_archive_write(ctx->archive, sample, data, bytes);
+        if (ret < 0)
+            return ret;
     }
-    cyanrip_log(NULL, 0, "\r\nTrying to quit\n");
-    quit_now = 1;
+
+    crip_process_checksums(checksum_ctx, data, bytes);
+
+    return cyanrip_send_pcm_to_encoders(ctx, t->enc_ctx, ctx->settings.outputs_num,
+                                        t->dec_ctx, data, bytes);
 }
 
-static void setup_track_lsn(cyanrip_ctx *ctx, cyanrip_track *t)
+/* Fills the sectors of the track beyond either end of the disc with silence */
+static int pad_track(cyanrip_ctx *ctx, cyanrip_track *t,
+                     cyanrip_checksum_ctx *checksum_ctx, int after)
 {
-    lsn_t first_frame = t->start_lsn;
-    lsn_t last_frame  = t->end_lsn;
-
-    /* Duration doesn't depend on adjustments we make to frames */
-    int frames = last_frame - first_frame + 1;
+    const ptrdiff_t offs = t->partial_frame_byte_offs;
+    const int nb = after ? t->frames_after_disc_end : t->frames_before_disc_start;
 
-    t->nb_samples = frames*(CDIO_CD_FRAMESIZE_RAW >> 2);
+    for (int i = 0; i < nb; i++) {
+        int bytes = CDIO_CD_FRAMESIZE_RAW;
+        const uint8_t *data = silent_frame;
 
-    /* Move the seek position coarsely */
-    const int extra_frames = ctx->settings.over_under_read_frames;
-    int sign = (extra_frames < 0) ? -1 : ((extra_frames > 0) ? +1 : 0);
-    first_frame += sign*FFMAX(FFABS(extra_frames) - 1, 0);
-    last_frame += sign*FFMAX(FFABS(extra_frames) - 1, 0);
+        if (!after && !i && offs) {
+            data += CDIO_CD_FRAMESIZE_RAW + offs;
+            bytes = -offs;
+        } else if (after && (i == (nb - 1)) && offs) {
+            bytes = offs;
+        }
 
-    /* Bump the lower/higher frame in the offset direction */
-    first_frame -= sign < 0;
-    last_frame  += sign > 0;
+        int ret = send_pcm(ctx, t, checksum_ctx, data, bytes);
+        if (ret < 0)
+            return ret;
+    }
 
-    /* Don't read into the lead in/out */
-    if (!ctx->settings.overread_leadinout) {
-        t->frames_before_disc_start = FFMAX(ctx->start_lsn - first_frame, 0);
-        t->frames_after_disc_end = FFMAX(last_frame - ctx->end_lsn, 0);
+    return 0;
+}
 
-        first_frame += t->frames_before_disc_start;
-        last_frame  -= t->frames_after_disc_end;
-    } else {
-        t->frames_before_disc_start = 0;
-        t->frames_after_disc_end = 0;
-    }
+/* Checksums and encodes nb sectors, the first being sector i of the track */
+static int process_sectors(cyanrip_ctx *ctx, cyanrip_track *t,
+                           cyanrip_checksum_ctx *checksum_ctx,
+                           const uint8_t *data, int i, int nb)
+{
+    const ptrdiff_t offs = t->partial_frame_byte_offs;
 
-    /* Offset accounted start/end sectors */
-    t->start_lsn = first_frame;
-    t->end_lsn = last_frame;
-    t->frames = last_frame - first_frame + 1;
+    /* Sectors get processed in bulk, only the first and last sector
+     * of the track may need slicing */
+    int bytes = nb*CDIO_CD_FRAMESIZE_RAW;
+    const int has_last = (i + nb) == t->frames && t->frames > 1;
 
-    /* Last/first frame partial offset */
-    ptrdiff_t offs = ctx->settings.offset*4;
-    offs -= sign*FFMAX(FFABS(extra_frames) - 1, 0)*CDIO_CD_FRAMESIZE_RAW;
+    /* Account for partial frames caused by the offset */
+    if (offs > 0) {
+        if (!i) {
+            data  += offs;
+            bytes -= offs;
+        }
+        if (has_last && !t->frames_after_disc_end)
+            bytes -= CDIO_CD_FRAMESIZE_RAW - offs;
+    } else if (offs < 0) {
+        if (!i && !t->frames_before_disc_start) {
+            data  += CDIO_CD_FRAMESIZE_RAW + offs;
+            bytes -= CDIO_CD_FRAMESIZE_RAW + offs;
+        }
+        if (has_last)
+            bytes += offs;
+    }
 
-    t->partial_frame_byte_offs = offs;
+    /* Update checksums and the sample peak, decode and encode */
+    return send_pcm(ctx, t, checksum_ctx, data, bytes);
 }
 
-static void setup_track_offsets_and_report(cyanrip_ctx *ctx)
+/* Everything which is logged once a track is done, in order */
+static void finish_track(cyanrip_ctx *ctx, cyanrip_track *t, int ret)
 {
-    int gaps = 0;
+    if (!crip_quit(ctx) && !ret) {
+        t->ripped = 1;
+        cyanrip_finalize_encoding(ctx, t);
+        if (ctx->settings.enable_replaygain)
+            crip_replaygain_meta_track(t);
+        cyanrip_log_track_end(ctx, t);
+        cyanrip_cue_track(ctx, t);
+    } else {
+        ctx->total_error_count++;
+    }
+}
 
-    cyanrip_log(ctx, 0, "Gaps:\n");
+static int cyanrip_rip_track(cyanrip_ctx *ctx, cyanrip_track *t)
+{
+    int ret = 0;
 
-    /* Before pregap */
-    if (ctx->tracks[0].pregap_lsn != CDIO_INVALID_LSN &&
-        ctx->tracks[0].pregap_lsn > ctx->start_lsn) {
-        cyanrip_log(ctx, 0, "    %i frame gap between lead-in and track 1 pregap, merging into pregap\n",
-                    ctx->tracks[0].pregap_lsn - ctx->start_lsn);
-        gaps++;
+    if (t->track_is_data) {
+        cyanrip_log(ctx, 0, "Track %i is data:\n", t->number);
+        cyanrip_log_track_end(ctx, t);
+        cyanrip_cue_track(ctx, t);
+        return 0;
+    }
 
-        ctx->tracks[0].pregap_lsn = ctx->start_lsn;
-    } else if (ctx->tracks[0].pregap_lsn == CDIO_INVALID_LSN &&
-               ctx->tracks[0].start_lsn > ctx->start_lsn) {
-        cyanrip_log(ctx, 0, "    %i frame unmarked gap between lead-in and track 1, marking as a pregap\n",
-                    ctx->tracks[0].start_lsn - ctx->start_lsn);
-        gaps++;
+    /* Set creation time at the start of ripping */
+    track_set_creation_time(ctx, t);
 
-        ctx->tracks[0].pregap_lsn = ctx->start_lsn;
+    t->ripped = 0;
+    crip_journal_track_start(ctx, t);
+
+    CRIPReader *reader = NULL;
+    CRIPVote *vote = NULL;
+    CRIPProgress progress = { .start_err = ctx->total_error_count };
+    uint32_t start_frames_read = ctx->frames_read;
+    uint32_t total_repeats = 0;
+
+    /* Burst rip first if AccurateRip can tell us whether that was good enough */
+    int burst_pass = 0;
+    t->strategy = CRIP_TRACK_SECURE;
+    if (ctx->settings.rip_strategy == CRIP_STRATEGY_BURST) {
+        if (t->ar_db_status != CYANRIP_ACCUDB_FOUND) {
+            t->strategy = CRIP_TRACK_SECURE_NO_AR;
+        } else if (ctx->settings.paranoia_level) {
+            burst_pass = 1;
+            cdio_paranoia_modeset(ctx->paranoia, paranoia_level_map[0]);
+        }
     }
 
-    /* Pregaps */
-    for (int i = 0; i < ctx->nb_tracks; i++) {
-        cyanrip_track *ct = &ctx->tracks[i - 0];
-        cyanrip_track *lt = ct->number > 1 ? &ctx->tracks[i - 1] : NULL;
+    /* Repeat rips get all of their reading done first, sector by sector,
+     * and the track is then assembled from what most reads agreed on */
+    if (ctx->settings.ripping_retries) {
+        ret = crip_vote_alloc(&vote, t->frames, ctx->settings.ripping_retries + 1);
+        if (ret < 0) {
+            cyanrip_log(ctx, 0, "Error allocating repeat ripping buffer: %s\n",
+                        av_err2str(ret));
+            goto end;
+        }
 
-        if (ct->pregap_lsn == CDIO_INVALID_LSN)
-            continue;
+        ret = vote_track(ctx, t, vote, &progress);
+        if (ret < 0 || crip_quit(ctx))
+            goto fail;
 
-        cyanrip_log(ctx, 0, "    %i frame pregap in track %i, ",
-                    ct->start_lsn - ct->pregap_lsn, ct->number);
-        gaps++;
+        total_repeats = t->total_repeats;
+    }
 
-        switch (ctx->settings.pregap_action[ct->number - 1]) {
-        case CYANRIP_PREGAP_DEFAULT:
-            if (!lt)
-                cyanrip_log(ctx, 0, "unmerged\n");
-            else
-                cyanrip_log(ctx, 0, "merging into track %i\n", lt->number);
+repeat_ripping:;
+    const int frames = t->frames;
 
-            if ((ct->number - 1) == 0)
-                ct->dropped_pregap_start = ct->pregap_lsn;
-            break;
-        case CYANRIP_PREGAP_DROP:
-            cyanrip_log(ctx, 0, "dropping\n");
-            ct->dropped_pregap_start = ct->pregap_lsn;
-            if (lt)
-                lt->end_lsn = ct->pregap_lsn - 1;
-            break;
-        case CYANRIP_PREGAP_MERGE:
-            cyanrip_log(ctx, 0, "merging\n");
-            ct->merged_pregap_end = ct->start_lsn;
-            ct->start_lsn = ct->pregap_lsn;
-            if (lt)
-                lt->end_lsn = ct->pregap_lsn - 1;
-            break;
-        case CYANRIP_PREGAP_TRACK:
-            cyanrip_log(ctx, 0, "splitting off into a new track, number %i\n", ct->number > 1 ? ct->number : 0);
+    if (!vote)
+        progress.start_err = ctx->total_error_count;
 
-            if (lt)
-                lt->end_lsn = ct->pregap_lsn - 1;
+    /* Checksum */
+    cyanrip_checksum_ctx checksum_ctx;
+    crip_init_checksum_ctx(ctx, &checksum_ctx, t);
 
-            if (ct->number > 1) /* Push all track numbers up if needed */
-                for (int j = i; j < ctx->nb_tracks; j++)
-                    ctx->tracks[j].number++;
+    /* Reset sample peak for this attempt - a bad sample from a discarded
+     * burst ripping pass must not stick around forever. */
+    t->sample_peak_rel_amp = 0.0;
 
-            memmove(&ctx->tracks[i + 1], &ctx->tracks[i],
-                    sizeof(cyanrip_track)*(ctx->nb_tracks - i));
+    /* Fill with silence to maintain track length */
+    ret = pad_track(ctx, t, &checksum_ctx, 0);
+    if (ret < 0) {
+        cyanrip_log(ctx, 0, "Error in decoding/sending frame: %s\n", av_err2str(ret));
+        goto fail;
+    }
 
-            ct = &ctx->tracks[i + 1];
+    /* Start reading the actual CD data, unless repeat ripping already did */
+    if (!vote) {
+        progress.last_read = av_gettime_relative();
 
-            ctx->nb_tracks++;
-            cyanrip_track *nt = &ctx->tracks[i];
+        ret = crip_reader_start(ctx, &reader, t->start_lsn, frames,
+                                !ctx->settings.paranoia_level || burst_pass);
+        if (ret < 0) {
+            cyanrip_log(ctx, 0, "Error starting reader: %s\n", av_err2str(ret));
+            goto fail;
+        }
+    }
 
-            memset(nt, 0, sizeof(*nt));
+    for (int i = 0; i < frames;) {
+        const uint8_t *data, *flags = NULL;
+        int nb, read_err = 0;
 
-            nt->number = ct->number - 1;
-            nt->pregap_lsn = CDIO_INVALID_LSN;
-            nt->dropped_pregap_start = CDIO_INVALID_LSN;
-            nt->merged_pregap_end = CDIO_INVALID_LSN;
-            nt->start_lsn = ct->pregap_lsn;
-            nt->end_lsn = ct->start_lsn - 1;
-            nt->cd_track_number = ct->cd_track_number;
+        if (vote) {
+            data = crip_vote_data(vote) + (size_t)i*CDIO_CD_FRAMESIZE_RAW;
+            nb = FFMIN(frames - i, CRIP_READER_RING_SECTORS);
+        } else {
+            ret = crip_reader_get(reader, &data, ctx->archive ? &flags : NULL,
+                                  &nb, &read_err);
+            if (ret == AVERROR(EINVAL)) {
+                /* Detect disc removals */
+                cyanrip_log(ctx, 0, "\nDrive media changed, stopping!\n");
+                goto fail;
+            } else if (ret < 0) {
+                /* The reader only stops early when asked to quit */
+                ret = 0;
+                cyanrip_log(ctx, 0, "\nStopping, ripping incomplete!\n");
+                break;
+            }
+        }
 
-            ct->pregap_lsn = CDIO_INVALID_LSN;
+        ctx->total_error_count += read_err;
+
+        /* Stop now if requested */
+        if (crip_quit(ctx)) {
+            cyanrip_log(ctx, 0, "\nStopping, ripping incomplete!\n");
+            if (reader)
+                crip_reader_release(reader, nb);
+            break;
+        }
+
+        ret = process_sectors(ctx, t, &checksum_ctx, data, i, nb);
+        if (ret < 0) {
+            cyanrip_log(ctx, 0, "\nError in decoding/sending frame: %s\n", av_err2str(ret));
+            goto fail;
+        }
+
+        if (ctx->archive && reader)
+            crip_archive_sectors_read(ctx->archive, t->start_lsn + i, flags, nb);
+
+        if (reader)
+            crip_reader_release(reader, nb);
+        i += nb;
+
+        /* Report progress */
+        if (vote) {
+            print_progress(ctx, &progress, 0, 0, "Encoding track %i, progress - %0.2f%%",
+                           t->number, ((double)i/frames)*100.0f);
+        } else {
+            ctx->frames_read += nb;
+            print_progress(ctx, &progress, nb, 0,
+                           "Ripping and encoding track %i, progress - %0.2f%%",
+                           t->number, ((double)i/frames)*100.0f);
         }
     }
 
-    /* Between tracks */
-    for (int i = 1; i < ctx->nb_tracks; i++) {
-        cyanrip_track *ct = &ctx->tracks[i - 0];
-        cyanrip_track *lt = &ctx->tracks[i - 1];
+    crip_reader_stop(&reader, &t->read_stats);
 
-        if (ct->start_lsn == (lt->end_lsn + 1))
-            continue;
+    /* Fill with silence to maintain track length */
+    ret = pad_track(ctx, t, &checksum_ctx, 1);
+    if (ret < 0) {
+        cyanrip_log(ctx, 0, "Error in decoding/sending frame: %s\n", av_err2str(ret));
+        goto fail;
+    }
 
-        int discont_frames = ct->start_lsn - lt->end_lsn - 1;
+    crip_finalize_checksums(&checksum_ctx, t);
 
-        cyanrip_log(ctx, 0, "    %i frame discontinuity between tracks %i and %i, ",
-                    discont_frames, ct->number, lt->number);
-        gaps++;
+    if (burst_pass) {
+        burst_pass = 0;
+        cdio_paranoia_modeset(ctx->paranoia,
+                              paranoia_level_map[ctx->settings.paranoia_level]);
 
-        if (ctx->settings.pregap_action[ct->number - 1] != CYANRIP_PREGAP_DROP) {
-            cyanrip_log(ctx, 0, "padding track %i\n", lt->number);
-            lt->end_lsn = ct->start_lsn - 1;
-        } else {
-            cyanrip_log(ctx, 0, "ignoring\n");
+        if (crip_quit(ctx))
+            goto finalize_ripping;
+
+        if (crip_find_ar(t, t->acurip_checksum_v1, 0) == t->ar_db_max_confidence ||
+            crip_find_ar(t, t->acurip_checksum_v2, 0) == t->ar_db_max_confidence) {
+            cyanrip_log(ctx, 0, "\nBurst rip verified by AccurateRip\n");
+            t->strategy = CRIP_TRACK_BURST;
+            goto finalize_ripping;
+        }
+
+        cyanrip_log(ctx, 0, "\nBurst rip not verified by AccurateRip, re-ripping securely\n");
+        t->strategy = CRIP_TRACK_BURST_RERIPPED;
+        total_repeats++;
+
+        int err = cyanrip_reset_encoding(ctx, t);
+        if (err < 0) {
+            cyanrip_log(ctx, 0, "Error in encoding: %s\n", av_err2str(err));
+            ret = err;
+            goto end;
         }
+
+        ctx->frames_read = start_frames_read;
+        goto repeat_ripping;
     }
 
-    /* After last track */
-    cyanrip_track *lt = &ctx->tracks[ctx->nb_tracks - 1];
-    if (ctx->end_lsn > lt->end_lsn && !lt->track_is_data) {
-        int discont_frames = ctx->end_lsn - lt->end_lsn;
-        cyanrip_log(ctx, 0, "    %i frame gap between last track and lead-out, padding track\n",
-                    discont_frames);
-        gaps++;
+finalize_ripping:
+    cyanrip_log(NULL, 0, "\nFlushing encoders...\n");
 
-        lt->end_lsn = ctx->end_lsn;
+    /* Flush encoders */
+    ret = cyanrip_send_pcm_to_encoders(ctx, t->enc_ctx, ctx->settings.outputs_num,
+                                       t->dec_ctx, NULL, 0);
+    if (ret) {
+        cyanrip_log(ctx, 0, "Error sending flush signal to encoders: %s\n", av_err2str(ret));
+        crip_vote_free(&vote);
+        return ret;
     }
 
-    /* Finally set up the internals with the set start_lsn/end_lsn */
-    for (int i = 0; i < ctx->nb_tracks; i++) {
-        cyanrip_track *t = &ctx->tracks[i];
+fail:
+    crip_reader_stop(&reader, &t->read_stats);
 
-        if (t->track_is_data)
-            t->frames = t->end_lsn - t->start_lsn + 1;
+    if (!ret && !crip_quit(ctx)) {
+        /* With repeat ripping, errors only matter if they could not be outvoted */
+        if (vote ? t->disputed_sectors : ctx->total_error_count - progress.start_err)
+            cyanrip_log(ctx, 0, "Track %i ripped and encoded with errors.\n", t->number);
         else
-            setup_track_lsn(ctx, t);
+            cyanrip_log(ctx, 0, "Track %i ripped and encoded successfully!\n", t->number);
     }
 
-    /* Setup next/previous pointers and redo track indices */
-    for (int i = 0; i < ctx->nb_tracks; i++) {
-        cyanrip_track *t = &ctx->tracks[i];
+end:
+    crip_vote_free(&vote);
 
-        t->index = i + 1;
-        t->pt = i ? &ctx->tracks[i - 1] : NULL;
-        t->nt = i != (ctx->nb_tracks - 1) ? &ctx->tracks[i + 1] : NULL;
-    }
+    t->total_repeats = total_repeats;
+    finish_track(ctx, t, ret);
 
-    cyanrip_log(ctx, 0, "%s\n", gaps ? "" : "    None signalled\n");
+    return ret;
 }
 
-int main(int argc, char **argv)
+/* Sets up the decoder and encoders, unless the track is data, which is never
+ * decoded or encoded */
+static int init_track(cyanrip_ctx *ctx, cyanrip_track *t)
 {
-    cyanrip_ctx *ctx = NULL;
-    cyanrip_settings settings = { 0 };
+    if (t->track_is_data)
+        return 0;
 
-#ifdef _WIN32
-    setlocale(LC_ALL, ".UTF8");
-#endif
+    /* Read ISRC and the preemphasis flags before creating
+     * the decoder, which needs them to decide on deemphasis */
+    track_read_extra(ctx, t);
 
-    av_log_set_level(AV_LOG_QUIET);
+    int ret = cyanrip_create_dec_ctx(ctx, &t->dec_ctx, t);
+    if (ret < 0) {
+        cyanrip_log(ctx, 0, "Error initializing decoder: %s\n", av_err2str(ret));
+        return ret;
+    }
 
-    if (signal(SIGINT, on_quit_signal) == SIG_ERR)
-        cyanrip_log(ctx, 0, "Can't init signal handler!\n");
+    for (int i = 0; i < ctx->settings.outputs_num; i++) {
+        ret = cyanrip_init_track_encoding(ctx, &t->enc_ctx[i], t,
+                                          ctx->settings.outputs[i]);
+        if (ret < 0) {
+            cyanrip_log(ctx, 0, "Error initializing encoder: %s\n", av_err2str(ret));
+            return ret;
+        }
+    }
 
-    /* Default settings */
-    settings.dev_path = NULL;
-    settings.folder_name_scheme = "{album}{if #releasecomment# > #0# (|releasecomment|)} [{format}]";
-    settings.track_name_scheme = "{if #totaldiscs# > #1#|disc|.}{track} - {title}";
-    settings.log_name_scheme = "{album}{if #totaldiscs# > #1# CD|disc|}";
-    settings.cue_name_scheme = "{album}{if #totaldiscs# > #1# CD|disc|}";
-    settings.sanitize_method = CRIP_SANITIZE_UNICODE;
-    settings.speed = 0;
-    settings.max_retries = 10;
-    settings.over_under_read_frames = 0;
-    settings.offset = 0;
-    settings.ripping_retries = 0;
-    settings.print_info_only = 0;
-    settings.disable_mb = 0;
-    settings.disable_coverart_db = 0;
-    settings.coverart_lookup_size = COVERART_LOOKUP_SIZE_ORIGINAL;
-    settings.decode_hdcd = 0;
-    settings.deemphasis = 1;
-    settings.force_deemphasis = 0;
-    settings.bitrate = 256.0f;
-    settings.overread_leadinout = 0;
-    settings.rip_indices_count = -1;
-    settings.disable_accurip = 0;
-    settings.eject_on_success_rip = 0;
-    settings.outputs[0] = CYANRIP_FORMAT_FLAC;
-    settings.outputs_num = 1;
-    settings.disable_coverart_embedding = 0;
-    settings.enable_replaygain = 1;
-    settings.paranoia_level = FF_ARRAY_ELEMS(paranoia_level_map) - 1;
+    return 0;
+}
 
-    memset(settings.pregap_action, CYANRIP_PREGAP_DEFAULT, 198*sizeof(*settings.pregap_action));
+/* Tracks done in an earlier run are only logged again */
+static void restore_track(cyanrip_ctx *ctx, cyanrip_track *t)
+{
+    track_read_extra(ctx, t);
+    if (ctx->settings.enable_replaygain)
+        crip_replaygain_meta_track(t);
 
-    int idx;
-    char *p_save, *p;
-    int mb_release_idx = -1;
-    char *mb_release_str = NULL;
-    int discnumber = 0, totaldiscs = 0;
-    char *album_metadata_ptr = NULL;
-    char *track_metadata_ptr[198] = { NULL };
-    int track_metadata_ptr_cnt = 0;
-    int find_drive_offset_range = 0;
-    int offset_set = 0;
+    if (ctx->album_loudness && t->loudness)
+        crip_loudness_merge(ctx->album_loudness, t->loudness);
+    av_freep(&t->loudness);
 
-    CRIPArt cover_arts[32] = { 0 };
-    int nb_cover_arts = 0;
+    cyanrip_log(ctx, 0, "Track %i restored from the journal.\n", t->number);
+    cyanrip_log_track_end(ctx, t);
+    cyanrip_cue_track(ctx, t);
+}
 
-    CRIPArt track_cover_arts[198] = { 0 };
-    int track_cover_arts_map[198] = { 0 };
-    int nb_track_cover_arts = 0;
+/* Records every track whose files have all been written in the journal */
+static void journal_finished_tracks(cyanrip_ctx *ctx)
+{
+    for (int i = 0; i < ctx->nb_tracks; i++) {
+        cyanrip_track *t = &ctx->tracks[i];
+        if (t->ripped && !t->journaled && cyanrip_track_encoding_done(ctx, t) > 0)
+            crip_journal_track_done(ctx, t);
+    }
+}
 
-    snprintf(cyanrip_helpstr, sizeof(cyanrip_helpstr),
-             "cyanrip %s (%s)", PROJECT_VERSION_STRING, vcstag);
+/* Tracks ripped in a single pass are read from the disc in one go. If that
+ * can't be set up, each track gets read on its own as usual. */
+static void stream_tracks(cyanrip_ctx *ctx, cyanrip_track **tracks, int nb_tracks)
+{
+    lsn_t start = 0, end = 0;
+    int nb = 0;
 
-    GEN_OPT_INIT(opts_list, 64);
+    if (ctx->image || ctx->settings.print_info_only || ctx->settings.ripping_retries ||
+        ctx->settings.rip_strategy == CRIP_STRATEGY_BURST)
+        return;
 
-    GEN_OPT_SEC(opts_list, "Ripping options");
-    GEN_OPT_ONE(opts_list, char *,  device, "d", 1, 1, NULL, 0, 0,
-                "Set device path (can be a TOC file)");
-    GEN_OPT_ONE(opts_list, int32_t, offset, "s", 1, 1, 0, INT32_MIN, INT32_MAX,
-                "CD drive offset in samples");
-    GEN_OPT_ONE(opts_list, int32_t, retries, "r", 1, 1, 10, 0, INT32_MAX,
-                "Maximum number of retries for frames and repeated rips");
-    GEN_OPT_ONE(opts_list, int32_t, repeat_rips, "Z", 1, 1, 0, 0, INT32_MAX,
-                "Rip tracks until checksums match N times (for damaged CDs)");
-    GEN_OPT_ONE(opts_list, int32_t, speed, "S", 1, 1, 0, 0, INT32_MAX,
-                "Set drive speed");
-    GEN_OPT_ARR(opts_list, char *,  pregap, "p", 0, 0, 198, 0, 0,
-                "Track pregap handling: N=default|drop|merge|track (repeatable)");
-    GEN_OPT_ONE(opts_list, char *,  paranoia, "P", 1, 1, NULL, 0, 0,
-                "Paranoia level (0..max, or 'none'/'max')");
-    GEN_OPT_ONE(opts_list, bool,    overread, "O", 0, 0, 0, 0, 0,
-                "Enable overreading into lead-in and lead-out");
-    GEN_OPT_ONE(opts_list, bool,    hdcd, "H", 0, 0, 0, 0, 0,
-                "Enable HDCD decoding");
-    GEN_OPT_ONE(opts_list, bool,    force_deemphasis, "E", 0, 0, 0, 0, 0,
-                "Force CD deemphasis");
-    GEN_OPT_ONE(opts_list, bool,    no_deemphasis, "W", 0, 0, 0, 0, 0,
-                "Disable automatic CD deemphasis");
-    GEN_OPT_ONE(opts_list, bool,    no_replaygain, "K", 0, 0, 0, 0, 0,
-                "Disable ReplayGain tagging");
+    for (int i = 0; i < nb_tracks; i++) {
+        cyanrip_track *t = tracks[i];
+        if (t->track_is_data || t->restored || !t->frames)
+            continue;
+        if (!nb++)
+            start = t->start_lsn;
+        end = FFMAX(end, t->end_lsn);
+    }
 
-    GEN_OPT_SEC(opts_list, "Output options");
-    GEN_OPT_ARR(opts_list, char *,  outputs, "o", ',', 0, 32, 0, 0,
-                "Comma separated list of output formats ('help' lists all)");
-    GEN_OPT_ONE(opts_list, float,   bitrate, "b", 1, 1, 256.0f, 0.0f, 10000.0f,
-                "Bitrate of lossy files in kbps");
-    GEN_OPT_ONE(opts_list, char *,  folder_scheme, "D", 1, 1,
-                settings.folder_name_scheme, 0, 0,
-                "Directory naming scheme");
-    GEN_OPT_ONE(opts_list, char *,  track_scheme, "F", 1, 1,
-                settings.track_name_scheme, 0, 0,
-                "Track naming scheme");
-    GEN_OPT_ONE(opts_list, char *,  log_scheme, "L", 1, 1,
-                settings.log_name_scheme, 0, 0,
-                "Log file name scheme");
-    GEN_OPT_ONE(opts_list, char *,  cue_scheme, "M", 1, 1,
-                settings.cue_name_scheme, 0, 0,
-                "CUE file name scheme");
-    GEN_OPT_ARR(opts_list, int32_t, tracks, "l", ',', 0, 198, 0, 198,
-                "Comma separated list of tracks to rip (default: all)");
-    GEN_OPT_ONE(opts_list, char *,  sanitize, "T", 1, 1, NULL, 0, 0,
-                "Filename sanitation: simple, os_simple, unicode, os_unicode");
+    if (nb)
+        crip_reader_stream_start(ctx, start, end, !ctx->settings.paranoia_level);
+}
 
-    GEN_OPT_SEC(opts_list, "Metadata options");
-    GEN_OPT_ONE(opts_list, bool,    info, "I", 0, 0, 0, 0, 0,
-                "Only print CD and track info");
-    GEN_OPT_ONE(opts_list, bool,    cue_only, "J", 0, 0, 0, 0, 0,
-                "Only generate and print a CUE sheet, don't rip");
-    GEN_OPT_ONE(opts_list, char *,  album_meta, "a", 1, 1, NULL, 0, 0,
-                "Album metadata, key=value:key=value");
-    GEN_OPT_ARR(opts_list, char *,  track_meta, "t", 0, 0, 198, 0, 0,
-                "Track metadata as N=key=value:key=value (repeatable)");
-    GEN_OPT_ONE(opts_list, char *,  release, "R", 1, 1, NULL, 0, 0,
-                "MusicBrainz release: 1-based index or ID string");
-    GEN_OPT_ONE(opts_list, char *,  disc, "c", 1, 1, NULL, 0, 0,
-                "Multi-disc tag: disc/totaldiscs");
-    GEN_OPT_ARR(opts_list, char *,  cover, "C", 0, 0, 32, 0, 0,
-                "Cover art: title=path (or N=path per-track, repeatable)");
-    GEN_OPT_ONE(opts_list, bool,    no_musicbrainz, "N", 0, 0, 0, 0, 0,
-                "Disable MusicBrainz lookup");
-    GEN_OPT_ONE(opts_list, bool,    no_accurip, "A", 0, 0, 0, 0, 0,
-                "Disable AccurateRip database query and validation");
-    GEN_OPT_ONE(opts_list, bool,    no_coverart_db, "U", 0, 0, 0, 0, 0,
-                "Disable Cover art DB query and retrieval");
-    GEN_OPT_ONE(opts_list, int32_t, cover_size, "m", 1, 1, -1, -1, 1200,
-                "Cover art max size: 250, 500, 1200, or -1 for original");
-    GEN_OPT_ONE(opts_list, bool,    no_coverart_embed, "G", 0, 0, 0, 0, 0,
-                "Disable embedding of cover art images");
+typedef struct CRIPTrackRun {
+    struct CRIPParallelRip *rip;
+    cyanrip_track *t;
+    pthread_t thread;
+    int started;
+    int finished; /* Under the lock */
+    int ret;
+    atomic_int sectors; /* For the progress */
+} CRIPTrackRun;
+
+typedef struct CRIPParallelRip {
+    cyanrip_ctx *ctx;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    int running;
+} CRIPParallelRip;
+
+/* Only mapped images can be read from several threads at once, and only
+ * if every track gets ripped in a single pass */
+static int tracks_parallel(cyanrip_ctx *ctx)
+{
+    return ctx->image && ctx->settings.track_jobs > 1 &&
+           !ctx->settings.print_info_only && !ctx->settings.ripping_retries &&
+           ctx->settings.rip_strategy != CRIP_STRATEGY_BURST;
+}
 
-    GEN_OPT_SEC(opts_list, "Misc. options");
-    GEN_OPT_ONE(opts_list, bool,    eject, "Q", 0, 0, 0, 0, 0,
-                "Eject tray once successfully done");
-    GEN_OPT_ONE(opts_list, bool,    find_offset, "f", 0, 0, 0, 0, 0,
-                "Find drive offset (requires a disc with an AccuRip entry)");
-    GEN_OPT_ONE(opts_list, char *,  verify_log, "Y", 1, 1, NULL, 0, 0,
-                "Verify a rip log's FUN512 checksum");
+/* cyanrip_rip_track() without any logging, as tracks finish out of order */
+static void *track_thread(void *arg)
+{
+    CRIPTrackRun *run = arg;
+    CRIPParallelRip *rip = run->rip;
+    cyanrip_ctx *ctx = rip->ctx;
+    cyanrip_track *t = run->t;
+    CRIPReader *reader = NULL;
+    cyanrip_checksum_ctx checksum_ctx;
 
-    {
-        int r = GEN_OPT_PARSE(NULL, opts_list, argc, argv);
-        if (r == -EAGAIN)
-            return 0;
-        if (r < 0)
-            return 1;
-    }
+    cyanrip_set_thread_ctx(ctx);
 
-    for (int i = 1; i < argc; i++) {
-        if (!strcmp(argv[i], "-s") || !strcmp(argv[i], "--offset")) {
-            offset_set = 1;
+    crip_init_checksum_ctx(ctx, &checksum_ctx, t);
+    t->sample_peak_rel_amp = 0.0;
+
+    int ret = pad_track(ctx, t, &checksum_ctx, 0);
+    if (ret >= 0)
+        ret = crip_reader_start(ctx, &reader, t->start_lsn, t->frames, 0);
+
+    for (int i = 0; ret >= 0 && i < t->frames;) {
+        const uint8_t *data;
+        int nb, read_err;
+
+        /* Mapped images only stop early when asked to quit */
+        ret = crip_reader_get(reader, &data, NULL, &nb, &read_err);
+        if (ret < 0)
             break;
-        }
+
+        ret = process_sectors(ctx, t, &checksum_ctx, data, i, nb);
+        if (ctx->archive && ret >= 0)
+            crip_archive_sectors_read(ctx->archive, t->start_lsn + i, NULL, nb);
+        crip_reader_release(reader, nb);
+        atomic_fetch_add(&run->sectors, nb);
+        i += nb;
     }
 
-    if (verify_log) {
-        switch (cyanrip_verify_log(verify_log)) {
-        case CRIP_LOG_VALID:
-            cyanrip_log(NULL, 0, "Log \"%s\" checksum valid.\n", verify_log);
-            return 0;
-        case CRIP_LOG_MISMATCH:
-            cyanrip_log(NULL, 0, "Log \"%s\" checksum mismatch, "
-                        "the file has been modified!\n", verify_log);
-            break;
-        case CRIP_LOG_TRAILING_DATA:
-            cyanrip_log(NULL, 0, "Log \"%s\" has data after the checksum, "
-                        "the file has been modified!\n", verify_log);
-            break;
-        case CRIP_LOG_NO_CHECKSUM:
-            cyanrip_log(NULL, 0, "No FUN512 checksum found in \"%s\"!\n",
-                        verify_log);
-            break;
-        case CRIP_LOG_IO_ERROR:
-            cyanrip_log(NULL, 0, "Couldn't read \"%s\"!\n", verify_log);
-            break;
-        }
-        return 1;
+    crip_reader_stop(&reader, &t->read_stats);
+
+    if (ret >= 0)
+        ret = pad_track(ctx, t, &checksum_ctx, 1);
+    if (ret >= 0) {
+        crip_finalize_checksums(&checksum_ctx, t);
+        ret = cyanrip_send_pcm_to_encoders(ctx, t->enc_ctx, ctx->settings.outputs_num,
+                                           t->dec_ctx, NULL, 0);
     }
 
-    if (device)
-        settings.dev_path = strdup(device);
+    pthread_mutex_lock(&rip->lock);
+    run->ret = ret;
+    run->finished = 1;
+    rip->running--;
+    pthread_cond_broadcast(&rip->cond);
+    pthread_mutex_unlock(&rip->lock);
 
-    settings.offset = offset;
-    settings.over_under_read_frames =
-        (offset < 0 ? -1 : 1) *
-        (int)ceilf(abs(offset) / (float)(CDIO_CD_FRAMESIZE_RAW >> 2));
+    return NULL;
+}
 
-    settings.max_retries                = retries;
-    settings.ripping_retries            = repeat_rips;
-    settings.speed                      = speed;
-    settings.bitrate                    = bitrate;
-    settings.overread_leadinout         = overread;
-    settings.decode_hdcd                = hdcd;
-    settings.force_deemphasis           = force_deemphasis;
-    settings.deemphasis                 = !no_deemphasis;
-    settings.enable_replaygain          = !no_replaygain;
-    settings.disable_mb                 = no_musicbrainz;
-    settings.disable_accurip            = no_accurip;
-    settings.disable_coverart_db        = no_coverart_db;
-    settings.disable_coverart_embedding = no_coverart_embed;
-    settings.print_info_only            = info;
-    settings.generate_cue_only          = cue_only;
-    settings.eject_on_success_rip       = eject;
-    settings.folder_name_scheme         = folder_scheme;
-    settings.track_name_scheme          = track_scheme;
-    settings.log_name_scheme            = log_scheme;
-    settings.cue_name_scheme            = cue_scheme;
+/* Waits for a track for at most 200ms, returns whether it finished, and the
+ * sectors all tracks have processed so far */
+static int wait_track_run(CRIPParallelRip *rip, CRIPTrackRun *runs, int nb_runs,
+                          CRIPTrackRun *run, int *sectors)
+{
+    int64_t until = av_gettime() + 200000;
+    struct timespec ts = { .tv_sec  = until / 1000000,
+                           .tv_nsec = (until % 1000000) * 1000 };
 
-    find_drive_offset_range = find_offset ? 6 : 0;
-    album_metadata_ptr = album_meta;
+    pthread_mutex_lock(&rip->lock);
+    if (!run->finished)
+        pthread_cond_timedwait(&rip->cond, &rip->lock, &ts);
+    int finished = run->finished;
+    pthread_mutex_unlock(&rip->lock);
 
-    if (paranoia) {
-        if (!strcmp(paranoia, "none"))
-            settings.paranoia_level = 0;
-        else if (!strcmp(paranoia, "max"))
-            settings.paranoia_level = crip_max_paranoia_level;
-        else
-            settings.paranoia_level = (int)strtol(paranoia, NULL, 10);
-        if (settings.paranoia_level < 0 ||
-            settings.paranoia_level > crip_max_paranoia_level) {
-            cyanrip_log(ctx, 0,
-                        "Invalid paranoia level %i must be between 0 and %i!\n",
-                        settings.paranoia_level, crip_max_paranoia_level);
-            return 1;
+    *sectors = 0;
+    for (int i = 0; i < nb_runs; i++)
+        *sectors += atomic_load(&runs[i].sectors);
+
+    return finished;
+}
+
+/* Tracks of mapped images needn't be read in order, so up to track_jobs of
+ * them get checksummed and encoded at once. They still get set up, logged
+ * and written to the CUE sheet in order, exactly as if ripped one by one.
+ * Only returns an error if a track could not be set up. */
+static int rip_tracks_parallel(cyanrip_ctx *ctx, cyanrip_track **tracks, int nb_tracks)
+{
+    CRIPParallelRip rip = { .ctx = ctx };
+    CRIPProgress progress = { .start_err = ctx->total_error_count,
+                              .last_read = av_gettime_relative() };
+    int ret = 0, next = 0, sectors = 0, rip_err = 0;
+
+    CRIPTrackRun *runs = av_calloc(nb_tracks, sizeof(*runs));
+    if (!runs)
+        return AVERROR(ENOMEM);
+
+    pthread_mutex_init(&rip.lock, NULL);
+    pthread_cond_init(&rip.cond, NULL);
+
+    for (int done = 0; done < nb_tracks; done++) {
+        /* Start as many tracks as allowed, in order */
+        while (next < nb_tracks && !rip_err && !crip_quit(ctx)) {
+            pthread_mutex_lock(&rip.lock);
+            int full = rip.running >= ctx->settings.track_jobs;
+            pthread_mutex_unlock(&rip.lock);
+            if (full)
+                break;
+
+            CRIPTrackRun *run = &runs[next];
+            run->rip = &rip;
+            run->t = tracks[next++];
+            atomic_init(&run->sectors, 0);
+            if (run->t->restored || run->t->track_is_data)
+                continue;
+
+            ret = init_track(ctx, run->t);
+            if (ret < 0)
+                goto end;
+
+            track_set_creation_time(ctx, run->t);
+            run->t->ripped = 0;
+            crip_journal_track_start(ctx, run->t);
+
+            pthread_mutex_lock(&rip.lock);
+            rip.running++;
+            pthread_mutex_unlock(&rip.lock);
+
+            ret = pthread_create(&run->thread, NULL, track_thread, run);
+            if (ret) {
+                cyanrip_log(ctx, 0, "Error starting track thread: %s\n",
+                            av_err2str(AVERROR(ret)));
+                ret = AVERROR(ret);
+                pthread_mutex_lock(&rip.lock);
+                rip.running--;
+                pthread_mutex_unlock(&rip.lock);
+                goto end;
+            }
+            run->started = 1;
         }
-    }
 
-    switch (cover_size) {
-    case -1:   settings.coverart_lookup_size = COVERART_LOOKUP_SIZE_ORIGINAL; break;
-    case 250:  settings.coverart_lookup_size = COVERART_LOOKUP_SIZE_250;      break;
-    case 500:  settings.coverart_lookup_size = COVERART_LOOKUP_SIZE_500;      break;
-    case 1200: settings.coverart_lookup_size = COVERART_LOOKUP_SIZE_1200;     break;
-    default:
-        cyanrip_log(ctx, 0,
-                    "Invalid max coverart size %i (must be 250, 500, 1200 or -1)\n",
-                    cover_size);
-        return 1;
-    }
+        /* Nothing left which was started */
+        if (done == next)
+            break;
 
-    if (sanitize) {
-        if      (!strcmp(sanitize, "simple"))     settings.sanitize_method = CRIP_SANITIZE_SIMPLE;
-        else if (!strcmp(sanitize, "os_simple"))  settings.sanitize_method = CRIP_SANITIZE_OS_SIMPLE;
-        else if (!strcmp(sanitize, "unicode"))    settings.sanitize_method = CRIP_SANITIZE_UNICODE;
-        else if (!strcmp(sanitize, "os_unicode")) settings.sanitize_method = CRIP_SANITIZE_OS_UNICODE;
-        else {
-            cyanrip_log(ctx, 0, "Invalid sanitation method %s\n", sanitize);
-            return 1;
+        CRIPTrackRun *run = &runs[done];
+        cyanrip_track *t = run->t;
+
+        for (int finished = !run->started; !finished;) {
+            int total;
+            finished = wait_track_run(&rip, runs, next, run, &total);
+            ctx->frames_read += total - sectors;
+            print_progress(ctx, &progress, total - sectors, 0,
+                           "Ripping and encoding tracks %i to %i, progress - %0.2f%%",
+                           t->number, runs[next - 1].t->number,
+                           ((double)ctx->frames_read/FFMAX(ctx->frames_to_read, 1))*100.0f);
+            sectors = total;
         }
-    }
 
-    if (release) {
-        p = NULL;
-        mb_release_idx = strtol(release, &p, 10);
-        if (p != NULL && p[0] != ' ' && p[0] != '\0') {
-            mb_release_str = release;
-            mb_release_idx = -1;
-        } else if (mb_release_idx <= 0) {
-            cyanrip_log(ctx, 0, "Invalid release index %i!\n", mb_release_idx);
-            return 1;
+        if (run->started) {
+            pthread_join(run->thread, NULL);
+            run->started = 0;
         }
-    }
 
-    if (disc) {
-        p = av_strtok(disc, "/", &p_save);
-        discnumber = strtol(p, NULL, 10);
-        if (discnumber <= 0) {
-            cyanrip_log(ctx, 0, "Invalid discnumber %i\n", discnumber);
-            return 1;
-        }
-        p = av_strtok(NULL, "/", &p_save);
-        if (p) {
-            totaldiscs = strtol(p, NULL, 10);
-            if (totaldiscs <= 0) {
-                cyanrip_log(ctx, 0, "Invalid totaldiscs %i\n", totaldiscs);
-                return 1;
-            }
-            if (discnumber > totaldiscs) {
-                cyanrip_log(ctx, 0,
-                            "discnumber %i is larger than totaldiscs %i\n",
-                            discnumber, totaldiscs);
-                return 1;
-            }
+        if (progress.line_len) {
+            cyanrip_log(NULL, 0, "\n");
+            progress.line_len = progress.max_line_len = 0;
         }
-    }
 
-    int nb_outputs = 0;
-    while (nb_outputs < 32 && outputs[nb_outputs])
-        nb_outputs++;
-    if (nb_outputs > 0) {
-        if (!strcmp(outputs[0], "help")) {
-            cyanrip_log(ctx, 0, "Supported output codecs:\n");
-            cyanrip_print_codecs();
-            return 0;
-        }
-        settings.outputs_num = 0;
-        for (int i = 0; i < nb_outputs; i++) {
-            int res = cyanrip_validate_fmt(outputs[i]);
-            if (res == -1) {
-                cyanrip_log(ctx, 0, "Invalid format \"%s\"\n", outputs[i]);
-                return 1;
-            }
-            for (int k = 0; k < settings.outputs_num; k++) {
-                if (settings.outputs[k] == res) {
-                    cyanrip_log(ctx, 0, "Duplicated format \"%s\"\n", outputs[i]);
-                    return 1;
-                }
-            }
-            settings.outputs[settings.outputs_num++] = res;
+        if (t->restored) {
+            restore_track(ctx, t);
+            continue;
+        } else if (t->track_is_data) {
+            cyanrip_rip_track(ctx, t);
+            continue;
         }
-    }
 
-    int nb_track_indices = genopt_nb_vals(opts_list, opts_list_nb, "tracks");
-    if (nb_track_indices > 0) {
-        settings.rip_indices_count = 0;
-        for (int i = 0; i < nb_track_indices; i++) {
-            int t = tracks[i];
-            for (int k = 0; k < settings.rip_indices_count; k++) {
-                if (settings.rip_indices[k] == t) {
-                    cyanrip_log(ctx, 0, "Duplicated rip idx %i\n", t);
-                    return 1;
-                }
-            }
-            settings.rip_indices[settings.rip_indices_count++] = t;
-        }
-        qsort(settings.rip_indices, settings.rip_indices_count,
-              sizeof(int), cmp_numbers);
-    }
+        if (crip_quit(ctx))
+            cyanrip_log(ctx, 0, "Stopping, ripping incomplete!\n");
+        else if (run->ret < 0)
+            cyanrip_log(ctx, 0, "Error ripping track %i: %s\n", t->number,
+                        av_err2str(run->ret));
+        else
+            cyanrip_log(ctx, 0, "Track %i ripped and encoded successfully!\n", t->number);
 
-    for (int i = 0; i < 198 && pregap[i]; i++) {
-        p = av_strtok(pregap[i], "=", &p_save);
-        idx = strtol(p, NULL, 10);
-        if (idx < 1 || idx > 197) {
-            cyanrip_log(ctx, 0, "Invalid track idx for pregap: %i\n", idx);
-            return 1;
-        }
-        enum cyanrip_pregap_action act = CYANRIP_PREGAP_DEFAULT;
-        p = av_strtok(NULL, "=", &p_save);
-        if (!p) {
-            cyanrip_log(ctx, 0, "Missing pregap action\n");
-            return 1;
-        }
-        if      (!strncmp(p, "default", strlen("default"))) act = CYANRIP_PREGAP_DEFAULT;
-        else if (!strncmp(p, "drop",    strlen("drop")))    act = CYANRIP_PREGAP_DROP;
-        else if (!strncmp(p, "merge",   strlen("merge")))   act = CYANRIP_PREGAP_MERGE;
-        else if (!strncmp(p, "track",   strlen("track")))   act = CYANRIP_PREGAP_TRACK;
-        else {
-            cyanrip_log(ctx, 0, "Invalid pregap action %s\n", p);
-            return 1;
-        }
-        settings.pregap_action[idx - 1] = act;
+        finish_track(ctx, t, run->ret);
+        journal_finished_tracks(ctx);
+
+        /* Like with a drive, the first failed track stops the rip */
+        rip_err = run->ret < 0;
+        if (rip_err || crip_quit(ctx))
+            break;
     }
 
-    for (int i = 0; i < 198 && track_meta[i]; i++)
-        track_metadata_ptr[track_metadata_ptr_cnt++] = track_meta[i];
+    ret = 0;
 
-    for (int i = 0; i < 32 && cover[i]; i++) {
-        /* Split on the first "=" only, paths may contain them */
-        char *next = strchr(cover[i], '=');
-        if (next)
-            *next++ = '\0';
-        p = cover[i];
-        CRIPArt *dst = NULL;
+end:
+    /* Whatever is still running after an error only gets waited for */
+    for (int i = 0; i < next; i++)
+        if (runs[i].started)
+            pthread_join(runs[i].thread, NULL);
 
-        if (!next) {
-            int have_front = 0;
-            int have_back = 0;
-            for (int k = 0; k < nb_cover_arts; k++) {
-                if (!strcmp(cover_arts[k].title, "Front")) have_front = 1;
-                if (!strcmp(cover_arts[k].title, "Back"))  have_back  = 1;
-            }
-            if (!have_front) {
-                next = p;
-                p = "Front";
-            } else if (!have_back) {
-                next = p;
-                p = "Back";
-            } else {
-                cyanrip_log(ctx, 0,
-                            "No cover art location specified for \"%s\"\n", p);
-                return 1;
-            }
-        }
+    pthread_cond_destroy(&rip.cond);
+    pthread_mutex_destroy(&rip.lock);
+    av_free(runs);
 
-        if (crip_is_integer(p)) {
-            idx = strtol(p, NULL, 10);
-            if (idx < 0 || idx > 198) {
-                cyanrip_log(ctx, 0,
-                            "Invalid track idx for cover art: %i\n", idx);
-                return 1;
-            }
-            for (int k = 0; k < nb_track_cover_arts; k++) {
-                if (track_cover_arts_map[k] == idx) {
-                    cyanrip_log(ctx, 0,
-                                "Cover art already specified for track idx %i!\n",
-                                idx);
-                    return 1;
-                }
-            }
-            track_cover_arts_map[nb_track_cover_arts] = idx;
-            dst = &track_cover_arts[nb_track_cover_arts++];
-            p = "title";
-        } else {
-            for (int k = 0; k < nb_cover_arts; k++) {
-                if (!strcmp(cover_arts[k].title, p)) {
-                    cyanrip_log(ctx, 0, "Cover art \"%s\" already specified!\n", p);
-                    return 1;
-                }
-            }
-            dst = &cover_arts[nb_cover_arts++];
-            if (nb_cover_arts > 31) {
-                cyanrip_log(ctx, 0, "Too many cover arts specified!\n");
-                return 1;
-            }
-        }
-        dst->source_url = next;
-        dst->title = p;
-    }
+    return ret;
+}
 
+static void set_offset(cyanrip_settings *settings, int offset)
+{
+    settings->offset = offset;
+    settings->over_under_read_frames =
+        (offset < 0 ? -1 : 1) *
+        (int)ceilf(abs(offset) / (float)(CDIO_CD_FRAMESIZE_RAW >> 2));
+}
 
-    if (settings.outputs_num > 1 && !strstr(settings.folder_name_scheme, "{format}")) {
-        cyanrip_log(ctx, 0, "Directory name scheme must contain {format} with multiple output formats!\n");
-        return 1;
+static void on_quit_signal(int signo)
+{
+    if (atomic_load(&crip_shared.quit)) {
+        cyanrip_log(NULL, 0, "Force quitting\n");
+        exit(1);
     }
+    cyanrip_log(NULL, 0, "\r\nTrying to quit\n");
+    atomic_store(&crip_shared.quit, 1);
+}
 
-    if (settings.print_info_only && settings.generate_cue_only) {
-        cyanrip_log(ctx, 0, "-J (only generate a CUE sheet) cannot be used with -I (only print info)!\n");
-        return 1;
-    }
+static void setup_track_lsn(cyanrip_ctx *ctx, cyanrip_track *t)
+{
+    lsn_t first_frame = t->start_lsn;
+    lsn_t last_frame  = t->end_lsn;
 
-    if (settings.generate_cue_only) {
-        /* No audio is read or checksummed, and no files to embed art into */
-        settings.disable_accurip = 1;
-        settings.disable_coverart_db = 1;
-    }
+    t->nominal_start_lsn = t->start_lsn;
 
-    if (find_drive_offset_range) {
-        settings.disable_accurip = 0;
-        settings.disable_mb = 1;
-        settings.disable_coverart_db = 1;
-        settings.offset = 0;
-        settings.eject_on_success_rip = 0;
-        cyanrip_log(ctx, 0, "Searching for drive offset, enabling AccuRip and disabling MusicBrainz and Cover art fetching...\n");
-    }
+    /* Duration doesn't depend on adjustments we make to frames */
+    int frames = last_frame - first_frame + 1;
 
-    if (cyanrip_ctx_init(&ctx, &settings))
-        return 1;
+    t->nb_samples = frames*(CDIO_CD_FRAMESIZE_RAW >> 2);
 
-    if (!settings.offset && !offset_set && !settings.print_info_only &&
-        !find_drive_offset_range && (ctx->rcap & CDIO_DRIVE_CAP_READ_ISRC)) {
-        cyanrip_log(ctx, 0, "Offset is unset! To continue with an offset of 0, run with -s 0!\n");
-        goto end;
-    }
+    /* Move the seek position coarsely */
+    const int extra_frames = ctx->settings.over_under_read_frames;
+    int sign = (extra_frames < 0) ? -1 : ((extra_frames > 0) ? +1 : 0);
+    first_frame += sign*FFMAX(FFABS(extra_frames) - 1, 0);
+    last_frame += sign*FFMAX(FFABS(extra_frames) - 1, 0);
 
-    /* Fill disc MCN */
-    crip_fill_mcn(ctx);
+    /* Bump the lower/higher frame in the offset direction */
+    first_frame -= sign < 0;
+    last_frame  += sign > 0;
 
-    /* Fill discid */
-    if (crip_fill_discid(ctx)) {
-        ctx->total_error_count++;
-        goto end;
+    /* Don't read into the lead in/out */
+    if (!ctx->settings.overread_leadinout) {
+        t->frames_before_disc_start = FFMAX(ctx->start_lsn - first_frame, 0);
+        t->frames_after_disc_end = FFMAX(last_frame - ctx->end_lsn, 0);
+
+        first_frame += t->frames_before_disc_start;
+        last_frame  -= t->frames_after_disc_end;
+    } else {
+        t->frames_before_disc_start = 0;
+        t->frames_after_disc_end = 0;
     }
 
-    /* Default album title */
-    av_dict_set(&ctx->meta, "album", "Unknown disc", 0);
-    av_dict_set(&ctx->meta, "comment", "cyanrip "PROJECT_VERSION_STRING, 0);
-    av_dict_set(&ctx->meta, "media",
-                ctx->settings.decode_hdcd ? "HDCD" : "CD", 0);
-    const char *barcode_id = dict_get(ctx->meta, "barcode");
-    const char *mcn_id = dict_get(ctx->meta, "disc_mcn");
-    const char *did_id = dict_get(ctx->meta, "musicbrainz_discid");
+    /* Offset accounted start/end sectors */
+    t->start_lsn = first_frame;
+    t->end_lsn = last_frame;
+    t->frames = last_frame - first_frame + 1;
 
-    if (barcode_id || mcn_id || did_id) {
-        char fourcc_id[5] = { '0', '0', '0', '0', '\0' };
-        const char *id = NULL;
+    /* Last/first frame partial offset */
+    ptrdiff_t offs = ctx->settings.offset*4;
+    offs -= sign*FFMAX(FFABS(extra_frames) - 1, 0)*CDIO_CD_FRAMESIZE_RAW;
 
-        /* Try the barcode first */
-        if (barcode_id)
-            id = barcode_id;
+    t->partial_frame_byte_offs = offs;
+}
 
-        /* Try MCN */
-        if (!id && mcn_id) {
-            /* Check MCN is not all zeroes (this happens often) */
-            for (int i = 0; i < strlen(mcn_id); i++) {
-                if (mcn_id[i] != '0') {
-                    id = mcn_id;
-                    break;
-                }
-            }
-        }
+static void setup_track_offsets_and_report(cyanrip_ctx *ctx)
+{
+    int gaps = 0;
 
-        /* Otherwise just grab the discid */
+    cyanrip_log(ctx, 0, "Gaps:\n");
+
+    /* Before pregap */
+    if (ctx->tracks[0].pregap_lsn != CDIO_INVALID_LSN &&
+        ctx->tracks[0].pregap_lsn > ctx->start_lsn) {
+        cyanrip_log(ctx, 0, "    %i frame gap between lead-in and track 1 pregap, merging into pregap\n",
+                    ctx->tracks[0].pregap_lsn - ctx->start_lsn);
+        gaps++;
+
+        ctx->tracks[0].pregap_lsn = ctx->start_lsn;
+    } else if (ctx->tracks[0].pregap_lsn == CDIO_INVALID_LSN &&
+               ctx->tracks[0].start_lsn > ctx->start_lsn) {
+        cyanrip_log(ctx, 0, "    %i frame unmarked gap between lead-in and track 1, marking as a pregap\n",
+                    ctx->tracks[0].start_lsn - ctx->start_lsn);
+        gaps++;
+
+        ctx->tracks[0].pregap_lsn = ctx->start_lsn;
+    }
+
+    /* Pregaps */
+    for (int i = 0; i < ctx->nb_tracks; i++) {
+        cyanrip_track *ct = &ctx->tracks[i - 0];
+        cyanrip_track *lt = ct->number > 1 ? &ctx->tracks[i - 1] : NULL;
+
+        if (ct->pregap_lsn == CDIO_INVALID_LSN)
+            continue;
+
+        cyanrip_log(ctx, 0, "    %i frame pregap in track %i, ",
+                    ct->start_lsn - ct->pregap_lsn, ct->number);
+        gaps++;
+
+        switch (ctx->settings.pregap_action[ct->number - 1]) {
+        case CYANRIP_PREGAP_DEFAULT:
+            if (!lt)
+                cyanrip_log(ctx, 0, "unmerged\n");
+            else
+                cyanrip_log(ctx, 0, "merging into track %i\n", lt->number);
+
+            if ((ct->number - 1) == 0)
+                ct->dropped_pregap_start = ct->pregap_lsn;
+            break;
+        case CYANRIP_PREGAP_DROP:
+            cyanrip_log(ctx, 0, "dropping\n");
+            ct->dropped_pregap_start = ct->pregap_lsn;
+            if (lt)
+                lt->end_lsn = ct->pregap_lsn - 1;
+            break;
+        case CYANRIP_PREGAP_MERGE:
+            cyanrip_log(ctx, 0, "merging\n");
+            ct->merged_pregap_end = ct->start_lsn;
+            ct->start_lsn = ct->pregap_lsn;
+            if (lt)
+                lt->end_lsn = ct->pregap_lsn - 1;
+            break;
+        case CYANRIP_PREGAP_TRACK:
+            cyanrip_log(ctx, 0, "splitting off into a new track, number %i\n", ct->number > 1 ? ct->number : 0);
+
+            if (lt)
+                lt->end_lsn = ct->pregap_lsn - 1;
+
+            if (ct->number > 1) /* Push all track numbers up if needed */
+                for (int j = i; j < ctx->nb_tracks; j++)
+                    ctx->tracks[j].number++;
+
+            memmove(&ctx->tracks[i + 1], &ctx->tracks[i],
+                    sizeof(cyanrip_track)*(ctx->nb_tracks - i));
+
+            ct = &ctx->tracks[i + 1];
+
+            ctx->nb_tracks++;
+            cyanrip_track *nt = &ctx->tracks[i];
+
+            memset(nt, 0, sizeof(*nt));
+
+            nt->number = ct->number - 1;
+            nt->pregap_lsn = CDIO_INVALID_LSN;
+            nt->dropped_pregap_start = CDIO_INVALID_LSN;
+            nt->merged_pregap_end = CDIO_INVALID_LSN;
+            nt->start_lsn = ct->pregap_lsn;
+            nt->end_lsn = ct->start_lsn - 1;
+            nt->cd_track_number = ct->cd_track_number;
+
+            ct->pregap_lsn = CDIO_INVALID_LSN;
+        }
+    }
+
+    /* Between tracks */
+    for (int i = 1; i < ctx->nb_tracks; i++) {
+        cyanrip_track *ct = &ctx->tracks[i - 0];
+        cyanrip_track *lt = &ctx->tracks[i - 1];
+
+        if (ct->start_lsn == (lt->end_lsn + 1))
+            continue;
+
+        int discont_frames = ct->start_lsn - lt->end_lsn - 1;
+
+        cyanrip_log(ctx, 0, "    %i frame discontinuity between tracks %i and %i, ",
+                    discont_frames, ct->number, lt->number);
+        gaps++;
+
+        if (ctx->settings.pregap_action[ct->number - 1] != CYANRIP_PREGAP_DROP) {
+            cyanrip_log(ctx, 0, "padding track %i\n", lt->number);
+            lt->end_lsn = ct->start_lsn - 1;
+        } else {
+            cyanrip_log(ctx, 0, "ignoring\n");
+        }
+    }
+
+    /* After last track */
+    cyanrip_track *lt = &ctx->tracks[ctx->nb_tracks - 1];
+    if (ctx->end_lsn > lt->end_lsn && !lt->track_is_data) {
+        int discont_frames = ctx->end_lsn - lt->end_lsn;
+        cyanrip_log(ctx, 0, "    %i frame gap between last track and lead-out, padding track\n",
+                    discont_frames);
+        gaps++;
+
+        lt->end_lsn = ctx->end_lsn;
+    }
+
+    /* Finally set up the internals with the set start_lsn/end_lsn */
+    for (int i = 0; i < ctx->nb_tracks; i++) {
+        cyanrip_track *t = &ctx->tracks[i];
+
+        if (t->track_is_data)
+            t->frames = t->end_lsn - t->start_lsn + 1;
+        else
+            setup_track_lsn(ctx, t);
+    }
+
+    /* Setup next/previous pointers and redo track indices */
+    for (int i = 0; i < ctx->nb_tracks; i++) {
+        cyanrip_track *t = &ctx->tracks[i];
+
+        t->index = i + 1;
+        t->pt = i ? &ctx->tracks[i - 1] : NULL;
+        t->nt = i != (ctx->nb_tracks - 1) ? &ctx->tracks[i + 1] : NULL;
+    }
+
+    cyanrip_log(ctx, 0, "%s\n", gaps ? "" : "    None signalled\n");
+}
+
+/* Options which apply to every disc being ripped */
+typedef struct CRIPDiscOpts {
+    int mb_release_idx;
+    char *mb_release_str;
+    int discnumber, totaldiscs;
+    char *album_metadata_ptr;
+    char **track_metadata_ptr;
+    int track_metadata_ptr_cnt;
+    int find_drive_offset_range;
+    int offset_set;
+
+    CRIPArt *cover_arts;
+    int nb_cover_arts;
+
+    CRIPArt *track_cover_arts;
+    int *track_cover_arts_map;
+    int nb_track_cover_arts;
+} CRIPDiscOpts;
+
+/* One drive or disc image, and the disc in it */
+typedef struct CRIPJob {
+    cyanrip_settings settings;
+    const CRIPDiscOpts *opts;
+    CRIPShared *shared;
+    char log_prefix[32];
+
+    pthread_t thread;
+    int thread_started;
+
+    /* Results */
+    int ret;
+    int opened;
+    int skipped;
+    int errors;
+    enum CRIPAccuDBStatus ar_status;
+    int ar_verified;
+    int nb_tracks;
+    int64_t sectors;
+    int64_t rip_time;
+} CRIPJob;
+
+static int rip_disc(CRIPJob *job)
+{
+    const CRIPDiscOpts *o = job->opts;
+    cyanrip_ctx *ctx = NULL;
+    int idx;
+
+    if (cyanrip_ctx_init(&ctx, &job->settings, job->shared, job->log_prefix))
+        return 1;
+    job->opened = 1;
+
+    if (!ctx->settings.offset && !o->offset_set && !ctx->settings.print_info_only &&
+        !o->find_drive_offset_range && (ctx->rcap & CDIO_DRIVE_CAP_READ_ISRC)) {
+        cyanrip_log(ctx, 0, "Offset is unset! To continue with an offset of 0, run with -s 0!\n");
+        goto end;
+    }
+
+    /* Fill disc MCN */
+    crip_fill_mcn(ctx);
+
+    /* Fill discid */
+    if (crip_fill_discid(ctx)) {
+        ctx->total_error_count++;
+        goto end;
+    }
+
+    /* Look the disc up in AccurateRip and spin the drive up while
+     * MusicBrainz and the Cover Art DB get queried */
+    if (crip_accurip_start(ctx) < 0) {
+        ctx->total_error_count++;
+        goto end;
+    }
+    crip_reader_spin_up(ctx);
+
+    /* Default album title */
+    av_dict_set(&ctx->meta, "album", "Unknown disc", 0);
+    av_dict_set(&ctx->meta, "comment", "cyanrip "PROJECT_VERSION_STRING, 0);
+    av_dict_set(&ctx->meta, "media",
+                ctx->settings.decode_hdcd ? "HDCD" : "CD", 0);
+    const char *barcode_id = dict_get(ctx->meta, "barcode");
+    const char *mcn_id = dict_get(ctx->meta, "disc_mcn");
+    const char *did_id = dict_get(ctx->meta, "musicbrainz_discid");
+
+    if (barcode_id || mcn_id || did_id) {
+        char fourcc_id[5] = { '0', '0', '0', '0', '\0' };
+        const char *id = NULL;
+
+        /* Try the barcode first */
+        if (barcode_id)
+            id = barcode_id;
+
+        /* Try MCN */
+        if (!id && mcn_id) {
+            /* Check MCN is not all zeroes (this happens often) */
+            for (int i = 0; i < strlen(mcn_id); i++) {
+                if (mcn_id[i] != '0') {
+                    id = mcn_id;
+                    break;
+                }
+            }
+        }
+
+        /* Otherwise just grab the discid */
         if (!id)
             id = did_id;
 
@@ -1650,8 +1792,8 @@ int main(int argc, char **argv)
 
     /* Fill musicbrainz metadata */
     if (crip_fill_metadata(ctx,
-                           !!album_metadata_ptr || track_metadata_ptr_cnt,
-                           mb_release_idx, mb_release_str, discnumber)) {
+                           !!o->album_metadata_ptr || o->track_metadata_ptr_cnt,
+                           o->mb_release_idx, o->mb_release_str, o->discnumber)) {
         ctx->total_error_count++;
         goto end;
     }
@@ -1663,10 +1805,10 @@ int main(int argc, char **argv)
     }
 
     /* Copy album cover arts */
-    ctx->nb_cover_arts = nb_cover_arts;
-    for (int i = 0; i < nb_cover_arts; i++) {
-        ctx->cover_arts[i].source_url = av_strdup(cover_arts[i].source_url);
-        av_dict_set(&ctx->cover_arts[i].meta, "title", cover_arts[i].title, 0);
+    ctx->nb_cover_arts = o->nb_cover_arts;
+    for (int i = 0; i < o->nb_cover_arts; i++) {
+        ctx->cover_arts[i].source_url = av_strdup(o->cover_arts[i].source_url);
+        av_dict_set(&ctx->cover_arts[i].meta, "title", o->cover_arts[i].title, 0);
     }
 
     /* Album cover art (down)loading, and DB quering */
@@ -1681,24 +1823,26 @@ int main(int argc, char **argv)
         goto end;
     }
 
-    if (find_drive_offset_range) {
-        search_for_drive_offset(ctx, find_drive_offset_range);
+    crip_reader_spin_up_wait(ctx);
+
+    if (o->find_drive_offset_range) {
+        search_for_drive_offset(ctx, o->find_drive_offset_range);
         goto end;
     }
 
-    if (mb_release_str && !dict_get(ctx->meta, "musicbrainz_albumid"))
-        av_dict_set(&ctx->meta, "musicbrainz_albumid", mb_release_str, 0);
+    if (o->mb_release_str && !dict_get(ctx->meta, "musicbrainz_albumid"))
+        av_dict_set(&ctx->meta, "musicbrainz_albumid", o->mb_release_str, 0);
 
-    if (discnumber)
-        av_dict_set_int(&ctx->meta, "disc", discnumber, 0);
+    if (o->discnumber)
+        av_dict_set_int(&ctx->meta, "disc", o->discnumber, 0);
 
-    if (totaldiscs)
-        av_dict_set_int(&ctx->meta, "totaldiscs", totaldiscs, 0);
+    if (o->totaldiscs)
+        av_dict_set_int(&ctx->meta, "totaldiscs", o->totaldiscs, 0);
 
     /* Read user album metadata */
-    if (album_metadata_ptr) {
+    if (o->album_metadata_ptr) {
         /* Fixup */
-        char *copy = append_missing_keys(album_metadata_ptr, "album=", "album_artist=");
+        char *copy = append_missing_keys(o->album_metadata_ptr, "album=", "album_artist=");
 
         /* Parse */
         int err = av_dict_parse_string(&ctx->meta, copy, "=", ":", 0);
@@ -1718,414 +1862,1219 @@ int main(int argc, char **argv)
             av_dict_set(&ctx->meta, "title", "", 0);
         }
 
-        /* Populate artist tag if missing/unspecified */
-        const char *album_artist = dict_get(ctx->meta, "album_artist");
-        const char *artist = dict_get(ctx->meta, "artist");
-        if (album_artist && !artist)
-            av_dict_set(&ctx->meta, "artist", album_artist, 0);
-        else if (artist && !album_artist)
-            av_dict_set(&ctx->meta, "album_artist", artist, 0);
+        /* Populate artist tag if missing/unspecified */
+        const char *album_artist = dict_get(ctx->meta, "album_artist");
+        const char *artist = dict_get(ctx->meta, "artist");
+        if (album_artist && !artist)
+            av_dict_set(&ctx->meta, "artist", album_artist, 0);
+        else if (artist && !album_artist)
+            av_dict_set(&ctx->meta, "album_artist", artist, 0);
+    }
+
+    /* Create log file */
+    if (!ctx->settings.print_info_only) {
+        if ((!ctx->settings.generate_cue_only && cyanrip_log_init(ctx)) ||
+            cyanrip_cue_init(ctx)) {
+            ctx->total_error_count++;
+            goto end;
+        }
+    } else {
+        cyanrip_log(ctx, 0, "Log(s) will be written to:\n");
+        for (int f = 0; f < ctx->settings.outputs_num; f++) {
+            char *logfile = crip_get_path(ctx, CRIP_PATH_LOG, 0,
+                                          &crip_fmt_info[ctx->settings.outputs[f]],
+                                          NULL);
+            cyanrip_log(ctx, 0, "    %s\n", logfile);
+            av_free(logfile);
+        }
+        cyanrip_log(ctx, 0, "CUE files will be written to:\n");
+        for (int f = 0; f < ctx->settings.outputs_num; f++) {
+            char *cuefile = crip_get_path(ctx, CRIP_PATH_CUE, 0,
+                                          &crip_fmt_info[ctx->settings.outputs[f]],
+                                          NULL);
+            cyanrip_log(ctx, 0, "    %s\n", cuefile);
+            av_free(cuefile);
+        }
+    }
+
+    cyanrip_log_start_report(ctx);
+    if (!ctx->settings.print_info_only)
+        cyanrip_cue_start(ctx);
+    setup_track_offsets_and_report(ctx);
+
+    copy_album_to_track_meta(ctx);
+
+    /* Read user track metadata */
+    for (int i = 0; i < o->track_metadata_ptr_cnt; i++) {
+        if (!o->track_metadata_ptr[i])
+            continue;
+
+        char *end = NULL;
+        int u_nb = strtol(o->track_metadata_ptr[i], &end, 10);
+
+        /* Verify all indices */
+        int track_idx = 0;
+        for (; track_idx < ctx->nb_tracks; track_idx++) {
+            if (ctx->tracks[track_idx].number == u_nb)
+                break;
+        }
+        if (track_idx >= ctx->nb_tracks) {
+            cyanrip_log(ctx, 0, "Invalid track number %i, list has %i tracks!\n",
+                        u_nb, ctx->nb_tracks);
+            ctx->total_error_count++;
+            goto end;
+        }
+
+        end += 1; /* Move past equal sign */
+
+        /* Fixup */
+        char *copy = append_missing_keys(end, "title=", "artist=");
+
+        /* Parse */
+        int err = av_dict_parse_string(&ctx->tracks[track_idx].meta,
+                                       copy, "=", ":", 0);
+        av_free(copy);
+        if (err) {
+            cyanrip_log(ctx, 0, "Error reading track tags: %s\n",
+                        av_err2str(err));
+            ctx->total_error_count++;
+            goto end;
+        }
+    }
+
+    /* Only generate the CUE sheet, print it, and exit */
+    if (ctx->settings.generate_cue_only) {
+        for (int i = 0; i < ctx->nb_tracks; i++) {
+            cyanrip_track *t = &ctx->tracks[i];
+            track_read_extra(ctx, t); /* ISRC and preemphasis flags */
+            cyanrip_cue_track(ctx, t);
+        }
+
+        /* Print it to the terminal too. The log files were never
+         * opened in this mode, so this only goes to stdout. */
+        if (ctx->cuefile[0]) {
+            char line[4096];
+            cyanrip_log(ctx, 0, "\n");
+            rewind(ctx->cuefile[0]);
+            while (fgets(line, sizeof(line), ctx->cuefile[0]))
+                cyanrip_log(ctx, 0, "%s", line);
+        }
+
+        goto end;
+    }
+
+    /* Copy track cover arts */
+    for (int i = 0; i < o->nb_track_cover_arts; i++) {
+        idx = o->track_cover_arts_map[i];
+        int track_idx = 0;
+        for (; track_idx < ctx->nb_tracks; track_idx++) {
+            if (ctx->tracks[track_idx].number == idx)
+                break;
+        }
+        if (track_idx >= ctx->nb_tracks) {
+            cyanrip_log(ctx, 0, "Invalid track number %i, list has %i tracks!\n",
+                        idx, ctx->nb_tracks);
+            ctx->total_error_count++;
+            goto end;
+        }
+        ctx->tracks[track_idx].art.source_url = av_strdup(o->track_cover_arts[i].source_url);
+        av_dict_set(&ctx->tracks[track_idx].art.meta, "title", "Front", 0);
+    }
+
+    /* Track cover art (down)loading */
+    if (crip_fill_track_coverart(ctx, ctx->settings.print_info_only) < 0) {
+        ctx->total_error_count++;
+        goto end;
+    }
+
+    /* Write non-track cover arts */
+    if (ctx->nb_cover_arts) {
+        cyanrip_log(ctx, 0, "Cover art destination(s):\n");
+        for (int f = 0; f < ctx->settings.outputs_num; f++) {
+            for (int i = 0; i < ctx->nb_cover_arts; i++) {
+                char *file = crip_get_path(ctx, CRIP_PATH_COVERART, 0,
+                                           &crip_fmt_info[ctx->settings.outputs[f]],
+                                           &ctx->cover_arts[i]);
+                cyanrip_log(ctx, 0, "    %s\n", file);
+                av_free(file);
+
+                if (!ctx->settings.print_info_only) {
+                    int err = crip_save_art(ctx, &ctx->cover_arts[i],
+                                            &crip_fmt_info[ctx->settings.outputs[f]]);
+                    if (err) {
+                        ctx->total_error_count++;
+                        goto end;
+                    }
+                }
+            }
+        }
+        cyanrip_log(ctx, 0, "\n");
+    }
+
+    /* Warn if the naming scheme sends multiple tracks to the same file */
+    if (!ctx->settings.print_info_only) {
+        for (int f = 0; f < ctx->settings.outputs_num; f++) {
+            const cyanrip_out_fmt *cfmt = &crip_fmt_info[ctx->settings.outputs[f]];
+            CRIPPathSet *paths = crip_path_set_alloc();
+            if (!paths)
+                break;
+            for (int i = 0; i < ctx->nb_tracks; i++) {
+                int prev;
+                char *path = crip_get_path(ctx, CRIP_PATH_TRACK, 0, cfmt,
+                                           &ctx->tracks[i]);
+                if (path && crip_path_set_add(paths, path, i, &prev) > 0)
+                    cyanrip_log(ctx, 0, "WARNING: tracks %i and %i resolve to "
+                                "the same file \"%s\", one will overwrite "
+                                "the other!\n",
+                                ctx->tracks[prev].number, ctx->tracks[i].number,
+                                path);
+                av_free(path);
+            }
+            crip_path_set_free(&paths);
+        }
+    }
+
+    /* Open the journal, and find out what an interrupted rip already did */
+    if (!ctx->settings.print_info_only) {
+        int err = crip_journal_init(ctx);
+        if (err < 0) {
+            ctx->total_error_count++;
+            goto end;
+        }
+    }
+
+    if (ctx->settings.write_archive && !ctx->settings.print_info_only) {
+        int err = crip_archive_open(ctx, &ctx->archive);
+        if (err < 0) {
+            cyanrip_log(ctx, 0, "Error opening archive image: %s\n", av_err2str(err));
+            ctx->total_error_count++;
+            goto end;
+        }
+    }
+
+    cyanrip_log(ctx, 0, "Tracks:\n");
+    if (!ctx->settings.print_info_only)
+        ctx->rip_start = av_gettime_relative();
+    if (ctx->settings.rip_indices_count == -1) {
+        ctx->frames_to_read = ctx->duration_frames;
+        for (int i = 0; i < ctx->nb_tracks; i++)
+            if (ctx->tracks[i].restored)
+                ctx->frames_to_read -= ctx->tracks[i].frames;
+
+        if (!ctx->settings.print_info_only)
+            cyanrip_initialize_ebur128(ctx);
+
+        cyanrip_track *tracks[FF_ARRAY_ELEMS(ctx->tracks)];
+        for (int i = 0; i < ctx->nb_tracks; i++)
+            tracks[i] = &ctx->tracks[i];
+
+        if (tracks_parallel(ctx)) {
+            if (rip_tracks_parallel(ctx, tracks, ctx->nb_tracks) < 0) {
+                ctx->total_error_count++;
+                goto end;
+            }
+        } else {
+            stream_tracks(ctx, tracks, ctx->nb_tracks);
+
+            for (int i = 0; i < ctx->nb_tracks; i++) {
+                cyanrip_track *t = &ctx->tracks[i];
+                if (ctx->settings.print_info_only) {
+                    cyanrip_log(ctx, 0, "Track %i info:\n", t->number);
+                    track_read_extra(ctx, t);
+                    cyanrip_log_track_end(ctx, t);
+
+                    if (atomic_load(&ctx->media_changed)) {
+                        cyanrip_log(ctx, 0, "Drive media changed, stopping!\n");
+                        break;
+                    }
+                } else if (t->restored) {
+                    restore_track(ctx, t);
+                } else {
+                    if (init_track(ctx, t) < 0) {
+                        ctx->total_error_count++;
+                        goto end;
+                    }
+
+                    if (cyanrip_rip_track(ctx, t))
+                        break;
+
+                    journal_finished_tracks(ctx);
+                }
+
+                if (crip_quit(ctx))
+                    break;
+            }
+
+            crip_reader_stream_stop(ctx);
+        }
+
+        if (!ctx->settings.print_info_only)
+            cyanrip_finalize_ebur128(ctx, 1);
+
+        if (ctx->settings.enable_replaygain &&
+            !ctx->settings.print_info_only) {
+            crip_replaygain_meta_album(ctx);
+
+            /* Tags of the files written so far only have placeholders */
+            for (int i = 0; i < ctx->nb_tracks; i++) {
+                cyanrip_track *t = &ctx->tracks[i];
+
+                if (t->track_is_data)
+                    continue;
+
+                if (cyanrip_update_replaygain(ctx, t) < 0)
+                    ctx->total_error_count++;
+            }
+        }
+    } else {
+        for (int i = 0; i < ctx->settings.rip_indices_count; i++) {
+            idx = ctx->settings.rip_indices[i];
+
+            /* Verify all indices */
+            int j = 0;
+            for (; j < ctx->nb_tracks; j++) {
+                if (ctx->tracks[j].number == idx)
+                    break;
+            }
+            if (j >= ctx->nb_tracks) {
+                cyanrip_log(ctx, 0, "Invalid rip index %i, list has %i tracks!\n",
+                            idx, ctx->nb_tracks);
+                ctx->total_error_count++;
+                goto end;
+            }
+
+            if (!ctx->tracks[j].restored)
+                ctx->frames_to_read += ctx->tracks[j].frames;
+        }
+
+        /**
+         * Print-only mode, if requested.
+         */
+        if (ctx->settings.print_info_only) {
+            for (int i = 0; i < ctx->settings.rip_indices_count; i++) {
+                idx = ctx->settings.rip_indices[i];
+
+                int j = 0;
+                for (; j < ctx->nb_tracks; j++) {
+                    if (ctx->tracks[j].number == idx)
+                        break;
+                }
+
+                cyanrip_track *t = &ctx->tracks[j];
+
+                cyanrip_log(ctx, 0, "Track %i info:\n", t->number);
+                track_read_extra(ctx, t);
+                cyanrip_log_track_end(ctx, t);
+
+                if (atomic_load(&ctx->media_changed)) {
+                    cyanrip_log(ctx, 0, "Drive media changed, stopping!\n");
+                    break;
+                }
+            }
+
+            goto end;
+        }
+
+        cyanrip_initialize_ebur128(ctx);
+
+        /**
+         * Rip tracks.
+         */
+        cyanrip_track *tracks[FF_ARRAY_ELEMS(ctx->tracks)];
+        for (int i = 0; i < ctx->settings.rip_indices_count; i++) {
+            int j = 0;
+            while (ctx->tracks[j].number != ctx->settings.rip_indices[i])
+                j++;
+            tracks[i] = &ctx->tracks[j];
+        }
+
+        if (tracks_parallel(ctx)) {
+            if (rip_tracks_parallel(ctx, tracks, ctx->settings.rip_indices_count) < 0) {
+                ctx->total_error_count++;
+                goto end;
+            }
+        } else {
+            stream_tracks(ctx, tracks, ctx->settings.rip_indices_count);
+
+            for (int i = 0; i < ctx->settings.rip_indices_count; i++) {
+                idx = ctx->settings.rip_indices[i];
+
+                int j = 0;
+                for (; j < ctx->nb_tracks; j++) {
+                    if (ctx->tracks[j].number == idx)
+                        break;
+                }
+
+                cyanrip_track *t = &ctx->tracks[j];
+
+                if (t->restored) {
+                    restore_track(ctx, t);
+                    continue;
+                }
+
+                int ret = init_track(ctx, t);
+                if (ret < 0) {
+                    ctx->total_error_count++;
+                    goto end;
+                }
+
+                /* Rip */
+                ret = cyanrip_rip_track(ctx, t);
+                if (ret < 0) {
+                    cyanrip_log(ctx, 0, "Error ripping: %s\n", av_err2str(ret));
+                    goto end;
+                }
+
+                journal_finished_tracks(ctx);
+
+                if (crip_quit(ctx))
+                    break;
+            }
+
+            crip_reader_stream_stop(ctx);
+        }
+
+        cyanrip_finalize_ebur128(ctx, 1);
+
+        if (ctx->settings.enable_replaygain) {
+            crip_replaygain_meta_album(ctx);
+
+            /* Tags of the files written so far only have placeholders */
+            for (int i = 0; i < ctx->settings.rip_indices_count; i++) {
+                idx = ctx->settings.rip_indices[i];
+
+                int j = 0;
+                for (; j < ctx->nb_tracks; j++) {
+                    if (ctx->tracks[j].number == idx)
+                        break;
+                }
+
+                cyanrip_track *t = &ctx->tracks[j];
+
+                if (t->track_is_data)
+                    continue;
+
+                if (cyanrip_update_replaygain(ctx, t) < 0)
+                    ctx->total_error_count++;
+            }
+        }
+    }
+
+    if (ctx->archive) {
+        int err = crip_archive_close(&ctx->archive);
+        if (err < 0) {
+            cyanrip_log(ctx, 0, "Error writing archive image: %s\n", av_err2str(err));
+            ctx->total_error_count++;
+        }
+    }
+
+    if (!ctx->settings.print_info_only) {
+        crip_pressing_search(ctx);
+        cyanrip_log_finish_report(ctx);
+    }
+end:
+    /* Wait for the encoders to finish and collect their status */
+    for (int i = 0; i < ctx->nb_tracks; i++) {
+        cyanrip_track *t = &ctx->tracks[i];
+        int written = 0;
+        for (int j = 0; j < ctx->settings.outputs_num; j++) {
+            int ret = cyanrip_end_track_encoding(&t->enc_ctx[j]);
+            if (ret < 0)
+                ctx->total_error_count++;
+            else
+                written += ret;
+        }
+
+        /* Only now are all files written if ReplayGain is on */
+        if (t->ripped && written == ctx->settings.outputs_num)
+            crip_journal_track_done(ctx, t);
+    }
+    crip_journal_end(ctx);
+
+    cyanrip_log_end(ctx);
+    cyanrip_cue_end(ctx);
+
+    int err_cnt = ctx->total_error_count;
+
+    /* For the summary of all drives */
+    for (int i = 0; i < ctx->nb_tracks; i++) {
+        job->nb_tracks += ctx->tracks[i].ripped;
+        job->sectors += ctx->tracks[i].read_stats.sectors;
+        job->ar_verified += crip_ar_verified(&ctx->tracks[i]);
+    }
+    job->ar_status = ctx->ar_db_status;
+    if (ctx->rip_start)
+        job->rip_time = av_gettime_relative() - ctx->rip_start;
+    job->errors = err_cnt;
+
+    cyanrip_ctx_end(&ctx);
+
+    return !!err_cnt;
+}
+
+
+static void *job_thread(void *arg)
+{
+    CRIPJob *job = arg;
+    job->ret = rip_disc(job);
+    return NULL;
+}
+
+static void print_drive_summary(CRIPJob *jobs, int nb_jobs, char **devices)
+{
+    cyanrip_log(NULL, 0, "\nDrive summary:\n");
+    for (int i = 0; i < nb_jobs; i++) {
+        CRIPJob *job = &jobs[i];
+        double secs = job->rip_time / 1000000.0;
+        double mib = job->sectors * CDIO_CD_FRAMESIZE_RAW / (1024.0 * 1024.0);
+
+        cyanrip_log(NULL, 0, "    %s: %i track(s), %.1f MiB read", devices[i],
+                    job->nb_tracks, mib);
+        if (secs > 0.0)
+            cyanrip_log(NULL, 0, " in %.1fs, %.2f MiB/s (%.1fx)", secs, mib / secs,
+                        job->sectors / (secs * 75.0));
+        cyanrip_log(NULL, 0, "%s\n", job->errors ? ", with errors" : "");
+    }
+}
+
+/* Disc images of a batch are handed out in order to a few threads */
+typedef struct CRIPBatch {
+    CRIPJob *jobs;
+    int nb_jobs;
+    atomic_int next;
+} CRIPBatch;
+
+static void *batch_thread(void *arg)
+{
+    CRIPBatch *b = arg;
+    int idx;
+
+    while ((idx = atomic_fetch_add(&b->next, 1)) < b->nb_jobs) {
+        CRIPJob *job = &b->jobs[idx];
+        if (atomic_load(&job->shared->quit)) {
+            free(job->settings.dev_path);
+            job->skipped = 1;
+            job->ret = 1;
+            continue;
+        }
+        job->ret = rip_disc(job);
+    }
+
+    return NULL;
+}
+
+static int rip_batch(CRIPJob *jobs, int nb_jobs, int nb_threads)
+{
+    CRIPBatch b = { .jobs = jobs, .nb_jobs = nb_jobs };
+    int started = 0, ret = 0;
+
+    atomic_init(&b.next, 0);
+
+    nb_threads = FFMIN(nb_threads, nb_jobs);
+    pthread_t *threads = av_calloc(nb_threads, sizeof(*threads));
+    if (threads) {
+        for (; started < nb_threads; started++)
+            if (pthread_create(&threads[started], NULL, batch_thread, &b))
+                break;
+    }
+
+    /* Whatever's left if no thread could be started */
+    if (!started)
+        batch_thread(&b);
+
+    for (int i = 0; i < started; i++)
+        pthread_join(threads[i], NULL);
+    av_free(threads);
+
+    for (int i = 0; i < nb_jobs; i++)
+        ret |= jobs[i].ret;
+
+    return ret;
+}
+
+static void print_batch_summary(CRIPJob *jobs, int nb_jobs, char **images)
+{
+    int nb_ok = 0;
+
+    cyanrip_log(NULL, 0, "\nBatch summary:\n");
+    cyanrip_log(NULL, 0, "    %-7s %-12s %6s %8s %8s %8s %7s  %s\n", "Status", "AccurateRip",
+                "Tracks", "MiB", "Time (s)", "MiB/s", "Speed", "Image");
+    for (int i = 0; i < nb_jobs; i++) {
+        CRIPJob *job = &jobs[i];
+        double secs = job->rip_time / 1000000.0;
+        double mib = job->sectors * CDIO_CD_FRAMESIZE_RAW / (1024.0 * 1024.0);
+        char ar[32];
+
+        const char *status = job->skipped ? "skipped" :
+                             !job->opened ? "failed" :
+                             job->errors  ? "errors" : "ok";
+        nb_ok += job->opened && !job->ret;
+
+        switch (job->ar_status) {
+        case CYANRIP_ACCUDB_FOUND:
+            snprintf(ar, sizeof(ar), "%i/%i", job->ar_verified, job->nb_tracks);
+            break;
+        case CYANRIP_ACCUDB_NOT_FOUND: av_strlcpy(ar, "not found", sizeof(ar)); break;
+        case CYANRIP_ACCUDB_ERROR:     av_strlcpy(ar, "error", sizeof(ar));     break;
+        case CYANRIP_ACCUDB_MISMATCH:  av_strlcpy(ar, "mismatch", sizeof(ar));  break;
+        default:                       av_strlcpy(ar, "disabled", sizeof(ar));  break;
+        }
+        if (!job->opened)
+            av_strlcpy(ar, "-", sizeof(ar));
+
+        cyanrip_log(NULL, 0, "    %-7s %-12s %6i %8.1f %8.1f", status, ar, job->nb_tracks,
+                    mib, secs);
+        if (secs > 0.0)
+            cyanrip_log(NULL, 0, " %8.2f %6.1fx", mib / secs, job->sectors / (secs * 75.0));
+        else
+            cyanrip_log(NULL, 0, " %8s %7s", "-", "-");
+        cyanrip_log(NULL, 0, "  %s\n", images[i]);
+    }
+
+    cyanrip_log(NULL, 0, "%i of %i disc image(s) ripped without errors\n", nb_ok, nb_jobs);
+}
+
+int main(int argc, char **argv)
+{
+    cyanrip_ctx *ctx = NULL;
+    cyanrip_settings settings = { 0 };
+
+#ifdef _WIN32
+    setlocale(LC_ALL, ".UTF8");
+#endif
+
+    av_log_set_level(AV_LOG_QUIET);
+
+    if (signal(SIGINT, on_quit_signal) == SIG_ERR)
+        cyanrip_log(ctx, 0, "Can't init signal handler!\n");
+
+    /* Default settings */
+    settings.dev_path = NULL;
+    settings.folder_name_scheme = "{album}{if #releasecomment# > #0# (|releasecomment|)} [{format}]";
+    settings.track_name_scheme = "{if #totaldiscs# > #1#|disc|.}{track} - {title}";
+    settings.log_name_scheme = "{album}{if #totaldiscs# > #1# CD|disc|}";
+    settings.cue_name_scheme = "{album}{if #totaldiscs# > #1# CD|disc|}";
+    settings.sanitize_method = CRIP_SANITIZE_UNICODE;
+    settings.speed = 0;
+    settings.max_retries = 10;
+    settings.over_under_read_frames = 0;
+    settings.offset = 0;
+    settings.ripping_retries = 0;
+    settings.track_jobs = 0;
+    settings.print_info_only = 0;
+    settings.disable_mb = 0;
+    settings.disable_coverart_db = 0;
+    settings.coverart_lookup_size = COVERART_LOOKUP_SIZE_ORIGINAL;
+    settings.decode_hdcd = 0;
+    settings.deemphasis = 1;
+    settings.force_deemphasis = 0;
+    settings.bitrate = 256.0f;
+    settings.overread_leadinout = 0;
+    settings.rip_indices_count = -1;
+    settings.disable_accurip = 0;
+    settings.eject_on_success_rip = 0;
+    settings.frame_size = CRIP_FRAME_SAMPLES;
+    settings.chunked_flac = 0;
+    settings.write_archive = 0;
+    settings.cache_dir = NULL;
+    settings.cache_ttl = 30;
+    settings.offline = 0;
+    settings.outputs[0] = CYANRIP_FORMAT_FLAC;
+    settings.outputs_num = 1;
+    settings.disable_coverart_embedding = 0;
+    settings.enable_replaygain = 1;
+    settings.paranoia_level = FF_ARRAY_ELEMS(paranoia_level_map) - 1;
+
+    memset(settings.pregap_action, CYANRIP_PREGAP_DEFAULT, 198*sizeof(*settings.pregap_action));
+
+    int idx;
+    char *p_save, *p;
+    int mb_release_idx = -1;
+    char *mb_release_str = NULL;
+    int discnumber = 0, totaldiscs = 0;
+    char *album_metadata_ptr = NULL;
+    char *track_metadata_ptr[198] = { NULL };
+    int track_metadata_ptr_cnt = 0;
+    int find_drive_offset_range = 0;
+    int offset_set = 0;
+
+    CRIPArt cover_arts[32] = { 0 };
+    int nb_cover_arts = 0;
+
+    CRIPArt track_cover_arts[198] = { 0 };
+    int track_cover_arts_map[198] = { 0 };
+    int nb_track_cover_arts = 0;
+
+    snprintf(cyanrip_helpstr, sizeof(cyanrip_helpstr),
+             "cyanrip %s (%s)", PROJECT_VERSION_STRING, vcstag);
+
+    GEN_OPT_INIT(opts_list, 64);
+
+    GEN_OPT_SEC(opts_list, "Ripping options");
+    GEN_OPT_ARR(opts_list, char *,  device, "d", ',', 0, CRIP_MAX_DRIVES, 0, 0,
+                "Device path (can be a TOC file), or a comma separated list to rip several at once");
+    GEN_OPT_ARR(opts_list, int32_t, offset, "s", ',', 0, CRIP_MAX_DRIVES, INT32_MIN, INT32_MAX,
+                "CD drive offset in samples, or a list with one per device");
+    GEN_OPT_ONE(opts_list, char *,  batch, "i", 1, 1, NULL, 0, 0,
+                "Rip every disc image in a directory, or listed in a file (one per line)");
+    GEN_OPT_ONE(opts_list, int32_t, batch_jobs, "n", 1, 1, 2, 1, 64,
+                "Disc images of a batch ripped at once");
+    GEN_OPT_ONE(opts_list, int32_t, retries, "r", 1, 1, 10, 0, INT32_MAX,
+                "Maximum number of retries for frames and repeated rips");
+    GEN_OPT_ONE(opts_list, int32_t, repeat_rips, "Z", 1, 1, 0, 0, INT32_MAX,
+                "Re-read sectors until they match N times (for damaged CDs)");
+    GEN_OPT_ONE(opts_list, int32_t, speed, "S", 1, 1, 0, 0, INT32_MAX,
+                "Set drive speed");
+    GEN_OPT_ARR(opts_list, char *,  pregap, "p", 0, 0, 198, 0, 0,
+                "Track pregap handling: N=default|drop|merge|track (repeatable)");
+    GEN_OPT_ONE(opts_list, char *,  paranoia, "P", 1, 1, NULL, 0, 0,
+                "Paranoia level (0..max, or 'none'/'max')");
+    GEN_OPT_ONE(opts_list, char *,  strategy, "X", 1, 1, NULL, 0, 0,
+                "Rip strategy: secure, or burst (re-rip if AccurateRip fails)");
+    GEN_OPT_ONE(opts_list, bool,    overread, "O", 0, 0, 0, 0, 0,
+                "Enable overreading into lead-in and lead-out");
+    GEN_OPT_ONE(opts_list, bool,    hdcd, "H", 0, 0, 0, 0, 0,
+                "Enable HDCD decoding");
+    GEN_OPT_ONE(opts_list, bool,    force_deemphasis, "E", 0, 0, 0, 0, 0,
+                "Force CD deemphasis");
+    GEN_OPT_ONE(opts_list, bool,    no_deemphasis, "W", 0, 0, 0, 0, 0,
+                "Disable automatic CD deemphasis");
+    GEN_OPT_ONE(opts_list, bool,    no_replaygain, "K", 0, 0, 0, 0, 0,
+                "Disable ReplayGain tagging");
+    GEN_OPT_ONE(opts_list, char *,  resume, "y", 1, 1, NULL, 0, 0,
+                "Resume a rip from its journal: all, or failed (also re-rip tracks AccurateRip didn't verify)");
+    GEN_OPT_ONE(opts_list, int32_t, track_jobs, "j", 1, 1, 0, 0, 198,
+                "Tracks of a disc image processed at once (default: one per CPU)");
+
+    GEN_OPT_SEC(opts_list, "Output options");
+    GEN_OPT_ARR(opts_list, char *,  outputs, "o", ',', 0, 32, 0, 0,
+                "Comma separated list of output formats ('help' lists all)");
+    GEN_OPT_ONE(opts_list, float,   bitrate, "b", 1, 1, 256.0f, 0.0f, 10000.0f,
+                "Bitrate of lossy files in kbps");
+    GEN_OPT_ONE(opts_list, int32_t, frame_size, "B", 1, 1, CRIP_FRAME_SAMPLES, 588, 65536,
+                "Samples per frame sent to the filters and encoders");
+    GEN_OPT_ONE(opts_list, bool,    chunked_flac, "k", 0, 0, 0, 0, 0,
+                "Encode each FLAC file in chunks on all threads (bit-identical)");
+    GEN_OPT_ONE(opts_list, bool,    archive, "w", 0, 0, 0, 0, 0,
+                "Also write a compressed, seekable image of the whole disc");
+    GEN_OPT_ONE(opts_list, char *,  folder_scheme, "D", 1, 1,
+                settings.folder_name_scheme, 0, 0,
+                "Directory naming scheme");
+    GEN_OPT_ONE(opts_list, char *,  track_scheme, "F", 1, 1,
+                settings.track_name_scheme, 0, 0,
+                "Track naming scheme");
+    GEN_OPT_ONE(opts_list, char *,  log_scheme, "L", 1, 1,
+                settings.log_name_scheme, 0, 0,
+                "Log file name scheme");
+    GEN_OPT_ONE(opts_list, char *,  cue_scheme, "M", 1, 1,
+                settings.cue_name_scheme, 0, 0,
+                "CUE file name scheme");
+    GEN_OPT_ARR(opts_list, int32_t, tracks, "l", ',', 0, 198, 0, 198,
+                "Comma separated list of tracks to rip (default: all)");
+    GEN_OPT_ONE(opts_list, char *,  sanitize, "T", 1, 1, NULL, 0, 0,
+                "Filename sanitation: simple, os_simple, unicode, os_unicode");
+
+    GEN_OPT_SEC(opts_list, "Metadata options");
+    GEN_OPT_ONE(opts_list, bool,    info, "I", 0, 0, 0, 0, 0,
+                "Only print CD and track info");
+    GEN_OPT_ONE(opts_list, bool,    cue_only, "J", 0, 0, 0, 0, 0,
+                "Only generate and print a CUE sheet, don't rip");
+    GEN_OPT_ONE(opts_list, char *,  album_meta, "a", 1, 1, NULL, 0, 0,
+                "Album metadata, key=value:key=value");
+    GEN_OPT_ARR(opts_list, char *,  track_meta, "t", 0, 0, 198, 0, 0,
+                "Track metadata as N=key=value:key=value (repeatable)");
+    GEN_OPT_ONE(opts_list, char *,  release, "R", 1, 1, NULL, 0, 0,
+                "MusicBrainz release: 1-based index or ID string");
+    GEN_OPT_ONE(opts_list, char *,  disc, "c", 1, 1, NULL, 0, 0,
+                "Multi-disc tag: disc/totaldiscs");
+    GEN_OPT_ARR(opts_list, char *,  cover, "C", 0, 0, 32, 0, 0,
+                "Cover art: title=path (or N=path per-track, repeatable)");
+    GEN_OPT_ONE(opts_list, bool,    no_musicbrainz, "N", 0, 0, 0, 0, 0,
+                "Disable MusicBrainz lookup");
+    GEN_OPT_ONE(opts_list, bool,    no_accurip, "A", 0, 0, 0, 0, 0,
+                "Disable AccurateRip database query and validation");
+    GEN_OPT_ONE(opts_list, bool,    no_coverart_db, "U", 0, 0, 0, 0, 0,
+                "Disable Cover art DB query and retrieval");
+    GEN_OPT_ONE(opts_list, int32_t, cover_size, "m", 1, 1, -1, -1, 1200,
+                "Cover art max size: 250, 500, 1200, or -1 for original");
+    GEN_OPT_ONE(opts_list, bool,    no_coverart_embed, "G", 0, 0, 0, 0, 0,
+                "Disable embedding of cover art images");
+    GEN_OPT_ONE(opts_list, char *,  cache_dir, "g", 1, 1, NULL, 0, 0,
+                "Directory to cache lookup results in");
+    GEN_OPT_ONE(opts_list, int32_t, cache_ttl, "u", 1, 1, 30, 0, INT32_MAX,
+                "Days after which cached lookups are redone, 0 to keep them forever");
+    GEN_OPT_ONE(opts_list, bool,    offline, "x", 0, 0, 0, 0, 0,
+                "Only use cached lookups (requires -g)");
+
+    GEN_OPT_SEC(opts_list, "Misc. options");
+    GEN_OPT_ONE(opts_list, bool,    eject, "Q", 0, 0, 0, 0, 0,
+                "Eject tray once successfully done");
+    GEN_OPT_ONE(opts_list, bool,    find_offset, "f", 0, 0, 0, 0, 0,
+                "Find drive offset (requires a disc with an AccuRip entry)");
+    GEN_OPT_ONE(opts_list, char *,  verify_log, "Y", 1, 1, NULL, 0, 0,
+                "Verify a rip log's FUN512 checksum");
+
+    {
+        int r = GEN_OPT_PARSE(NULL, opts_list, argc, argv);
+        if (r == -EAGAIN)
+            return 0;
+        if (r < 0)
+            return 1;
+    }
+
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-s") || !strcmp(argv[i], "--offset")) {
+            offset_set = 1;
+            break;
+        }
+    }
+
+    if (verify_log) {
+        switch (cyanrip_verify_log(verify_log)) {
+        case CRIP_LOG_VALID:
+            cyanrip_log(NULL, 0, "Log \"%s\" checksum valid.\n", verify_log);
+            return 0;
+        case CRIP_LOG_MISMATCH:
+            cyanrip_log(NULL, 0, "Log \"%s\" checksum mismatch, "
+                        "the file has been modified!\n", verify_log);
+            break;
+        case CRIP_LOG_TRAILING_DATA:
+            cyanrip_log(NULL, 0, "Log \"%s\" has data after the checksum, "
+                        "the file has been modified!\n", verify_log);
+            break;
+        case CRIP_LOG_NO_CHECKSUM:
+            cyanrip_log(NULL, 0, "No FUN512 checksum found in \"%s\"!\n",
+                        verify_log);
+            break;
+        case CRIP_LOG_IO_ERROR:
+            cyanrip_log(NULL, 0, "Couldn't read \"%s\"!\n", verify_log);
+            break;
+        }
+        return 1;
+    }
+
+    int nb_devices = genopt_nb_vals(opts_list, opts_list_nb, "device");
+    int nb_offsets = genopt_nb_vals(opts_list, opts_list_nb, "offset");
+    if (nb_offsets > 1 && nb_offsets != nb_devices) {
+        cyanrip_log(ctx, 0, "Got %i offsets for %i devices, give either one "
+                    "offset for all, or one per device!\n", nb_offsets, nb_devices);
+        return 1;
     }
 
-    /* Create log file */
-    if (!ctx->settings.print_info_only) {
-        if (!ctx->settings.generate_cue_only && cyanrip_log_init(ctx))
-            return 1;
-        if (cyanrip_cue_init(ctx))
+    char **images = NULL;
+    int nb_images = 0;
+    if (batch) {
+        if (nb_devices) {
+            cyanrip_log(ctx, 0, "-i (batch) cannot be used with -d!\n");
             return 1;
-    } else {
-        cyanrip_log(ctx, 0, "Log(s) will be written to:\n");
-        for (int f = 0; f < ctx->settings.outputs_num; f++) {
-            char *logfile = crip_get_path(ctx, CRIP_PATH_LOG, 0,
-                                          &crip_fmt_info[ctx->settings.outputs[f]],
-                                          NULL);
-            cyanrip_log(ctx, 0, "    %s\n", logfile);
-            av_free(logfile);
         }
-        cyanrip_log(ctx, 0, "CUE files will be written to:\n");
-        for (int f = 0; f < ctx->settings.outputs_num; f++) {
-            char *cuefile = crip_get_path(ctx, CRIP_PATH_CUE, 0,
-                                          &crip_fmt_info[ctx->settings.outputs[f]],
-                                          NULL);
-            cyanrip_log(ctx, 0, "    %s\n", cuefile);
-            av_free(cuefile);
+
+        int err = crip_batch_list(batch, &images, &nb_images);
+        if (err < 0) {
+            cyanrip_log(ctx, 0, "Unable to list disc images in \"%s\": %s!\n",
+                        batch, av_err2str(err));
+            return 1;
+        } else if (!nb_images) {
+            cyanrip_log(ctx, 0, "No disc images found in \"%s\"!\n", batch);
+            return 1;
         }
     }
 
-    cyanrip_log_start_report(ctx);
-    if (!ctx->settings.print_info_only)
-        cyanrip_cue_start(ctx);
-    setup_track_offsets_and_report(ctx);
-
-    copy_album_to_track_meta(ctx);
-
-    /* Read user track metadata */
-    for (int i = 0; i < track_metadata_ptr_cnt; i++) {
-        if (!track_metadata_ptr[i])
-            continue;
+    set_offset(&settings, offset[0]);
 
-        char *end = NULL;
-        int u_nb = strtol(track_metadata_ptr[i], &end, 10);
-
-        /* Verify all indices */
-        int track_idx = 0;
-        for (; track_idx < ctx->nb_tracks; track_idx++) {
-            if (ctx->tracks[track_idx].number == u_nb)
-                break;
-        }
-        if (track_idx >= ctx->nb_tracks) {
-            cyanrip_log(ctx, 0, "Invalid track number %i, list has %i tracks!\n",
-                        u_nb, ctx->nb_tracks);
-            ctx->total_error_count++;
-            goto end;
-        }
+    settings.max_retries                = retries;
+    settings.ripping_retries            = repeat_rips;
+    settings.track_jobs                 = track_jobs ? track_jobs : av_cpu_count();
+    settings.speed                      = speed;
+    settings.bitrate                    = bitrate;
+    settings.frame_size                 = frame_size;
+    settings.chunked_flac               = chunked_flac;
+    settings.write_archive              = archive;
+    settings.overread_leadinout         = overread;
+    settings.decode_hdcd                = hdcd;
+    settings.force_deemphasis           = force_deemphasis;
+    settings.deemphasis                 = !no_deemphasis;
+    settings.enable_replaygain          = !no_replaygain;
+    settings.disable_mb                 = no_musicbrainz;
+    settings.disable_accurip            = no_accurip;
+    settings.disable_coverart_db        = no_coverart_db;
+    settings.disable_coverart_embedding = no_coverart_embed;
+    settings.cache_dir                  = cache_dir;
+    settings.cache_ttl                  = cache_ttl;
+    settings.offline                    = offline;
+    settings.print_info_only            = info;
+    settings.generate_cue_only          = cue_only;
+    settings.eject_on_success_rip       = eject;
+    settings.folder_name_scheme         = folder_scheme;
+    settings.track_name_scheme          = track_scheme;
+    settings.log_name_scheme            = log_scheme;
+    settings.cue_name_scheme            = cue_scheme;
 
-        end += 1; /* Move past equal sign */
+    find_drive_offset_range = find_offset ? 6 : 0;
 
-        /* Fixup */
-        char *copy = append_missing_keys(end, "title=", "artist=");
+    /* Discs ripped at once split the CPUs between them */
+    if (batch && !track_jobs)
+        settings.track_jobs = FFMAX(av_cpu_count() / FFMIN(batch_jobs, nb_images), 1);
+    album_metadata_ptr = album_meta;
 
-        /* Parse */
-        int err = av_dict_parse_string(&ctx->tracks[track_idx].meta,
-                                       copy, "=", ":", 0);
-        av_free(copy);
-        if (err) {
-            cyanrip_log(ctx, 0, "Error reading track tags: %s\n",
-                        av_err2str(err));
-            ctx->total_error_count++;
-            goto end;
+    if (paranoia) {
+        if (!strcmp(paranoia, "none"))
+            settings.paranoia_level = 0;
+        else if (!strcmp(paranoia, "max"))
+            settings.paranoia_level = crip_max_paranoia_level;
+        else
+            settings.paranoia_level = (int)strtol(paranoia, NULL, 10);
+        if (settings.paranoia_level < 0 ||
+            settings.paranoia_level > crip_max_paranoia_level) {
+            cyanrip_log(ctx, 0,
+                        "Invalid paranoia level %i must be between 0 and %i!\n",
+                        settings.paranoia_level, crip_max_paranoia_level);
+            return 1;
         }
     }
 
-    /* Only generate the CUE sheet, print it, and exit */
-    if (ctx->settings.generate_cue_only) {
-        for (int i = 0; i < ctx->nb_tracks; i++) {
-            cyanrip_track *t = &ctx->tracks[i];
-            track_read_extra(ctx, t); /* ISRC and preemphasis flags */
-            cyanrip_cue_track(ctx, t);
-        }
-
-        /* Print it to the terminal too. The log files were never
-         * opened in this mode, so this only goes to stdout. */
-        if (ctx->cuefile[0]) {
-            char line[4096];
-            cyanrip_log(ctx, 0, "\n");
-            rewind(ctx->cuefile[0]);
-            while (fgets(line, sizeof(line), ctx->cuefile[0]))
-                cyanrip_log(ctx, 0, "%s", line);
+    if (strategy) {
+        if      (!strcmp(strategy, "secure")) settings.rip_strategy = CRIP_STRATEGY_SECURE;
+        else if (!strcmp(strategy, "burst"))  settings.rip_strategy = CRIP_STRATEGY_BURST;
+        else {
+            cyanrip_log(ctx, 0, "Invalid rip strategy %s\n", strategy);
+            return 1;
         }
-
-        goto end;
-    }
-
-    /* Copy track cover arts */
-    for (int i = 0; i < nb_track_cover_arts; i++) {
-        idx = track_cover_arts_map[i];
-        int track_idx = 0;
-        for (; track_idx < ctx->nb_tracks; track_idx++) {
-            if (ctx->tracks[track_idx].number == idx)
-                break;
+        if (settings.rip_strategy == CRIP_STRATEGY_BURST && settings.ripping_retries) {
+            cyanrip_log(ctx, 0, "The burst rip strategy can't be combined with repeat ripping!\n");
+            return 1;
         }
-        if (track_idx >= ctx->nb_tracks) {
-            cyanrip_log(ctx, 0, "Invalid track number %i, list has %i tracks!\n",
-                        idx, ctx->nb_tracks);
-            ctx->total_error_count++;
-            goto end;
+        if (settings.rip_strategy == CRIP_STRATEGY_BURST && settings.write_archive) {
+            cyanrip_log(ctx, 0, "The burst rip strategy can't be combined with an archive image!\n");
+            return 1;
         }
-        ctx->tracks[track_idx].art.source_url = av_strdup(track_cover_arts[i].source_url);
-        av_dict_set(&ctx->tracks[track_idx].art.meta, "title", "Front", 0);
     }
 
-    /* Track cover art (down)loading */
-    if (crip_fill_track_coverart(ctx, ctx->settings.print_info_only) < 0) {
-        ctx->total_error_count++;
-        goto end;
+    if (settings.offline && !settings.cache_dir) {
+        cyanrip_log(ctx, 0, "Offline mode (-x) requires a cache directory (-g)!\n");
+        return 1;
     }
 
-    /* Write non-track cover arts */
-    if (ctx->nb_cover_arts) {
-        cyanrip_log(ctx, 0, "Cover art destination(s):\n");
-        for (int f = 0; f < ctx->settings.outputs_num; f++) {
-            for (int i = 0; i < ctx->nb_cover_arts; i++) {
-                char *file = crip_get_path(ctx, CRIP_PATH_COVERART, 0,
-                                           &crip_fmt_info[ctx->settings.outputs[f]],
-                                           &ctx->cover_arts[i]);
-                cyanrip_log(ctx, 0, "    %s\n", file);
-                av_free(file);
-
-                if (!ctx->settings.print_info_only) {
-                    int err = crip_save_art(ctx, &ctx->cover_arts[i],
-                                            &crip_fmt_info[ctx->settings.outputs[f]]);
-                    if (err) {
-                        ctx->total_error_count++;
-                        goto end;
-                    }
-                }
-            }
+    if (resume) {
+        if      (!strcmp(resume, "all"))    settings.resume_mode = CRIP_RESUME_ALL;
+        else if (!strcmp(resume, "failed")) settings.resume_mode = CRIP_RESUME_FAILED;
+        else {
+            cyanrip_log(ctx, 0, "Invalid resume mode %s\n", resume);
+            return 1;
         }
-        cyanrip_log(ctx, 0, "\n");
     }
 
-    /* Warn if the naming scheme sends multiple tracks to the same file */
-    if (!ctx->settings.print_info_only) {
-        for (int f = 0; f < ctx->settings.outputs_num; f++) {
-            const cyanrip_out_fmt *cfmt = &crip_fmt_info[ctx->settings.outputs[f]];
-            char **paths = av_calloc(ctx->nb_tracks, sizeof(*paths));
-            if (!paths)
-                break;
-            for (int i = 0; i < ctx->nb_tracks; i++)
-                paths[i] = crip_get_path(ctx, CRIP_PATH_TRACK, 0, cfmt,
-                                         &ctx->tracks[i]);
-            for (int i = 0; i < ctx->nb_tracks; i++)
-                for (int j = i + 1; j < ctx->nb_tracks; j++)
-                    if (paths[i] && paths[j] && !strcmp(paths[i], paths[j]))
-                        cyanrip_log(ctx, 0, "WARNING: tracks %i and %i resolve to "
-                                    "the same file \"%s\", one will overwrite "
-                                    "the other!\n",
-                                    ctx->tracks[i].number, ctx->tracks[j].number,
-                                    paths[i]);
-            for (int i = 0; i < ctx->nb_tracks; i++)
-                av_free(paths[i]);
-            av_free(paths);
-        }
+    switch (cover_size) {
+    case -1:   settings.coverart_lookup_size = COVERART_LOOKUP_SIZE_ORIGINAL; break;
+    case 250:  settings.coverart_lookup_size = COVERART_LOOKUP_SIZE_250;      break;
+    case 500:  settings.coverart_lookup_size = COVERART_LOOKUP_SIZE_500;      break;
+    case 1200: settings.coverart_lookup_size = COVERART_LOOKUP_SIZE_1200;     break;
+    default:
+        cyanrip_log(ctx, 0,
+                    "Invalid max coverart size %i (must be 250, 500, 1200 or -1)\n",
+                    cover_size);
+        return 1;
     }
 
-    cyanrip_log(ctx, 0, "Tracks:\n");
-    if (ctx->settings.rip_indices_count == -1) {
-        ctx->frames_to_read = ctx->duration_frames;
-
-        if (!ctx->settings.print_info_only)
-            cyanrip_initialize_ebur128(ctx);
-
-        for (int i = 0; i < ctx->nb_tracks; i++) {
-            cyanrip_track *t = &ctx->tracks[i];
-            if (ctx->settings.print_info_only) {
-                cyanrip_log(ctx, 0, "Track %i info:\n", t->number);
-                track_read_extra(ctx, t);
-                cyanrip_log_track_end(ctx, t);
-
-                if (get_media_changed(ctx->cdio)) {
-                    cyanrip_log(ctx, 0, "Drive media changed, stopping!\n");
-                    break;
-                }
-            } else {
-                /* Initialize, unless the track is data, which is never
-                 * decoded or encoded */
-                if (!t->track_is_data) {
-                    /* Read ISRC and the preemphasis flags before creating
-                     * the decoder, which needs them to decide on deemphasis */
-                    track_read_extra(ctx, t);
-
-                    int ret = cyanrip_create_dec_ctx(ctx, &t->dec_ctx, t);
-                    if (ret < 0) {
-                        cyanrip_log(ctx, 0, "Error initializing decoder: %s\n", av_err2str(ret));
-                        ctx->total_error_count++;
-                        goto end;
-                    }
-
-                    for (int j = 0; j < ctx->settings.outputs_num; j++) {
-                        ret = cyanrip_init_track_encoding(ctx, &t->enc_ctx[j], t,
-                                                          ctx->settings.outputs[j]);
-                        if (ret < 0) {
-                            cyanrip_log(ctx, 0, "Error initializing encoder: %s\n", av_err2str(ret));
-                            ctx->total_error_count++;
-                            goto end;
-                        }
-                    }
-                }
-
-                if (cyanrip_rip_track(ctx, t))
-                    break;
-            }
-
-            if (quit_now)
-                break;
+    if (sanitize) {
+        if      (!strcmp(sanitize, "simple"))     settings.sanitize_method = CRIP_SANITIZE_SIMPLE;
+        else if (!strcmp(sanitize, "os_simple"))  settings.sanitize_method = CRIP_SANITIZE_OS_SIMPLE;
+        else if (!strcmp(sanitize, "unicode"))    settings.sanitize_method = CRIP_SANITIZE_UNICODE;
+        else if (!strcmp(sanitize, "os_unicode")) settings.sanitize_method = CRIP_SANITIZE_OS_UNICODE;
+        else {
+            cyanrip_log(ctx, 0, "Invalid sanitation method %s\n", sanitize);
+            return 1;
         }
+    }
 
-        if (!ctx->settings.print_info_only)
-            cyanrip_finalize_ebur128(ctx, 1);
-
-        if (ctx->settings.enable_replaygain &&
-            !ctx->settings.print_info_only) {
-            crip_replaygain_meta_album(ctx);
-
-            /**
-             * Writeout tracks.
-             */
-            for (int i = 0; i < ctx->nb_tracks; i++) {
-                cyanrip_track *t = &ctx->tracks[i];
-
-                if (t->track_is_data)
-                    continue;
-
-                for (int j = 0; j < ctx->settings.outputs_num; j++) {
-                    int ret = cyanrip_writeout_track(ctx, t->enc_ctx[j]);
-                    if (ret < 0) {
-                        cyanrip_log(ctx, 0, "Error encoding: %s\n", av_err2str(ret));
-                        goto end;
-                    }
-                }
-
-                if (quit_now)
-                    break;
-            }
-        }
-    } else {
-        for (int i = 0; i < ctx->settings.rip_indices_count; i++) {
-            idx = ctx->settings.rip_indices[i];
+    if (release) {
+        p = NULL;
+        mb_release_idx = strtol(release, &p, 10);
+        if (p != NULL && p[0] != ' ' && p[0] != '\0') {
+            mb_release_str = release;
+            mb_release_idx = -1;
+        } else if (mb_release_idx <= 0) {
+            cyanrip_log(ctx, 0, "Invalid release index %i!\n", mb_release_idx);
+            return 1;
+        }
+    }
 
-            /* Verify all indices */
-            int j = 0;
-            for (; j < ctx->nb_tracks; j++) {
-                if (ctx->tracks[j].number == idx)
-                    break;
+    if (disc) {
+        p = av_strtok(disc, "/", &p_save);
+        discnumber = strtol(p, NULL, 10);
+        if (discnumber <= 0) {
+            cyanrip_log(ctx, 0, "Invalid discnumber %i\n", discnumber);
+            return 1;
+        }
+        p = av_strtok(NULL, "/", &p_save);
+        if (p) {
+            totaldiscs = strtol(p, NULL, 10);
+            if (totaldiscs <= 0) {
+                cyanrip_log(ctx, 0, "Invalid totaldiscs %i\n", totaldiscs);
+                return 1;
             }
-            if (j >= ctx->nb_tracks) {
-                cyanrip_log(ctx, 0, "Invalid rip index %i, list has %i tracks!\n",
-                            idx, ctx->nb_tracks);
-                ctx->total_error_count++;
-                goto end;
+            if (discnumber > totaldiscs) {
+                cyanrip_log(ctx, 0,
+                            "discnumber %i is larger than totaldiscs %i\n",
+                            discnumber, totaldiscs);
+                return 1;
             }
-
-            ctx->frames_to_read += ctx->tracks[j].frames;
         }
+    }
 
-        /**
-         * Print-only mode, if requested.
-         */
-        if (ctx->settings.print_info_only) {
-            for (int i = 0; i < ctx->settings.rip_indices_count; i++) {
-                idx = ctx->settings.rip_indices[i];
-
-                int j = 0;
-                for (; j < ctx->nb_tracks; j++) {
-                    if (ctx->tracks[j].number == idx)
-                        break;
+    int nb_outputs = 0;
+    while (nb_outputs < 32 && outputs[nb_outputs])
+        nb_outputs++;
+    if (nb_outputs > 0) {
+        if (!strcmp(outputs[0], "help")) {
+            cyanrip_log(ctx, 0, "Supported output codecs:\n");
+            cyanrip_print_codecs();
+            return 0;
+        }
+        settings.outputs_num = 0;
+        for (int i = 0; i < nb_outputs; i++) {
+            int res = cyanrip_validate_fmt(outputs[i]);
+            if (res == -1) {
+                cyanrip_log(ctx, 0, "Invalid format \"%s\"\n", outputs[i]);
+                return 1;
+            }
+            for (int k = 0; k < settings.outputs_num; k++) {
+                if (settings.outputs[k] == res) {
+                    cyanrip_log(ctx, 0, "Duplicated format \"%s\"\n", outputs[i]);
+                    return 1;
                 }
+            }
+            settings.outputs[settings.outputs_num++] = res;
+        }
+    }
 
-                cyanrip_track *t = &ctx->tracks[j];
-
-                cyanrip_log(ctx, 0, "Track %i info:\n", t->number);
-                track_read_extra(ctx, t);
-                cyanrip_log_track_end(ctx, t);
-
-                if (get_media_changed(ctx->cdio)) {
-                    cyanrip_log(ctx, 0, "Drive media changed, stopping!\n");
-                    break;
+    int nb_track_indices = genopt_nb_vals(opts_list, opts_list_nb, "tracks");
+    if (nb_track_indices > 0) {
+        settings.rip_indices_count = 0;
+        for (int i = 0; i < nb_track_indices; i++) {
+            int t = tracks[i];
+            for (int k = 0; k < settings.rip_indices_count; k++) {
+                if (settings.rip_indices[k] == t) {
+                    cyanrip_log(ctx, 0, "Duplicated rip idx %i\n", t);
+                    return 1;
                 }
             }
+            settings.rip_indices[settings.rip_indices_count++] = t;
+        }
+        qsort(settings.rip_indices, settings.rip_indices_count,
+              sizeof(int), cmp_numbers);
+    }
 
-            goto end;
+    for (int i = 0; i < 198 && pregap[i]; i++) {
+        p = av_strtok(pregap[i], "=", &p_save);
+        idx = strtol(p, NULL, 10);
+        if (idx < 1 || idx > 197) {
+            cyanrip_log(ctx, 0, "Invalid track idx for pregap: %i\n", idx);
+            return 1;
         }
+        enum cyanrip_pregap_action act = CYANRIP_PREGAP_DEFAULT;
+        p = av_strtok(NULL, "=", &p_save);
+        if (!p) {
+            cyanrip_log(ctx, 0, "Missing pregap action\n");
+            return 1;
+        }
+        if      (!strncmp(p, "default", strlen("default"))) act = CYANRIP_PREGAP_DEFAULT;
+        else if (!strncmp(p, "drop",    strlen("drop")))    act = CYANRIP_PREGAP_DROP;
+        else if (!strncmp(p, "merge",   strlen("merge")))   act = CYANRIP_PREGAP_MERGE;
+        else if (!strncmp(p, "track",   strlen("track")))   act = CYANRIP_PREGAP_TRACK;
+        else {
+            cyanrip_log(ctx, 0, "Invalid pregap action %s\n", p);
+            return 1;
+        }
+        settings.pregap_action[idx - 1] = act;
+    }
 
-        cyanrip_initialize_ebur128(ctx);
+    for (int i = 0; i < 198 && track_meta[i]; i++)
+        track_metadata_ptr[track_metadata_ptr_cnt++] = track_meta[i];
 
-        /**
-         * Rip tracks.
-         */
-        for (int i = 0; i < ctx->settings.rip_indices_count; i++) {
-            idx = ctx->settings.rip_indices[i];
+    for (int i = 0; i < 32 && cover[i]; i++) {
+        /* Split on the first "=" only, paths may contain them */
+        char *next = strchr(cover[i], '=');
+        if (next)
+            *next++ = '\0';
+        p = cover[i];
+        CRIPArt *dst = NULL;
 
-            int j = 0;
-            for (; j < ctx->nb_tracks; j++) {
-                if (ctx->tracks[j].number == idx)
-                    break;
+        if (!next) {
+            int have_front = 0;
+            int have_back = 0;
+            for (int k = 0; k < nb_cover_arts; k++) {
+                if (!strcmp(cover_arts[k].title, "Front")) have_front = 1;
+                if (!strcmp(cover_arts[k].title, "Back"))  have_back  = 1;
             }
+            if (!have_front) {
+                next = p;
+                p = "Front";
+            } else if (!have_back) {
+                next = p;
+                p = "Back";
+            } else {
+                cyanrip_log(ctx, 0,
+                            "No cover art location specified for \"%s\"\n", p);
+                return 1;
+            }
+        }
 
-            cyanrip_track *t = &ctx->tracks[j];
-
-            /* Initialize, unless the track is data, which is never
-             * decoded or encoded */
-            int ret = 0;
-            if (!t->track_is_data) {
-                /* Read ISRC and the preemphasis flags before creating
-                 * the decoder, which needs them to decide on deemphasis */
-                track_read_extra(ctx, t);
-
-                ret = cyanrip_create_dec_ctx(ctx, &t->dec_ctx, t);
-                if (ret < 0) {
-                    cyanrip_log(ctx, 0, "Error initializing decoder: %s\n", av_err2str(ret));
-                    ctx->total_error_count++;
-                    goto end;
+        if (crip_is_integer(p)) {
+            idx = strtol(p, NULL, 10);
+            if (idx < 0 || idx > 198) {
+                cyanrip_log(ctx, 0,
+                            "Invalid track idx for cover art: %i\n", idx);
+                return 1;
+            }
+            for (int k = 0; k < nb_track_cover_arts; k++) {
+                if (track_cover_arts_map[k] == idx) {
+                    cyanrip_log(ctx, 0,
+                                "Cover art already specified for track idx %i!\n",
+                                idx);
+                    return 1;
                 }
-
-                for (j = 0; j < ctx->settings.outputs_num; j++) {
-                    ret = cyanrip_init_track_encoding(ctx, &t->enc_ctx[j], t,
-                                                      ctx->settings.outputs[j]);
-                    if (ret < 0) {
-                        cyanrip_log(ctx, 0, "Error initializing encoder: %s\n", av_err2str(ret));
-                        ctx->total_error_count++;
-                        goto end;
-                    }
+            }
+            track_cover_arts_map[nb_track_cover_arts] = idx;
+            dst = &track_cover_arts[nb_track_cover_arts++];
+            p = "title";
+        } else {
+            for (int k = 0; k < nb_cover_arts; k++) {
+                if (!strcmp(cover_arts[k].title, p)) {
+                    cyanrip_log(ctx, 0, "Cover art \"%s\" already specified!\n", p);
+                    return 1;
                 }
             }
-
-            /* Rip */
-            ret = cyanrip_rip_track(ctx, t);
-            if (ret < 0) {
-                cyanrip_log(ctx, 0, "Error ripping: %s\n", av_err2str(ret));
-                goto end;
+            dst = &cover_arts[nb_cover_arts++];
+            if (nb_cover_arts > 31) {
+                cyanrip_log(ctx, 0, "Too many cover arts specified!\n");
+                return 1;
             }
-
-            if (quit_now)
-                break;
         }
+        dst->source_url = next;
+        dst->title = p;
+    }
 
-        cyanrip_finalize_ebur128(ctx, 1);
 
-        if (ctx->settings.enable_replaygain) {
-            crip_replaygain_meta_album(ctx);
+    if (settings.outputs_num > 1 && !strstr(settings.folder_name_scheme, "{format}")) {
+        cyanrip_log(ctx, 0, "Directory name scheme must contain {format} with multiple output formats!\n");
+        return 1;
+    }
 
-            /**
-             * Writeout tracks.
-             */
-            for (int i = 0; i < ctx->settings.rip_indices_count; i++) {
-                idx = ctx->settings.rip_indices[i];
+    if (settings.print_info_only && settings.generate_cue_only) {
+        cyanrip_log(ctx, 0, "-J (only generate a CUE sheet) cannot be used with -I (only print info)!\n");
+        return 1;
+    }
 
-                int j = 0;
-                for (; j < ctx->nb_tracks; j++) {
-                    if (ctx->tracks[j].number == idx)
-                        break;
-                }
+    if (settings.generate_cue_only) {
+        /* No audio is read or checksummed, and no files to embed art into */
+        settings.disable_accurip = 1;
+        settings.disable_coverart_db = 1;
+    }
 
-                cyanrip_track *t = &ctx->tracks[j];
+    if (find_drive_offset_range) {
+        settings.disable_accurip = 0;
+        settings.disable_mb = 1;
+        settings.disable_coverart_db = 1;
+        set_offset(&settings, 0);
+        settings.eject_on_success_rip = 0;
+        cyanrip_log(ctx, 0, "Searching for drive offset, enabling AccuRip and disabling MusicBrainz and Cover art fetching...\n");
+    }
 
-                if (t->track_is_data)
-                    continue;
+    CRIPDiscOpts opts = {
+        .mb_release_idx = mb_release_idx,
+        .mb_release_str = mb_release_str,
+        .discnumber = discnumber,
+        .totaldiscs = totaldiscs,
+        .album_metadata_ptr = album_metadata_ptr,
+        .track_metadata_ptr = track_metadata_ptr,
+        .track_metadata_ptr_cnt = track_metadata_ptr_cnt,
+        .find_drive_offset_range = find_drive_offset_range,
+        .offset_set = offset_set,
+        .cover_arts = cover_arts,
+        .nb_cover_arts = nb_cover_arts,
+        .track_cover_arts = track_cover_arts,
+        .track_cover_arts_map = track_cover_arts_map,
+        .nb_track_cover_arts = nb_track_cover_arts,
+    };
+
+    int nb_jobs = batch ? nb_images : FFMAX(nb_devices, 1);
+    char **paths = batch ? images : device;
+    CRIPJob *jobs = av_calloc(nb_jobs, sizeof(*jobs));
+    if (!jobs) {
+        crip_batch_free(&images, nb_images);
+        return 1;
+    }
 
-                for (j = 0; j < ctx->settings.outputs_num; j++) {
-                    int ret = cyanrip_writeout_track(ctx, t->enc_ctx[j]);
-                    if (ret < 0) {
-                        cyanrip_log(ctx, 0, "Error encoding: %s\n", av_err2str(ret));
-                        goto end;
-                    }
-                }
+    /* Neither is safe to initialize from several threads at once */
+    curl_global_init(CURL_GLOBAL_DEFAULT);
+    cdio_init();
 
-                if (quit_now)
-                    break;
+    int ret = crip_enc_pool_init(&crip_shared.enc_pool, av_cpu_count());
+    if (ret >= 0) {
+        ret = crip_fetch_init(&crip_shared.fetch);
+        if (ret < 0)
+            crip_enc_pool_uninit(&crip_shared.enc_pool);
+    }
+    if (ret < 0) {
+        cyanrip_log(NULL, 0, "Unable to start the encoding and lookup threads: %s!\n",
+                    av_err2str(ret));
+        curl_global_cleanup();
+        crip_batch_free(&images, nb_images);
+        av_free(jobs);
+        return 1;
+    }
+    pthread_mutex_init(&crip_shared.mb_lock, NULL);
+
+    for (int i = 0; i < nb_jobs; i++) {
+        CRIPJob *job = &jobs[i];
+        job->settings = settings;
+        job->opts = &opts;
+        job->shared = &crip_shared;
+        if (nb_devices || batch)
+            job->settings.dev_path = strdup(paths[i]);
+        if (nb_offsets > 1 && !find_drive_offset_range)
+            set_offset(&job->settings, offset[i]);
+        if (nb_jobs > 1)
+            snprintf(job->log_prefix, sizeof(job->log_prefix), "[%s] ",
+                     av_basename(paths[i]));
+    }
+
+    ret = 0;
+    if (batch) {
+        ret = rip_batch(jobs, nb_jobs, batch_jobs);
+        print_batch_summary(jobs, nb_jobs, images);
+    } else if (nb_jobs == 1) {
+        ret = rip_disc(&jobs[0]);
+    } else {
+        for (int i = 0; i < nb_jobs; i++) {
+            if (pthread_create(&jobs[i].thread, NULL, job_thread, &jobs[i])) {
+                cyanrip_log(NULL, 0, "Unable to start ripping %s!\n", device[i]);
+                free(jobs[i].settings.dev_path);
+                jobs[i].ret = 1;
+                continue;
             }
+            jobs[i].thread_started = 1;
         }
-    }
 
-    if (!ctx->settings.print_info_only)
-        cyanrip_log_finish_report(ctx);
-end:
-    /* Wait for the encoders to finish and collect their status */
-    for (int i = 0; i < ctx->nb_tracks; i++) {
-        cyanrip_track *t = &ctx->tracks[i];
-        for (int j = 0; j < ctx->settings.outputs_num; j++)
-            if (cyanrip_end_track_encoding(&t->enc_ctx[j]) < 0)
-                ctx->total_error_count++;
-    }
+        for (int i = 0; i < nb_jobs; i++) {
+            if (jobs[i].thread_started)
+                pthread_join(jobs[i].thread, NULL);
+            ret |= jobs[i].ret;
+        }
 
-    cyanrip_log_end(ctx);
-    cyanrip_cue_end(ctx);
+        print_drive_summary(jobs, nb_jobs, device);
+    }
 
-    int err_cnt = ctx->total_error_count;
+    crip_fetch_uninit(&crip_shared.fetch);
+    crip_enc_pool_uninit(&crip_shared.enc_pool);
+    pthread_mutex_destroy(&crip_shared.mb_lock);
+    curl_global_cleanup();
 
-    cyanrip_ctx_end(&ctx);
+    crip_batch_free(&images, nb_images);
+    av_free(jobs);
 
-    return !!err_cnt;
+    return ret;
 }
 
 #ifdef HAVE_WMAIN
@@ -23,6 +23,8 @@
 #include <stdint.h>
 #include <string.h>
 #include <math.h>
+#include <pthread.h>
+#include <stdatomic.h>
 #include "../config.h"
 #include "version.h"
 
@@ -61,6 +63,25 @@ enum cyanrip_pregap_action {
     CYANRIP_PREGAP_TRACK,
 };
 
+enum CRIPRipStrategy {
+    CRIP_STRATEGY_SECURE = 0, /* Rip everything at the set paranoia level */
+    CRIP_STRATEGY_BURST, /* Burst rip first, securely re-rip what AccurateRip can't verify */
+};
+
+/* What a track ended up being ripped with */
+enum CRIPTrackStrategy {
+    CRIP_TRACK_SECURE = 0,
+    CRIP_TRACK_SECURE_NO_AR, /* Burst strategy, but track wasn't in the AccurateRip DB */
+    CRIP_TRACK_BURST, /* Burst rip verified by AccurateRip */
+    CRIP_TRACK_BURST_RERIPPED, /* Burst rip failed verification, re-ripped securely */
+};
+
+enum CRIPResumeMode {
+    CRIP_RESUME_NONE = 0,
+    CRIP_RESUME_ALL, /* Skip all tracks the journal has as done */
+    CRIP_RESUME_FAILED, /* Skip only those AccurateRip verified */
+};
+
 enum CRIPAccuDBStatus {
     CYANRIP_ACCUDB_DISABLED = 0,
     CYANRIP_ACCUDB_NOT_FOUND,
@@ -75,6 +96,8 @@ enum CRIPPathType {
     CRIP_PATH_DATA, /* arg must be a cyanrip_track * */
     CRIP_PATH_LOG, /* arg must be NULL */
     CRIP_PATH_CUE, /* arg must be NULL */
+    CRIP_PATH_JOURNAL, /* arg must be NULL */
+    CRIP_PATH_ARCHIVE, /* arg must be NULL */
 };
 
 enum CRIPSanitize {
@@ -114,13 +137,22 @@ typedef struct cyanrip_settings {
     int rip_indices_count;
     int rip_indices[198];
     int paranoia_level;
+    enum CRIPRipStrategy rip_strategy;
+    enum CRIPResumeMode resume_mode;
     int deemphasis;
     int force_deemphasis;
     int ripping_retries;
+    int track_jobs; /* Tracks of a mapped image processed at once */
     int disable_coverart_embedding;
     enum coverart_lookup_sizes coverart_lookup_size;
     int enable_replaygain;
     int generate_cue_only;
+    int frame_size;
+    int chunked_flac;
+    int write_archive; /* Also write a compressed image of the whole disc */
+    char *cache_dir; /* Lookups are cached if set */
+    int cache_ttl; /* Days cached lookups stay valid, 0 for forever */
+    int offline; /* Only use cached lookups */
 
     enum cyanrip_output_formats outputs[CYANRIP_FORMATS_NB];
     int outputs_num;
@@ -132,6 +164,20 @@ typedef struct CRIPAccuDBEntry {
     uint32_t checksum_450;
 } CRIPAccuDBEntry;
 
+typedef struct CRIPPressingMatch {
+    int offset; /* Relative to this rip, in samples */
+    int confidence;
+    int partial; /* Only the 450th sector matched */
+} CRIPPressingMatch;
+
+typedef struct CRIPReaderStats {
+    int64_t sectors; /* Sectors which went through the read ring */
+    int64_t depth_sum; /* Sum of the ring depth, sampled once per sector */
+    int max_depth;
+    int64_t reader_waits; /* Times the drive had to wait for processing */
+    int64_t consumer_waits; /* Times processing had to wait for the drive */
+} CRIPReaderStats;
+
 typedef struct CRIPArt {
     AVDictionary *meta;
     char *source_url;
@@ -150,6 +196,12 @@ typedef struct cyanrip_track {
     int cd_track_number; /* Actual track on the CD, may be 0 */
     AVDictionary *meta; /* Disc's AVDictionary gets copied here */
     int total_repeats; /* How many times the track was re-ripped */
+    int reread_sectors; /* Sectors read again after the first pass, repeat rips only */
+    int disputed_sectors; /* Sectors which did not match often enough, repeat rips only */
+    int ripped; /* Ripped during this run */
+    int restored; /* Done in an earlier, interrupted run, not ripped again */
+    int journaled; /* Recorded as done in the journal */
+    enum CRIPTrackStrategy strategy;
     int index; /* Array position + 1 */
 
     int track_is_data;
@@ -163,6 +215,7 @@ typedef struct cyanrip_track {
     int frames_after_disc_end;
 
     lsn_t pregap_lsn;
+    lsn_t nominal_start_lsn; /* Where the samples begin, before offsets */
     lsn_t start_lsn;
     lsn_t start_lsn_sig;
     lsn_t end_lsn;
@@ -189,6 +242,11 @@ typedef struct cyanrip_track {
     int ar_db_nb_entries;
     int ar_db_max_confidence;
 
+    /* Matches at other offsets, when not verified at this one */
+    struct CRIPPressing *pressing;
+    CRIPPressingMatch pressing_matches[4];
+    int nb_pressing_matches;
+
     /* EBUR128 values */
     double ebu_integrated;
     double ebu_range;
@@ -197,6 +255,9 @@ typedef struct cyanrip_track {
     double ebu_sample_peak;
     double ebu_true_peak;
     double sample_peak_rel_amp; /* Relative amplitude of the largest sample absolute value, (0.0-1.0) */
+    struct CRIPLoudnessStats *loudness; /* For the album, until journaled or restored */
+
+    CRIPReaderStats read_stats;
 
     struct cyanrip_track *pt;
     struct cyanrip_track *nt;
@@ -205,12 +266,33 @@ typedef struct cyanrip_track {
     struct cyanrip_enc_ctx *enc_ctx[CYANRIP_FORMATS_NB];
 } cyanrip_track;
 
+/* State shared by all drives ripping at once */
+typedef struct CRIPShared {
+    atomic_int quit; /* Set once the user has asked cyanrip to quit */
+
+    /* Workers encoding the tracks of all drives, one per CPU */
+    struct CRIPEncPool *enc_pool;
+
+    /* Lookups of all drives, over connections kept open between them */
+    struct CRIPFetch *fetch;
+
+    /* MusicBrainz queries, which are rate limited per client */
+    pthread_mutex_t mb_lock;
+    int64_t mb_last_query;
+} CRIPShared;
+
 typedef struct cyanrip_ctx {
+    CRIPShared        *shared;
     cdrom_drive_t     *drive;
     cdrom_paranoia_t  *paranoia;
     CdIo_t            *cdio;
+    struct CRIPImage  *image; /* Mapped audio of disc images */
+    struct CRIPReader *stream; /* Reads the disc for all tracks, if set */
+    struct CRIPArchive *archive; /* Archival image of the disc, if set */
+    struct CRIPNaming *naming; /* Compiled naming schemes and paths worked out */
     FILE              *logfile[CYANRIP_FORMATS_NB];
     FILE              *cuefile[CYANRIP_FORMATS_NB];
+    FILE              *journal;
     cyanrip_settings   settings;
 
     cyanrip_track tracks[198];
@@ -232,10 +314,22 @@ typedef struct cyanrip_ctx {
     /* Metadata */
     AVDictionary *meta;
     enum CRIPAccuDBStatus ar_db_status;
+    struct CRIPFetchReq *ar_req; /* AccurateRip lookup, until it's parsed */
 
     /* State */
     int success;
     int total_error_count;
+    uint64_t paranoia_status[PARANOIA_CB_FINISHED + 1];
+
+    /* Drive events, polled by a separate thread */
+    struct CRIPMonitor *monitor;
+    atomic_int media_changed;
+    atomic_int media_polls;
+    atomic_int media_changes;
+    int media_poll_interval; /* 0 if the drive can't report media changes */
+    int64_t rip_start; /* When ripping began, for the drive summary */
+    pthread_t spin_up_thread; /* Reading the first sector during the lookups */
+    int spinning_up;
     lsn_t start_lsn;
     lsn_t end_lsn;
     lsn_t duration_frames;
@@ -245,14 +339,21 @@ typedef struct cyanrip_ctx {
     lsn_t frames_read;
     lsn_t frames_to_read;
 
-    /* Album EBUR128 values */
-    struct cyanrip_dec_ctx *peak_ctx;
+    /* Resamplers of finished tracks, for the next ones */
+    struct cyanrip_enc_cache *enc_cache;
+
+    /* Album EBUR128 values, from merging those of the tracks */
+    struct CRIPLoudnessStats *album_loudness;
     double ebu_integrated;
     double ebu_range;
     double ebu_lra_low;
     double ebu_lra_high;
     double ebu_sample_peak;
     double ebu_true_peak;
+
+    /* Terminal output, prefixed with the drive when ripping several */
+    char log_prefix[32];
+    int log_line_start;
 } cyanrip_ctx;
 
 typedef struct cyanrip_out_fmt {
@@ -268,8 +369,19 @@ typedef struct cyanrip_out_fmt {
 
 extern const cyanrip_out_fmt crip_fmt_info[];
 
+/* Schemes are compiled on first use, and paths are only worked out again if
+ * the metadata they're made of changed. Thread-safe. */
 char *crip_get_path(cyanrip_ctx *ctx, enum CRIPPathType type, int create_dirs,
                     const cyanrip_out_fmt *fmt, void *arg);
+void crip_naming_free(cyanrip_ctx *ctx);
+
+/* Set of paths, to find files a naming scheme gives the same name */
+typedef struct CRIPPathSet CRIPPathSet;
+CRIPPathSet *crip_path_set_alloc(void);
+/* Returns 1 and the owner it was added by if the path's already there,
+ * otherwise adds it and returns 0 */
+int crip_path_set_add(CRIPPathSet *s, const char *path, int owner, int *prev_owner);
+void crip_path_set_free(CRIPPathSet **s);
 
 /* Prepend key1= and key2= to the first two keyless entries of a
  * key=value:key=value string, minding escapes. Key 1 and 2 must be set. */
@@ -277,8 +389,9 @@ char *append_missing_keys(const char *src, const char *key1, const char *key2);
 
 int crip_is_integer(const char *src);
 
-extern uint64_t paranoia_status[PARANOIA_CB_FINISHED + 1];
 extern const int crip_max_paranoia_level;
 
-/* Set once the user has asked cyanrip to quit */
-extern int quit_now;
+static inline int crip_quit(cyanrip_ctx *ctx)
+{
+    return atomic_load(&ctx->shared->quit);
+}
@@ -0,0 +1,287 @@
+/*
+ * This file is part of cyanrip.
+ *
+ * cyanrip is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * cyanrip is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with cyanrip; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include <pthread.h>
+
+#include <libavutil/error.h>
+#include <libavutil/mem.h>
+
+#include "enc_pool.h"
+
+enum CRIPEncJobState {
+    JOB_IDLE = 0, /* Waiting for a kick */
+    JOB_QUEUED,
+    JOB_RUNNING,
+    JOB_RERUN,    /* Kicked while running */
+    JOB_FINISHED,
+};
+
+/* Jobs are linked through their next field, each is in one queue at most */
+typedef struct CRIPEncQueue {
+    pthread_mutex_t lock;
+    CRIPEncJob *head;
+    CRIPEncJob *tail;
+} CRIPEncQueue;
+
+typedef struct CRIPEncWorker {
+    CRIPEncPool *pool;
+    int idx;
+    pthread_t thread;
+    int thread_started;
+    CRIPEncQueue queue;
+} CRIPEncWorker;
+
+struct CRIPEncPool {
+    CRIPEncWorker *workers;
+    int nb_workers;
+    atomic_int next_worker; /* Where new jobs go */
+
+    /* Sleeping works the same as in the frame ring */
+    pthread_mutex_t lock;
+    pthread_cond_t cond_work;
+    pthread_cond_t cond_finished;
+    atomic_int nb_queued;
+    atomic_int sleepers;
+    int quit;
+};
+
+static void queue_push(CRIPEncPool *s, CRIPEncJob *job)
+{
+    CRIPEncQueue *q = &s->workers[atomic_load(&job->worker)].queue;
+
+    job->next = NULL;
+    pthread_mutex_lock(&q->lock);
+    if (q->tail)
+        q->tail->next = job;
+    else
+        q->head = job;
+    q->tail = job;
+    pthread_mutex_unlock(&q->lock);
+
+    atomic_fetch_add(&s->nb_queued, 1);
+    if (atomic_load(&s->sleepers)) {
+        pthread_mutex_lock(&s->lock);
+        pthread_cond_signal(&s->cond_work);
+        pthread_mutex_unlock(&s->lock);
+    }
+}
+
+static CRIPEncJob *queue_pop(CRIPEncPool *s, CRIPEncQueue *q)
+{
+    pthread_mutex_lock(&q->lock);
+    CRIPEncJob *job = q->head;
+    if (job) {
+        q->head = job->next;
+        if (!q->head)
+            q->tail = NULL;
+    }
+    pthread_mutex_unlock(&q->lock);
+
+    if (job)
+        atomic_fetch_sub(&s->nb_queued, 1);
+
+    return job;
+}
+
+/* The worker's own queue first, then the others' */
+static CRIPEncJob *take_job(CRIPEncWorker *w)
+{
+    CRIPEncPool *s = w->pool;
+
+    for (int i = 0; i < s->nb_workers; i++) {
+        CRIPEncWorker *victim = &s->workers[(w->idx + i) % s->nb_workers];
+        CRIPEncJob *job = queue_pop(s, &victim->queue);
+        if (job)
+            return job;
+    }
+
+    return NULL;
+}
+
+static void run_job(CRIPEncWorker *w, CRIPEncJob *job)
+{
+    CRIPEncPool *s = w->pool;
+
+    atomic_store(&job->state, JOB_RUNNING);
+
+    for (;;) {
+        int ret = job->step(job);
+        if (ret == AVERROR(EAGAIN)) {
+            int state = JOB_RUNNING;
+            if (atomic_compare_exchange_strong(&job->state, &state, JOB_IDLE))
+                return;
+            atomic_store(&job->state, JOB_RUNNING);
+        } else if (!ret) {
+            /* Stays with the worker it last ran on */
+            atomic_store(&job->worker, w->idx);
+            atomic_store(&job->state, JOB_QUEUED);
+            queue_push(s, job);
+            return;
+        } else {
+            /* Whoever waits may free the job as soon as the lock is let go */
+            pthread_mutex_lock(&s->lock);
+            atomic_store(&job->state, JOB_FINISHED);
+            pthread_cond_broadcast(&s->cond_finished);
+            pthread_mutex_unlock(&s->lock);
+            return;
+        }
+    }
+}
+
+static void *worker_thread(void *arg)
+{
+    CRIPEncWorker *w = arg;
+    CRIPEncPool *s = w->pool;
+
+    for (;;) {
+        CRIPEncJob *job = take_job(w);
+        if (job) {
+            run_job(w, job);
+            continue;
+        }
+
+        pthread_mutex_lock(&s->lock);
+        atomic_fetch_add(&s->sleepers, 1);
+        while (!atomic_load(&s->nb_queued) && !s->quit)
+            pthread_cond_wait(&s->cond_work, &s->lock);
+        atomic_fetch_sub(&s->sleepers, 1);
+        int quit = s->quit;
+        pthread_mutex_unlock(&s->lock);
+
+        if (quit)
+            break;
+    }
+
+    return NULL;
+}
+
+int crip_enc_pool_init(CRIPEncPool **s, int nb_workers)
+{
+    CRIPEncPool *pool = av_mallocz(sizeof(*pool));
+    if (!pool)
+        return AVERROR(ENOMEM);
+
+    pool->workers = av_calloc(nb_workers, sizeof(*pool->workers));
+    if (!pool->workers) {
+        av_free(pool);
+        return AVERROR(ENOMEM);
+    }
+
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->cond_work, NULL);
+    pthread_cond_init(&pool->cond_finished, NULL);
+    atomic_init(&pool->next_worker, 0);
+    atomic_init(&pool->nb_queued, 0);
+    atomic_init(&pool->sleepers, 0);
+
+    /* Queues must all exist before any worker looks at them */
+    for (int i = 0; i < nb_workers; i++) {
+        pool->workers[i].pool = pool;
+        pool->workers[i].idx = i;
+        pthread_mutex_init(&pool->workers[i].queue.lock, NULL);
+    }
+    pool->nb_workers = nb_workers;
+
+    for (int i = 0; i < nb_workers; i++) {
+        int ret = pthread_create(&pool->workers[i].thread, NULL, worker_thread,
+                                 &pool->workers[i]);
+        if (ret) {
+            crip_enc_pool_uninit(&pool);
+            return AVERROR(ret);
+        }
+        pool->workers[i].thread_started = 1;
+    }
+
+    *s = pool;
+
+    return 0;
+}
+
+void crip_enc_pool_uninit(CRIPEncPool **s)
+{
+    if (!s || !*s)
+        return;
+
+    CRIPEncPool *pool = *s;
+
+    pthread_mutex_lock(&pool->lock);
+    pool->quit = 1;
+    pthread_cond_broadcast(&pool->cond_work);
+    pthread_mutex_unlock(&pool->lock);
+
+    /* Workers look at each other's queues until they've all stopped */
+    for (int i = 0; i < pool->nb_workers; i++)
+        if (pool->workers[i].thread_started)
+            pthread_join(pool->workers[i].thread, NULL);
+    for (int i = 0; i < pool->nb_workers; i++)
+        pthread_mutex_destroy(&pool->workers[i].queue.lock);
+
+    pthread_cond_destroy(&pool->cond_finished);
+    pthread_cond_destroy(&pool->cond_work);
+    pthread_mutex_destroy(&pool->lock);
+
+    av_free(pool->workers);
+    av_freep(s);
+}
+
+int crip_enc_pool_nb_workers(CRIPEncPool *s)
+{
+    return s->nb_workers;
+}
+
+void crip_enc_job_start(CRIPEncPool *s, CRIPEncJob *job,
+                        int (*step)(CRIPEncJob *job))
+{
+    job->step = step;
+    job->next = NULL;
+    atomic_init(&job->worker, atomic_fetch_add(&s->next_worker, 1) % s->nb_workers);
+    atomic_init(&job->state, JOB_QUEUED);
+    queue_push(s, job);
+}
+
+void crip_enc_job_kick(CRIPEncPool *s, CRIPEncJob *job)
+{
+    int state = atomic_load(&job->state);
+
+    for (;;) {
+        if (state == JOB_IDLE) {
+            if (atomic_compare_exchange_weak(&job->state, &state, JOB_QUEUED)) {
+                queue_push(s, job);
+                return;
+            }
+        } else if (state == JOB_RUNNING) {
+            if (atomic_compare_exchange_weak(&job->state, &state, JOB_RERUN))
+                return;
+        } else {
+            return;
+        }
+    }
+}
+
+int crip_enc_job_finished(CRIPEncJob *job)
+{
+    return atomic_load(&job->state) == JOB_FINISHED;
+}
+
+void crip_enc_job_wait(CRIPEncPool *s, CRIPEncJob *job)
+{
+    pthread_mutex_lock(&s->lock);
+    while (atomic_load(&job->state) != JOB_FINISHED)
+        pthread_cond_wait(&s->cond_finished, &s->lock);
+    pthread_mutex_unlock(&s->lock);
+}
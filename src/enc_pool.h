@@ -0,0 +1,62 @@
+/*
+ * This file is part of cyanrip.
+ *
+ * cyanrip is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * cyanrip is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with cyanrip; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#pragma once
+
+#include <stdatomic.h>
+
+/* A fixed set of worker threads, living as long as the process, which run
+ * the encoding jobs of every track of every drive. Jobs run in short steps
+ * rather than waiting for audio, so no job ever holds a worker up while
+ * another has work. Each worker has a queue of its own, and takes from the
+ * others' once it runs dry. */
+
+typedef struct CRIPEncPool CRIPEncPool;
+
+typedef struct CRIPEncJob {
+    /* Returns AVERROR(EAGAIN) to wait until kicked, 0 to be run again after
+     * the other queued jobs, anything else once the job is finished.
+     * Never runs on more than one worker at once. */
+    int (*step)(struct CRIPEncJob *job);
+
+    /* Private */
+    atomic_int state;
+    atomic_int worker;
+    struct CRIPEncJob *next;
+} CRIPEncJob;
+
+int crip_enc_pool_init(CRIPEncPool **s, int nb_workers);
+
+/* Jobs must all have finished */
+void crip_enc_pool_uninit(CRIPEncPool **s);
+
+int crip_enc_pool_nb_workers(CRIPEncPool *s);
+
+/* Queues the job's first step */
+void crip_enc_job_start(CRIPEncPool *s, CRIPEncJob *job,
+                        int (*step)(CRIPEncJob *job));
+
+/* Makes sure the job gets stepped, once more if it's running right now.
+ * Fine to call from any thread, as often as needed, until it's finished. */
+void crip_enc_job_kick(CRIPEncPool *s, CRIPEncJob *job);
+
+/* Returns 1 once the job is finished, and no worker touches it anymore */
+int crip_enc_job_finished(CRIPEncJob *job);
+
+/* Blocks until the job is finished */
+void crip_enc_job_wait(CRIPEncPool *s, CRIPEncJob *job);
@@ -0,0 +1,231 @@
+/*
+ * This file is part of cyanrip.
+ *
+ * cyanrip is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * cyanrip is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with cyanrip; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include <libavutil/common.h>
+#include <libavutil/error.h>
+#include <libavutil/mem.h>
+
+#include "../config.h"
+#include "fetch.h"
+
+struct CRIPFetch {
+    CURLM *multi;
+    pthread_t thread;
+    atomic_int stop;
+
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    CRIPFetchReq *pending; /* Started, not yet handed to curl */
+};
+
+/* Bigger Content-Lengths aren't trusted to preallocate */
+#define FETCH_MAX_PREALLOC (64 << 20)
+
+static size_t receive_data(void *buffer, size_t size, size_t nb, void *opaque)
+{
+    CRIPFetchReq *req = opaque;
+    size_t len = size * nb;
+
+    /* Sized up front from the Content-Length, when the server sent one,
+     * doubled whenever it runs out otherwise */
+    if (req->size + len + 1 > req->alloc) {
+        size_t alloc = FFMAX(req->alloc * 2, req->size + len + 1);
+        curl_off_t total = -1;
+        if (!req->data &&
+            curl_easy_getinfo(req->handle, CURLINFO_CONTENT_LENGTH_DOWNLOAD_T,
+                              &total) == CURLE_OK &&
+            total > 0 && total < FETCH_MAX_PREALLOC)
+            alloc = FFMAX(alloc, total + 1);
+
+        uint8_t *new_data = av_realloc(req->data, alloc);
+        if (!new_data)
+            return 0;
+
+        req->data  = new_data;
+        req->alloc = alloc;
+    }
+
+    memcpy(req->data + req->size, buffer, len);
+
+    req->size += len;
+    req->data[req->size] = '\0'; /* For text, always terminated */
+
+    return len;
+}
+
+static void finish_req(CRIPFetch *s, CURL *handle, CURLcode res)
+{
+    CRIPFetchReq *req = NULL;
+    char *content_type = NULL, *effective_url = NULL;
+
+    curl_easy_getinfo(handle, CURLINFO_PRIVATE, (char **)&req);
+
+    req->res = res;
+    curl_easy_getinfo(handle, CURLINFO_RESPONSE_CODE, &req->response_code);
+    if (curl_easy_getinfo(handle, CURLINFO_CONTENT_TYPE, &content_type) == CURLE_OK &&
+        content_type)
+        req->content_type = av_strdup(content_type);
+    if (curl_easy_getinfo(handle, CURLINFO_EFFECTIVE_URL, &effective_url) == CURLE_OK &&
+        effective_url)
+        req->effective_url = av_strdup(effective_url);
+
+    curl_multi_remove_handle(s->multi, handle);
+    curl_easy_cleanup(handle);
+
+    pthread_mutex_lock(&s->lock);
+    req->handle = NULL;
+    req->done = 1;
+    pthread_cond_broadcast(&s->cond);
+    pthread_mutex_unlock(&s->lock);
+}
+
+static void *fetch_thread(void *arg)
+{
+    CRIPFetch *s = arg;
+    int running = 0;
+
+    while (!atomic_load(&s->stop) || running) {
+        pthread_mutex_lock(&s->lock);
+        CRIPFetchReq *pending = s->pending;
+        s->pending = NULL;
+        pthread_mutex_unlock(&s->lock);
+
+        for (CRIPFetchReq *req = pending, *next; req; req = next) {
+            next = req->next;
+            if (curl_multi_add_handle(s->multi, req->handle) != CURLM_OK)
+                finish_req(s, req->handle, CURLE_FAILED_INIT);
+        }
+
+        curl_multi_perform(s->multi, &running);
+
+        CURLMsg *msg;
+        int left;
+        while ((msg = curl_multi_info_read(s->multi, &left)))
+            if (msg->msg == CURLMSG_DONE)
+                finish_req(s, msg->easy_handle, msg->data.result);
+
+        if (!atomic_load(&s->stop) || running)
+            curl_multi_poll(s->multi, NULL, 0, 1000, NULL);
+    }
+
+    return NULL;
+}
+
+int crip_fetch_init(CRIPFetch **s)
+{
+    CRIPFetch *f = av_mallocz(sizeof(*f));
+    if (!f)
+        return AVERROR(ENOMEM);
+
+    f->multi = curl_multi_init();
+    if (!f->multi) {
+        av_free(f);
+        return AVERROR(ENOMEM);
+    }
+
+    pthread_mutex_init(&f->lock, NULL);
+    pthread_cond_init(&f->cond, NULL);
+
+    int ret = pthread_create(&f->thread, NULL, fetch_thread, f);
+    if (ret) {
+        pthread_cond_destroy(&f->cond);
+        pthread_mutex_destroy(&f->lock);
+        curl_multi_cleanup(f->multi);
+        av_free(f);
+        return AVERROR(ret);
+    }
+
+    *s = f;
+
+    return 0;
+}
+
+void crip_fetch_uninit(CRIPFetch **s)
+{
+    CRIPFetch *f = *s;
+    if (!f)
+        return;
+
+    /* Lets whatever is still running finish */
+    atomic_store(&f->stop, 1);
+    curl_multi_wakeup(f->multi);
+    pthread_join(f->thread, NULL);
+
+    pthread_cond_destroy(&f->cond);
+    pthread_mutex_destroy(&f->lock);
+    curl_multi_cleanup(f->multi);
+    av_freep(s);
+}
+
+int crip_fetch_start(CRIPFetch *s, CRIPFetchReq *req)
+{
+    CURL *handle = curl_easy_init();
+    if (!handle) {
+        req->res = CURLE_FAILED_INIT;
+        return AVERROR(ENOMEM);
+    }
+
+    char user_agent[256] = { 0 };
+    snprintf(user_agent, sizeof(user_agent),
+             "cyanrip/%s ( https://github.com/cyanreg/cyanrip )", PROJECT_VERSION_STRING);
+
+    req->errbuf[0] = '\0';
+    curl_easy_setopt(handle, CURLOPT_URL, req->url);
+    curl_easy_setopt(handle, CURLOPT_USERAGENT, user_agent);
+    curl_easy_setopt(handle, CURLOPT_WRITEFUNCTION, receive_data);
+    curl_easy_setopt(handle, CURLOPT_WRITEDATA, req);
+    curl_easy_setopt(handle, CURLOPT_PRIVATE, req);
+    curl_easy_setopt(handle, CURLOPT_ERRORBUFFER, req->errbuf);
+    curl_easy_setopt(handle, CURLOPT_FAILONERROR, 1L); /* Explode on errors */
+    curl_easy_setopt(handle, CURLOPT_FOLLOWLOCATION, (long)req->follow_location);
+
+    pthread_mutex_lock(&s->lock);
+    req->handle = handle;
+    req->started = 1;
+    req->done = 0;
+    req->next = s->pending;
+    s->pending = req;
+    pthread_mutex_unlock(&s->lock);
+
+    curl_multi_wakeup(s->multi);
+
+    return 0;
+}
+
+void crip_fetch_wait(CRIPFetch *s, CRIPFetchReq *req)
+{
+    if (!req->started)
+        return;
+
+    pthread_mutex_lock(&s->lock);
+    while (!req->done)
+        pthread_cond_wait(&s->cond, &s->lock);
+    pthread_mutex_unlock(&s->lock);
+}
+
+void crip_fetch_req_free(CRIPFetchReq *req)
+{
+    av_freep(&req->data);
+    req->size = 0;
+    req->alloc = 0;
+    av_freep(&req->content_type);
+    av_freep(&req->effective_url);
+}
@@ -0,0 +1,65 @@
+/*
+ * This file is part of cyanrip.
+ *
+ * cyanrip is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * cyanrip is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with cyanrip; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#pragma once
+
+#include <curl/curl.h>
+
+/* HTTP requests of every drive, issued at once on a single curl multi handle
+ * from a thread of its own. Connections, and with them TLS sessions, are
+ * kept open and reused by later requests to the same hosts. */
+
+typedef struct CRIPFetch CRIPFetch;
+
+typedef struct CRIPFetchReq {
+    /* Set before starting */
+    char url[4096];
+    int follow_location;
+    const char *cache_type; /* Kept in the lookup cache under cache_key, if set */
+    char cache_key[256];
+
+    /* Valid once crip_fetch_wait() returns */
+    CURLcode res;
+    char errbuf[CURL_ERROR_SIZE];
+    uint8_t *data;
+    size_t size;
+    long response_code;
+    char *content_type; /* NULL if the server sent none */
+    char *effective_url;
+
+    /* Private */
+    CURL *handle;
+    size_t alloc; /* Allocated size of data */
+    int started;
+    int cached; /* Came from or went to the cache, or never will */
+    int done;
+    struct CRIPFetchReq *next;
+} CRIPFetchReq;
+
+int crip_fetch_init(CRIPFetch **s);
+void crip_fetch_uninit(CRIPFetch **s);
+
+/* Queues the request, which must not be touched until waited on */
+int crip_fetch_start(CRIPFetch *s, CRIPFetchReq *req);
+
+/* Blocks until the request is done, does nothing if it was never started.
+ * Fine to call several times. */
+void crip_fetch_wait(CRIPFetch *s, CRIPFetchReq *req);
+
+/* Frees what the request received */
+void crip_fetch_req_free(CRIPFetchReq *req);
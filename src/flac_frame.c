@@ -0,0 +1,98 @@
+/*
+ * This file is part of cyanrip.
+ *
+ * cyanrip is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * cyanrip is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with cyanrip; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include <string.h>
+
+#include <libavutil/bswap.h>
+#include <libavutil/common.h>
+#include <libavutil/crc.h>
+#include <libavutil/error.h>
+#include <libavutil/intreadwrite.h>
+
+#include "flac_frame.h"
+
+/* Length of the UTF-8 style coded number from its first byte */
+static int coded_number_len(uint8_t first)
+{
+    if (first < 0x80)
+        return 1;
+
+    int len = 0;
+    while (len < 7 && (first & (0x80 >> len)))
+        len++;
+
+    return (len >= 2 && len <= 6) ? len : AVERROR_INVALIDDATA;
+}
+
+int crip_flac_frame_renumber(uint8_t *dst, const uint8_t *src, int size,
+                             uint32_t frame_nb)
+{
+    /* Sync code, fixed blocksize */
+    if (size < 4 + 1 + 1 + 2 || src[0] != 0xFF || src[1] != 0xF8)
+        return AVERROR_INVALIDDATA;
+
+    int num_len = coded_number_len(src[4]);
+    if (num_len < 0)
+        return num_len;
+
+    /* Blocksize and sample rate which don't fit the codes come after it */
+    int bs_code = src[2] >> 4;
+    int sr_code = src[2] & 0xF;
+    int extra = (bs_code == 6 ? 1 : bs_code == 7 ? 2 : 0) +
+                (sr_code == 12 ? 1 : (sr_code == 13 || sr_code == 14) ? 2 : 0);
+
+    int hdr_len = 4 + num_len + extra;
+    if (size < hdr_len + 1 + 2)
+        return AVERROR_INVALIDDATA;
+
+    uint8_t tmp, *p = dst;
+    memcpy(p, src, 4);
+    p += 4;
+    PUT_UTF8(frame_nb, tmp, *p++ = tmp;)
+    memcpy(p, src + 4 + num_len, extra);
+    p += extra;
+
+    *p = av_crc(av_crc_get_table(AV_CRC_8_ATM), 0, dst, p - dst);
+    p++;
+
+    /* The subframes and padding, without the old CRC-16 */
+    int body_len = size - (hdr_len + 1) - 2;
+    memcpy(p, src + hdr_len + 1, body_len);
+    p += body_len;
+
+    uint16_t crc = av_bswap16(av_crc(av_crc_get_table(AV_CRC_16_ANSI), 0,
+                                     dst, p - dst));
+    AV_WB16(p, crc);
+    p += 2;
+
+    return p - dst;
+}
+
+void crip_flac_streaminfo_update(uint8_t *streaminfo,
+                                 int min_frame_size, int max_frame_size,
+                                 int64_t nb_samples, const uint8_t md5[16])
+{
+    AV_WB24(streaminfo +  4, min_frame_size);
+    AV_WB24(streaminfo +  7, max_frame_size);
+
+    /* 36 bits, after the sample rate, channels and bits per sample */
+    streaminfo[13] = (streaminfo[13] & 0xF0) | ((nb_samples >> 32) & 0xF);
+    AV_WB32(streaminfo + 14, nb_samples);
+
+    memcpy(streaminfo + 18, md5, 16);
+}
@@ -0,0 +1,42 @@
+/*
+ * This file is part of cyanrip.
+ *
+ * cyanrip is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * cyanrip is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with cyanrip; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+/* Helpers to stitch FLAC streams encoded in separate pieces back into the
+ * stream a single encoder would've written. Frames only depend on their own
+ * samples, what differs are their numbers, and the totals in STREAMINFO. */
+
+#define CRIP_FLAC_STREAMINFO_SIZE 34
+
+/* How much a frame can grow by when renumbered */
+#define CRIP_FLAC_RENUMBER_GROWTH 5
+
+/* Writes the fixed blocksize frame in src as frame number frame_nb to dst,
+ * along with both of its CRCs. dst needs room for size plus
+ * CRIP_FLAC_RENUMBER_GROWTH bytes. Returns the new size, or a negative
+ * error if src isn't such a frame. */
+int crip_flac_frame_renumber(uint8_t *dst, const uint8_t *src, int size,
+                             uint32_t frame_nb);
+
+/* Fills in what's only known once the whole stream has been encoded */
+void crip_flac_streaminfo_update(uint8_t *streaminfo,
+                                 int min_frame_size, int max_frame_size,
+                                 int64_t nb_samples, const uint8_t md5[16]);
@@ -0,0 +1,293 @@
+/*
+ * This file is part of cyanrip.
+ *
+ * cyanrip is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * cyanrip is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with cyanrip; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include <libavutil/common.h>
+#include <libavutil/error.h>
+#include <libavutil/mem.h>
+
+#include "frame_ring.h"
+
+/* Positions only ever increase, and wrap around. Each reader's position is
+ * on a cache line of its own, as it's written for every frame. */
+typedef struct CRFrameRingReader {
+    atomic_uint pos;
+    char pad[64 - sizeof(atomic_uint)];
+} CRFrameRingReader;
+
+/* The last reader done with a frame frees it */
+typedef struct CRFrameRingSlot {
+    AVFrame *frame;
+    atomic_int pending;
+} CRFrameRingSlot;
+
+typedef struct CRFrameRing {
+    CRFrameRingSlot *slots;
+    unsigned int mask;
+
+    atomic_uint head; /* Position of the next push */
+    atomic_int eof;
+    atomic_uint readers; /* Bitmask of the readers frames get counted for */
+    atomic_uint removed; /* Readers which left, until the writer catches up */
+    CRFrameRingReader reader[CR_FRAME_RING_MAX_READERS];
+
+    /* Only for sleeping. Whoever sleeps registers as a waiter before checking
+     * again, and whoever makes progress only takes the lock if there are any,
+     * so no wakeup gets lost. */
+    pthread_mutex_t lock;
+    pthread_cond_t cond_data;
+    pthread_cond_t cond_space;
+    atomic_int data_waiters;
+    atomic_int space_waiters;
+} CRFrameRing;
+
+static void frame_ring_destroy(void *opaque, uint8_t *data)
+{
+    CRFrameRing *ctx = (CRFrameRing *)data;
+
+    for (int i = 0; i <= ctx->mask; i++)
+        av_frame_free(&ctx->slots[i].frame);
+    av_freep(&ctx->slots);
+
+    pthread_cond_destroy(&ctx->cond_data);
+    pthread_cond_destroy(&ctx->cond_space);
+    pthread_mutex_destroy(&ctx->lock);
+
+    av_free(ctx);
+}
+
+AVBufferRef *cr_frame_ring_create(int size)
+{
+    CRFrameRing *ctx = av_mallocz(sizeof(*ctx));
+    if (!ctx)
+        return NULL;
+
+    unsigned int slots = 1;
+    while (slots < size)
+        slots <<= 1;
+
+    ctx->mask = slots - 1;
+    ctx->slots = av_calloc(slots, sizeof(*ctx->slots));
+    if (!ctx->slots) {
+        av_free(ctx);
+        return NULL;
+    }
+
+    AVBufferRef *ctx_ref = av_buffer_create((uint8_t *)ctx, sizeof(*ctx),
+                                            frame_ring_destroy, NULL, 0);
+    if (!ctx_ref) {
+        av_free(ctx->slots);
+        av_free(ctx);
+        return NULL;
+    }
+
+    for (int i = 0; i < slots; i++)
+        atomic_init(&ctx->slots[i].pending, 0);
+    atomic_init(&ctx->head, 0);
+    atomic_init(&ctx->eof, 0);
+    atomic_init(&ctx->readers, 0);
+    atomic_init(&ctx->removed, 0);
+    atomic_init(&ctx->data_waiters, 0);
+    atomic_init(&ctx->space_waiters, 0);
+    for (int i = 0; i < CR_FRAME_RING_MAX_READERS; i++)
+        atomic_init(&ctx->reader[i].pos, 0);
+
+    pthread_mutex_init(&ctx->lock, NULL);
+    pthread_cond_init(&ctx->cond_data, NULL);
+    pthread_cond_init(&ctx->cond_space, NULL);
+
+    return ctx_ref;
+}
+
+static void wake(CRFrameRing *ctx, atomic_int *waiters, pthread_cond_t *cond)
+{
+    if (!atomic_load(waiters))
+        return;
+
+    pthread_mutex_lock(&ctx->lock);
+    pthread_cond_broadcast(cond);
+    pthread_mutex_unlock(&ctx->lock);
+}
+
+int cr_frame_ring_add_reader(AVBufferRef *dst)
+{
+    CRFrameRing *ctx = (CRFrameRing *)dst->data;
+    int ret = AVERROR(ENOSPC);
+
+    pthread_mutex_lock(&ctx->lock);
+    unsigned int readers = atomic_load(&ctx->readers);
+    for (int i = 0; i < CR_FRAME_RING_MAX_READERS; i++) {
+        if (!(readers & (1u << i))) {
+            atomic_store(&ctx->reader[i].pos, atomic_load(&ctx->head));
+            atomic_fetch_and(&ctx->removed, ~(1u << i));
+            atomic_fetch_or(&ctx->readers, 1u << i);
+            ret = i;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&ctx->lock);
+
+    return ret;
+}
+
+static void slot_release(CRFrameRingSlot *slot)
+{
+    if (atomic_fetch_sub(&slot->pending, 1) == 1)
+        av_frame_free(&slot->frame);
+}
+
+void cr_frame_ring_remove_reader(AVBufferRef *dst, int reader)
+{
+    CRFrameRing *ctx = (CRFrameRing *)dst->data;
+
+    /* Only the writer knows which frames were counted for the reader */
+    atomic_fetch_or(&ctx->removed, 1u << reader);
+    wake(ctx, &ctx->space_waiters, &ctx->cond_space);
+}
+
+/* Writer only. Releases what removed readers didn't, up to head, which is
+ * every frame they were counted for. */
+static void frame_ring_reap(CRFrameRing *ctx, unsigned int head)
+{
+    unsigned int leaving = atomic_load(&ctx->removed) & atomic_load(&ctx->readers);
+
+    for (int i = 0; leaving; i++, leaving >>= 1) {
+        if (!(leaving & 1))
+            continue;
+
+        for (unsigned int pos = atomic_load(&ctx->reader[i].pos); pos != head; pos++)
+            slot_release(&ctx->slots[pos & ctx->mask]);
+        atomic_store(&ctx->reader[i].pos, head);
+        atomic_fetch_and(&ctx->readers, ~(1u << i));
+    }
+}
+
+/* How far behind the slowest reader is */
+static unsigned int frame_ring_used(CRFrameRing *ctx, unsigned int head)
+{
+    unsigned int used = 0;
+    unsigned int readers = atomic_load(&ctx->readers);
+
+    for (int i = 0; readers; i++, readers >>= 1)
+        if (readers & 1)
+            used = FFMAX(used, head - atomic_load(&ctx->reader[i].pos));
+
+    return used;
+}
+
+int cr_frame_ring_push(AVBufferRef *dst, AVFrame *in)
+{
+    if (!dst)
+        return 0;
+
+    CRFrameRing *ctx = (CRFrameRing *)dst->data;
+
+    if (!in) {
+        atomic_store(&ctx->eof, 1);
+        wake(ctx, &ctx->data_waiters, &ctx->cond_data);
+        return 0;
+    } else if (atomic_load(&ctx->eof)) {
+        return AVERROR_EOF;
+    }
+
+    AVFrame *ref = av_frame_clone(in);
+    if (!ref)
+        return AVERROR(ENOMEM);
+
+    unsigned int head = atomic_load(&ctx->head);
+
+    frame_ring_reap(ctx, head);
+    if (frame_ring_used(ctx, head) > ctx->mask) {
+        pthread_mutex_lock(&ctx->lock);
+        atomic_fetch_add(&ctx->space_waiters, 1);
+        while (frame_ring_reap(ctx, head), frame_ring_used(ctx, head) > ctx->mask)
+            pthread_cond_wait(&ctx->cond_space, &ctx->lock);
+        atomic_fetch_sub(&ctx->space_waiters, 1);
+        pthread_mutex_unlock(&ctx->lock);
+    }
+
+    /* Every reader is past what was in the slot, and released it. It's only
+     * still there if no reader was counted for it. */
+    CRFrameRingSlot *slot = &ctx->slots[head & ctx->mask];
+    unsigned int readers = atomic_load(&ctx->readers);
+    int nb_readers = 0;
+    for (; readers; readers >>= 1)
+        nb_readers += readers & 1;
+
+    av_frame_free(&slot->frame);
+    slot->frame = ref;
+    atomic_store(&slot->pending, nb_readers);
+
+    atomic_store(&ctx->head, head + 1);
+    wake(ctx, &ctx->data_waiters, &ctx->cond_data);
+
+    return 0;
+}
+
+const AVFrame *cr_frame_ring_peek(AVBufferRef *src, int reader)
+{
+    if (!src)
+        return NULL;
+
+    CRFrameRing *ctx = (CRFrameRing *)src->data;
+    unsigned int pos = atomic_load(&ctx->reader[reader].pos);
+
+    if (pos == atomic_load(&ctx->head)) {
+        pthread_mutex_lock(&ctx->lock);
+        atomic_fetch_add(&ctx->data_waiters, 1);
+        while (pos == atomic_load(&ctx->head) && !atomic_load(&ctx->eof))
+            pthread_cond_wait(&ctx->cond_data, &ctx->lock);
+        atomic_fetch_sub(&ctx->data_waiters, 1);
+        pthread_mutex_unlock(&ctx->lock);
+
+        /* The end is only pushed after the last frame */
+        if (pos == atomic_load(&ctx->head))
+            return NULL;
+    }
+
+    return ctx->slots[pos & ctx->mask].frame;
+}
+
+int cr_frame_ring_try_peek(AVBufferRef *src, int reader, const AVFrame **out)
+{
+    CRFrameRing *ctx = (CRFrameRing *)src->data;
+    unsigned int pos = atomic_load(&ctx->reader[reader].pos);
+
+    *out = NULL;
+    if (pos == atomic_load(&ctx->head)) {
+        if (!atomic_load(&ctx->eof))
+            return AVERROR(EAGAIN);
+        if (pos == atomic_load(&ctx->head))
+            return AVERROR_EOF;
+    }
+
+    *out = ctx->slots[pos & ctx->mask].frame;
+    return 0;
+}
+
+void cr_frame_ring_release(AVBufferRef *src, int reader)
+{
+    CRFrameRing *ctx = (CRFrameRing *)src->data;
+    unsigned int pos = atomic_load(&ctx->reader[reader].pos);
+
+    slot_release(&ctx->slots[pos & ctx->mask]);
+    atomic_store(&ctx->reader[reader].pos, pos + 1);
+    wake(ctx, &ctx->space_waiters, &ctx->cond_space);
+}
@@ -0,0 +1,59 @@
+/*
+ * This file is part of cyanrip.
+ *
+ * cyanrip is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * cyanrip is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with cyanrip; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#pragma once
+
+#include <libavutil/buffer.h>
+#include <libavutil/frame.h>
+
+/* A fixed size ring of frames, written by one thread and read by up to
+ * CR_FRAME_RING_MAX_READERS others, each of which sees every frame. Frames
+ * are shared by all readers, not copied for each. With a single reader, it's
+ * a plain SPSC ring. Neither side takes a lock, unless it has to sleep
+ * because the ring is full or empty. */
+
+#define CR_FRAME_RING_MAX_READERS 16
+
+/* size gets rounded up to a power of 2 */
+AVBufferRef *cr_frame_ring_create(int size);
+
+/* Readers must be added before the first push. Returns the reader's index. */
+int cr_frame_ring_add_reader(AVBufferRef *dst);
+
+/* The ring stops waiting for the reader, which must not touch it anymore.
+ * Readers have to be removed once they stop reading, or the writer will
+ * block once the ring is full. Frames the reader didn't release get released
+ * by the writer, on its next push. */
+void cr_frame_ring_remove_reader(AVBufferRef *dst, int reader);
+
+/* Adds a reference to the frame, blocking while the slowest reader is a
+ * whole ring behind. A NULL frame ends the stream, and is fine to push
+ * more than once. */
+int cr_frame_ring_push(AVBufferRef *dst, AVFrame *in);
+
+/* Returns the reader's next frame, blocking until there is one. Returns NULL
+ * once the stream has ended. The frame is read-only, and stays valid until
+ * cr_frame_ring_release() is called. */
+const AVFrame *cr_frame_ring_peek(AVBufferRef *src, int reader);
+
+/* Same, but returns AVERROR(EAGAIN) rather than blocking, and AVERROR_EOF
+ * once the stream has ended */
+int cr_frame_ring_try_peek(AVBufferRef *src, int reader, const AVFrame **out);
+
+/* Done with the frame cr_frame_ring_peek() returned */
+void cr_frame_ring_release(AVBufferRef *src, int reader);
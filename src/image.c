@@ -0,0 +1,256 @@
+/*
+ * This file is part of cyanrip.
+ *
+ * cyanrip is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * cyanrip is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with cyanrip; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include <libavformat/avformat.h>
+#include <libavutil/avstring.h>
+#include <libavutil/file.h>
+#include <libavutil/intreadwrite.h>
+#include <libavutil/mem.h>
+
+#include "image.h"
+
+struct CRIPImage {
+    uint8_t *map;
+    size_t map_size;
+    int64_t base; /* File offset of LSN 0, which may be outside of it */
+    lsn_t first; /* Sectors stored in the file */
+    lsn_t last;
+};
+
+/* Returns the data file of a cue sheet, if it has a single raw one */
+static char *cue_data_path(const char *cue)
+{
+    uint8_t *buf;
+    size_t size;
+    char *text, *file = NULL, *path = NULL;
+    int nb_files = 0;
+
+    if (av_file_map(cue, &buf, &size, 0, NULL) < 0)
+        return NULL;
+
+    text = av_malloc(size + 1);
+    if (text) {
+        memcpy(text, buf, size);
+        text[size] = '\0';
+    }
+    av_file_unmap(buf, size);
+    if (!text)
+        return NULL;
+
+    for (char *line = text, *next; line; line = next) {
+        const char *p, *end;
+
+        next = strchr(line, '\n');
+        if (next)
+            *next++ = '\0';
+
+        if (!av_strstart(line + strspn(line, " \t"), "FILE", &p))
+            continue;
+
+        nb_files++;
+        p += strspn(p, " \t");
+        if (*p == '"')
+            end = strchr(++p, '"');
+        else
+            end = p + strcspn(p, " \t\r");
+        if (!end || end == p)
+            continue;
+
+        /* MOTOROLA files are big-endian, anything else isn't raw */
+        const char *type = end + (*end == '"');
+        if (!av_strstart(type + strspn(type, " \t"), "BINARY", NULL))
+            continue;
+
+        av_free(file);
+        file = av_strndup(p, end - p);
+    }
+
+    av_free(text);
+
+    if (file && nb_files == 1) {
+        const char *slash = strrchr(cue, '/');
+        if (file[0] == '/' || !slash)
+            path = av_strdup(file);
+        else
+            path = av_asprintf("%.*s/%s", (int)(slash - cue), cue, file);
+    }
+
+    av_free(file);
+
+    return path;
+}
+
+/* Finds where the first track starts and the last track ends in a disc at
+ * once NRG image. Track at once images aren't stored contiguously. */
+static int nrg_layout(const uint8_t *buf, size_t size, int64_t *start, int64_t *end)
+{
+    uint64_t pos;
+
+    if (size >= 12 && !memcmp(buf + size - 12, "NER5", 4))
+        pos = AV_RB64(buf + size - 8);
+    else if (size >= 8 && !memcmp(buf + size - 8, "NERO", 4))
+        pos = AV_RB32(buf + size - 4);
+    else
+        return AVERROR_INVALIDDATA;
+
+    while (pos + 8 <= size) {
+        const uint8_t *chunk = buf + pos;
+        uint32_t len = AV_RB32(chunk + 4);
+        if (len > size - pos - 8 || !memcmp(chunk, "END!", 4))
+            break;
+
+        int daox = !memcmp(chunk, "DAOX", 4);
+        if (daox || !memcmp(chunk, "DAOI", 4)) {
+            /* ISRC, sector size, mode, then index 0, 1 and end offsets */
+            int entry = daox ? 42 : 30;
+            if (len < 22 + entry)
+                break;
+
+            const uint8_t *first = chunk + 8 + 22;
+            const uint8_t *last = first + ((len - 22)/entry - 1)*entry;
+            for (const uint8_t *t = first; t <= last; t += entry)
+                if (AV_RB16(t + 12) != CDIO_CD_FRAMESIZE_RAW)
+                    return AVERROR_INVALIDDATA;
+
+            *start = daox ? AV_RB64(first + 26) : AV_RB32(first + 22);
+            *end = daox ? AV_RB64(last + 34) : AV_RB32(last + 26);
+            return 0;
+        }
+
+        pos += 8 + len;
+    }
+
+    return AVERROR_INVALIDDATA;
+}
+
+/* Compares a few sectors of every audio track with what libcdio returns */
+static int image_matches(cyanrip_ctx *ctx, CRIPImage *s)
+{
+    uint8_t buf[CDIO_CD_FRAMESIZE_RAW];
+    int checked = 0, match = 1;
+
+    for (int i = 0; i < ctx->nb_cd_tracks && match; i++) {
+        cyanrip_track *t = &ctx->tracks[i];
+        if (t->track_is_data)
+            continue;
+
+        lsn_t probe[] = { t->start_lsn_sig, (t->start_lsn_sig + t->end_lsn_sig)/2,
+                          t->end_lsn_sig };
+        for (int j = 0; j < FF_ARRAY_ELEMS(probe) && match; j++) {
+            int nb = 1;
+            const uint8_t *data = crip_image_sectors(s, probe[j], &nb);
+            match = data && cdio_cddap_read(ctx->drive, buf, probe[j], 1) == 1 &&
+                    !memcmp(data, buf, sizeof(buf));
+        }
+        checked++;
+    }
+
+    char *msg = cdio_cddap_errors(ctx->drive);
+    if (msg)
+        cdio_cddap_free_messages(msg);
+
+    return match && checked;
+}
+
+int crip_image_open(cyanrip_ctx *ctx, CRIPImage **s)
+{
+    const char *path = ctx->settings.dev_path;
+    char *data_path = NULL;
+    int nrg = 0;
+
+    *s = NULL;
+
+    switch (cdio_get_driver_id(ctx->cdio)) {
+    case DRIVER_BINCUE:
+        if (av_match_ext(path, "cue")) {
+            data_path = cue_data_path(path);
+            if (!data_path)
+                return 0;
+            path = data_path;
+        }
+        break;
+    case DRIVER_NRG:
+        nrg = 1;
+        break;
+    default:
+        return 0;
+    }
+
+    CRIPImage *img = av_mallocz(sizeof(*img));
+    if (!img) {
+        av_free(data_path);
+        return AVERROR(ENOMEM);
+    }
+
+    int ret = av_file_map(path, &img->map, &img->map_size, 0, NULL);
+    av_free(data_path);
+    if (ret < 0) {
+        av_free(img);
+        return 0;
+    }
+
+    int64_t base = 0, end = img->map_size;
+    if (nrg) {
+        if (nrg_layout(img->map, img->map_size, &base, &end) < 0)
+            goto unsupported;
+        base -= (int64_t)cdio_get_track_lsn(ctx->cdio, cdio_get_first_track_num(ctx->cdio)) *
+                 CDIO_CD_FRAMESIZE_RAW;
+    }
+
+    end = FFMIN(end, img->map_size);
+    if ((base % CDIO_CD_FRAMESIZE_RAW) || (end - base) < CDIO_CD_FRAMESIZE_RAW)
+        goto unsupported;
+
+    img->base = base;
+    img->first = -base/CDIO_CD_FRAMESIZE_RAW;
+    img->last = (end - base)/CDIO_CD_FRAMESIZE_RAW - 1;
+
+    if (!image_matches(ctx, img))
+        goto unsupported;
+
+    *s = img;
+
+    return 0;
+
+unsupported:
+    crip_image_close(&img);
+    return 0;
+}
+
+void crip_image_close(CRIPImage **s)
+{
+    if (!s || !*s)
+        return;
+
+    av_file_unmap((*s)->map, (*s)->map_size);
+    av_freep(s);
+}
+
+const uint8_t *crip_image_sectors(CRIPImage *s, lsn_t lsn, int *nb)
+{
+    if (lsn < s->first) {
+        *nb = FFMIN(*nb, s->first - lsn);
+        return NULL;
+    } else if (lsn > s->last) {
+        return NULL;
+    }
+
+    *nb = FFMIN(*nb, s->last - lsn + 1);
+
+    return s->map + s->base + (int64_t)lsn*CDIO_CD_FRAMESIZE_RAW;
+}
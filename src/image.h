@@ -0,0 +1,38 @@
+/*
+ * This file is part of cyanrip.
+ *
+ * cyanrip is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * cyanrip is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with cyanrip; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#pragma once
+
+#include "cyanrip_main.h"
+
+typedef struct CRIPImage CRIPImage;
+
+/* Maps the audio of a BIN/CUE or NRG disc image, if its sectors are stored
+ * one after another in a single file. *s is left NULL if the image can't be
+ * mapped, or if the mapping doesn't match what libcdio reads from it, in
+ * which case it's to be read through libcdio as usual. Returns an error
+ * only if out of memory. */
+int crip_image_open(cyanrip_ctx *ctx, CRIPImage **s);
+
+void crip_image_close(CRIPImage **s);
+
+/* Returns *nb (at most as many as requested) contiguous sectors from lsn
+ * onwards, straight from the mapping. Returns NULL if lsn isn't stored in
+ * the image, with *nb set to the number of such sectors, to be taken as
+ * silence. */
+const uint8_t *crip_image_sectors(CRIPImage *s, lsn_t lsn, int *nb);
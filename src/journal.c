@@ -0,0 +1,484 @@
+/*
+ * This file is part of cyanrip.
+ *
+ * cyanrip is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * cyanrip is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with cyanrip; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <sys/stat.h>
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+#include <libavutil/bprint.h>
+
+#include "journal.h"
+#include "cyanrip_log.h"
+#include "accurip.h"
+#include "loudness.h"
+#include "os_compat.h"
+
+#define JOURNAL_HEADER "cyanrip journal 2\n"
+
+/* Histogram bins per line */
+#define HIST_LINE_BINS 128
+
+typedef struct JournalEntry {
+    int started;
+    int done;
+    int frames;
+    uint32_t eac_crc;
+    uint32_t acurip_checksum_v1;
+    uint32_t acurip_checksum_v1_450;
+    uint32_t acurip_checksum_v2;
+    int total_repeats;
+    int strategy;
+    double sample_peak_rel_amp;
+    double ebu[6];
+    CRIPLoudnessStats *loudness;
+    int loudness_done; /* The peaks come last */
+    char *files[CYANRIP_FORMATS_NB];
+    int nb_files;
+} JournalEntry;
+
+/* The journal has to survive reboots, not just crashes */
+static void journal_sync(FILE *f)
+{
+    fflush(f);
+#ifdef _WIN32
+    _commit(_fileno(f));
+#else
+    fsync(fileno(f));
+#endif
+}
+
+#ifndef _WIN32
+/* So that the rename of the journal survives reboots too */
+static void sync_dir(const char *path)
+{
+    const char *sep = strrchr(path, '/');
+    char *dir = sep ? av_strndup(path, FFMAX(sep - path, 1)) : av_strdup(".");
+    if (!dir)
+        return;
+
+    int fd = open(dir, O_RDONLY);
+    if (fd >= 0) {
+        fsync(fd);
+        close(fd);
+    }
+
+    av_free(dir);
+}
+#endif
+
+/* Replaces path with the file at tmp, which must be synced */
+static int replace_file(const char *tmp, const char *path)
+{
+#ifdef _WIN32
+    wchar_t *tmp_w, *path_w;
+    if (utf8towchar(tmp, &tmp_w))
+        return AVERROR(ENOMEM);
+    if (utf8towchar(path, &path_w)) {
+        av_free(tmp_w);
+        return AVERROR(ENOMEM);
+    }
+    int ok = MoveFileExW(tmp_w, path_w, MOVEFILE_REPLACE_EXISTING |
+                                        MOVEFILE_WRITE_THROUGH);
+    av_free(tmp_w);
+    av_free(path_w);
+    return ok ? 0 : AVERROR(EIO);
+#else
+    if (rename(tmp, path))
+        return AVERROR(errno);
+    sync_dir(path);
+    return 0;
+#endif
+}
+
+/* Identifies the disc, and the settings which affect the files */
+static void print_disc_line(cyanrip_ctx *ctx, AVBPrint *buf)
+{
+    const char *discid = dict_get(ctx->meta, "musicbrainz_discid");
+    const char *cddb = dict_get(ctx->meta, "cddb");
+
+    av_bprintf(buf, "disc %s %s %i ", discid ? discid : "none",
+               cddb ? cddb : "none", ctx->settings.offset);
+    for (int i = 0; i < ctx->settings.outputs_num; i++)
+        av_bprintf(buf, "%s%s", i ? "," : "",
+                   crip_fmt_info[ctx->settings.outputs[i]].name);
+    av_bprintf(buf, "\n");
+}
+
+static int find_track(cyanrip_ctx *ctx, int number)
+{
+    for (int i = 0; i < ctx->nb_tracks; i++)
+        if (ctx->tracks[i].number == number && !ctx->tracks[i].track_is_data)
+            return i;
+    return -1;
+}
+
+/* Where the gate lines of a track go, the track must have been done */
+static CRIPLoudnessGate *entry_gate(cyanrip_ctx *ctx, JournalEntry *entries,
+                                    int number, const char *scope)
+{
+    int idx = find_track(ctx, number);
+    if (idx < 0 || !entries[idx].done)
+        return NULL;
+
+    JournalEntry *e = &entries[idx];
+    if (!e->loudness && !(e->loudness = av_mallocz(sizeof(*e->loudness))))
+        return NULL;
+
+    if (!strcmp(scope, "block"))
+        return &e->loudness->block;
+    else if (!strcmp(scope, "range"))
+        return &e->loudness->range;
+    return NULL;
+}
+
+/* Bins are listed as bin:count, ones which are 0 are left out */
+static void parse_hist(CRIPLoudnessGate *g, const char *str)
+{
+    while (*str) {
+        char *end;
+        unsigned long bin = strtoul(str, &end, 10);
+        if (end == str || *end != ':')
+            return;
+        str = end + 1;
+
+        unsigned long count = strtoul(str, &end, 10);
+        if (end == str)
+            return;
+        str = end + strspn(end, " \r\n");
+
+        if (bin < CRIP_LOUDNESS_HIST_SIZE)
+            g->hist[bin] = count;
+    }
+}
+
+/* Returns 0 if the journal belongs to this disc, 1 if it doesn't or
+ * there is none */
+static int journal_load(cyanrip_ctx *ctx, const char *path, JournalEntry *entries)
+{
+    char line[4096];
+    int ret = 1;
+
+    FILE *f = fopen(path, "rb");
+    if (!f)
+        return 1;
+
+    AVBPrint disc;
+    av_bprint_init(&disc, 0, AV_BPRINT_SIZE_UNLIMITED);
+    print_disc_line(ctx, &disc);
+
+    if (!fgets(line, sizeof(line), f) || strcmp(line, JOURNAL_HEADER))
+        goto end;
+    if (!fgets(line, sizeof(line), f) || strcmp(line, disc.str))
+        goto end;
+
+    ret = 0;
+
+    while (fgets(line, sizeof(line), f)) {
+        int number, idx, off = 0;
+        JournalEntry e = { 0 };
+        CRIPLoudnessGate *g;
+        char scope[16];
+        uint64_t nb_powers;
+        double sum_power;
+        float sample_peak, true_peak;
+
+        if (sscanf(line, "start %i", &number) == 1) {
+            if ((idx = find_track(ctx, number)) >= 0)
+                entries[idx].started = 1;
+        } else if (sscanf(line, "done %i %i %x %x %x %x %i %i %lf %lf %lf %lf %lf %lf %lf",
+                          &number, &e.frames, &e.eac_crc, &e.acurip_checksum_v1,
+                          &e.acurip_checksum_v1_450, &e.acurip_checksum_v2,
+                          &e.total_repeats, &e.strategy, &e.sample_peak_rel_amp,
+                          &e.ebu[0], &e.ebu[1], &e.ebu[2], &e.ebu[3], &e.ebu[4],
+                          &e.ebu[5]) == 15) {
+            if ((idx = find_track(ctx, number)) < 0)
+                continue;
+            for (int i = 0; i < entries[idx].nb_files; i++)
+                av_freep(&entries[idx].files[i]);
+            av_freep(&entries[idx].loudness);
+            e.started = e.done = 1;
+            entries[idx] = e;
+        } else if (sscanf(line, "gate %i %15s %"SCNu64" %lf", &number, scope,
+                          &nb_powers, &sum_power) == 4) {
+            if (!(g = entry_gate(ctx, entries, number, scope)))
+                continue;
+            g->nb_powers = nb_powers;
+            g->sum_power = sum_power;
+        } else if (sscanf(line, "hist %i %15s %n", &number, scope, &off) == 2 && off) {
+            if ((g = entry_gate(ctx, entries, number, scope)))
+                parse_hist(g, line + off);
+        } else if (sscanf(line, "peak %i %f %f", &number, &sample_peak, &true_peak) == 3) {
+            if ((idx = find_track(ctx, number)) < 0 || !entries[idx].loudness)
+                continue;
+            entries[idx].loudness->sample_peak = sample_peak;
+            entries[idx].loudness->true_peak = true_peak;
+            entries[idx].loudness_done = 1;
+        } else if (sscanf(line, "file %i %n", &number, &off) == 1 && off) {
+            if ((idx = find_track(ctx, number)) < 0 || !entries[idx].done ||
+                entries[idx].nb_files >= CYANRIP_FORMATS_NB)
+                continue;
+            line[strcspn(line, "\r\n")] = '\0';
+            entries[idx].files[entries[idx].nb_files++] = av_strdup(line + off);
+        }
+    }
+
+end:
+    av_bprint_finalize(&disc, NULL);
+    fclose(f);
+    return ret;
+}
+
+/* Whether the files a journal entry lists are the ones this run would write,
+ * and are all still there */
+static int files_present(cyanrip_ctx *ctx, cyanrip_track *t, JournalEntry *e)
+{
+    if (e->nb_files != ctx->settings.outputs_num)
+        return 0;
+
+    for (int i = 0; i < e->nb_files; i++) {
+        cyanrip_stat_t st = { 0 };
+        char *path = crip_get_path(ctx, CRIP_PATH_TRACK, 0,
+                                   &crip_fmt_info[ctx->settings.outputs[i]], t);
+        int match = path && e->files[i] && !strcmp(path, e->files[i]) &&
+                    !cyanrip_stat(path, &st);
+        av_free(path);
+        if (!match)
+            return 0;
+    }
+
+    return 1;
+}
+
+static void restore_track(cyanrip_track *t, JournalEntry *e)
+{
+    t->restored = 1;
+    t->computed_crcs = 1;
+    t->eac_crc = e->eac_crc;
+    t->acurip_checksum_v1 = e->acurip_checksum_v1;
+    t->acurip_checksum_v1_450 = e->acurip_checksum_v1_450;
+    t->acurip_checksum_v2 = e->acurip_checksum_v2;
+    t->total_repeats = e->total_repeats;
+    t->strategy = e->strategy;
+    t->sample_peak_rel_amp = e->sample_peak_rel_amp;
+    t->ebu_integrated = e->ebu[0];
+    t->ebu_range = e->ebu[1];
+    t->ebu_lra_low = e->ebu[2];
+    t->ebu_lra_high = e->ebu[3];
+    t->ebu_sample_peak = e->ebu[4];
+    t->ebu_true_peak = e->ebu[5];
+
+    /* Merged into the album loudness once the track's turn comes */
+    t->loudness = e->loudness;
+    e->loudness = NULL;
+}
+
+static void write_gate(FILE *f, int number, const char *scope,
+                       const CRIPLoudnessGate *g)
+{
+    fprintf(f, "gate %i %s %"PRIu64" %a\n", number, scope, g->nb_powers, g->sum_power);
+
+    for (int i = 0; i < CRIP_LOUDNESS_HIST_SIZE;) {
+        int nb = 0;
+        for (; i < CRIP_LOUDNESS_HIST_SIZE && nb < HIST_LINE_BINS; i++) {
+            if (!g->hist[i])
+                continue;
+            if (!nb++)
+                fprintf(f, "hist %i %s", number, scope);
+            fprintf(f, " %i:%"PRIu32, i, g->hist[i]);
+        }
+        if (nb)
+            fprintf(f, "\n");
+    }
+}
+
+static void write_track_done(cyanrip_ctx *ctx, cyanrip_track *t)
+{
+    fprintf(ctx->journal, "done %i %i %08X %08X %08X %08X %i %i %f %f %f %f %f %f %f\n",
+            t->number, t->frames, t->eac_crc, t->acurip_checksum_v1,
+            t->acurip_checksum_v1_450, t->acurip_checksum_v2,
+            t->total_repeats, t->strategy, t->sample_peak_rel_amp,
+            t->ebu_integrated, t->ebu_range, t->ebu_lra_low, t->ebu_lra_high,
+            t->ebu_sample_peak, t->ebu_true_peak);
+
+    /* The album loudness can't be worked out from the results above */
+    if (t->loudness) {
+        write_gate(ctx->journal, t->number, "block", &t->loudness->block);
+        write_gate(ctx->journal, t->number, "range", &t->loudness->range);
+        fprintf(ctx->journal, "peak %i %a %a\n", t->number,
+                t->loudness->sample_peak, t->loudness->true_peak);
+    }
+
+    for (int i = 0; i < ctx->settings.outputs_num; i++) {
+        char *path = crip_get_path(ctx, CRIP_PATH_TRACK, 0,
+                                   &crip_fmt_info[ctx->settings.outputs[i]], t);
+        fprintf(ctx->journal, "file %i %s\n", t->number, path);
+        av_free(path);
+    }
+}
+
+int crip_journal_init(cyanrip_ctx *ctx)
+{
+    int ret = 0;
+    char *tmp = NULL;
+    JournalEntry entries[198] = { 0 };
+
+    char *path = crip_get_path(ctx, CRIP_PATH_JOURNAL, 1,
+                               &crip_fmt_info[ctx->settings.outputs[0]], NULL);
+    if (!path)
+        return AVERROR(ENOMEM);
+
+    int found = !journal_load(ctx, path, entries);
+
+    if (found && ctx->settings.resume_mode == CRIP_RESUME_NONE) {
+        cyanrip_log(ctx, 0, "Found the journal of an earlier rip of this disc, "
+                    "starting over (use -y to resume it)\n\n");
+    } else if (!found && ctx->settings.resume_mode != CRIP_RESUME_NONE) {
+        cyanrip_log(ctx, 0, "No journal of an earlier rip of this disc found, "
+                    "ripping all tracks\n\n");
+    } else if (found) {
+        int restored = 0;
+        for (int i = 0; i < ctx->nb_tracks; i++) {
+            cyanrip_track *t = &ctx->tracks[i];
+            JournalEntry *e = &entries[i];
+
+            if (!e->started)
+                continue;
+
+            if (!e->done) {
+                cyanrip_log(ctx, 0, "Track %i was interrupted, ripping it again\n",
+                            t->number);
+                continue;
+            }
+
+            if (e->frames != t->frames || !e->loudness_done ||
+                !files_present(ctx, t, e)) {
+                cyanrip_log(ctx, 0, "Track %i files are missing or named "
+                            "differently, ripping it again\n", t->number);
+                continue;
+            }
+
+            if (ctx->settings.resume_mode == CRIP_RESUME_FAILED &&
+                (t->ar_db_status != CYANRIP_ACCUDB_FOUND ||
+                 (crip_find_ar(t, e->acurip_checksum_v1, 0) < 1 &&
+                  crip_find_ar(t, e->acurip_checksum_v2, 0) < 1))) {
+                cyanrip_log(ctx, 0, "Track %i was not verified by AccurateRip, "
+                            "ripping it again\n", t->number);
+                continue;
+            }
+
+            restore_track(t, e);
+            restored++;
+        }
+
+        cyanrip_log(ctx, 0, "Resuming from journal, %i track(s) already done\n\n",
+                    restored);
+    }
+
+    /* The old journal stays until the new one has everything carried over */
+    tmp = av_asprintf("%s.tmp", path);
+    if (!tmp) {
+        ret = AVERROR(ENOMEM);
+        goto end;
+    }
+
+    ctx->journal = fopen(tmp, "wb");
+    if (!ctx->journal) {
+        ret = AVERROR(errno);
+        cyanrip_log(ctx, 0, "Couldn't open journal \"%s\" for writing: %s!\n",
+                    tmp, av_err2str(ret));
+        goto end;
+    }
+
+    AVBPrint disc;
+    av_bprint_init(&disc, 0, AV_BPRINT_SIZE_UNLIMITED);
+    print_disc_line(ctx, &disc);
+    fprintf(ctx->journal, JOURNAL_HEADER "%s", disc.str);
+    av_bprint_finalize(&disc, NULL);
+
+    /* Carry over what's been restored */
+    for (int i = 0; i < ctx->nb_tracks; i++) {
+        cyanrip_track *t = &ctx->tracks[i];
+        if (t->restored) {
+            write_track_done(ctx, t);
+            t->journaled = 1;
+        }
+    }
+
+    journal_sync(ctx->journal);
+
+    int err = ferror(ctx->journal);
+    if (fclose(ctx->journal) || err)
+        ret = AVERROR(EIO);
+    else
+        ret = replace_file(tmp, path);
+    ctx->journal = ret < 0 ? NULL : fopen(path, "ab");
+    if (!ctx->journal) {
+        if (ret >= 0)
+            ret = AVERROR(errno);
+        cyanrip_log(ctx, 0, "Couldn't write journal \"%s\": %s!\n",
+                    path, av_err2str(ret));
+        remove(tmp);
+    }
+
+end:
+    for (int i = 0; i < FF_ARRAY_ELEMS(entries); i++) {
+        for (int j = 0; j < entries[i].nb_files; j++)
+            av_free(entries[i].files[j]);
+        av_free(entries[i].loudness);
+    }
+    av_free(tmp);
+    av_free(path);
+    return ret;
+}
+
+void crip_journal_track_start(cyanrip_ctx *ctx, cyanrip_track *t)
+{
+    if (!ctx->journal)
+        return;
+
+    fprintf(ctx->journal, "start %i\n", t->number);
+    journal_sync(ctx->journal);
+}
+
+void crip_journal_track_done(cyanrip_ctx *ctx, cyanrip_track *t)
+{
+    if (!ctx->journal || t->journaled || t->track_is_data)
+        return;
+
+    write_track_done(ctx, t);
+    journal_sync(ctx->journal);
+    t->journaled = 1;
+
+    av_freep(&t->loudness);
+}
+
+void crip_journal_end(cyanrip_ctx *ctx)
+{
+    if (!ctx->journal)
+        return;
+
+    fclose(ctx->journal);
+    ctx->journal = NULL;
+}
@@ -0,0 +1,40 @@
+/*
+ * This file is part of cyanrip.
+ *
+ * cyanrip is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * cyanrip is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with cyanrip; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#pragma once
+
+#include "cyanrip_main.h"
+
+/* The rip journal is a text file next to the log. It records which tracks
+ * have had all of their files written, with their checksums and loudness
+ * measurement, so that an interrupted rip of the same disc can pick up
+ * where it left off. */
+
+/* Opens the journal for writing. When resuming, tracks which an existing
+ * journal of the same disc and settings lists as done, and whose files are
+ * still there, get marked as restored and have their results filled in. */
+int crip_journal_init(cyanrip_ctx *ctx);
+
+/* Records that ripping a track has started */
+void crip_journal_track_start(cyanrip_ctx *ctx, cyanrip_track *t);
+
+/* Records a track as done. Must only be called once all of its files have
+ * been completely written. Does nothing if the track was already recorded. */
+void crip_journal_track_done(cyanrip_ctx *ctx, cyanrip_track *t);
+
+void crip_journal_end(cyanrip_ctx *ctx);
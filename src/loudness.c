@@ -0,0 +1,377 @@
+/*
+ * This file is part of cyanrip.
+ *
+ * cyanrip is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * cyanrip is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with cyanrip; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include <math.h>
+#include <string.h>
+
+#include <libavutil/common.h>
+#include <libavutil/cpu.h>
+#include <libavutil/intreadwrite.h>
+
+#include "loudness.h"
+
+#ifdef HAVE_X86_SIMD
+#include <immintrin.h>
+#endif
+
+#define SAMPLE_RATE 44100
+#define ABS_THRES (-70.0)
+#define BLOCK_GATE (-10)
+#define RANGE_GATE (-20)
+#define RANGE_LOW_PRC 10
+#define RANGE_HIGH_PRC 95
+
+#define HIST_GRAIN 100
+#define HIST_POS(l) av_clip((int)(((l) - ABS_THRES)*HIST_GRAIN), 0, CRIP_LOUDNESS_HIST_SIZE - 1)
+#define HIST_LOUDNESS(i) (ABS_THRES + (i)/(double)HIST_GRAIN)
+
+#define TP_HISTORY (CRIP_LOUDNESS_TP_TAPS - 1)
+
+/* The 4 phase, 48 tap interpolation filter from ITU-R BS.1770-4, Annex 2 */
+static const float tp_coeffs[4][CRIP_LOUDNESS_TP_TAPS] = {
+    {  0.0017089843750f,  0.0109863281250f, -0.0196533203125f,  0.0332031250000f,
+      -0.0594482421875f,  0.1373291015625f,  0.9721679687500f, -0.1022949218750f,
+       0.0476074218750f, -0.0266113281250f,  0.0148925781250f, -0.0083007812500f },
+    { -0.0291748046875f,  0.0292968750000f, -0.0517578125000f,  0.0891113281250f,
+      -0.1665039062500f,  0.4650878906250f,  0.7797851562500f, -0.2003173828125f,
+       0.1015625000000f, -0.0582275390625f,  0.0330810546875f, -0.0189208984375f },
+    { -0.0189208984375f,  0.0330810546875f, -0.0582275390625f,  0.1015625000000f,
+      -0.2003173828125f,  0.7797851562500f,  0.4650878906250f, -0.1665039062500f,
+       0.0891113281250f, -0.0517578125000f,  0.0292968750000f, -0.0291748046875f },
+    { -0.0083007812500f,  0.0148925781250f, -0.0266113281250f,  0.0476074218750f,
+      -0.1022949218750f,  0.9721679687500f,  0.1373291015625f, -0.0594482421875f,
+       0.0332031250000f, -0.0196533203125f,  0.0109863281250f,  0.0017089843750f },
+};
+
+static float true_peak_c(const float *data, int nb, float peak)
+{
+    for (int i = 0; i < nb; i++) {
+        for (int c = 0; c < 2; c++) {
+            for (int p = 0; p < 4; p++) {
+                float v = 0.0f;
+                for (int k = 0; k < CRIP_LOUDNESS_TP_TAPS; k++)
+                    v += tp_coeffs[p][k] * data[(i - k)*2 + c];
+                peak = FFMAX(peak, fabsf(v));
+            }
+        }
+    }
+
+    return peak;
+}
+
+#ifdef HAVE_X86_SIMD
+/* All 4 phases of a channel at once */
+__attribute__((target("sse2")))
+static float true_peak_sse2(const float *data, int nb, float peak)
+{
+    const __m128 abs_mask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+    __m128 coeffs[CRIP_LOUDNESS_TP_TAPS];
+    __m128 max = _mm_set1_ps(peak);
+
+    for (int k = 0; k < CRIP_LOUDNESS_TP_TAPS; k++)
+        coeffs[k] = _mm_setr_ps(tp_coeffs[0][k], tp_coeffs[1][k],
+                                tp_coeffs[2][k], tp_coeffs[3][k]);
+
+    for (int i = 0; i < nb; i++) {
+        __m128 l = _mm_setzero_ps();
+        __m128 r = _mm_setzero_ps();
+        for (int k = 0; k < CRIP_LOUDNESS_TP_TAPS; k++) {
+            const float *src = &data[(i - k)*2];
+            l = _mm_add_ps(l, _mm_mul_ps(coeffs[k], _mm_set1_ps(src[0])));
+            r = _mm_add_ps(r, _mm_mul_ps(coeffs[k], _mm_set1_ps(src[1])));
+        }
+        max = _mm_max_ps(max, _mm_and_ps(l, abs_mask));
+        max = _mm_max_ps(max, _mm_and_ps(r, abs_mask));
+    }
+
+    max = _mm_max_ps(max, _mm_movehl_ps(max, max));
+    max = _mm_max_ss(max, _mm_shuffle_ps(max, max, 1));
+
+    return _mm_cvtss_f32(max);
+}
+
+/* Both channels, all 4 phases at once. The lanes hold the phases of the
+ * left and right channels interleaved, so that a stereo sample can just
+ * be broadcast. */
+__attribute__((target("avx2")))
+static float true_peak_avx2(const float *data, int nb, float peak)
+{
+    const __m256 abs_mask = _mm256_castsi256_ps(_mm256_set1_epi32(0x7fffffff));
+    __m256 coeffs[CRIP_LOUDNESS_TP_TAPS];
+    __m256 max = _mm256_set1_ps(peak);
+
+    for (int k = 0; k < CRIP_LOUDNESS_TP_TAPS; k++)
+        coeffs[k] = _mm256_setr_ps(tp_coeffs[0][k], tp_coeffs[0][k],
+                                   tp_coeffs[1][k], tp_coeffs[1][k],
+                                   tp_coeffs[2][k], tp_coeffs[2][k],
+                                   tp_coeffs[3][k], tp_coeffs[3][k]);
+
+    for (int i = 0; i < nb; i++) {
+        __m256 acc = _mm256_setzero_ps();
+        for (int k = 0; k < CRIP_LOUDNESS_TP_TAPS; k++) {
+            __m256 src = _mm256_castpd_ps(_mm256_broadcast_sd((const double *)&data[(i - k)*2]));
+            acc = _mm256_add_ps(acc, _mm256_mul_ps(coeffs[k], src));
+        }
+        max = _mm256_max_ps(max, _mm256_and_ps(acc, abs_mask));
+    }
+
+    __m128 m = _mm_max_ps(_mm256_castps256_ps128(max), _mm256_extractf128_ps(max, 1));
+    m = _mm_max_ps(m, _mm_movehl_ps(m, m));
+    m = _mm_max_ss(m, _mm_shuffle_ps(m, m, 1));
+
+    return _mm_cvtss_f32(m);
+}
+#endif
+
+void crip_loudness_dsp_init(CRIPLoudnessDSP *dsp, int cpu_flags)
+{
+    dsp->true_peak = true_peak_c;
+
+#ifdef HAVE_X86_SIMD
+    if (cpu_flags & AV_CPU_FLAG_SSE2)
+        dsp->true_peak = true_peak_sse2;
+    if (cpu_flags & AV_CPU_FLAG_AVX2)
+        dsp->true_peak = true_peak_avx2;
+#endif
+}
+
+/* Same designs as lavfi and libebur128 use, for any sample rate */
+static void init_k_weighting(CRIPLoudness *s)
+{
+    double f0 = 1681.974450955533;
+    double G  = 3.999843853973347;
+    double Q  = 0.7071752369554196;
+    double K  = tan(M_PI*f0/SAMPLE_RATE);
+    double Vh = pow(10.0, G/20.0);
+    double Vb = pow(Vh, 0.4996667741545416);
+    double a0 = 1.0 + K/Q + K*K;
+
+    s->pre_b[0] = (Vh + Vb*K/Q + K*K)/a0;
+    s->pre_b[1] = 2.0*(K*K - Vh)/a0;
+    s->pre_b[2] = (Vh - Vb*K/Q + K*K)/a0;
+    s->pre_a[0] = 1.0;
+    s->pre_a[1] = 2.0*(K*K - 1.0)/a0;
+    s->pre_a[2] = (1.0 - K/Q + K*K)/a0;
+
+    f0 = 38.13547087602444;
+    Q  = 0.5003270373238773;
+    K  = tan(M_PI*f0/SAMPLE_RATE);
+    a0 = 1.0 + K/Q + K*K;
+
+    s->rlb_b[0] = 1.0;
+    s->rlb_b[1] = -2.0;
+    s->rlb_b[2] = 1.0;
+    s->rlb_a[0] = 1.0;
+    s->rlb_a[1] = 2.0*(K*K - 1.0)/a0;
+    s->rlb_a[2] = (1.0 - K/Q + K*K)/a0;
+}
+
+void crip_loudness_init(CRIPLoudness *s)
+{
+    memset(s, 0, sizeof(*s));
+    crip_loudness_dsp_init(&s->dsp, av_get_cpu_flags());
+    init_k_weighting(s);
+}
+
+/* Transposed direct form II */
+static av_always_inline double biquad(const double *b, const double *a,
+                                      double *state, double x)
+{
+    double y = b[0]*x + state[0];
+    state[0] = b[1]*x - a[1]*y + state[1];
+    state[1] = b[2]*x - a[2]*y;
+    return y;
+}
+
+static inline double to_loudness(double power)
+{
+    return 10.0*log10(power) - 0.691;
+}
+
+static void gate_add(CRIPLoudnessGate *g, double power)
+{
+    double loudness = to_loudness(power);
+    if (loudness < ABS_THRES)
+        return;
+
+    g->hist[HIST_POS(loudness)]++;
+    g->sum_power += power;
+    g->nb_powers++;
+}
+
+/* Blocks are 400ms long and overlap by 75%, short-term ones for the range
+ * are 3s long, both get measured every 100ms once there's enough audio */
+static void end_step(CRIPLoudness *s)
+{
+    s->steps[s->nb_steps % FF_ARRAY_ELEMS(s->steps)] = s->step_energy;
+    s->nb_steps++;
+    s->step_energy = 0.0;
+    s->step_samples = 0;
+
+    if (s->nb_steps >= 4) {
+        double sum = 1e-12;
+        for (int i = 1; i <= 4; i++)
+            sum += s->steps[(s->nb_steps - i) % FF_ARRAY_ELEMS(s->steps)];
+        gate_add(&s->stats.block, sum/(4*CRIP_LOUDNESS_STEP));
+    }
+
+    if (s->nb_steps >= FF_ARRAY_ELEMS(s->steps)) {
+        double sum = 1e-12;
+        for (int i = 0; i < FF_ARRAY_ELEMS(s->steps); i++)
+            sum += s->steps[i];
+        gate_add(&s->stats.range, sum/(FF_ARRAY_ELEMS(s->steps)*CRIP_LOUDNESS_STEP));
+    }
+}
+
+static void run_true_peak(CRIPLoudness *s)
+{
+    float *buf = s->tp_buf;
+
+    s->stats.true_peak = s->dsp.true_peak(buf + 2*TP_HISTORY, s->tp_samples,
+                                          s->stats.true_peak);
+
+    memmove(buf, buf + 2*s->tp_samples, 2*TP_HISTORY*sizeof(*buf));
+    s->tp_samples = 0;
+}
+
+void crip_loudness_process(CRIPLoudness *s, const uint8_t *data, int bytes)
+{
+    const int nb = bytes >> 2;
+    float sample_peak = s->stats.sample_peak;
+
+    for (int i = 0; i < nb;) {
+        const int len = FFMIN(nb - i, FFMIN(CRIP_LOUDNESS_STEP - s->step_samples,
+                                            CRIP_LOUDNESS_TP_CHUNK - s->tp_samples));
+        float *tp = s->tp_buf + 2*(TP_HISTORY + s->tp_samples);
+        double energy = s->step_energy;
+
+        for (int j = 0; j < len; j++) {
+            for (int c = 0; c < 2; c++) {
+                double x = (int16_t)AV_RL16(&data[(i + j)*4 + c*2])/32768.0;
+                double y = biquad(s->pre_b, s->pre_a, s->pre_state[c], x);
+                y = biquad(s->rlb_b, s->rlb_a, s->rlb_state[c], y);
+                energy += y*y;
+
+                tp[j*2 + c] = x;
+                sample_peak = FFMAX(sample_peak, fabsf(tp[j*2 + c]));
+            }
+        }
+
+        s->step_energy = energy;
+        s->step_samples += len;
+        s->tp_samples += len;
+        i += len;
+
+        if (s->step_samples == CRIP_LOUDNESS_STEP)
+            end_step(s);
+        if (s->tp_samples == CRIP_LOUDNESS_TP_CHUNK)
+            run_true_peak(s);
+    }
+
+    s->stats.sample_peak = sample_peak;
+}
+
+void crip_loudness_flush(CRIPLoudness *s)
+{
+    /* Incomplete steps don't count, as with lavfi */
+    if (s->tp_samples)
+        run_true_peak(s);
+
+    /* The interpolation filter isn't exactly flat at the samples */
+    s->stats.true_peak = FFMAX(s->stats.true_peak, s->stats.sample_peak);
+}
+
+void crip_loudness_merge(CRIPLoudnessStats *dst, const CRIPLoudnessStats *src)
+{
+    const CRIPLoudnessGate *sg[] = { &src->block, &src->range };
+    CRIPLoudnessGate *dg[] = { &dst->block, &dst->range };
+
+    for (int j = 0; j < FF_ARRAY_ELEMS(sg); j++) {
+        for (int i = 0; i < CRIP_LOUDNESS_HIST_SIZE; i++)
+            dg[j]->hist[i] += sg[j]->hist[i];
+        dg[j]->sum_power += sg[j]->sum_power;
+        dg[j]->nb_powers += sg[j]->nb_powers;
+    }
+
+    dst->sample_peak = FFMAX(dst->sample_peak, src->sample_peak);
+    dst->true_peak = FFMAX(dst->true_peak, src->true_peak);
+}
+
+/* Relative gate, as a histogram position */
+static int gate_threshold(const CRIPLoudnessGate *g, int gate, double *threshold)
+{
+    double mean = g->sum_power/g->nb_powers;
+    *threshold = to_loudness(mean ? mean : 1e-12) + gate;
+    return HIST_POS(*threshold);
+}
+
+void crip_loudness_results(const CRIPLoudnessStats *s, CRIPLoudnessResults *r)
+{
+    memset(r, 0, sizeof(*r));
+    r->integrated = ABS_THRES;
+
+    if (s->block.nb_powers) {
+        const CRIPLoudnessGate *g = &s->block;
+        int pos = gate_threshold(g, BLOCK_GATE, &r->threshold);
+
+        double sum = 0.0;
+        uint64_t nb = 0;
+        for (int i = pos; i < CRIP_LOUDNESS_HIST_SIZE; i++) {
+            nb  += g->hist[i];
+            sum += g->hist[i]*pow(10.0, (HIST_LOUDNESS(i) + 0.691)/10.0);
+        }
+        if (nb)
+            r->integrated = to_loudness(sum/nb);
+    }
+
+    if (s->range.nb_powers) {
+        const CRIPLoudnessGate *g = &s->range;
+        int pos = gate_threshold(g, RANGE_GATE, &r->range_threshold);
+
+        uint64_t nb = 0;
+        for (int i = pos; i < CRIP_LOUDNESS_HIST_SIZE; i++)
+            nb += g->hist[i];
+
+        /* The percentiles get rounded the same way lavfi does */
+        if (nb) {
+            uint64_t n = 0, target = RANGE_LOW_PRC*nb*0.01 + 0.5;
+            for (int i = pos; i < CRIP_LOUDNESS_HIST_SIZE; i++) {
+                n += g->hist[i];
+                if (n >= target) {
+                    r->range_low = HIST_LOUDNESS(i);
+                    break;
+                }
+            }
+
+            n = nb;
+            target = RANGE_HIGH_PRC*nb*0.01 + 0.5;
+            for (int i = CRIP_LOUDNESS_HIST_SIZE - 1; i >= 0; i--) {
+                n -= FFMIN(n, g->hist[i]);
+                if (n < target) {
+                    r->range_high = HIST_LOUDNESS(i);
+                    break;
+                }
+            }
+
+            r->range = r->range_high - r->range_low;
+        }
+    }
+
+    r->sample_peak = 20.0*log10(s->sample_peak);
+    r->true_peak = 20.0*log10(s->true_peak);
+}
@@ -0,0 +1,109 @@
+/*
+ * This file is part of cyanrip.
+ *
+ * cyanrip is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * cyanrip is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with cyanrip; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+/* EBU R128 loudness measurement of 44.1kHz stereo audio, following what
+ * lavfi's ebur128 filter does. Gating blocks only get counted into
+ * histograms with 0.01 LU bins, so the measurements of several tracks can
+ * be merged to get the loudness of all of them. */
+
+/* -70 LUFS to +10 LUFS */
+#define CRIP_LOUDNESS_HIST_SIZE 8000
+
+/* Samples of one channel of one 100ms step */
+#define CRIP_LOUDNESS_STEP 4410
+
+/* Number of input samples the true peak kernels get at a time */
+#define CRIP_LOUDNESS_TP_CHUNK 1024
+
+/* Taps per phase of the true peak oversampling filter */
+#define CRIP_LOUDNESS_TP_TAPS 12
+
+typedef struct CRIPLoudnessGate {
+    uint32_t hist[CRIP_LOUDNESS_HIST_SIZE];
+    double sum_power; /* Of the blocks above the absolute gate */
+    uint64_t nb_powers;
+} CRIPLoudnessGate;
+
+/* All that's needed to get the results */
+typedef struct CRIPLoudnessStats {
+    CRIPLoudnessGate block; /* 400ms blocks, for the integrated loudness */
+    CRIPLoudnessGate range; /* 3s blocks, for the loudness range */
+    float sample_peak;
+    float true_peak;
+} CRIPLoudnessStats;
+
+typedef struct CRIPLoudnessResults {
+    double integrated;
+    double threshold;
+    double range;
+    double range_threshold;
+    double range_low;
+    double range_high;
+    double sample_peak; /* dBFS */
+    double true_peak;   /* dBFS */
+} CRIPLoudnessResults;
+
+/* Returns the greatest absolute value out of peak, and every sample of nb
+ * stereo samples 4x oversampled. data is interleaved, and must be preceded
+ * by CRIP_LOUDNESS_TP_TAPS - 1 samples of history. */
+typedef float (*crip_true_peak_fn)(const float *data, int nb, float peak);
+
+typedef struct CRIPLoudnessDSP {
+    crip_true_peak_fn true_peak;
+} CRIPLoudnessDSP;
+
+typedef struct CRIPLoudness {
+    CRIPLoudnessDSP dsp;
+    CRIPLoudnessStats stats;
+
+    /* K-weighting, a high shelf followed by a high pass */
+    double pre_b[3], pre_a[3];
+    double rlb_b[3], rlb_a[3];
+    double pre_state[2][2];
+    double rlb_state[2][2];
+
+    /* Weighted energy of the last 30 steps, and of the current one */
+    double steps[30];
+    int nb_steps;
+    double step_energy;
+    int step_samples;
+
+    /* Samples waiting for the true peak kernel, after its history */
+    float tp_buf[2*(CRIP_LOUDNESS_TP_TAPS - 1 + CRIP_LOUDNESS_TP_CHUNK)];
+    int tp_samples;
+} CRIPLoudness;
+
+/* Sets up the kernels for the given AV_CPU_FLAG_ flags */
+void crip_loudness_dsp_init(CRIPLoudnessDSP *dsp, int cpu_flags);
+
+void crip_loudness_init(CRIPLoudness *s);
+
+/* Measures interleaved 16 bit stereo samples, any whole number of them */
+void crip_loudness_process(CRIPLoudness *s, const uint8_t *data, int bytes);
+
+/* Finishes the measurement, must be called before using s->stats */
+void crip_loudness_flush(CRIPLoudness *s);
+
+/* Adds the measurement in src to dst */
+void crip_loudness_merge(CRIPLoudnessStats *dst, const CRIPLoudnessStats *src);
+
+void crip_loudness_results(const CRIPLoudnessStats *s, CRIPLoudnessResults *r);
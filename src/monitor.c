@@ -0,0 +1,103 @@
+/*
+ * This file is part of cyanrip.
+ *
+ * cyanrip is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * cyanrip is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with cyanrip; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include <pthread.h>
+
+#include <libavutil/time.h>
+
+#include "monitor.h"
+
+struct CRIPMonitor {
+    cyanrip_ctx *ctx;
+    pthread_t thread;
+    atomic_int stop;
+};
+
+/* Returns 1 if the media changed, 0 if not, or a negative value if the
+ * drive can't tell */
+static int poll_media_changed(cyanrip_ctx *ctx)
+{
+    int ret = cdio_get_media_changed(ctx->cdio);
+    if (ret == DRIVER_OP_UNSUPPORTED)
+        return ret;
+
+    atomic_fetch_add(&ctx->media_polls, 1);
+    if (ret > 0) {
+        atomic_fetch_add(&ctx->media_changes, 1);
+        atomic_store(&ctx->media_changed, 1);
+    }
+
+    return ret > 0;
+}
+
+static void *monitor_thread(void *arg)
+{
+    CRIPMonitor *s = arg;
+
+    while (!atomic_load(&s->stop)) {
+        av_usleep(CRIP_MONITOR_INTERVAL_MS * 1000);
+        if (!atomic_load(&s->stop))
+            poll_media_changed(s->ctx);
+    }
+
+    return NULL;
+}
+
+int crip_monitor_start(cyanrip_ctx *ctx, CRIPMonitor **s)
+{
+    /* Resets the drive's changed state, so only changes from now on count */
+    if (poll_media_changed(ctx) < 0) {
+        ctx->media_poll_interval = 0;
+        *s = NULL;
+        return 0;
+    }
+
+    /* The initial poll is not a detection */
+    atomic_store(&ctx->media_polls, 0);
+    atomic_store(&ctx->media_changes, 0);
+    atomic_store(&ctx->media_changed, 0);
+
+    CRIPMonitor *m = av_mallocz(sizeof(*m));
+    if (!m)
+        return AVERROR(ENOMEM);
+
+    m->ctx = ctx;
+    atomic_init(&m->stop, 0);
+
+    int ret = pthread_create(&m->thread, NULL, monitor_thread, m);
+    if (ret) {
+        av_free(m);
+        return AVERROR(ret);
+    }
+
+    ctx->media_poll_interval = CRIP_MONITOR_INTERVAL_MS;
+    *s = m;
+
+    return 0;
+}
+
+void crip_monitor_stop(CRIPMonitor **s)
+{
+    CRIPMonitor *m = *s;
+    if (!m)
+        return;
+
+    atomic_store(&m->stop, 1);
+    pthread_join(m->thread, NULL);
+    av_freep(s);
+}
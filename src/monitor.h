@@ -0,0 +1,34 @@
+/*
+ * This file is part of cyanrip.
+ *
+ * cyanrip is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * cyanrip is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with cyanrip; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#pragma once
+
+#include "cyanrip_main.h"
+
+/* How often the drive gets asked whether its media changed */
+#define CRIP_MONITOR_INTERVAL_MS 250
+
+typedef struct CRIPMonitor CRIPMonitor;
+
+/* Starts a thread polling the drive for media changes, raising
+ * ctx->media_changed once one happens. Drives which can't report changes
+ * (like disc images) are polled once, and get no thread. */
+int crip_monitor_start(cyanrip_ctx *ctx, CRIPMonitor **s);
+
+/* Stops the thread, ctx->media_polls and media_changes stay valid */
+void crip_monitor_stop(CRIPMonitor **s);
@@ -19,8 +19,11 @@
 #include "musicbrainz.h"
 #include "qrcode.h"
 #include "cyanrip_log.h"
+#include "cache.h"
 
 #include <musicbrainz5/mb5_c.h>
+#include <libavutil/avstring.h>
+#include <libavutil/bprint.h>
 #include <libavutil/crc.h>
 #include <libavutil/time.h>
 
@@ -28,6 +31,7 @@
  * queried again right after a cancelled rip. Wait it out and retry. */
 #define MB_RETRY_DELAY_MS 15000
 #define MB_MAX_RETRIES 3
+#define MB_QUERY_INTERVAL_MS 1000
 
 #define READ_MB(FUNC, MBCTX, DICT, KEY, APPEND)                                     \
     do {                                                                            \
@@ -195,22 +199,168 @@ static int mb_tracks(cyanrip_ctx *ctx, Mb5Release release, const char *discid, i
 }
 
 /* Returns 1 if the wait was cut short by the user quitting */
-static int mb_wait(int64_t delay_ms)
+static int mb_wait(cyanrip_ctx *ctx, int64_t delay_ms)
 {
-    while ((delay_ms > 0) && !quit_now) {
+    while ((delay_ms > 0) && !crip_quit(ctx)) {
         int64_t chunk = delay_ms > 100 ? 100 : delay_ms;
         av_usleep(chunk * 1000);
         delay_ms -= chunk;
     }
 
-    return quit_now;
+    return crip_quit(ctx);
+}
+
+/* Queries from all drives go through here, one at a time, and no more often
+ * than the MusicBrainz rate limit allows */
+static Mb5Metadata mb_query(cyanrip_ctx *ctx, Mb5Query query, const char *discid,
+                            char **names, char **values)
+{
+    CRIPShared *sh = ctx->shared;
+    Mb5Metadata metadata = NULL;
+
+    pthread_mutex_lock(&sh->mb_lock);
+
+    int64_t next = sh->mb_last_query + MB_QUERY_INTERVAL_MS*1000;
+    int64_t now = av_gettime_relative();
+    if (!sh->mb_last_query || now >= next || !mb_wait(ctx, (next - now)/1000)) {
+        metadata = mb5_query_query(query, "discid", discid, 0, 1, names, values);
+        sh->mb_last_query = av_gettime_relative();
+    }
+
+    pthread_mutex_unlock(&sh->mb_lock);
+
+    return metadata;
+}
+
+/* libmusicbrainz doesn't hand out its responses, so what was taken from the
+ * release gets cached instead, as "<scope> <key>=<value>" lines, where the
+ * scope is either "album", or a track number. */
+static void mb_cache_key(char *key, size_t len, const char *discid,
+                         int release_idx, const char *release_str, int discnumber)
+{
+    if (release_str)
+        snprintf(key, len, "%s release=%s disc=%i", discid, release_str, discnumber);
+    else
+        snprintf(key, len, "%s release=%i disc=%i", discid, release_idx, discnumber);
+}
+
+/* Only what the lookup added or changed gets written */
+static void mb_cache_dict(AVBPrint *bp, const char *scope,
+                          AVDictionary *dict, AVDictionary *prev)
+{
+    const AVDictionaryEntry *e = NULL;
+    while ((e = av_dict_get(dict, "", e, AV_DICT_IGNORE_SUFFIX))) {
+        const char *old = dict_get(prev, e->key);
+        if (old && !strcmp(old, e->value))
+            continue;
+
+        av_bprintf(bp, "%s %s=", scope, e->key);
+        for (const char *c = e->value; *c; c++) {
+            if (*c == '\\')
+                av_bprintf(bp, "\\\\");
+            else if (*c == '\n')
+                av_bprintf(bp, "\\n");
+            else
+                av_bprint_chars(bp, *c, 1);
+        }
+        av_bprint_chars(bp, '\n', 1);
+    }
+}
+
+static void mb_cache_store(cyanrip_ctx *ctx, const char *key,
+                           AVDictionary *prev_meta, AVDictionary **prev_tracks)
+{
+    AVBPrint bp;
+    av_bprint_init(&bp, 0, AV_BPRINT_SIZE_UNLIMITED);
+
+    mb_cache_dict(&bp, "album", ctx->meta, prev_meta);
+    for (int i = 0; i < ctx->nb_cd_tracks; i++) {
+        char scope[16];
+        snprintf(scope, sizeof(scope), "%i", i + 1);
+        mb_cache_dict(&bp, scope, ctx->tracks[i].meta, prev_tracks[i]);
+    }
+
+    if (av_bprint_is_complete(&bp))
+        crip_cache_put(ctx, "musicbrainz", key, (uint8_t *)bp.str, bp.len, NULL);
+
+    av_bprint_finalize(&bp, NULL);
+}
+
+static int mb_cache_parse(cyanrip_ctx *ctx, char *data)
+{
+    char *save = NULL;
+    for (char *line = av_strtok(data, "\n", &save); line; line = av_strtok(NULL, "\n", &save)) {
+        char *key = strchr(line, ' ');
+        char *val = key ? strchr(key, '=') : NULL;
+        if (!val)
+            return AVERROR_INVALIDDATA;
+        *key++ = '\0';
+        *val++ = '\0';
+
+        char *dst = val;
+        for (const char *src = val; *src; src++) {
+            if (*src == '\\' && src[1]) {
+                src++;
+                *dst++ = *src == 'n' ? '\n' : *src;
+            } else {
+                *dst++ = *src;
+            }
+        }
+        *dst = '\0';
+
+        AVDictionary **dict;
+        if (!strcmp(line, "album")) {
+            dict = &ctx->meta;
+        } else {
+            int idx = strtol(line, NULL, 10);
+            if (idx < 1 || idx > ctx->nb_cd_tracks)
+                continue;
+            dict = &ctx->tracks[idx - 1].meta;
+        }
+
+        av_dict_set(dict, key, val, 0);
+    }
+
+    return 0;
+}
+
+static int mb_cache_lookup(cyanrip_ctx *ctx, const char *key)
+{
+    uint8_t *data;
+    size_t size;
+    char *content_type;
+
+    int ret = crip_cache_get(ctx, "musicbrainz", key, &data, &size, &content_type);
+    if (ret == CRIP_CACHE_HIT && mb_cache_parse(ctx, (char *)data) < 0) {
+        cyanrip_log(ctx, 0, "Cached MusicBrainz lookup is invalid, ignoring!\n");
+        ret = CRIP_CACHE_MISS;
+    }
+
+    av_free(content_type);
+    av_free(data);
+
+    return ret;
 }
 
 static int mb_metadata(cyanrip_ctx *ctx, int manual_metadata_specified, int release_idx, char *release_str, int discnumber)
 {
     int ret = 0, notfound = 0, possible_stub = 0;
     const char *ua = "cyanrip/" PROJECT_VERSION_STRING " ( https://github.com/cyanreg/cyanrip )";
-    Mb5Query query = mb5_query_new(ua, NULL, 0);
+
+    /* A different server can be given as host[:port] */
+    int port = 0;
+    char server[256] = { 0 };
+    const char *server_env = crip_lookup_url("CYANRIP_MUSICBRAINZ_SERVER", NULL);
+    if (server_env) {
+        av_strlcpy(server, server_env, sizeof(server));
+        char *sep = strrchr(server, ':');
+        if (sep) {
+            *sep = '\0';
+            port = strtol(sep + 1, NULL, 10);
+        }
+    }
+
+    Mb5Query query = mb5_query_new(ua, server[0] ? server : NULL, port);
     if (!query) {
         cyanrip_log(ctx, 0, "Could not connect to MusicBrainz.\n");
         return 1;
@@ -220,6 +370,9 @@ static int mb_metadata(cyanrip_ctx *ctx, int manual_metadata_specified, int rele
     char *values[] = { "recordings artist-credits labels" };
     Mb5Metadata metadata = NULL;
     tQueryResult res = eQuery_Success;
+    AVDictionary *prev_meta = NULL;
+    AVDictionary **prev_tracks = NULL;
+    char cache_key[256];
 
     const char *discid = dict_get(ctx->meta, "musicbrainz_discid");
     if (!discid) {
@@ -227,8 +380,36 @@ static int mb_metadata(cyanrip_ctx *ctx, int manual_metadata_specified, int rele
         goto end;
     }
 
+    mb_cache_key(cache_key, sizeof(cache_key), discid, release_idx, release_str, discnumber);
+    int cached = mb_cache_lookup(ctx, cache_key);
+    if (cached == CRIP_CACHE_HIT) {
+        cyanrip_log(ctx, 0, "Found MusicBrainz release (cached): %s - %s\n",
+                    dict_get(ctx->meta, "album"), dict_get(ctx->meta, "album_artist"));
+        goto end;
+    } else if (cached == CRIP_CACHE_NOT_FOUND) {
+        notfound = 1;
+        goto end;
+    } else if (ctx->settings.offline) {
+        cyanrip_log(ctx, 0, "MusicBrainz lookup failed: not cached, and offline, "
+                    "disable it via -N\n");
+        ret = 1;
+        goto end;
+    }
+
+    /* Keep what was there before, to only cache what the lookup found */
+    if (ctx->settings.cache_dir) {
+        prev_tracks = av_calloc(ctx->nb_cd_tracks, sizeof(*prev_tracks));
+        if (!prev_tracks) {
+            ret = 1;
+            goto end;
+        }
+        av_dict_copy(&prev_meta, ctx->meta, 0);
+        for (int i = 0; i < ctx->nb_cd_tracks; i++)
+            av_dict_copy(&prev_tracks[i], ctx->tracks[i].meta, 0);
+    }
+
     for (int i = 0; i <= MB_MAX_RETRIES; i++) {
-        metadata = mb5_query_query(query, "discid", discid, 0, 1, names, values);
+        metadata = mb_query(ctx, query, discid, names, values);
         if (metadata)
             break;
 
@@ -257,14 +438,16 @@ static int mb_metadata(cyanrip_ctx *ctx, int manual_metadata_specified, int rele
         cyanrip_log(ctx, 0, "Retrying in %i seconds (attempt %i out of %i)...\n",
                     MB_RETRY_DELAY_MS / 1000, i + 2, MB_MAX_RETRIES + 1);
 
-        if (mb_wait(MB_RETRY_DELAY_MS))
+        if (mb_wait(ctx, MB_RETRY_DELAY_MS))
             break;
     }
 
     if (!metadata) {
-        if (res == eQuery_ResourceNotFound)
+        if (res == eQuery_ResourceNotFound) {
+            crip_cache_put(ctx, "musicbrainz", cache_key, NULL, 0, NULL);
             notfound = 1;
-        else if (!quit_now)
+        }
+        else if (!crip_quit(ctx))
             cyanrip_log(ctx, 0, "MusicBrainz lookup failed, try again later, "
                         "or disable it via -N\n");
 
@@ -387,7 +570,8 @@ static int mb_metadata(cyanrip_ctx *ctx, int manual_metadata_specified, int rele
                 dict_get(ctx->meta, "album"), dict_get(ctx->meta, "album_artist"));
 
     /* Read track metadata */
-    mb_tracks(ctx, release, discid, discnumber);
+    if (!mb_tracks(ctx, release, discid, discnumber) && prev_tracks)
+        mb_cache_store(ctx, cache_key, prev_meta, prev_tracks);
 
 end_meta:
     mb5_metadata_delete(metadata); /* This frees _all_ metadata */
@@ -395,6 +579,11 @@ end_meta:
 end:
     mb5_query_delete(query);
 
+    av_dict_free(&prev_meta);
+    for (int i = 0; prev_tracks && (i < ctx->nb_cd_tracks); i++)
+        av_dict_free(&prev_tracks[i]);
+    av_free(prev_tracks);
+
     if (notfound) {
         if (possible_stub) {
             cyanrip_log(ctx, 0, "MusicBrainz lookup failed, but DiscID has a matching stub, "
@@ -16,10 +16,13 @@
  * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
  */
 
+#include <pthread.h>
+#include <stdint.h>
 #include <sys/stat.h>
 
 #include <libavutil/avstring.h>
 #include <libavutil/bprint.h>
+#include <libavutil/common.h>
 
 #include "cyanrip_main.h"
 #include "cyanrip_log.h"
@@ -156,56 +159,286 @@ static int crip_bprint_sanitize(cyanrip_ctx *ctx, AVBPrint *buf, const char *str
     return 0;
 }
 
-static char *get_dir_tag_val(cyanrip_ctx *ctx, AVDictionary *meta,
-                             const char *ofmt, const char *key)
+/* Returns the value of a scheme tag, or NULL if missing. Derived values are
+ * written to buf. */
+static const char *tag_value(cyanrip_ctx *ctx, AVDictionary *meta, const char *ofmt,
+                             const char *key, char *buf, size_t buf_size)
 {
-    char *val = NULL;
     if (!strcmp(key, "year")) {
         const char *date = dict_get(meta, "date");
-        if (date) {
-            char *save_year, *date_dup = av_strdup(date);
-            val = av_strdup(av_strtok(date_dup, ":-", &save_year));
-            av_free(date_dup);
-        }
+        if (!date)
+            return NULL;
+        date += strspn(date, ":-");
+        size_t len = FFMIN(strcspn(date, ":-"), buf_size - 1);
+        if (!len)
+            return NULL;
+        memcpy(buf, date, len);
+        buf[len] = '\0';
+        return buf;
     } else if (!strcmp(key, "format")) {
-        val = av_strdup(ofmt);
+        return ofmt;
     } else if (!strcmp(key, "track")) {
         const char *track = dict_get(meta, "track");
-        if (crip_is_integer(track)) {
-            int pad = 0, digits = strlen(track);
-            if (((digits + pad) < 2) && ctx->nb_tracks >  9) pad++;
-            if (((digits + pad) < 3) && ctx->nb_tracks > 99) pad++;
-            val = av_mallocz(pad + digits + 1);
-            for (int i = 0; i < pad; i++)
-                val[i] = '0';
-            memcpy(&val[pad], track, digits);
-        } else {
-            val = av_strdup(track);
-        }
-    } else {
-        val = av_strdup(dict_get(meta, key));
+        if (!crip_is_integer(track))
+            return track;
+        int pad = 0, digits = strlen(track);
+        if (((digits + pad) < 2) && ctx->nb_tracks >  9) pad++;
+        if (((digits + pad) < 3) && ctx->nb_tracks > 99) pad++;
+        if (pad + digits + 1 > buf_size)
+            return track;
+        memset(buf, '0', pad);
+        memcpy(&buf[pad], track, digits + 1);
+        return buf;
+    }
+
+    return dict_get(meta, key);
+}
+
+/* Strings to arbitrary pointers, for the paths and directories remembered */
+typedef struct StrMapEntry {
+    char *key;
+    uint32_t hash;
+    void *val;
+} StrMapEntry;
+
+typedef struct StrMap {
+    StrMapEntry *entries;
+    int nb_entries;
+    int size; /* Power of two */
+} StrMap;
+
+static uint32_t str_hash(const char *str)
+{
+    uint32_t hash = 2166136261u;
+    for (; *str; str++)
+        hash = (hash ^ (uint8_t)*str) * 16777619u;
+    return hash;
+}
+
+static int strmap_grow(StrMap *m)
+{
+    int size = m->size ? m->size*2 : 64;
+    StrMapEntry *entries = av_calloc(size, sizeof(*entries));
+    if (!entries)
+        return AVERROR(ENOMEM);
+
+    for (int i = 0; i < m->size; i++) {
+        if (!m->entries[i].key)
+            continue;
+        uint32_t j = m->entries[i].hash & (size - 1);
+        while (entries[j].key)
+            j = (j + 1) & (size - 1);
+        entries[j] = m->entries[i];
     }
 
-    return val;
+    av_free(m->entries);
+    m->entries = entries;
+    m->size = size;
+
+    return 0;
 }
 
-static int process_cond(cyanrip_ctx *ctx, AVBPrint *buf, AVDictionary *meta,
-                        const char *ofmt, const char *scheme)
+/* Returns NULL if the key is missing, unless add is set, in which case it's
+ * added with a NULL value. NULL then means out of memory. */
+static StrMapEntry *strmap_get(StrMap *m, const char *key, int add)
 {
-    char *scheme_copy = av_strdup(scheme);
+    if (add && ((m->nb_entries + 1)*4 > m->size*3) && strmap_grow(m) < 0)
+        return NULL;
+    if (!m->size)
+        return NULL;
+
+    uint32_t hash = str_hash(key);
+    uint32_t j = hash & (m->size - 1);
+    while (m->entries[j].key) {
+        if (m->entries[j].hash == hash && !strcmp(m->entries[j].key, key))
+            return &m->entries[j];
+        j = (j + 1) & (m->size - 1);
+    }
+
+    if (!add || !(m->entries[j].key = av_strdup(key)))
+        return NULL;
+
+    m->entries[j].hash = hash;
+    m->nb_entries++;
+
+    return &m->entries[j];
+}
+
+static void strmap_free(StrMap *m, void (*free_val)(void *val))
+{
+    for (int i = 0; i < m->size; i++) {
+        av_free(m->entries[i].key);
+        if (free_val && m->entries[i].val)
+            free_val(m->entries[i].val);
+    }
+    av_freep(&m->entries);
+    m->nb_entries = m->size = 0;
+}
+
+struct CRIPPathSet {
+    StrMap map;
+};
+
+CRIPPathSet *crip_path_set_alloc(void)
+{
+    return av_mallocz(sizeof(CRIPPathSet));
+}
+
+int crip_path_set_add(CRIPPathSet *s, const char *path, int owner, int *prev_owner)
+{
+    StrMapEntry *e = strmap_get(&s->map, path, 1);
+    if (!e)
+        return AVERROR(ENOMEM);
+
+    if (e->val) {
+        *prev_owner = (intptr_t)e->val - 1;
+        return 1;
+    }
+
+    e->val = (void *)(intptr_t)(owner + 1);
+
+    return 0;
+}
+
+void crip_path_set_free(CRIPPathSet **s)
+{
+    if (!*s)
+        return;
+    strmap_free(&(*s)->map, NULL);
+    av_freep(s);
+}
+
+/* Schemes are compiled once into a list of these */
+enum SchemeOpType {
+    SCHEME_TEXT, /* Literal text, sanitized when compiled */
+    SCHEME_TAG,  /* Tag value, or its name as text if it's missing */
+    SCHEME_COND, /* Skips the next nb_skip ops if false */
+};
+
+enum SchemeCond {
+    SCHEME_COND_EQ,
+    SCHEME_COND_NOT_EQ,
+    SCHEME_COND_MORE,
+    SCHEME_COND_LESS,
+};
+
+typedef struct SchemeOp {
+    enum SchemeOpType type;
+    char *text;      /* Text, or name of the (first) tag */
+    char *fallback;  /* Tag: sanitized name, cond: compared if the tag is missing */
+
+    enum SchemeCond cond;
+    char *key2;
+    char *fallback2;
+    int nb_skip;
+} SchemeOp;
+
+typedef struct CRIPScheme {
+    char *src;
+    enum CRIPSanitize sanitize_method;
+
+    SchemeOp *ops;
+    int nb_ops;
+    int error; /* Output stops at the end of the ops, as the scheme is invalid */
+
+    const char **keys; /* Every tag looked at, once, points into ops */
+    int nb_keys;
+} CRIPScheme;
+
+/* A path as last worked out, with the values it was made of */
+typedef struct PathMemo {
+    uint8_t *inputs;
+    int inputs_len;
+    char *path;
+} PathMemo;
+
+typedef struct CRIPNaming {
+    CRIPScheme **schemes;
+    int nb_schemes;
+    StrMap paths; /* PathMemo by path type, format and argument */
+    StrMap dirs;  /* Every directory known to exist */
+} CRIPNaming;
+
+/* Paths are worked out from encoding threads too */
+static pthread_mutex_t naming_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static char *sanitized(cyanrip_ctx *ctx, const char *str, int sanitize_fwdslash)
+{
+    char *ret = NULL;
+    AVBPrint buf;
+    av_bprint_init(&buf, 0, AV_BPRINT_SIZE_UNLIMITED);
+    crip_bprint_sanitize(ctx, &buf, str, sanitize_fwdslash);
+    av_bprint_finalize(&buf, &ret);
+    return ret;
+}
+
+static SchemeOp *add_op(CRIPScheme *s)
+{
+    SchemeOp *ops = av_realloc_array(s->ops, s->nb_ops + 1, sizeof(*ops));
+    if (!ops)
+        return NULL;
+    s->ops = ops;
+    memset(&ops[s->nb_ops], 0, sizeof(*ops));
+    return &ops[s->nb_ops++];
+}
+
+static int add_key(CRIPScheme *s, const char *key)
+{
+    for (int i = 0; i < s->nb_keys; i++)
+        if (!strcmp(s->keys[i], key))
+            return 0;
+
+    const char **keys = av_realloc_array(s->keys, s->nb_keys + 1, sizeof(*keys));
+    if (!keys)
+        return AVERROR(ENOMEM);
+    s->keys = keys;
+    s->keys[s->nb_keys++] = key;
+
+    return 0;
+}
+
+static int add_tag_op(cyanrip_ctx *ctx, CRIPScheme *s, const char *key)
+{
+    SchemeOp *op = add_op(s);
+    if (!op)
+        return AVERROR(ENOMEM);
+
+    op->type = SCHEME_TAG;
+    op->text = av_strdup(key);
+    op->fallback = sanitized(ctx, key, 0);
+    if (!op->text || !op->fallback)
+        return AVERROR(ENOMEM);
+
+    return add_key(s, op->text);
+}
+
+/* Invalid schemes are compiled up to the error, and logged once */
+static int compile_scheme(cyanrip_ctx *ctx, CRIPScheme *s)
+{
+    int ret = 0;
+    char *cond = NULL;
+    char *scheme_copy = av_strdup(s->src);
+    if (!scheme_copy)
+        return AVERROR(ENOMEM);
 
     char *pos = scheme_copy;
     while (*pos) {
         /* Literal text outside of {} is emitted as-is, never substituted */
         if (*pos != '{') {
             char *next = strchr(pos, '{');
-            char tmpc = next ? *next : 0;
             if (next)
                 *next = '\0';
-            crip_bprint_sanitize(ctx, buf, pos, 0);
+
+            SchemeOp *op = add_op(s);
+            if (!op || !(op->text = sanitized(ctx, pos, 0))) {
+                ret = AVERROR(ENOMEM);
+                goto end;
+            }
+            op->type = SCHEME_TEXT;
+
             if (!next)
                 break;
-            *next = tmpc;
+            *next = '{';
             pos = next;
             continue;
         }
@@ -219,129 +452,231 @@ static int process_cond(cyanrip_ctx *ctx, AVBPrint *buf, AVDictionary *meta,
         char *tok = pos + 1;
         pos = end + 1;
 
-        if (!strncmp(tok, "if", strlen("if")) &&
-            (tok[strlen("if")] == ' ' || tok[strlen("if")] == '#')) {
-            char *cond = av_strdup(tok);
-            char *cond_save, *cond_tok = av_strtok(cond, "#", &cond_save);
+        if (!(!strncmp(tok, "if", strlen("if")) &&
+              (tok[strlen("if")] == ' ' || tok[strlen("if")] == '#'))) {
+            if ((ret = add_tag_op(ctx, s, tok)) < 0)
+                goto end;
+            continue;
+        }
 
-            cond_tok = av_strtok(NULL, "#", &cond_save);
-            if (!cond_tok) {
-                cyanrip_log(ctx, 0, "Invalid scheme syntax, no \"#\"!\n");
-                av_free(cond);
-                goto fail;
-            }
+        /* {if #val1# op #val2#|body|...} */
+        char *cond_save, *cond_tok[5] = { NULL };
+        cond = av_strdup(tok);
+        if (!cond) {
+            ret = AVERROR(ENOMEM);
+            goto end;
+        }
+        cond_tok[0] = av_strtok(cond, "#", &cond_save);
+        for (int i = 1; i < FF_ARRAY_ELEMS(cond_tok) && cond_tok[i - 1]; i++)
+            cond_tok[i] = av_strtok(NULL, "#", &cond_save);
 
-            int val1_origin_is_tag = 1;
-            char *val1 = get_dir_tag_val(ctx, meta, ofmt, cond_tok);
-            if (!val1) {
-                val1 = av_strdup(tok);
-                val1_origin_is_tag = 0;
-            }
+        if (!cond_tok[1]) {
+            cyanrip_log(ctx, 0, "Invalid scheme syntax, no \"#\"!\n");
+            goto fail;
+        } else if (!cond_tok[2]) {
+            cyanrip_log(ctx, 0, "Invalid scheme syntax, no terminating \"#\"!\n");
+            goto fail;
+        }
 
-            cond_tok = av_strtok(NULL, "#", &cond_save);
-            if (!cond_tok) {
-                cyanrip_log(ctx, 0, "Invalid scheme syntax, no terminating \"#\"!\n");
-                av_free(cond);
-                av_free(val1);
-                goto fail;
-            }
+        enum SchemeCond cond_type;
+        if (strstr(cond_tok[2], "==")) {
+            cond_type = SCHEME_COND_EQ;
+        } else if (strstr(cond_tok[2], "!=")) {
+            cond_type = SCHEME_COND_NOT_EQ;
+        } else if (strstr(cond_tok[2], ">")) {
+            cond_type = SCHEME_COND_MORE;
+        } else if (strstr(cond_tok[2], "<")) {
+            cond_type = SCHEME_COND_LESS;
+        } else {
+            cyanrip_log(ctx, 0, "Invalid condition syntax!\n");
+            goto fail;
+        }
 
-            int cond_is_eq = 0, cond_is_not_eq = 0, cond_is_more = 0, cond_is_less = 0;
-            if (strstr(cond_tok, "==")) {
-                cond_is_eq = 1;
-            } else if (strstr(cond_tok, "!=")) {
-                cond_is_not_eq = 1;
-            } else if (strstr(cond_tok, ">")) {
-                cond_is_more = 1;
-            } else if (strstr(cond_tok, "<")) {
-                cond_is_less = 1;
-            } else {
-                cyanrip_log(ctx, 0, "Invalid condition syntax!\n");
-                av_free(cond);
-                av_free(val1);
-                goto fail;
-            }
+        if (!cond_tok[3] || !cond_tok[4]) {
+            cyanrip_log(ctx, 0, "Invalid scheme syntax, no terminating \"#\"!\n");
+            goto fail;
+        }
 
-            cond_tok = av_strtok(NULL, "#", &cond_save);
-            if (!cond_tok) {
-                cyanrip_log(ctx, 0, "Invalid scheme syntax, no terminating \"#\"!\n");
-                goto fail;
-            }
+        int cond_idx = s->nb_ops;
+        SchemeOp *op = add_op(s);
+        if (!op) {
+            ret = AVERROR(ENOMEM);
+            goto end;
+        }
+        op->type = SCHEME_COND;
+        op->cond = cond_type;
+        op->text = av_strdup(cond_tok[1]);
+        op->fallback = av_strdup(tok); /* Not a typo, the whole thing */
+        op->key2 = av_strdup(cond_tok[3]);
+        op->fallback2 = av_strdup(cond_tok[3]);
+        if (!op->text || !op->fallback || !op->key2 || !op->fallback2) {
+            ret = AVERROR(ENOMEM);
+            goto end;
+        }
+        if ((ret = add_key(s, op->text)) < 0 || (ret = add_key(s, op->key2)) < 0)
+            goto end;
 
-            int val2_origin_is_tag = 1;
-            char *val2 = get_dir_tag_val(ctx, meta, ofmt, cond_tok);
-            if (!val2) {
-                val2 = av_strdup(cond_tok);
-                val2_origin_is_tag = 0;
-            }
+        char *body_save, *body_tok = av_strtok(cond_tok[4], "|", &body_save);
+        while (body_tok) {
+            if ((ret = add_tag_op(ctx, s, body_tok)) < 0)
+                goto end;
+            body_tok = av_strtok(NULL, "|", &body_save);
+        }
+        s->ops[cond_idx].nb_skip = s->nb_ops - cond_idx - 1;
 
-            cond_tok = av_strtok(NULL, "#", &cond_save);
-            if (!cond_tok) {
-                cyanrip_log(ctx, 0, "Invalid scheme syntax, no terminating \"#\"!\n");
-                goto fail;
-            }
+        av_freep(&cond);
+    }
 
-            int cond_true = 0;
-            cond_true |= cond_is_eq && !strcmp(val1, val2);
-            cond_true |= cond_is_not_eq && strcmp(val1, val2);
-
-            if (cond_is_less || cond_is_more) {
-                int val1_is_int = crip_is_integer(val1), val2_is_int = crip_is_integer(val2);
-                if (!val1_is_int && (val1_is_int == val2_is_int)) { /* None are int */
-                    cond_true = cond_is_less ? (strcmp(val1, val2) < 0) : (cond_is_more ? strcmp(val1, val2) > 0 : 0);
-                } else if (val1_is_int && (val1_is_int == val2_is_int)) { /* Both are int */
-                    int64_t val1_dec = strtol(val1, NULL, 10);
-                    int64_t val2_dec = strtol(val2, NULL, 10);
-                    cond_true |= cond_is_less && val1_dec < val2_dec;
-                    cond_true |= cond_is_more && val1_dec > val2_dec;
-                } else {
-                    ptrdiff_t val1_dec = val1_is_int ? strtol(val1, NULL, 10) : (!val1_origin_is_tag ? 0 : (ptrdiff_t)val1);
-                    ptrdiff_t val2_dec = val2_is_int ? strtol(val2, NULL, 10) : (!val2_origin_is_tag ? 0 : (ptrdiff_t)val2);
-                    cond_true |= cond_is_less && val1_dec < val2_dec;
-                    cond_true |= cond_is_more && val1_dec > val2_dec;
-                }
-            }
+end:
+    av_free(cond);
+    av_free(scheme_copy);
+    return ret;
 
-            if (cond_true) {
-                char *true_save, *true_tok = av_strtok(cond_tok, "|", &true_save);
-                while (true_tok) {
-                    int origin_is_tag = 1;
-                    char *true_val = get_dir_tag_val(ctx, meta, ofmt, true_tok);
-                    if (!true_val) {
-                        true_val = av_strdup(true_tok);
-                        origin_is_tag = 0;
-                    }
-
-                    crip_bprint_sanitize(ctx, buf, true_val, origin_is_tag);
-                    av_free(true_val);
-
-                    true_tok = av_strtok(NULL, "|", &true_save);
-                }
-            }
+fail:
+    s->error = 1;
+    goto end;
+}
 
-            av_free(val2);
-            av_free(val1);
-            av_free(cond);
-            continue;
-        }
+static void free_scheme(CRIPScheme **s)
+{
+    if (!*s)
+        return;
+
+    for (int i = 0; i < (*s)->nb_ops; i++) {
+        SchemeOp *op = &(*s)->ops[i];
+        av_free(op->text);
+        av_free(op->fallback);
+        av_free(op->key2);
+        av_free(op->fallback2);
+    }
+    av_free((*s)->ops);
+    av_free((*s)->keys);
+    av_free((*s)->src);
+    av_freep(s);
+}
 
-        int origin_is_tag = 1;
-        char *val = get_dir_tag_val(ctx, meta, ofmt, tok);
-        if (!val) {
-            val = av_strdup(tok);
-            origin_is_tag = 0;
-        }
+static void free_memo(void *val)
+{
+    PathMemo *m = val;
+    av_free(m->inputs);
+    av_free(m->path);
+    av_free(m);
+}
 
-        crip_bprint_sanitize(ctx, buf, val, origin_is_tag);
-        av_free(val);
+void crip_naming_free(cyanrip_ctx *ctx)
+{
+    pthread_mutex_lock(&naming_lock);
+
+    CRIPNaming *s = ctx->naming;
+    if (s) {
+        for (int i = 0; i < s->nb_schemes; i++)
+            free_scheme(&s->schemes[i]);
+        av_free(s->schemes);
+        strmap_free(&s->paths, free_memo);
+        strmap_free(&s->dirs, NULL);
+        av_freep(&ctx->naming);
     }
 
-    av_free(scheme_copy);
-    return 0;
+    pthread_mutex_unlock(&naming_lock);
+}
 
-fail:
-    av_free(scheme_copy);
-    return AVERROR(EINVAL);
+static CRIPScheme *get_scheme(cyanrip_ctx *ctx, CRIPNaming *s, const char *src)
+{
+    if (!src)
+        return NULL;
+
+    for (int i = 0; i < s->nb_schemes; i++)
+        if (s->schemes[i]->sanitize_method == ctx->settings.sanitize_method &&
+            !strcmp(s->schemes[i]->src, src))
+            return s->schemes[i];
+
+    CRIPScheme **schemes = av_realloc_array(s->schemes, s->nb_schemes + 1,
+                                            sizeof(*schemes));
+    if (!schemes)
+        return NULL;
+    s->schemes = schemes;
+
+    CRIPScheme *sch = av_mallocz(sizeof(*sch));
+    if (!sch)
+        return NULL;
+    sch->sanitize_method = ctx->settings.sanitize_method;
+    sch->src = av_strdup(src);
+    if (!sch->src || compile_scheme(ctx, sch) < 0) {
+        free_scheme(&sch);
+        return NULL;
+    }
+
+    s->schemes[s->nb_schemes++] = sch;
+
+    return sch;
+}
+
+static int cond_true(cyanrip_ctx *ctx, const SchemeOp *op, AVDictionary *meta,
+                     const char *ofmt)
+{
+    char buf1[64], buf2[64];
+    const char *val1 = tag_value(ctx, meta, ofmt, op->text, buf1, sizeof(buf1));
+    const char *val2 = tag_value(ctx, meta, ofmt, op->key2, buf2, sizeof(buf2));
+    int val1_origin_is_tag = !!val1, val2_origin_is_tag = !!val2;
+    if (!val1)
+        val1 = op->fallback;
+    if (!val2)
+        val2 = op->fallback2;
+
+    if (op->cond == SCHEME_COND_EQ)
+        return !strcmp(val1, val2);
+    else if (op->cond == SCHEME_COND_NOT_EQ)
+        return !!strcmp(val1, val2);
+
+    int less = op->cond == SCHEME_COND_LESS;
+    int val1_is_int = crip_is_integer(val1), val2_is_int = crip_is_integer(val2);
+    if (!val1_is_int && !val2_is_int) {
+        int cmp = strcmp(val1, val2);
+        return less ? (cmp < 0) : (cmp > 0);
+    }
+
+    /* Against a number, a tag which isn't one is more than any, text is 0 */
+    int64_t val1_dec = val1_is_int ? strtoll(val1, NULL, 10) : (val1_origin_is_tag ? INT64_MAX : 0);
+    int64_t val2_dec = val2_is_int ? strtoll(val2, NULL, 10) : (val2_origin_is_tag ? INT64_MAX : 0);
+
+    return less ? (val1_dec < val2_dec) : (val1_dec > val2_dec);
+}
+
+static int run_scheme(cyanrip_ctx *ctx, const CRIPScheme *s, AVBPrint *buf,
+                      AVDictionary *meta, const char *ofmt)
+{
+    char tmp[64];
+
+    for (int i = 0; i < s->nb_ops; i++) {
+        const SchemeOp *op = &s->ops[i];
+        if (op->type == SCHEME_TEXT) {
+            av_bprintf(buf, "%s", op->text);
+        } else if (op->type == SCHEME_TAG) {
+            const char *val = tag_value(ctx, meta, ofmt, op->text, tmp, sizeof(tmp));
+            if (val)
+                crip_bprint_sanitize(ctx, buf, val, 1);
+            else
+                av_bprintf(buf, "%s", op->fallback);
+        } else if (!cond_true(ctx, op, meta, ofmt)) {
+            i += op->nb_skip;
+        }
+    }
+
+    return s->error ? AVERROR(EINVAL) : 0;
+}
+
+/* Everything the output of a scheme depends on */
+static void scheme_inputs(cyanrip_ctx *ctx, AVBPrint *bp, const CRIPScheme *s,
+                          AVDictionary *meta, const char *ofmt)
+{
+    char tmp[64];
+
+    av_bprintf(bp, "%p", s);
+    for (int i = 0; i < s->nb_keys; i++) {
+        const char *val = tag_value(ctx, meta, ofmt, s->keys[i], tmp, sizeof(tmp));
+        av_bprint_chars(bp, val ? '=' : '!', 1);
+        av_bprint_append_data(bp, val ? val : "", val ? strlen(val) + 1 : 1);
+    }
 }
 
 /* Schemes with conditionals easily produce spaces at the edges of path
@@ -382,64 +717,126 @@ static void crip_trim_path_components(char *path)
     }
 }
 
+
 char *crip_get_path(cyanrip_ctx *ctx, enum CRIPPathType type, int create_dirs,
                     const cyanrip_out_fmt *fmt, void *arg)
 {
+    int err = 0;
     char *ret = NULL;
-    AVBPrint buf;
+    AVBPrint buf, inputs;
     av_bprint_init(&buf, 0, AV_BPRINT_SIZE_AUTOMATIC);
+    av_bprint_init(&inputs, 0, AV_BPRINT_SIZE_UNLIMITED);
+
+    pthread_mutex_lock(&naming_lock);
 
-    if (process_cond(ctx, &buf, ctx->meta, fmt->folder_suffix,
-                     ctx->settings.folder_name_scheme))
+    if (!ctx->naming && !(ctx->naming = av_mallocz(sizeof(*ctx->naming))))
         goto end;
+    CRIPNaming *s = ctx->naming;
 
-    av_bprint_chars(&buf, OS_DIR_CHAR, 1);
+    CRIPScheme *folder = get_scheme(ctx, s, ctx->settings.folder_name_scheme);
+    if (!folder)
+        goto end;
 
-    char *ext = NULL;
+    CRIPScheme *name = NULL;
+    AVDictionary *meta = ctx->meta;
+    const char *ext = NULL;
     if (type == CRIP_PATH_COVERART) {
         CRIPArt *art = arg;
-        crip_bprint_sanitize(ctx, &buf, dict_get(art->meta, "title"), 0);
-        ext = art->extension ? av_strdup(art->extension) : av_strdup("<extension>");
+        ext = art->extension ? art->extension : "<extension>";
     } else if (type == CRIP_PATH_LOG) {
-        if (process_cond(ctx, &buf, ctx->meta, fmt->name,
-                         ctx->settings.log_name_scheme))
-            goto end;
-        ext = av_strdup("log");
+        name = get_scheme(ctx, s, ctx->settings.log_name_scheme);
+        ext = "log";
+    } else if (type == CRIP_PATH_JOURNAL) {
+        name = get_scheme(ctx, s, ctx->settings.log_name_scheme);
+        ext = "journal";
     } else if (type == CRIP_PATH_CUE) {
-        if (process_cond(ctx, &buf, ctx->meta, fmt->name,
-                         ctx->settings.cue_name_scheme))
-            goto end;
-        ext = av_strdup("cue");
+        name = get_scheme(ctx, s, ctx->settings.cue_name_scheme);
+        ext = "cue";
+    } else if (type == CRIP_PATH_ARCHIVE) {
+        name = get_scheme(ctx, s, ctx->settings.cue_name_scheme);
+        ext = "crimg";
     } else {
         cyanrip_track *t = arg;
-        if (process_cond(ctx, &buf, t->meta, fmt->name,
-                         ctx->settings.track_name_scheme))
-            goto end;
-        ext = av_strdup(t->track_is_data ? "bin" : fmt->ext);
+        name = get_scheme(ctx, s, ctx->settings.track_name_scheme);
+        meta = t->meta;
+        ext = t->track_is_data ? "bin" : fmt->ext;
     }
+    if (!name && type != CRIP_PATH_COVERART)
+        goto end;
+
+    /* Paths are only worked out again if anything they're made of changed */
+    scheme_inputs(ctx, &inputs, folder, ctx->meta, fmt->folder_suffix);
+    if (name)
+        scheme_inputs(ctx, &inputs, name, meta, fmt->name);
+    else
+        av_bprintf(&inputs, "%s", dict_get(((CRIPArt *)arg)->meta, "title"));
+    av_bprintf(&inputs, ".%s", ext);
+    if (!av_bprint_is_complete(&inputs))
+        goto end;
 
-    if (ext)
-        av_bprintf(&buf, ".%s", ext);
-    av_free(ext);
+    char memo_key[64];
+    snprintf(memo_key, sizeof(memo_key), "%i %p %p", type, fmt, arg);
+    StrMapEntry *memo_entry = strmap_get(&s->paths, memo_key, 1);
+    PathMemo *memo = memo_entry ? memo_entry->val : NULL;
+    if (memo && memo->inputs_len == inputs.len &&
+        !memcmp(memo->inputs, inputs.str, inputs.len)) {
+        ret = av_strdup(memo->path);
+        goto dirs;
+    }
 
-end:
+    if ((err = run_scheme(ctx, folder, &buf, ctx->meta, fmt->folder_suffix)))
+        goto done;
+
+    av_bprint_chars(&buf, OS_DIR_CHAR, 1);
+
+    if (type == CRIP_PATH_COVERART) {
+        CRIPArt *art = arg;
+        crip_bprint_sanitize(ctx, &buf, dict_get(art->meta, "title"), 0);
+    } else if ((err = run_scheme(ctx, name, &buf, meta, fmt->name))) {
+        goto done;
+    }
+
+    av_bprintf(&buf, ".%s", ext);
+
+done:
     av_bprint_finalize(&buf, &ret);
     if (!ret)
-        return NULL;
+        goto end;
 
     crip_trim_path_components(ret);
 
-    if (create_dirs) {
-        /* Create every directory making up the path */
+    /* Invalid schemes are logged once, their output isn't kept */
+    if (!err && memo_entry) {
+        if (!memo && (memo = av_mallocz(sizeof(*memo))))
+            memo_entry->val = memo;
+        if (memo) {
+            av_free(memo->inputs);
+            av_free(memo->path);
+            memo->inputs = av_memdup(inputs.str, inputs.len);
+            memo->inputs_len = memo->inputs ? inputs.len : 0;
+            memo->path = av_strdup(ret);
+        }
+    }
+
+dirs:
+    if (ret && create_dirs) {
+        /* Create every directory making up the path, only once */
         for (char *p = strchr(ret + 1, OS_DIR_CHAR); p;
              p = strchr(p + 1, OS_DIR_CHAR)) {
             *p = '\0';
-            cyanrip_stat_t st_req = { 0 };
-            if (cyanrip_stat(ret, &st_req) == -1)
-                mkdir(ret, 0700);
+            if (!strmap_get(&s->dirs, ret, 0)) {
+                cyanrip_stat_t st_req = { 0 };
+                if (cyanrip_stat(ret, &st_req) != -1 || !mkdir(ret, 0700))
+                    strmap_get(&s->dirs, ret, 1);
+            }
             *p = OS_DIR_CHAR;
         }
     }
 
+end:
+    pthread_mutex_unlock(&naming_lock);
+    av_bprint_finalize(&buf, NULL);
+    av_bprint_finalize(&inputs, NULL);
+
     return ret;
 }
@@ -0,0 +1,146 @@
+/*
+ * This file is part of cyanrip.
+ *
+ * cyanrip is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * cyanrip is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with cyanrip; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include <stdlib.h>
+
+#include <libavutil/error.h>
+#include <libavutil/intreadwrite.h>
+#include <libavutil/mem.h>
+
+#include "offset.h"
+
+struct CRIPOffsetSearch {
+    /* Open addressing, 0 marks an empty slot, as a zero checksum never
+     * counts as a match anyway */
+    uint32_t *table;
+    uint32_t mask;
+};
+
+static inline uint32_t hash_slot(CRIPOffsetSearch *s, uint32_t checksum)
+{
+    return (checksum * 0x9E3779B1U) & s->mask;
+}
+
+static int has_checksum(CRIPOffsetSearch *s, uint32_t checksum)
+{
+    if (!checksum)
+        return 0;
+
+    for (uint32_t i = hash_slot(s, checksum); s->table[i]; i = (i + 1) & s->mask)
+        if (s->table[i] == checksum)
+            return 1;
+
+    return 0;
+}
+
+int crip_offset_search_alloc(CRIPOffsetSearch **s, const uint32_t *checksums,
+                             int nb_checksums)
+{
+    CRIPOffsetSearch *o = av_mallocz(sizeof(*o));
+    if (!o)
+        return AVERROR(ENOMEM);
+
+    /* At most half full */
+    uint32_t size = 16;
+    while (size < 2*nb_checksums)
+        size <<= 1;
+
+    o->mask = size - 1;
+    o->table = av_calloc(size, sizeof(*o->table));
+    if (!o->table) {
+        crip_offset_search_free(&o);
+        return AVERROR(ENOMEM);
+    }
+
+    for (int i = 0; i < nb_checksums; i++) {
+        if (!checksums[i] || has_checksum(o, checksums[i]))
+            continue;
+        uint32_t j = hash_slot(o, checksums[i]);
+        while (o->table[j])
+            j = (j + 1) & o->mask;
+        o->table[j] = checksums[i];
+    }
+
+    *s = o;
+
+    return 0;
+}
+
+/* Lower ranks are preferred */
+static int64_t offset_rank(int offset, int guess, int dir)
+{
+    if (offset == guess)
+        return -1;
+
+    int same_dir = dir < 0 ? offset < 0 : offset >= 0;
+    return (int64_t)!same_dir*INT32_MAX + abs(offset);
+}
+
+int crip_offset_search(CRIPOffsetSearch *s, const uint8_t *data, int samples,
+                       int guess, int dir, int *offset)
+{
+    const int last = samples - CRIP_OFFSET_WINDOW;
+    if (last < -samples)
+        return 0;
+
+    /* With x the samples from the window start, the checksum is
+     * sum = x[0]*1 + x[1]*2 + ... + x[N-1]*N, and sliding the window by one
+     * sample gives sum - (x[0] + ... + x[N-1]) + x[N]*N */
+    const uint8_t *win = data;
+    uint32_t sum = 0, plain = 0;
+    for (int j = 0; j < CRIP_OFFSET_WINDOW; j++) {
+        uint32_t x = AV_RL32(&win[j*4]);
+        sum += x*(j + 1);
+        plain += x;
+    }
+
+    int found = 0;
+    int64_t best_rank = INT64_MAX;
+
+    for (int o = -samples;; o++) {
+        if (has_checksum(s, sum)) {
+            int64_t rank = offset_rank(o, guess, dir);
+            if (rank < best_rank) {
+                best_rank = rank;
+                *offset = o;
+                found = 1;
+            }
+        }
+
+        if (o == last)
+            break;
+
+        uint32_t out = AV_RL32(&win[0]);
+        uint32_t in = AV_RL32(&win[CRIP_OFFSET_WINDOW*4]);
+        sum += in*CRIP_OFFSET_WINDOW - plain;
+        plain += in - out;
+        win += 4;
+    }
+
+    return found;
+}
+
+void crip_offset_search_free(CRIPOffsetSearch **s)
+{
+    CRIPOffsetSearch *o = *s;
+    if (!o)
+        return;
+
+    av_free(o->table);
+    av_freep(s);
+}
@@ -0,0 +1,45 @@
+/*
+ * This file is part of cyanrip.
+ *
+ * cyanrip is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * cyanrip is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with cyanrip; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+/* Drive offset detection. The AccurateRip v1 checksum of the 450th sector of
+ * a track is computed at every possible offset, and looked up among the
+ * checksums the database has for it. The checksum is a weighted sum, so it
+ * gets updated as the window slides rather than recomputed at every offset. */
+typedef struct CRIPOffsetSearch CRIPOffsetSearch;
+
+/* Number of samples the checksum covers, a single sector */
+#define CRIP_OFFSET_WINDOW 588
+
+/* Takes the checksums of the 450th sector which count as a match */
+int crip_offset_search_alloc(CRIPOffsetSearch **s, const uint32_t *checksums,
+                             int nb_checksums);
+
+/* Searches data, which holds samples*2 samples around the 450th sector, the
+ * sector itself starting at samples. Offsets from -samples up to
+ * samples - CRIP_OFFSET_WINDOW get checked.
+ * If several offsets match, guess wins, then the offset closest to 0 in
+ * the direction dir, then the closest one in the other direction.
+ * Returns 1 and sets *offset if anything matched, 0 otherwise. */
+int crip_offset_search(CRIPOffsetSearch *s, const uint8_t *data, int samples,
+                       int guess, int dir, int *offset);
+
+void crip_offset_search_free(CRIPOffsetSearch **s);
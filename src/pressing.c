@@ -0,0 +1,289 @@
+/*
+ * This file is part of cyanrip.
+ *
+ * cyanrip is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * cyanrip is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with cyanrip; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include <libavutil/common.h>
+#include <libavutil/error.h>
+#include <libavutil/intreadwrite.h>
+#include <libavutil/mem.h>
+
+#include "pressing.h"
+
+/* First sample of the 450th sector is at this multiplier + 1 */
+#define W450 (450 * (CDIO_CD_FRAMESIZE_RAW >> 2))
+#define W450_LEN (CDIO_CD_FRAMESIZE_RAW >> 2)
+
+struct CRIPPressing {
+    int64_t nb_samples;
+    int64_t ar_start, ar_end;
+
+    int64_t pos; /* Samples added so far */
+    uint32_t sum_plain; /* Unweighted sum over the AccurateRip range */
+    uint32_t sum_v1;
+    int complete;
+
+    /* Samples 1 to head_len, and nb_samples - tail_len + 1 to nb_samples */
+    uint32_t *head;
+    int64_t head_len;
+    uint32_t *tail;
+    int64_t tail_len;
+
+    /* Samples win_start to win_start + win_len - 1, around the 450th sector */
+    uint32_t *win;
+    int64_t win_start, win_len;
+};
+
+int crip_pressing_reset(CRIPPressing **s, size_t nb_samples,
+                        uint32_t ar_start, uint32_t ar_end)
+{
+    CRIPPressing *p = *s;
+    if (!p) {
+        p = av_mallocz(sizeof(*p));
+        if (!p)
+            return AVERROR(ENOMEM);
+        *s = p;
+    }
+
+    av_freep(&p->head);
+    av_freep(&p->tail);
+    av_freep(&p->win);
+
+    p->nb_samples = nb_samples;
+    p->ar_start = FFMAX(ar_start, 1);
+    p->ar_end = ar_end;
+    p->pos = 0;
+    p->sum_plain = 0;
+    p->complete = 0;
+
+    /* Enough for this track's own offsets, and its neighbours' */
+    p->head_len = FFMIN(p->nb_samples, p->ar_start + CRIP_PRESSING_RANGE);
+    p->tail_len = FFMIN(p->nb_samples, p->nb_samples - p->ar_end + CRIP_PRESSING_RANGE);
+
+    p->win_start = FFMAX(W450 + 1 - CRIP_PRESSING_RANGE, 1);
+    p->win_len = FFMIN(W450 + W450_LEN + CRIP_PRESSING_RANGE, p->nb_samples) -
+                 p->win_start + 1;
+
+    p->head = av_malloc_array(p->head_len, sizeof(*p->head));
+    p->tail = av_malloc_array(p->tail_len, sizeof(*p->tail));
+    if (p->win_len > 0)
+        p->win = av_malloc_array(p->win_len, sizeof(*p->win));
+    if (!p->head || !p->tail || (p->win_len > 0 && !p->win)) {
+        crip_pressing_free(s);
+        return AVERROR(ENOMEM);
+    }
+
+    return 0;
+}
+
+/* Copies the samples between first and first + len - 1 which were added */
+static void keep_samples(uint32_t *dst, int64_t first, int64_t len,
+                         const uint8_t *data, int64_t pos, int nb)
+{
+    int64_t start = FFMAX(first, pos + 1);
+    int64_t end = FFMIN(first + len, pos + 1 + nb);
+    for (int64_t j = start; j < end; j++)
+        dst[j - first] = AV_RL32(&data[(j - pos - 1)*4]);
+}
+
+void crip_pressing_add(CRIPPressing *s, const uint8_t *data, int nb)
+{
+    nb = FFMIN(nb, s->nb_samples - s->pos);
+    if (nb <= 0)
+        return;
+
+    keep_samples(s->head, 1, s->head_len, data, s->pos, nb);
+    keep_samples(s->tail, s->nb_samples - s->tail_len + 1, s->tail_len, data, s->pos, nb);
+    if (s->win)
+        keep_samples(s->win, s->win_start, s->win_len, data, s->pos, nb);
+
+    int64_t start = FFMAX(s->ar_start, s->pos + 1);
+    int64_t end = FFMIN(s->ar_end + 1, s->pos + 1 + nb);
+    uint32_t sum = 0;
+    for (int64_t j = start; j < end; j++)
+        sum += AV_RL32(&data[(j - s->pos - 1)*4]);
+    s->sum_plain += sum;
+
+    s->pos += nb;
+}
+
+void crip_pressing_finish(CRIPPressing *s, uint32_t checksum_v1)
+{
+    s->sum_v1 = checksum_v1;
+    s->complete = s->pos == s->nb_samples;
+}
+
+void crip_pressing_free(CRIPPressing **s)
+{
+    CRIPPressing *p = *s;
+    if (!p)
+        return;
+
+    av_free(p->head);
+    av_free(p->tail);
+    av_free(p->win);
+    av_freep(s);
+}
+
+/* A sample of the track, with j the multiplier it would have in the
+ * checksum. Returns 0 if it's not known. */
+static int own_sample(CRIPPressing *p, int64_t j, uint32_t *val)
+{
+    if (j >= 1 && j <= p->head_len)
+        *val = p->head[j - 1];
+    else if (j > p->nb_samples - p->tail_len && j <= p->nb_samples)
+        *val = p->tail[j - (p->nb_samples - p->tail_len) - 1];
+    else
+        return 0;
+    return 1;
+}
+
+static int neighbour_done(cyanrip_track *t, cyanrip_track *n)
+{
+    if (!n || n->track_is_data || !n->pressing || !n->pressing->complete)
+        return 0;
+    return n == t->pt ? n->end_lsn + 1 == t->start_lsn :
+                        t->end_lsn + 1 == n->start_lsn;
+}
+
+/* Past the ends of the disc, there's only silence */
+static int track_sample(cyanrip_track *t, int64_t j, uint32_t *val)
+{
+    CRIPPressing *p = t->pressing;
+
+    if (j < 1) {
+        if (t->acurip_track_is_first) {
+            *val = 0;
+            return 1;
+        }
+        return neighbour_done(t, t->pt) &&
+               own_sample(t->pt->pressing, t->pt->pressing->nb_samples + j, val);
+    } else if (j > p->nb_samples) {
+        if (t->acurip_track_is_last) {
+            *val = 0;
+            return 1;
+        }
+        return neighbour_done(t, t->nt) &&
+               own_sample(t->nt->pressing, j - p->nb_samples, val);
+    }
+
+    return own_sample(p, j, val);
+}
+
+static int window_sample(cyanrip_track *t, int64_t j, uint32_t *val)
+{
+    CRIPPressing *p = t->pressing;
+    if (j < p->win_start || j >= p->win_start + p->win_len)
+        return 0;
+    *val = p->win[j - p->win_start];
+    return 1;
+}
+
+static int find_entry(cyanrip_track *t, uint32_t checksum, int is_450)
+{
+    for (int i = 0; i < t->ar_db_nb_entries; i++) {
+        CRIPAccuDBEntry *e = &t->ar_db_entries[i];
+        if ((is_450 ? e->checksum_450 : e->checksum) == checksum)
+            return e->confidence;
+    }
+    return 0;
+}
+
+static void add_match(cyanrip_track *t, int offset, int confidence, int partial)
+{
+    if (t->nb_pressing_matches >= FF_ARRAY_ELEMS(t->pressing_matches))
+        return;
+
+    CRIPPressingMatch *m = &t->pressing_matches[t->nb_pressing_matches++];
+    m->offset = offset;
+    m->confidence = confidence;
+    m->partial = partial;
+}
+
+/* With s the samples, the checksum at offset d is
+ * sum(d) = (a - c)*s[a + d] + ... + (b - c)*s[b + d]
+ * and with plain(d) = s[a + d] + ... + s[b + d], going one offset up gives
+ * sum(d + 1) = sum(d) - (a - c)*s[a + d] + (b + 1 - c)*s[b + 1 + d] - plain(d + 1)
+ * and going one offset down
+ * sum(d - 1) = sum(d) + (a - 1 - c)*s[a - 1 + d] - (b - c)*s[b + d] + plain(d - 1) */
+static void search_offsets(cyanrip_track *t,
+                           int (*get)(cyanrip_track *t, int64_t j, uint32_t *val),
+                           int64_t a, int64_t b, int64_t c,
+                           uint32_t sum, uint32_t plain, int is_450)
+{
+    const int min_confidence = is_450 ? 3*(t->ar_db_max_confidence + 1)/4 + 1 : 1;
+
+    for (int dir = -1; dir <= 1; dir += 2) {
+        uint32_t s = sum, p = plain;
+        for (int d = 0; abs(d) < CRIP_PRESSING_RANGE; d += dir) {
+            uint32_t in, out;
+            if (dir > 0) {
+                if (!get(t, a + d, &out) || !get(t, b + 1 + d, &in))
+                    break;
+                p += in - out;
+                s += (uint32_t)(b + 1 - c)*in - (uint32_t)(a - c)*out - p;
+            } else {
+                if (!get(t, a - 1 + d, &in) || !get(t, b + d, &out))
+                    break;
+                p += in - out;
+                s += (uint32_t)(a - 1 - c)*in - (uint32_t)(b - c)*out + p;
+            }
+
+            int confidence = s ? find_entry(t, s, is_450) : 0;
+            if (confidence >= min_confidence)
+                add_match(t, d + dir, confidence, is_450);
+        }
+    }
+}
+
+/* Submissions checked with v2 can only be matched by their 450th sector,
+ * the v2 sum can't be slid */
+static void search_450(cyanrip_track *t)
+{
+    uint32_t sum = 0, plain = 0;
+
+    for (int m = 1; m <= W450_LEN; m++) {
+        uint32_t val;
+        if (!window_sample(t, W450 + m, &val))
+            return;
+        sum += val*m;
+        plain += val;
+    }
+
+    search_offsets(t, window_sample, W450 + 1, W450 + W450_LEN, W450,
+                   sum, plain, 1);
+}
+
+void crip_pressing_search(cyanrip_ctx *ctx)
+{
+    for (int i = 0; i < ctx->nb_tracks; i++) {
+        cyanrip_track *t = &ctx->tracks[i];
+        CRIPPressing *p = t->pressing;
+
+        t->nb_pressing_matches = 0;
+
+        if (!p || !p->complete || t->ar_db_status != CYANRIP_ACCUDB_FOUND ||
+            find_entry(t, t->acurip_checksum_v1, 0) > 0 ||
+            find_entry(t, t->acurip_checksum_v2, 0) > 0)
+            continue;
+
+        search_offsets(t, track_sample, p->ar_start, p->ar_end, 0,
+                       p->sum_v1, p->sum_plain, 0);
+
+        if (!t->nb_pressing_matches && p->win)
+            search_450(t);
+    }
+}
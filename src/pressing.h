@@ -0,0 +1,49 @@
+/*
+ * This file is part of cyanrip.
+ *
+ * cyanrip is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * cyanrip is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with cyanrip; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#pragma once
+
+#include "cyanrip_main.h"
+
+/* Checks whether tracks which AccurateRip didn't verify match the database
+ * at another offset, as they do when the disc is a different pressing than
+ * the ones the database has. Only the start and end of every track, plus
+ * the samples around its 450th sector, are kept while ripping. The checksums
+ * at every other offset follow from those and the checksum at offset 0, one
+ * offset at a time. The samples past the ends of a track come from the
+ * neighbouring tracks, if they were ripped too. */
+typedef struct CRIPPressing CRIPPressing;
+
+/* Relative offsets checked, in samples either way */
+#define CRIP_PRESSING_RANGE 3000
+
+/* Gets a track ready to have its samples added, from the first one.
+ * ar_start and ar_end are the multipliers of the first and last sample
+ * covered by the AccurateRip checksum. */
+int crip_pressing_reset(CRIPPressing **s, size_t nb_samples,
+                        uint32_t ar_start, uint32_t ar_end);
+
+void crip_pressing_add(CRIPPressing *s, const uint8_t *data, int nb);
+
+/* Takes the track's AccurateRip v1 checksum, once all samples were added */
+void crip_pressing_finish(CRIPPressing *s, uint32_t checksum_v1);
+
+/* Searches every track not verified at offset 0, once all are ripped */
+void crip_pressing_search(cyanrip_ctx *ctx);
+
+void crip_pressing_free(CRIPPressing **s);
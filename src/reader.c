@@ -0,0 +1,623 @@
+/*
+ * This file is part of cyanrip.
+ *
+ * cyanrip is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * cyanrip is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with cyanrip; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include <pthread.h>
+
+#include "reader.h"
+#include "image.h"
+#include "cyanrip_log.h"
+
+struct CRIPReader {
+    cyanrip_ctx *ctx;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond_data;
+    pthread_cond_t cond_space;
+
+    lsn_t start;
+    int frames;
+    int burst;
+
+    /* Mapped images are read without a thread, ring or paranoia */
+    CRIPImage *image;
+    int pos;
+
+    /* Readers of tracks take their sectors from the disc stream, if any */
+    CRIPReader *src;
+    int from_last; /* The sector handed out is the stream's last one */
+    CRIPReaderStats src_stats; /* Those of the stream when started */
+
+    /* The stream keeps the last sector it handed out, as with an offset,
+     * a track starts with the last sector of the one before it */
+    lsn_t end;
+    lsn_t next; /* First sector not handed out */
+    uint8_t *last;
+    uint8_t last_err;
+    uint8_t last_flag;
+    pthread_mutex_t drive_lock; /* Held while reading */
+
+    uint8_t *ring;
+    uint8_t *ring_err;
+    uint8_t *ring_flag;
+    int size;
+    int rd; /* Next sector for processing */
+    int wr; /* Next sector the reader fills */
+    int fill;
+
+    int stop; /* Set by the consumer */
+    int eof; /* Set by the reader once it's done */
+    int status;
+
+    CRIPReaderStats stats;
+};
+
+static const uint8_t silent_frame[CDIO_CD_FRAMESIZE_RAW] = { 0 };
+static const uint8_t clean_flags[CRIP_READER_RING_SECTORS] = { 0 };
+
+/* The callback gets no opaque, so the counts go to the thread's disc */
+static void status_cb(long int n, paranoia_cb_mode_t status)
+{
+    cyanrip_ctx *ctx = cyanrip_get_thread_ctx();
+    if (ctx && status >= PARANOIA_CB_READ && status <= PARANOIA_CB_FINISHED)
+        ctx->paranoia_status[status]++;
+}
+
+/* Paranoia events after which the returned data could not be verified */
+static uint64_t paranoia_unverified(cyanrip_ctx *ctx)
+{
+    return ctx->paranoia_status[PARANOIA_CB_READERR] +
+           ctx->paranoia_status[PARANOIA_CB_SKIP] +
+           ctx->paranoia_status[PARANOIA_CB_SCRATCH] +
+           ctx->paranoia_status[PARANOIA_CB_FIXUP_DROPPED] +
+           ctx->paranoia_status[PARANOIA_CB_FIXUP_DUPED];
+}
+
+static const uint8_t *read_frame(cyanrip_ctx *ctx, int *read_err, int *flagged)
+{
+    int err = 0;
+    char *msg = NULL;
+    uint64_t unverified = paranoia_unverified(ctx);
+
+    const uint8_t *data;
+    data = (void *)cdio_paranoia_read_limited(ctx->paranoia, &status_cb,
+                                              ctx->settings.max_retries);
+
+    msg = cdio_cddap_errors(ctx->drive);
+    if (msg) {
+        cyanrip_log(ctx, 0, "\ncdio error: %s\n", msg);
+        cdio_cddap_free_messages(msg);
+        err = 1;
+    }
+
+    if (!data) {
+        if (!msg) {
+            cyanrip_log(ctx, 0, "\nFrame read failed!\n");
+            err = 1;
+        }
+        data = silent_frame;
+    }
+
+    *read_err = err;
+    *flagged = err || paranoia_unverified(ctx) != unverified;
+
+    return data;
+}
+
+const uint8_t *crip_read_frame(cyanrip_ctx *ctx, int *read_err)
+{
+    int flagged;
+    return read_frame(ctx, read_err, &flagged);
+}
+
+void crip_reader_flush_cache(cyanrip_ctx *ctx, lsn_t lsn)
+{
+    if (ctx->image)
+        return;
+
+    uint8_t buf[CDIO_CD_FRAMESIZE_RAW];
+    lsn_t far = (lsn - ctx->start_lsn) > (ctx->end_lsn - lsn) ? ctx->start_lsn :
+                                                               ctx->end_lsn;
+
+    cdio_cddap_read(ctx->drive, buf, far, 1);
+
+    char *msg = cdio_cddap_errors(ctx->drive);
+    if (msg)
+        cdio_cddap_free_messages(msg);
+
+    cdio_paranoia_seek(ctx->paranoia, lsn, SEEK_SET);
+}
+
+static void *spin_up_thread(void *arg)
+{
+    cyanrip_ctx *ctx = arg;
+    uint8_t buf[CDIO_CD_FRAMESIZE_RAW];
+
+    cdio_cddap_read(ctx->drive, buf, ctx->start_lsn, 1);
+
+    char *msg = cdio_cddap_errors(ctx->drive);
+    if (msg)
+        cdio_cddap_free_messages(msg);
+
+    return NULL;
+}
+
+void crip_reader_spin_up(cyanrip_ctx *ctx)
+{
+    if (ctx->image || ctx->spinning_up)
+        return;
+
+    ctx->spinning_up = !pthread_create(&ctx->spin_up_thread, NULL, spin_up_thread, ctx);
+}
+
+void crip_reader_spin_up_wait(cyanrip_ctx *ctx)
+{
+    if (!ctx->spinning_up)
+        return;
+
+    pthread_join(ctx->spin_up_thread, NULL);
+    ctx->spinning_up = 0;
+}
+
+/* Waits until nb sectors can be written contiguously, returns 1 if stopped */
+static int reader_wait_space(CRIPReader *s, int nb)
+{
+    pthread_mutex_lock(&s->lock);
+    if ((s->size - s->fill) < nb && !s->stop)
+        s->stats.reader_waits++;
+    while ((s->size - s->fill) < nb && !s->stop)
+        pthread_cond_wait(&s->cond_space, &s->lock);
+    int stop = s->stop;
+    pthread_mutex_unlock(&s->lock);
+
+    return stop || crip_quit(s->ctx);
+}
+
+static void reader_commit(CRIPReader *s, int nb)
+{
+    pthread_mutex_lock(&s->lock);
+    s->wr = (s->wr + nb) % s->size;
+    s->fill += nb;
+    pthread_cond_signal(&s->cond_data);
+    pthread_mutex_unlock(&s->lock);
+}
+
+/* Reads nb sectors in one request, bypassing paranoia. Anything which the
+ * drive did not return cleanly gets re-read sector by sector. */
+static void read_burst(CRIPReader *s, lsn_t lsn, int nb)
+{
+    cyanrip_ctx *ctx = s->ctx;
+    uint8_t *dst = s->ring + s->wr*CDIO_CD_FRAMESIZE_RAW;
+
+    long ret = cdio_cddap_read(ctx->drive, dst, lsn, nb);
+
+    char *msg = cdio_cddap_errors(ctx->drive);
+    if (msg) {
+        cyanrip_log(ctx, 0, "\ncdio error: %s\n", msg);
+        cdio_cddap_free_messages(msg);
+        ret = 0;
+    }
+
+    if (ret == nb) {
+        memset(s->ring_err + s->wr, 0, nb);
+        memset(s->ring_flag + s->wr, 0, nb);
+        return;
+    }
+
+    cdio_paranoia_seek(ctx->paranoia, lsn, SEEK_SET);
+    for (int i = 0; i < nb; i++) {
+        int err, flagged;
+        const uint8_t *data = read_frame(ctx, &err, &flagged);
+        memcpy(dst + i*CDIO_CD_FRAMESIZE_RAW, data, CDIO_CD_FRAMESIZE_RAW);
+        s->ring_err[s->wr + i] = err;
+        s->ring_flag[s->wr + i] = flagged;
+    }
+}
+
+static void *reader_thread(void *arg)
+{
+    CRIPReader *s = arg;
+    cyanrip_ctx *ctx = s->ctx;
+    int status = 0;
+
+    cyanrip_set_thread_ctx(ctx);
+
+    cdio_paranoia_seek(ctx->paranoia, s->start, SEEK_SET);
+
+    for (int i = 0; i < s->frames;) {
+        lsn_t lsn = s->start + i;
+        int nb = 1;
+
+        /* Bursts never wrap around the ring or extend into the lead-out */
+        if (s->burst > 1 && lsn <= ctx->end_lsn) {
+            nb = FFMIN(s->burst, s->frames - i);
+            nb = FFMIN(nb, ctx->end_lsn - lsn + 1);
+            nb = FFMIN(nb, s->size - s->wr);
+        }
+
+        if (reader_wait_space(s, nb))
+            break;
+
+        /* Detect disc removals, as seen by the drive monitor */
+        if (atomic_load(&ctx->media_changed)) {
+            status = AVERROR(EINVAL);
+            break;
+        }
+
+        if (s->last)
+            pthread_mutex_lock(&s->drive_lock);
+
+        if (nb > 1) {
+            read_burst(s, lsn, nb);
+        } else {
+            /* Flush paranoia cache if overreading into lead-out - no idea why */
+            if (lsn > ctx->end_lsn || s->burst > 1)
+                cdio_paranoia_seek(ctx->paranoia, lsn, SEEK_SET);
+
+            int err, flagged;
+            const uint8_t *data = read_frame(ctx, &err, &flagged);
+
+            /* Only the reader touches the write slots, no need to lock */
+            memcpy(s->ring + s->wr*CDIO_CD_FRAMESIZE_RAW, data, CDIO_CD_FRAMESIZE_RAW);
+            s->ring_err[s->wr] = err;
+            s->ring_flag[s->wr] = flagged;
+        }
+
+        if (s->last)
+            pthread_mutex_unlock(&s->drive_lock);
+
+        reader_commit(s, nb);
+        i += nb;
+    }
+
+    pthread_mutex_lock(&s->lock);
+    s->status = status;
+    s->eof = 1;
+    pthread_cond_signal(&s->cond_data);
+    pthread_mutex_unlock(&s->lock);
+
+    return NULL;
+}
+
+static int burst_size(cyanrip_ctx *ctx, int burst)
+{
+    return burst ? FFMAX(FFMIN(ctx->drive->nsectors, CRIP_READER_MAX_BURST), 1) : 0;
+}
+
+static int reader_open(cyanrip_ctx *ctx, CRIPReader **s, lsn_t start, int frames,
+                       int burst, int stream)
+{
+    int ret;
+    CRIPReader *r = av_mallocz(sizeof(*r));
+    if (!r)
+        return AVERROR(ENOMEM);
+
+    r->ctx = ctx;
+    r->start = start;
+    r->frames = frames;
+    r->burst = burst_size(ctx, burst);
+    r->size = CRIP_READER_RING_SECTORS;
+
+    if (ctx->image) {
+        r->image = ctx->image;
+        *s = r;
+        return 0;
+    }
+
+    r->ring = av_malloc(r->size*CDIO_CD_FRAMESIZE_RAW);
+    r->ring_err = av_mallocz(r->size);
+    r->ring_flag = av_mallocz(r->size);
+    if (!r->ring || !r->ring_err || !r->ring_flag) {
+        ret = AVERROR(ENOMEM);
+        goto fail;
+    }
+
+    if (stream) {
+        r->end = start + frames - 1;
+        r->next = start;
+        r->last = av_malloc(CDIO_CD_FRAMESIZE_RAW);
+        if (!r->last) {
+            ret = AVERROR(ENOMEM);
+            goto fail;
+        }
+        pthread_mutex_init(&r->drive_lock, NULL);
+    }
+
+    pthread_mutex_init(&r->lock, NULL);
+    pthread_cond_init(&r->cond_data, NULL);
+    pthread_cond_init(&r->cond_space, NULL);
+
+    ret = pthread_create(&r->thread, NULL, reader_thread, r);
+    if (ret) {
+        ret = AVERROR(ret);
+        pthread_cond_destroy(&r->cond_space);
+        pthread_cond_destroy(&r->cond_data);
+        pthread_mutex_destroy(&r->lock);
+        if (r->last)
+            pthread_mutex_destroy(&r->drive_lock);
+        goto fail;
+    }
+
+    *s = r;
+
+    return 0;
+
+fail:
+    av_free(r->last);
+    av_free(r->ring_flag);
+    av_free(r->ring_err);
+    av_free(r->ring);
+    av_free(r);
+    return ret;
+}
+
+/* Takes the sectors of a track from the stream, skipping over a few sectors
+ * if need be. Anything else, e.g. going back, seeks by starting anew. */
+static int view_start(cyanrip_ctx *ctx, CRIPReader **s, lsn_t start, int frames,
+                      int burst)
+{
+    CRIPReader *src = ctx->stream;
+    lsn_t end = start + frames - 1;
+    int ret;
+
+    lsn_t first = src->next - (src->next > src->start);
+    if (start < first || start > src->next + src->size || end > src->end ||
+        burst_size(ctx, burst) != src->burst) {
+        lsn_t stream_end = FFMAX(src->end, end);
+        crip_reader_stream_stop(ctx);
+        ret = crip_reader_stream_start(ctx, start, stream_end, burst);
+        if (ret < 0)
+            return ret;
+        src = ctx->stream;
+    }
+
+    CRIPReader *r = av_mallocz(sizeof(*r));
+    if (!r)
+        return AVERROR(ENOMEM);
+
+    r->ctx = ctx;
+    r->src = src;
+    r->start = start;
+    r->frames = frames;
+
+    pthread_mutex_lock(&src->lock);
+    r->src_stats = src->stats;
+    pthread_mutex_unlock(&src->lock);
+
+    while (src->next < start) {
+        const uint8_t *data;
+        int nb, err;
+        ret = crip_reader_get(src, &data, NULL, &nb, &err);
+        if (ret < 0) {
+            av_free(r);
+            return ret;
+        }
+        crip_reader_release(src, FFMIN(nb, start - src->next));
+    }
+
+    *s = r;
+
+    return 0;
+}
+
+int crip_reader_start(cyanrip_ctx *ctx, CRIPReader **s, lsn_t start, int frames,
+                      int burst)
+{
+    if (ctx->stream)
+        return view_start(ctx, s, start, frames, burst);
+
+    return reader_open(ctx, s, start, frames, burst, 0);
+}
+
+int crip_reader_stream_start(cyanrip_ctx *ctx, lsn_t start, lsn_t end, int burst)
+{
+    return reader_open(ctx, &ctx->stream, start, end - start + 1, burst, 1);
+}
+
+void crip_reader_stream_stop(cyanrip_ctx *ctx)
+{
+    crip_reader_stop(&ctx->stream, NULL);
+}
+
+void crip_reader_lock_drive(cyanrip_ctx *ctx)
+{
+    if (ctx->stream)
+        pthread_mutex_lock(&ctx->stream->drive_lock);
+}
+
+void crip_reader_unlock_drive(cyanrip_ctx *ctx)
+{
+    if (ctx->stream)
+        pthread_mutex_unlock(&ctx->stream->drive_lock);
+}
+
+/* Slices of the mapping, or silence where the image has no data */
+static int image_get(CRIPReader *s, const uint8_t **data, const uint8_t **flags,
+                     int *nb_sectors, int *read_err)
+{
+    if (s->pos == s->frames || crip_quit(s->ctx))
+        return AVERROR_EOF;
+
+    int nb = FFMIN(s->frames - s->pos, s->size);
+    *data = crip_image_sectors(s->image, s->start + s->pos, &nb);
+    if (!*data) {
+        *data = silent_frame;
+        nb = 1;
+    }
+
+    if (flags)
+        *flags = clean_flags;
+    *nb_sectors = nb;
+    *read_err = 0;
+
+    s->stats.sectors += nb;
+
+    return 0;
+}
+
+/* Everything available up to the end of the ring, or max sectors */
+static int ring_get(CRIPReader *s, const uint8_t **data, const uint8_t **flags,
+                    int *nb_sectors, int *read_err, int max)
+{
+    int ret = 0;
+
+    pthread_mutex_lock(&s->lock);
+
+    if (!s->fill && !s->eof)
+        s->stats.consumer_waits++;
+    while (!s->fill && !s->eof)
+        pthread_cond_wait(&s->cond_data, &s->lock);
+
+    if (!s->fill) {
+        ret = s->status < 0 ? s->status : AVERROR_EOF;
+    } else {
+        int nb = FFMIN(FFMIN(s->fill, s->size - s->rd), max);
+        int err = 0;
+        for (int i = 0; i < nb; i++)
+            err += s->ring_err[s->rd + i];
+
+        *data = s->ring + s->rd*CDIO_CD_FRAMESIZE_RAW;
+        if (flags)
+            *flags = s->ring_flag + s->rd;
+        *nb_sectors = nb;
+        *read_err = err;
+
+        s->stats.sectors += nb;
+        s->stats.depth_sum += (int64_t)s->fill*nb;
+        s->stats.max_depth = FFMAX(s->stats.max_depth, s->fill);
+    }
+
+    pthread_mutex_unlock(&s->lock);
+
+    return ret;
+}
+
+static int view_get(CRIPReader *s, const uint8_t **data, const uint8_t **flags,
+                    int *nb_sectors, int *read_err)
+{
+    CRIPReader *src = s->src;
+
+    if (s->pos == s->frames)
+        return AVERROR_EOF;
+
+    if (s->start + s->pos < src->next) {
+        *data = src->last;
+        if (flags)
+            *flags = &src->last_flag;
+        *nb_sectors = 1;
+        *read_err = src->last_err;
+        s->from_last = 1;
+        return 0;
+    }
+
+    return ring_get(src, data, flags, nb_sectors, read_err, s->frames - s->pos);
+}
+
+int crip_reader_get(CRIPReader *s, const uint8_t **data, const uint8_t **flags,
+                    int *nb_sectors, int *read_err)
+{
+    if (s->image)
+        return image_get(s, data, flags, nb_sectors, read_err);
+    else if (s->src)
+        return view_get(s, data, flags, nb_sectors, read_err);
+
+    return ring_get(s, data, flags, nb_sectors, read_err, INT_MAX);
+}
+
+void crip_reader_release(CRIPReader *s, int nb_sectors)
+{
+    if (s->image) {
+        s->pos += nb_sectors;
+        return;
+    } else if (s->src) {
+        if (s->from_last)
+            s->from_last = 0;
+        else
+            crip_reader_release(s->src, nb_sectors);
+        s->pos += nb_sectors;
+        return;
+    }
+
+    /* Only the consumer touches released slots, no need to lock */
+    if (s->last && nb_sectors) {
+        int idx = s->rd + nb_sectors - 1;
+        memcpy(s->last, s->ring + idx*CDIO_CD_FRAMESIZE_RAW, CDIO_CD_FRAMESIZE_RAW);
+        s->last_err = s->ring_err[idx];
+        s->last_flag = s->ring_flag[idx];
+        s->next += nb_sectors;
+    }
+
+    pthread_mutex_lock(&s->lock);
+    s->rd = (s->rd + nb_sectors) % s->size;
+    s->fill -= nb_sectors;
+    pthread_cond_signal(&s->cond_space);
+    pthread_mutex_unlock(&s->lock);
+}
+
+void crip_reader_stop(CRIPReader **s, CRIPReaderStats *stats)
+{
+    CRIPReader *r = *s;
+    if (!r)
+        return;
+
+    if (r->image) {
+        if (stats)
+            stats->sectors += r->stats.sectors;
+        av_freep(s);
+        return;
+    } else if (r->src) {
+        /* The stream's, since the track started */
+        CRIPReader *src = r->src;
+        if (stats) {
+            pthread_mutex_lock(&src->lock);
+            stats->sectors += src->stats.sectors - r->src_stats.sectors;
+            stats->depth_sum += src->stats.depth_sum - r->src_stats.depth_sum;
+            stats->reader_waits += src->stats.reader_waits - r->src_stats.reader_waits;
+            stats->consumer_waits += src->stats.consumer_waits - r->src_stats.consumer_waits;
+            stats->max_depth = FFMAX(stats->max_depth, src->stats.max_depth);
+            pthread_mutex_unlock(&src->lock);
+        }
+        av_freep(s);
+        return;
+    }
+
+    pthread_mutex_lock(&r->lock);
+    r->stop = 1;
+    pthread_cond_signal(&r->cond_space);
+    pthread_mutex_unlock(&r->lock);
+
+    pthread_join(r->thread, NULL);
+
+    if (stats) {
+        stats->sectors += r->stats.sectors;
+        stats->depth_sum += r->stats.depth_sum;
+        stats->reader_waits += r->stats.reader_waits;
+        stats->consumer_waits += r->stats.consumer_waits;
+        stats->max_depth = FFMAX(stats->max_depth, r->stats.max_depth);
+    }
+
+    if (r->last)
+        pthread_mutex_destroy(&r->drive_lock);
+    pthread_cond_destroy(&r->cond_space);
+    pthread_cond_destroy(&r->cond_data);
+    pthread_mutex_destroy(&r->lock);
+    av_free(r->last);
+    av_free(r->ring_flag);
+    av_free(r->ring_err);
+    av_free(r->ring);
+    av_freep(s);
+}
@@ -0,0 +1,77 @@
+/*
+ * This file is part of cyanrip.
+ *
+ * cyanrip is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * cyanrip is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with cyanrip; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#pragma once
+
+#include "cyanrip_main.h"
+
+/* Number of sectors buffered between the drive and the processing loop,
+ * about 7 seconds of audio */
+#define CRIP_READER_RING_SECTORS 512
+
+typedef struct CRIPReader CRIPReader;
+
+/* Maximum number of sectors requested at once in burst mode */
+#define CRIP_READER_MAX_BURST 64
+
+/* Starts a thread reading frames sectors from start onwards into a ring.
+ * If burst is set, paranoia is bypassed and multiple sectors are read from
+ * the drive per request, which is only sensible with paranoia disabled. */
+int crip_reader_start(cyanrip_ctx *ctx, CRIPReader **s, lsn_t start, int frames,
+                      int burst);
+
+/* Waits for the next sectors. Returns 0 on success, AVERROR_EOF if the
+ * reader stopped early (quit requested) or AVERROR(EINVAL) if the drive media
+ * changed. On success, data points to nb_sectors contiguous sectors, and
+ * read_err is set to the number of errors reading them caused.
+ * If flags is not NULL, it's set to one byte per sector, non-zero if the
+ * sector could not be read cleanly or paranoia could not verify it.
+ * The data stays valid until crip_reader_release() is called. */
+int crip_reader_get(CRIPReader *s, const uint8_t **data, const uint8_t **flags,
+                    int *nb_sectors, int *read_err);
+
+/* Returns nb_sectors sectors, in order, from the last crip_reader_get() */
+void crip_reader_release(CRIPReader *s, int nb_sectors);
+
+/* Stops the thread and frees the reader, stats (if not NULL) get added to */
+void crip_reader_stop(CRIPReader **s, CRIPReaderStats *stats);
+
+/* Starts reading the disc continuously from start to end, for the readers
+ * of tracks ripped one after another to take their sectors from, rather than
+ * each seeking to its track. Sectors two tracks share are read once, and
+ * the drive only seeks if a track doesn't start where the last one ended. */
+int crip_reader_stream_start(cyanrip_ctx *ctx, lsn_t start, lsn_t end, int burst);
+
+void crip_reader_stream_stop(cyanrip_ctx *ctx);
+
+/* Held around anything else using the drive while the stream reads */
+void crip_reader_lock_drive(cyanrip_ctx *ctx);
+void crip_reader_unlock_drive(cyanrip_ctx *ctx);
+
+/* Synchronously reads a sector, never returns NULL */
+const uint8_t *crip_read_frame(cyanrip_ctx *ctx, int *read_err);
+
+/* Reads a sector far away from lsn, so that the drive cache will not return
+ * the same data again when lsn gets re-read */
+void crip_reader_flush_cache(cyanrip_ctx *ctx, lsn_t lsn);
+
+/* Reads the first sector of the disc on a thread of its own, so the drive
+ * spins up while the lookups are made. Nothing else may use the drive until
+ * crip_reader_spin_up_wait() returns. */
+void crip_reader_spin_up(cyanrip_ctx *ctx);
+void crip_reader_spin_up_wait(cyanrip_ctx *ctx);
@@ -0,0 +1,251 @@
+/*
+ * This file is part of cyanrip.
+ *
+ * cyanrip is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * cyanrip is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with cyanrip; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include <errno.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <libavutil/avstring.h>
+#include <libavutil/common.h>
+#include <libavutil/crc.h>
+#include <libavutil/error.h>
+#include <libavutil/intreadwrite.h>
+#include <libavutil/mem.h>
+
+#include "replaygain.h"
+
+/* Tags bigger than this aren't ours, ID3 tags include the cover art */
+#define MAX_TAGS_SIZE (64 << 20)
+
+void crip_replaygain_meta(AVDictionary **meta, const char *scope,
+                          double integrated, double range, double true_peak)
+{
+    char key[64], val[32];
+    double gain = 0.0, peak = 0.0;
+
+    /* Clipped so that the widths never change */
+    if (isnan(integrated)) {
+        range = 0.0;
+    } else {
+        gain = av_clipd(CRIP_REPLAYGAIN_REF_LOUDNESS - integrated, -99.99, 99.99);
+        range = av_clipd(range, 0.0, 99.99);
+        peak = av_clipd(pow(10, true_peak / 20.0), 0.0, 9.999999);
+    }
+
+    snprintf(key, sizeof(key), "REPLAYGAIN_%s_GAIN", scope);
+    snprintf(val, sizeof(val), "%+06.2f dB", gain);
+    av_dict_set(meta, key, val, 0);
+
+    /* Relative to -23 LUFS rather than -18, so 5 dB lower, in Q7.8 */
+    snprintf(key, sizeof(key), "R128_%s_GAIN", scope);
+    snprintf(val, sizeof(val), "%+06li", lrint((gain - 5) * 256));
+    av_dict_set(meta, key, val, 0);
+
+    snprintf(key, sizeof(key), "REPLAYGAIN_%s_RANGE", scope);
+    snprintf(val, sizeof(val), "%05.2f dB", range);
+    av_dict_set(meta, key, val, 0);
+
+    snprintf(key, sizeof(key), "REPLAYGAIN_%s_PEAK", scope);
+    snprintf(val, sizeof(val), "%.6f", peak);
+    av_dict_set(meta, key, val, 0);
+
+    snprintf(val, sizeof(val), "%.2f LUFS", CRIP_REPLAYGAIN_REF_LOUDNESS);
+    av_dict_set(meta, "REPLAYGAIN_REFERENCE_LOUDNESS", val, 0);
+}
+
+/* Finds the Vorbis comment, ID3v2 or APEv2 tag the muxer wrote. For Ogg,
+ * that's all the header pages. Returns 1 if found, 0 if there's none. */
+static int find_tags(FILE *f, const char *lavf_name, long *off, long *size)
+{
+    uint8_t hdr[32];
+
+    if (!strcmp(lavf_name, "flac")) {
+        if (fread(hdr, 1, 4, f) != 4 || memcmp(hdr, "fLaC", 4))
+            return AVERROR_INVALIDDATA;
+        do {
+            if (fread(hdr, 1, 4, f) != 4)
+                return AVERROR_INVALIDDATA;
+            *size = AV_RB24(hdr + 1);
+            if ((hdr[0] & 0x7f) == 4) {
+                *off = ftell(f);
+                return 1;
+            }
+            if (fseek(f, *size, SEEK_CUR))
+                return AVERROR(errno);
+        } while (!(hdr[0] & 0x80));
+    } else if (!strcmp(lavf_name, "ogg")) {
+        long pos = 0;
+        for (;;) {
+            size_t nb = fread(hdr, 1, 27, f);
+            if (!nb && pos)
+                break;
+            if (nb != 27 || memcmp(hdr, "OggS", 4))
+                return AVERROR_INVALIDDATA;
+
+            /* Header pages have a granule of 0, or -1 if nothing ends on them */
+            int64_t granule = AV_RL64(hdr + 6);
+            if (pos && granule && granule != -1)
+                break;
+
+            uint8_t segs[255];
+            long len = 27 + hdr[26];
+            if (fread(segs, 1, hdr[26], f) != hdr[26])
+                return AVERROR_INVALIDDATA;
+            for (int i = 0; i < hdr[26]; i++)
+                len += segs[i];
+
+            pos += len;
+            if (pos > MAX_TAGS_SIZE)
+                return AVERROR_INVALIDDATA;
+            if (fseek(f, pos, SEEK_SET))
+                return AVERROR(errno);
+        }
+        *off = 0;
+        *size = pos;
+        return 1;
+    } else if (!strcmp(lavf_name, "mp3")) {
+        if (fread(hdr, 1, 10, f) != 10 || memcmp(hdr, "ID3", 3))
+            return 0;
+        *off = 10;
+        *size = (hdr[6] & 0x7f) << 21 | (hdr[7] & 0x7f) << 14 |
+                (hdr[8] & 0x7f) <<  7 | (hdr[9] & 0x7f);
+        return 1;
+    } else if (!strcmp(lavf_name, "wv") || !strcmp(lavf_name, "tta")) {
+        /* The footer's size counts the items and itself */
+        if (fseek(f, -32, SEEK_END) || fread(hdr, 1, 32, f) != 32 ||
+            memcmp(hdr, "APETAGEX", 8))
+            return 0;
+        long end = ftell(f);
+        *size = AV_RL32(hdr + 12);
+        if (*size < 32 || *size > end)
+            return AVERROR_INVALIDDATA;
+        *off = end - *size;
+        *size -= 32;
+        return 1;
+    }
+
+    return 0;
+}
+
+/* Digits and signs may differ, anything else must be the same */
+static int same_form(const uint8_t *old, const char *val, int len)
+{
+    for (int i = 0; i < len; i++) {
+        int c1 = old[i], c2 = val[i];
+        if (av_isdigit(c1) && av_isdigit(c2))
+            continue;
+        if ((c1 == '+' || c1 == '-') && (c2 == '+' || c2 == '-'))
+            continue;
+        if (c1 != c2)
+            return 0;
+    }
+    return 1;
+}
+
+/* Keys are followed by '=' in Vorbis comments, by a 0 in ID3 and APE tags */
+static int patch_value(uint8_t *buf, long size, const char *key, const char *val)
+{
+    int nb = 0;
+    const long klen = strlen(key), vlen = strlen(val);
+
+    for (long i = 0; i + klen + 1 + vlen <= size; i++) {
+        uint8_t *v = buf + i + klen + 1;
+        if (memcmp(buf + i, key, klen) || (v[-1] != '=' && v[-1] != '\0') ||
+            !same_form(v, val, vlen))
+            continue;
+        memcpy(v, val, vlen);
+        nb++;
+    }
+
+    return nb;
+}
+
+static void ogg_update_crcs(uint8_t *buf, long size)
+{
+    const AVCRC *crc_tab = av_crc_get_table(AV_CRC_32_IEEE);
+
+    for (long pos = 0; pos + 27 <= size;) {
+        uint8_t *page = buf + pos;
+        long len = 27 + page[26];
+        if (pos + len > size)
+            break;
+        for (int i = 0; i < page[26]; i++)
+            len += page[27 + i];
+        if (pos + len > size)
+            break;
+
+        AV_WB32(page + 22, 0);
+        AV_WB32(page + 22, av_crc(crc_tab, 0, page, len));
+        pos += len;
+    }
+}
+
+int crip_replaygain_patch(const char *path, const char *lavf_name,
+                          const AVDictionary *meta)
+{
+    int ret, nb = 0;
+    long off = 0, size = 0;
+    uint8_t *buf = NULL;
+    const AVDictionaryEntry *e = NULL;
+
+    FILE *f = fopen(path, "r+b");
+    if (!f)
+        return AVERROR(errno);
+
+    ret = find_tags(f, lavf_name, &off, &size);
+    if (ret <= 0)
+        goto end;
+    if (size > MAX_TAGS_SIZE) {
+        ret = AVERROR_INVALIDDATA;
+        goto end;
+    }
+
+    buf = av_malloc(size + 1);
+    if (!buf) {
+        ret = AVERROR(ENOMEM);
+        goto end;
+    }
+
+    if (fseek(f, off, SEEK_SET) || fread(buf, 1, size, f) != size) {
+        ret = AVERROR_INVALIDDATA;
+        goto end;
+    }
+
+    while ((e = av_dict_get(meta, "", e, AV_DICT_IGNORE_SUFFIX)))
+        if (av_strstart(e->key, "REPLAYGAIN_", NULL) ||
+            av_strstart(e->key, "R128_", NULL))
+            nb += patch_value(buf, size, e->key, e->value);
+
+    if (nb) {
+        if (!strcmp(lavf_name, "ogg"))
+            ogg_update_crcs(buf, size);
+        if (fseek(f, off, SEEK_SET) || fwrite(buf, 1, size, f) != size ||
+            fflush(f)) {
+            ret = AVERROR(errno);
+            goto end;
+        }
+    }
+
+    ret = nb;
+
+end:
+    av_free(buf);
+    fclose(f);
+    return ret;
+}
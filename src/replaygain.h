@@ -0,0 +1,40 @@
+/*
+ * This file is part of cyanrip.
+ *
+ * cyanrip is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * cyanrip is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with cyanrip; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#pragma once
+
+#include <libavutil/dict.h>
+
+/* Files get written while their track is being ripped, long before the
+ * album has been measured. So their ReplayGain tags start out as
+ * placeholders, and all values always have the same width, to be
+ * overwritten in place once they're known. */
+
+#define CRIP_REPLAYGAIN_REF_LOUDNESS (-18.0)
+
+/* Sets the REPLAYGAIN_ and R128_ tags of scope "TRACK" or "ALBUM" from a
+ * measurement in LUFS and dBFS. A NAN loudness sets placeholders. */
+void crip_replaygain_meta(AVDictionary **meta, const char *scope,
+                          double integrated, double range, double true_peak);
+
+/* Overwrites the ReplayGain values in a file written by the given lavf muxer
+ * with the ones in meta. Values written in another form, as by older
+ * versions, are left alone. Returns the number of values overwritten, or a
+ * negative error. Muxers which don't write the tags are no error. */
+int crip_replaygain_patch(const char *path, const char *lavf_name,
+                          const AVDictionary *meta);
@@ -0,0 +1,161 @@
+/*
+ * This file is part of cyanrip.
+ *
+ * cyanrip is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * cyanrip is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with cyanrip; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include <string.h>
+
+#include <libavutil/crc.h>
+#include <libavutil/error.h>
+#include <libavutil/mem.h>
+#include <cdio/paranoia/paranoia.h>
+
+#include "vote.h"
+
+typedef struct CRIPVoteCand {
+    uint32_t crc;
+    int votes;
+} CRIPVoteCand;
+
+struct CRIPVote {
+    int frames;
+    int votes_needed;
+    int accepted;
+
+    const AVCRC *crc_tab;
+
+    /* Candidate 0 is always the one with the most votes */
+    CRIPVoteCand *cand;
+    uint8_t *data;
+};
+
+int crip_vote_alloc(CRIPVote **s, int frames, int votes_needed)
+{
+    CRIPVote *v = av_mallocz(sizeof(*v));
+    if (!v)
+        return AVERROR(ENOMEM);
+
+    v->frames = frames;
+    v->votes_needed = votes_needed;
+    v->crc_tab = av_crc_get_table(AV_CRC_32_IEEE_LE);
+
+    v->cand = av_calloc((size_t)frames*CRIP_VOTE_CANDIDATES, sizeof(*v->cand));
+    v->data = av_mallocz((size_t)frames*CDIO_CD_FRAMESIZE_RAW);
+    if (!v->cand || !v->data) {
+        crip_vote_free(&v);
+        return AVERROR(ENOMEM);
+    }
+
+    *s = v;
+
+    return 0;
+}
+
+void crip_vote_add(CRIPVote *s, int idx, const uint8_t *data, int flagged)
+{
+    CRIPVoteCand *c = &s->cand[idx*CRIP_VOTE_CANDIDATES];
+    uint8_t *dst = s->data + (size_t)idx*CDIO_CD_FRAMESIZE_RAW;
+
+    if (flagged) {
+        if (!c[0].votes)
+            memcpy(dst, data, CDIO_CD_FRAMESIZE_RAW);
+        return;
+    }
+
+    uint32_t crc = av_crc(s->crc_tab, UINT32_MAX, data, CDIO_CD_FRAMESIZE_RAW);
+
+    int j;
+    for (j = 0; j < CRIP_VOTE_CANDIDATES; j++)
+        if (!c[j].votes || c[j].crc == crc)
+            break;
+
+    /* All slots taken by other contents, replace the least popular one */
+    if (j == CRIP_VOTE_CANDIDATES) {
+        j = 1;
+        for (int k = 2; k < CRIP_VOTE_CANDIDATES; k++)
+            if (c[k].votes < c[j].votes)
+                j = k;
+        c[j].votes = 0;
+    }
+
+    if (!c[j].votes)
+        c[j].crc = crc;
+    c[j].votes++;
+
+    int best_votes = c[0].votes;
+    if (j && c[j].votes > best_votes) {
+        CRIPVoteCand tmp = c[0];
+        c[0] = c[j];
+        c[j] = tmp;
+    } else if (j) {
+        return;
+    }
+
+    /* Keep the contents of candidate 0, unless they're already there */
+    if (c[0].votes == 1 || c[0].votes > best_votes)
+        memcpy(dst, data, CDIO_CD_FRAMESIZE_RAW);
+
+    s->accepted += c[0].votes == s->votes_needed;
+}
+
+static inline int is_accepted(CRIPVote *s, int idx)
+{
+    return s->cand[idx*CRIP_VOTE_CANDIDATES].votes >= s->votes_needed;
+}
+
+int crip_vote_next_run(CRIPVote *s, int *start)
+{
+    int i = *start;
+    while (i < s->frames && is_accepted(s, i))
+        i++;
+    if (i == s->frames)
+        return 0;
+
+    *start = i;
+
+    int end = i + 1;
+    for (int gap = 0; end + gap < s->frames && gap < CRIP_VOTE_MAX_GAP;) {
+        if (is_accepted(s, end + gap)) {
+            gap++;
+        } else {
+            end += gap + 1;
+            gap = 0;
+        }
+    }
+
+    return end - i;
+}
+
+int crip_vote_disputed(CRIPVote *s)
+{
+    return s->frames - s->accepted;
+}
+
+const uint8_t *crip_vote_data(CRIPVote *s)
+{
+    return s->data;
+}
+
+void crip_vote_free(CRIPVote **s)
+{
+    CRIPVote *v = *s;
+    if (!v)
+        return;
+
+    av_free(v->cand);
+    av_free(v->data);
+    av_freep(s);
+}
@@ -0,0 +1,53 @@
+/*
+ * This file is part of cyanrip.
+ *
+ * cyanrip is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * cyanrip is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with cyanrip; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+/* Sector-level voting for repeated rips. Every sector of a track keeps a few
+ * candidates, identified by the CRC of their contents, along with how many
+ * reads returned each. The contents of the leading candidate are kept in
+ * a track-sized buffer. */
+typedef struct CRIPVote CRIPVote;
+
+/* Number of differing contents remembered per sector */
+#define CRIP_VOTE_CANDIDATES 4
+
+/* Accepted runs closer than this get read together, rather than seeking */
+#define CRIP_VOTE_MAX_GAP 8
+
+/* A sector is accepted once votes_needed reads of it agree */
+int crip_vote_alloc(CRIPVote **s, int frames, int votes_needed);
+
+/* Adds a read of sector idx. Flagged reads (errors, or paranoia having had to
+ * skip or guess) never vote, but are kept if there is nothing better. */
+void crip_vote_add(CRIPVote *s, int idx, const uint8_t *data, int flagged);
+
+/* Finds the next run of sectors not yet accepted, starting at *start.
+ * Returns its length, or 0 if all sectors from *start onwards are accepted.
+ * Runs separated by fewer than CRIP_VOTE_MAX_GAP accepted sectors are merged. */
+int crip_vote_next_run(CRIPVote *s, int *start);
+
+/* Number of sectors not accepted yet */
+int crip_vote_disputed(CRIPVote *s);
+
+/* The track, assembled from the leading candidate of every sector */
+const uint8_t *crip_vote_data(CRIPVote *s);
+
+void crip_vote_free(CRIPVote **s);
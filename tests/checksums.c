@@ -0,0 +1,172 @@
+/*
+ * This file is part of cyanrip.
+ *
+ * cyanrip is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * cyanrip is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with cyanrip; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <libavutil/cpu.h>
+#include <libavutil/crc.h>
+#include <libavutil/intreadwrite.h>
+
+#include "checksums.h"
+
+/* Enough for the 450th sector checksum */
+#define SAMPLES (460*588 + 123)
+
+static int fails = 0;
+
+/* The straightforward per-sample version everything must match */
+typedef struct RefChecksums {
+    uint32_t eac_crc, sum_1, sum_1_450, sum_2, mult, start, end;
+    int peak;
+} RefChecksums;
+
+static void ref_init(RefChecksums *r, int first, int last)
+{
+    memset(r, 0, sizeof(*r));
+    r->eac_crc = UINT32_MAX;
+    r->mult = 1;
+    r->end = SAMPLES;
+    if (first)
+        r->start += (CDIO_CD_FRAMESIZE_RAW * 5) >> 2;
+    if (last)
+        r->end -= (CDIO_CD_FRAMESIZE_RAW * 5) >> 2;
+}
+
+static void ref_process(RefChecksums *r, const uint8_t *data, int bytes)
+{
+    r->eac_crc = av_crc(av_crc_get_table(AV_CRC_32_IEEE_LE), r->eac_crc, data, bytes);
+
+    for (int j = 0; j < (bytes >> 2); j++) {
+        uint32_t val = AV_RL32(&data[j*4]);
+        if (r->mult >= r->start && r->mult <= r->end) {
+            uint64_t tmp = (uint64_t)val * (uint64_t)r->mult;
+            r->sum_1 += r->mult * val;
+            r->sum_2 += (uint32_t)tmp + (uint32_t)(tmp >> 32);
+        }
+        if ((r->mult - 1) >= 450*588 && (r->mult - 1) < 451*588)
+            r->sum_1_450 += val * (r->mult - 450*588);
+        r->mult++;
+    }
+
+    for (int j = 0; j < (bytes >> 1); j++)
+        r->peak = FFMAX(r->peak, abs((int16_t)AV_RL16(&data[j*2])));
+}
+
+static void check_u32(const char *what, const char *impl, uint32_t got, uint32_t want)
+{
+    if (got != want) {
+        printf("FAIL: %s %s: got %08X, want %08X\n", impl, what, got, want);
+        fails++;
+    }
+}
+
+static void test_impl(const char *impl, int cpu_flags, const uint8_t *data,
+                      int first, int last, int max_chunk)
+{
+    cyanrip_track t = { 0 };
+    t.nb_samples = SAMPLES;
+    t.acurip_track_is_first = first;
+    t.acurip_track_is_last = last;
+
+    cyanrip_checksum_ctx s;
+    crip_init_checksum_ctx(NULL, &s, &t);
+    crip_checksum_dsp_init(&s.dsp, cpu_flags);
+
+    RefChecksums r;
+    ref_init(&r, first, last);
+
+    /* Uneven chunks, the odd one not even a whole sample */
+    srand(first*2 + last);
+    for (int pos = 0; pos < SAMPLES*4;) {
+        int bytes = (rand() % max_chunk) + 1;
+        bytes = FFMIN(bytes, SAMPLES*4 - pos);
+        if (rand() & 7)
+            bytes = FFMAX(bytes & ~3, FFMIN(4, SAMPLES*4 - pos));
+        crip_process_checksums(&s, data + pos, bytes);
+        ref_process(&r, data + pos, bytes);
+        pos += bytes;
+    }
+
+    crip_finalize_checksums(&s, &t);
+
+    check_u32("EAC CRC", impl, t.eac_crc, r.eac_crc ^ UINT32_MAX);
+    check_u32("AccurateRip v1", impl, t.acurip_checksum_v1, r.sum_1);
+    check_u32("AccurateRip v1 450", impl, t.acurip_checksum_v1_450, r.sum_1_450);
+    check_u32("AccurateRip v2", impl, t.acurip_checksum_v2, r.sum_2);
+    check_u32("sample peak", impl, t.sample_peak_rel_amp*32768.0, r.peak);
+}
+
+int main(void)
+{
+    static const struct {
+        const char *name;
+        int flags;
+    } impls[] = {
+        { "C",    0 },
+        /* The flags' bits mean different things on each architecture */
+#if defined(__x86_64__) || defined(__i386__)
+        { "SSE4", AV_CPU_FLAG_SSE4 },
+        { "AVX2", AV_CPU_FLAG_SSE4 | AV_CPU_FLAG_AVX2 },
+#elif defined(__aarch64__)
+        { "NEON", AV_CPU_FLAG_NEON },
+#endif
+    };
+
+    uint8_t *data = malloc(SAMPLES*4);
+    if (!data)
+        return 1;
+
+    srand(0);
+    for (int i = 0; i < SAMPLES*4; i++)
+        data[i] = rand();
+    AV_WL16(&data[1000], INT16_MIN);
+
+    int cpu_flags = av_get_cpu_flags();
+
+    for (int i = 0; i < FF_ARRAY_ELEMS(impls); i++) {
+        if ((cpu_flags & impls[i].flags) != impls[i].flags)
+            continue;
+        for (int first = 0; first < 2; first++)
+            for (int last = 0; last < 2; last++)
+                test_impl(impls[i].name, impls[i].flags, data, first, last,
+                          first ? 64*CDIO_CD_FRAMESIZE_RAW : 200);
+        printf("Tested %s\n", impls[i].name);
+    }
+
+    free(data);
+
+    /* A known CRC, to check the CRC setup itself */
+    uint8_t silence[CDIO_CD_FRAMESIZE_RAW] = { 0 };
+    cyanrip_track t = { 0 };
+    t.nb_samples = CDIO_CD_FRAMESIZE_RAW >> 2;
+    cyanrip_checksum_ctx s;
+    crip_init_checksum_ctx(NULL, &s, &t);
+    crip_process_checksums(&s, silence, sizeof(silence));
+    crip_finalize_checksums(&s, &t);
+    check_u32("silent sector CRC", "", t.eac_crc, 0xBE97CE3F);
+
+    if (fails) {
+        printf("%i check(s) failed\n", fails);
+        return 1;
+    }
+
+    printf("All checksum tests passed\n");
+    return 0;
+}
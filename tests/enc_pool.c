@@ -0,0 +1,131 @@
+/*
+ * This file is part of cyanrip.
+ *
+ * cyanrip is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * cyanrip is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with cyanrip; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <libavutil/error.h>
+
+#include "enc_pool.h"
+
+/* More jobs than workers, fed like the encoders of several tracks */
+#define NB_JOBS   24
+#define NB_ITEMS  500
+#define PER_STEP  3
+
+typedef struct TestJob {
+    CRIPEncJob job; /* Must be first */
+    atomic_int available; /* Items sent, like frames in the ring */
+    atomic_int in_step;
+    int consumed;
+    int overlaps;
+} TestJob;
+
+static int test_step(CRIPEncJob *job)
+{
+    TestJob *s = (TestJob *)job;
+    int ret = 0;
+
+    if (atomic_fetch_add(&s->in_step, 1))
+        s->overlaps++;
+
+    for (int i = 0; i < PER_STEP; i++) {
+        if (s->consumed == NB_ITEMS) {
+            ret = AVERROR_EOF;
+            break;
+        } else if (s->consumed == atomic_load(&s->available)) {
+            ret = AVERROR(EAGAIN);
+            break;
+        }
+        s->consumed++;
+    }
+
+    atomic_fetch_sub(&s->in_step, 1);
+
+    return ret;
+}
+
+static int run(int nb_workers)
+{
+    static TestJob jobs[NB_JOBS];
+    CRIPEncPool *pool = NULL;
+    int fails = 0;
+
+    int ret = crip_enc_pool_init(&pool, nb_workers);
+    if (ret < 0) {
+        printf("FAIL: unable to start %i workers\n", nb_workers);
+        return 1;
+    }
+
+    for (int i = 0; i < NB_JOBS; i++) {
+        TestJob *s = &jobs[i];
+        atomic_init(&s->available, 0);
+        atomic_init(&s->in_step, 0);
+        s->consumed = 0;
+        s->overlaps = 0;
+        crip_enc_job_start(pool, &s->job, test_step);
+    }
+
+    /* Nothing may get lost between a job running dry and being kicked */
+    for (int n = 1; n <= NB_ITEMS; n++) {
+        for (int i = 0; i < NB_JOBS; i++) {
+            atomic_store(&jobs[i].available, n);
+            crip_enc_job_kick(pool, &jobs[i].job);
+        }
+    }
+
+    for (int i = 0; i < NB_JOBS; i++) {
+        TestJob *s = &jobs[i];
+        crip_enc_job_wait(pool, &s->job);
+        if (!crip_enc_job_finished(&s->job) || s->consumed != NB_ITEMS) {
+            printf("FAIL: %i workers: job %i consumed %i items\n",
+                   nb_workers, i, s->consumed);
+            fails++;
+        }
+        if (s->overlaps) {
+            printf("FAIL: %i workers: job %i ran on several at once\n",
+                   nb_workers, i);
+            fails++;
+        }
+
+        /* Kicks after the end are ignored */
+        crip_enc_job_kick(pool, &s->job);
+    }
+
+    crip_enc_pool_uninit(&pool);
+
+    return fails;
+}
+
+int main(void)
+{
+    int fails = 0;
+
+    for (int nb_workers = 1; nb_workers <= 8; nb_workers *= 2)
+        for (int i = 0; i < 20; i++)
+            fails += run(nb_workers);
+
+    if (fails) {
+        printf("%i check(s) failed\n", fails);
+        return 1;
+    }
+
+    printf("All encoding pool tests passed\n");
+    return 0;
+}
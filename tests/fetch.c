@@ -0,0 +1,111 @@
+/*
+ * This file is part of cyanrip.
+ *
+ * cyanrip is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * cyanrip is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with cyanrip; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <libavutil/file.h>
+#include <libavutil/mem.h>
+
+#include "fetch.h"
+
+/* Requests in flight at once, served from local files */
+#define NB_REQS 16
+
+int main(int argc, char **argv)
+{
+    static CRIPFetchReq reqs[NB_REQS];
+    CRIPFetch *fetch = NULL;
+    uint8_t *want;
+    size_t want_size;
+    int fails = 0;
+
+    if (argc < 2) {
+        printf("Usage: %s <fixtures-dir>\n", argv[0]);
+        return 1;
+    }
+
+    char path[4096];
+    snprintf(path, sizeof(path), "%s/cdda.bin", argv[1]);
+    if (av_file_map(path, &want, &want_size, 0, NULL) < 0) {
+        printf("FAIL: unable to read %s\n", path);
+        return 1;
+    }
+
+    curl_global_init(CURL_GLOBAL_DEFAULT);
+
+    if (crip_fetch_init(&fetch) < 0) {
+        printf("FAIL: unable to start the lookup thread\n");
+        return 1;
+    }
+
+    /* Twice over, the second time on whatever the first left open */
+    for (int pass = 0; pass < 2; pass++) {
+        for (int i = 0; i < NB_REQS; i++) {
+            CRIPFetchReq *req = &reqs[i];
+            memset(req, 0, sizeof(*req));
+            snprintf(req->url, sizeof(req->url), "file://%s/%s", argv[1],
+                     (i % 4 == 3) ? "missing.bin" : "cdda.bin");
+            if (crip_fetch_start(fetch, req) < 0) {
+                printf("FAIL: unable to start request %i\n", i);
+                fails++;
+            }
+        }
+
+        /* Out of order, and more than once */
+        for (int i = NB_REQS - 1; i >= 0; i--) {
+            CRIPFetchReq *req = &reqs[i];
+            crip_fetch_wait(fetch, req);
+            crip_fetch_wait(fetch, req);
+
+            if (i % 4 == 3) {
+                if (req->res == CURLE_OK) {
+                    printf("FAIL: pass %i: missing file %i was found\n", pass, i);
+                    fails++;
+                }
+            } else if (req->res != CURLE_OK || req->size != want_size ||
+                       memcmp(req->data, want, want_size)) {
+                printf("FAIL: pass %i: request %i got %zu bytes (%s)\n", pass, i,
+                       req->size, req->errbuf);
+                fails++;
+            } else if (!req->effective_url || strcmp(req->effective_url, req->url)) {
+                printf("FAIL: pass %i: request %i has no effective URL\n", pass, i);
+                fails++;
+            }
+
+            crip_fetch_req_free(req);
+        }
+    }
+
+    /* Never started, so never waited on */
+    CRIPFetchReq idle = { 0 };
+    crip_fetch_wait(fetch, &idle);
+
+    crip_fetch_uninit(&fetch);
+    curl_global_cleanup();
+    av_file_unmap(want, want_size);
+
+    if (fails) {
+        printf("%i check(s) failed\n", fails);
+        return 1;
+    }
+
+    printf("All lookup tests passed\n");
+    return 0;
+}
@@ -0,0 +1,263 @@
+/*
+ * This file is part of cyanrip.
+ *
+ * cyanrip is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * cyanrip is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with cyanrip; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <libavcodec/avcodec.h>
+#include <libavutil/channel_layout.h>
+#include <libavutil/md5.h>
+
+#include "flac_frame.h"
+
+/* Small, so frame numbers get past what fits in a byte */
+#define CHUNK_FRAMES 8
+#define MAX_FRAMES 1024
+
+typedef struct Encoded {
+    AVPacket *pkts[MAX_FRAMES];
+    int nb_pkts;
+    uint8_t streaminfo[CRIP_FLAC_STREAMINFO_SIZE]; /* Sent once drained */
+} Encoded;
+
+static int fails = 0;
+
+static AVCodecContext *open_encoder(int frame_size)
+{
+    const AVCodec *codec = avcodec_find_encoder(AV_CODEC_ID_FLAC);
+    if (!codec)
+        return NULL;
+
+    AVCodecContext *avctx = avcodec_alloc_context3(codec);
+    if (!avctx)
+        return NULL;
+
+    /* As cyanrip sets it up */
+    avctx->sample_fmt          = AV_SAMPLE_FMT_S16;
+    avctx->ch_layout           = (AVChannelLayout)AV_CHANNEL_LAYOUT_STEREO;
+    avctx->sample_rate         = 44100;
+    avctx->time_base           = (AVRational){ 1, 44100 };
+    avctx->compression_level   = 11;
+    avctx->bits_per_raw_sample = 16;
+    avctx->frame_size          = frame_size;
+
+    if (avcodec_open2(avctx, codec, NULL) < 0)
+        avcodec_free_context(&avctx);
+
+    return avctx;
+}
+
+/* Encodes samples [start, end) of data, the packets get appended to e */
+static int encode(Encoded *e, const uint8_t *data, int start, int end,
+                  int frame_size)
+{
+    int ret = 0;
+    AVFrame *frame = NULL;
+    AVPacket *pkt = NULL;
+    AVCodecContext *avctx = open_encoder(frame_size);
+    if (!avctx)
+        return AVERROR(ENOMEM);
+
+    for (int pos = start;; pos += avctx->frame_size) {
+        if (pos < end) {
+            frame = av_frame_alloc();
+            if (!frame) {
+                ret = AVERROR(ENOMEM);
+                goto end;
+            }
+            frame->format = AV_SAMPLE_FMT_S16;
+            frame->sample_rate = 44100;
+            frame->ch_layout = (AVChannelLayout)AV_CHANNEL_LAYOUT_STEREO;
+            frame->nb_samples = FFMIN(avctx->frame_size, end - pos);
+            frame->pts = pos;
+            ret = av_frame_get_buffer(frame, 0);
+            if (ret < 0)
+                goto end;
+            memcpy(frame->data[0], data + pos*4, frame->nb_samples*4);
+        }
+
+        ret = avcodec_send_frame(avctx, frame);
+        av_frame_free(&frame);
+        if (ret < 0)
+            goto end;
+
+        for (;;) {
+            pkt = av_packet_alloc();
+            if (!pkt) {
+                ret = AVERROR(ENOMEM);
+                goto end;
+            }
+
+            ret = avcodec_receive_packet(avctx, pkt);
+            if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF) {
+                ret = 0;
+                break;
+            } else if (ret < 0) {
+                goto end;
+            }
+
+            /* The final STREAMINFO */
+            size_t size;
+            uint8_t *si = av_packet_get_side_data(pkt, AV_PKT_DATA_NEW_EXTRADATA, &size);
+            if (si && size == CRIP_FLAC_STREAMINFO_SIZE)
+                memcpy(e->streaminfo, si, size);
+
+            if (!pkt->size) {
+                av_packet_free(&pkt);
+            } else if (e->nb_pkts == MAX_FRAMES) {
+                ret = AVERROR_BUG;
+                goto end;
+            } else {
+                e->pkts[e->nb_pkts++] = pkt;
+                pkt = NULL;
+            }
+        }
+        av_packet_free(&pkt);
+
+        if (pos >= end)
+            break;
+    }
+
+end:
+    av_frame_free(&frame);
+    av_packet_free(&pkt);
+    avcodec_free_context(&avctx);
+    return ret;
+}
+
+static void free_encoded(Encoded *e)
+{
+    for (int i = 0; i < e->nb_pkts; i++)
+        av_packet_free(&e->pkts[i]);
+    e->nb_pkts = 0;
+}
+
+/* Stitches chunks together the way the encoder does, and compares */
+static void test_chunked(const uint8_t *data, int nb_samples, int frame_size)
+{
+    static Encoded serial, chunks;
+    uint8_t buf[65536 + CRIP_FLAC_RENUMBER_GROWTH];
+
+    memset(&serial, 0, sizeof(serial));
+    memset(&chunks, 0, sizeof(chunks));
+
+    if (encode(&serial, data, 0, nb_samples, frame_size) < 0) {
+        printf("FAIL: unable to encode with a frame size of %i\n", frame_size);
+        fails++;
+        return;
+    }
+
+    /* Whatever the encoder picked */
+    int bs = serial.pkts[0]->duration;
+    int chunk_samples = CHUNK_FRAMES*bs;
+    for (int pos = 0; pos < nb_samples; pos += chunk_samples) {
+        if (encode(&chunks, data, pos, FFMIN(pos + chunk_samples, nb_samples), bs) < 0) {
+            printf("FAIL: unable to encode chunk at %i\n", pos);
+            fails++;
+            goto end;
+        }
+    }
+
+    if (chunks.nb_pkts != serial.nb_pkts) {
+        printf("FAIL: %i frames in chunks, %i serially\n",
+               chunks.nb_pkts, serial.nb_pkts);
+        fails++;
+        goto end;
+    }
+
+    int min_size = INT_MAX, max_size = 0;
+    for (int i = 0; i < chunks.nb_pkts; i++) {
+        const AVPacket *pkt = chunks.pkts[i];
+        int size = crip_flac_frame_renumber(buf, pkt->data, pkt->size, i);
+        if (size != serial.pkts[i]->size ||
+            memcmp(buf, serial.pkts[i]->data, size)) {
+            printf("FAIL: block size %i: frame %i differs\n", bs, i);
+            fails++;
+            goto end;
+        }
+        min_size = FFMIN(min_size, size);
+        max_size = FFMAX(max_size, size);
+    }
+
+    /* From the header of an encoder which never got any samples */
+    AVCodecContext *avctx = open_encoder(bs);
+    if (!avctx || avctx->extradata_size < CRIP_FLAC_STREAMINFO_SIZE) {
+        printf("FAIL: no STREAMINFO in the header\n");
+        fails++;
+        avcodec_free_context(&avctx);
+        goto end;
+    }
+
+    uint8_t md5[16], streaminfo[CRIP_FLAC_STREAMINFO_SIZE];
+    av_md5_sum(md5, data, nb_samples*4);
+    memcpy(streaminfo, avctx->extradata, CRIP_FLAC_STREAMINFO_SIZE);
+    avcodec_free_context(&avctx);
+
+    crip_flac_streaminfo_update(streaminfo, min_size, max_size, nb_samples, md5);
+    if (memcmp(streaminfo, serial.streaminfo, CRIP_FLAC_STREAMINFO_SIZE)) {
+        printf("FAIL: block size %i: STREAMINFO differs\n", bs);
+        fails++;
+    }
+
+    printf("Tested %i frames of %i samples\n", serial.nb_pkts, bs);
+
+end:
+    free_encoded(&serial);
+    free_encoded(&chunks);
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 2) {
+        printf("Usage: %s <fixtures/cdda.bin>\n", argv[0]);
+        return 1;
+    }
+
+    static uint8_t data[600*2352];
+    FILE *f = fopen(argv[1], "rb");
+    if (!f || fread(data, 1, sizeof(data), f) != sizeof(data)) {
+        printf("Unable to read %s\n", argv[1]);
+        return 1;
+    }
+    fclose(f);
+
+    /* The block size cyanrip gets, and one which makes more frames */
+    test_chunked(data, sizeof(data)/4, 0);
+    test_chunked(data, sizeof(data)/4, 1152);
+
+    /* Frame numbers take up to 6 bytes */
+    uint8_t frame[16] = { 0xFF, 0xF8, 0xC9, 0x18, 0x00 };
+    uint8_t out[sizeof(frame) + CRIP_FLAC_RENUMBER_GROWTH], back[sizeof(frame)];
+    int size = crip_flac_frame_renumber(out, frame, sizeof(frame), 0x7FFFFFFF);
+    if (size != sizeof(frame) + 5 ||
+        crip_flac_frame_renumber(back, out, size, 0) != sizeof(frame) ||
+        memcmp(back + 6, frame + 6, sizeof(frame) - 8)) {
+        printf("FAIL: renumbering to the largest frame number\n");
+        fails++;
+    }
+
+    if (fails) {
+        printf("%i check(s) failed\n", fails);
+        return 1;
+    }
+
+    printf("All FLAC stitching tests passed\n");
+    return 0;
+}
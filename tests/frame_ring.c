@@ -0,0 +1,173 @@
+/*
+ * This file is part of cyanrip.
+ *
+ * cyanrip is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * cyanrip is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with cyanrip; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <libavutil/mem.h>
+
+#include "frame_ring.h"
+
+/* A small ring, so the writer is blocked on it most of the time, and readers
+ * leaving at every point of the stream, as when an encoder fails */
+#define RING_SIZE  4
+#define NB_READERS 4
+#define NB_FRAMES  200
+#define NB_RUNS    200
+
+static atomic_int nb_freed;
+
+static void frame_data_free(void *opaque, uint8_t *data)
+{
+    /* Anyone still reading the frame sees it's gone */
+    *(int64_t *)data = -1;
+    av_free(data);
+    atomic_fetch_add(&nb_freed, 1);
+}
+
+typedef struct Reader {
+    AVBufferRef *ring;
+    int idx;
+    int leave_at; /* Frames read before leaving, or -1 to read all */
+    int nb_frames;
+    int errors;
+} Reader;
+
+static void *reader_thread(void *arg)
+{
+    Reader *r = arg;
+    const AVFrame *f;
+
+    while (r->nb_frames != r->leave_at &&
+           (f = cr_frame_ring_peek(r->ring, r->idx))) {
+        if (f->pts != r->nb_frames || *(int64_t *)f->data[0] != f->pts)
+            r->errors++;
+        r->nb_frames++;
+        cr_frame_ring_release(r->ring, r->idx);
+    }
+
+    cr_frame_ring_remove_reader(r->ring, r->idx);
+
+    return NULL;
+}
+
+static int push_frame(AVBufferRef *ring, int64_t pts)
+{
+    AVFrame *f = av_frame_alloc();
+    int64_t *data = av_malloc(sizeof(*data));
+    if (!f || !data) {
+        av_frame_free(&f);
+        av_free(data);
+        return AVERROR(ENOMEM);
+    }
+
+    *data = pts;
+    f->buf[0] = av_buffer_create((uint8_t *)data, sizeof(*data),
+                                 frame_data_free, NULL, 0);
+    if (!f->buf[0]) {
+        av_frame_free(&f);
+        av_free(data);
+        return AVERROR(ENOMEM);
+    }
+    f->data[0] = f->buf[0]->data;
+    f->extended_data = f->data;
+    f->pts = pts;
+
+    int ret = cr_frame_ring_push(ring, f);
+    av_frame_free(&f);
+
+    return ret;
+}
+
+static int run(int run_idx)
+{
+    Reader readers[NB_READERS];
+    pthread_t threads[NB_READERS];
+    int fails = 0;
+
+    atomic_store(&nb_freed, 0);
+
+    AVBufferRef *ring = cr_frame_ring_create(RING_SIZE);
+    if (!ring) {
+        printf("FAIL: unable to create the ring\n");
+        return 1;
+    }
+
+    /* The first reader always stays, the others leave at spread out points */
+    for (int i = 0; i < NB_READERS; i++) {
+        Reader *r = &readers[i];
+        r->ring = ring;
+        r->idx = cr_frame_ring_add_reader(ring);
+        r->leave_at = i ? (run_idx*7 + i*RING_SIZE) % NB_FRAMES : -1;
+        r->nb_frames = 0;
+        r->errors = 0;
+    }
+
+    for (int i = 0; i < NB_READERS; i++)
+        pthread_create(&threads[i], NULL, reader_thread, &readers[i]);
+
+    for (int n = 0; n < NB_FRAMES; n++) {
+        if (push_frame(ring, n) < 0) {
+            printf("FAIL: run %i: unable to push frame %i\n", run_idx, n);
+            fails++;
+            break;
+        }
+    }
+    cr_frame_ring_push(ring, NULL);
+
+    for (int i = 0; i < NB_READERS; i++) {
+        Reader *r = &readers[i];
+        pthread_join(threads[i], NULL);
+
+        int expected = r->leave_at < 0 ? NB_FRAMES : r->leave_at;
+        if (r->nb_frames != expected || r->errors) {
+            printf("FAIL: run %i: reader %i got %i of %i frames, %i wrong\n",
+                   run_idx, i, r->nb_frames, expected, r->errors);
+            fails++;
+        }
+    }
+
+    av_buffer_unref(&ring);
+
+    /* Each frame freed once, no matter who released it last */
+    if (atomic_load(&nb_freed) != NB_FRAMES) {
+        printf("FAIL: run %i: %i of %i frames freed\n",
+               run_idx, atomic_load(&nb_freed), NB_FRAMES);
+        fails++;
+    }
+
+    return fails;
+}
+
+int main(void)
+{
+    int fails = 0;
+
+    for (int i = 0; i < NB_RUNS; i++)
+        fails += run(i);
+
+    if (fails) {
+        printf("%i check(s) failed\n", fails);
+        return 1;
+    }
+
+    printf("All frame ring tests passed\n");
+    return 0;
+}
@@ -0,0 +1,244 @@
+/*
+ * This file is part of cyanrip.
+ *
+ * cyanrip is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * cyanrip is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with cyanrip; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <libavfilter/avfilter.h>
+#include <libavfilter/buffersrc.h>
+#include <libavutil/channel_layout.h>
+#include <libavutil/cpu.h>
+#include <libavutil/frame.h>
+#include <libavutil/opt.h>
+
+#include "loudness.h"
+
+/* The tracks of cdda.bin, in bytes */
+static const int tracks[] = { 0, 225*2352, 450*2352, 600*2352 };
+
+/* lavfi gates the same way. The true peak differs, as lavfi oversamples with
+ * swresample rather than the BS.1770 filter. */
+#define LOUDNESS_TOL 0.05
+#define SAMPLE_PEAK_TOL 1e-4
+#define TRUE_PEAK_TOL 0.25
+
+static int fails = 0;
+
+static void check(const char *what, const char *impl, double got, double want,
+                  double tol)
+{
+    if (!(fabs(got - want) <= tol)) {
+        printf("FAIL: %s (%s): got %f, want %f\n", what, impl, got, want);
+        fails++;
+    }
+}
+
+static void check_results(const char *impl, const CRIPLoudnessResults *got,
+                          const CRIPLoudnessResults *want, double tol,
+                          double sample_peak_tol, double true_peak_tol)
+{
+    check("integrated", impl, got->integrated, want->integrated, tol);
+    check("range", impl, got->range, want->range, tol);
+    check("range low", impl, got->range_low, want->range_low, tol);
+    check("range high", impl, got->range_high, want->range_high, tol);
+    check("sample peak", impl, got->sample_peak, want->sample_peak, sample_peak_tol);
+    check("true peak", impl, got->true_peak, want->true_peak, true_peak_tol);
+}
+
+/* Measures in uneven chunks, to test what's carried over between them */
+static void measure(CRIPLoudnessStats *stats, int cpu_flags,
+                    const uint8_t *data, int bytes)
+{
+    CRIPLoudness *s = malloc(sizeof(*s));
+    if (!s)
+        exit(1);
+
+    crip_loudness_init(s);
+    crip_loudness_dsp_init(&s->dsp, cpu_flags);
+
+    srand(bytes);
+    for (int pos = 0; pos < bytes;) {
+        int len = ((rand() % 3000) + 1)*4;
+        len = FFMIN(len, bytes - pos);
+        crip_loudness_process(s, data + pos, len);
+        pos += len;
+    }
+
+    crip_loudness_flush(s);
+    *stats = s->stats;
+    free(s);
+}
+
+static int measure_lavfi(CRIPLoudnessResults *r, const uint8_t *data, int bytes)
+{
+    int ret;
+    AVFilterContext *src;
+    AVFilterInOut *outputs = avfilter_inout_alloc();
+    AVFilterGraph *graph = avfilter_graph_alloc();
+    AVFrame *frame = NULL;
+    if (!graph || !outputs) {
+        ret = AVERROR(ENOMEM);
+        goto end;
+    }
+
+    ret = avfilter_graph_create_filter(&src, avfilter_get_by_name("abuffer"), "in",
+                                       "time_base=1/44100:sample_rate=44100:"
+                                       "sample_fmt=s16:channel_layout=stereo",
+                                       NULL, graph);
+    if (ret < 0)
+        goto end;
+
+    outputs->name       = av_strdup("in");
+    outputs->filter_ctx = src;
+    ret = avfilter_graph_parse_ptr(graph, "ebur128=peak=sample+true,anullsink",
+                                   NULL, &outputs, NULL);
+    if (ret < 0)
+        goto end;
+
+    ret = avfilter_graph_config(graph, NULL);
+    if (ret < 0)
+        goto end;
+
+    for (int pos = 0; pos < bytes; pos += 16*2352) {
+        frame = av_frame_alloc();
+        if (!frame) {
+            ret = AVERROR(ENOMEM);
+            goto end;
+        }
+        frame->format = AV_SAMPLE_FMT_S16;
+        frame->sample_rate = 44100;
+        frame->ch_layout = (AVChannelLayout)AV_CHANNEL_LAYOUT_STEREO;
+        frame->nb_samples = FFMIN(16*2352, bytes - pos) >> 2;
+        frame->pts = pos >> 2;
+        ret = av_frame_get_buffer(frame, 0);
+        if (ret < 0)
+            goto end;
+        memcpy(frame->data[0], data + pos, frame->nb_samples*4);
+
+        ret = av_buffersrc_add_frame_flags(src, frame, AV_BUFFERSRC_FLAG_PUSH);
+        if (ret < 0)
+            goto end;
+        av_frame_free(&frame);
+    }
+
+    ret = av_buffersrc_add_frame_flags(src, NULL, AV_BUFFERSRC_FLAG_PUSH);
+    if (ret < 0)
+        goto end;
+
+    AVFilterContext *ebur128 = graph->filters[1];
+    av_opt_get_double(ebur128, "integrated", AV_OPT_SEARCH_CHILDREN, &r->integrated);
+    av_opt_get_double(ebur128, "range", AV_OPT_SEARCH_CHILDREN, &r->range);
+    av_opt_get_double(ebur128, "lra_low", AV_OPT_SEARCH_CHILDREN, &r->range_low);
+    av_opt_get_double(ebur128, "lra_high", AV_OPT_SEARCH_CHILDREN, &r->range_high);
+    av_opt_get_double(ebur128, "sample_peak", AV_OPT_SEARCH_CHILDREN, &r->sample_peak);
+    av_opt_get_double(ebur128, "true_peak", AV_OPT_SEARCH_CHILDREN, &r->true_peak);
+
+end:
+    av_frame_free(&frame);
+    avfilter_inout_free(&outputs);
+    avfilter_graph_free(&graph);
+    return ret;
+}
+
+int main(int argc, char **argv)
+{
+    static const struct {
+        const char *name;
+        int flags;
+    } impls[] = {
+        { "C",    0 },
+        { "SSE2", AV_CPU_FLAG_SSE2 },
+        { "AVX2", AV_CPU_FLAG_SSE2 | AV_CPU_FLAG_AVX2 },
+    };
+
+    if (argc < 2) {
+        printf("Usage: %s <fixtures/cdda.bin>\n", argv[0]);
+        return 1;
+    }
+
+    static uint8_t data[600*2352];
+    FILE *f = fopen(argv[1], "rb");
+    if (!f || fread(data, 1, sizeof(data), f) != sizeof(data)) {
+        printf("Unable to read %s\n", argv[1]);
+        return 1;
+    }
+    fclose(f);
+
+    static CRIPLoudnessStats stats, ref_stats;
+    CRIPLoudnessResults res, ref;
+    int cpu_flags = av_get_cpu_flags();
+
+    /* Everything but the true peak is the same for all implementations */
+    measure(&ref_stats, 0, data, sizeof(data));
+    crip_loudness_results(&ref_stats, &ref);
+    for (int i = 1; i < FF_ARRAY_ELEMS(impls); i++) {
+        if ((cpu_flags & impls[i].flags) != impls[i].flags)
+            continue;
+        measure(&stats, impls[i].flags, data, sizeof(data));
+        crip_loudness_results(&stats, &res);
+        check_results(impls[i].name, &res, &ref, 0.0, 1e-4, 1e-4);
+        printf("Tested %s\n", impls[i].name);
+    }
+
+    /* The whole disc, and every track on its own */
+    for (int i = -1; i < (int)FF_ARRAY_ELEMS(tracks) - 1; i++) {
+        const int start = i < 0 ? 0 : tracks[i];
+        const int end = i < 0 ? sizeof(data) : tracks[i + 1];
+        char name[32] = "disc";
+        if (i >= 0)
+            snprintf(name, sizeof(name), "track %i", i + 1);
+
+        measure(&stats, cpu_flags, data + start, end - start);
+        crip_loudness_results(&stats, &res);
+        if (measure_lavfi(&ref, data + start, end - start) < 0) {
+            printf("FAIL: unable to measure %s with lavfi\n", name);
+            return 1;
+        }
+        check_results(name, &res, &ref, LOUDNESS_TOL, SAMPLE_PEAK_TOL, TRUE_PEAK_TOL);
+    }
+
+    /* Merging tracks only misses the blocks spanning two of them. The range
+     * isn't comparable, the tracks are barely long enough for a 3s block. */
+    static CRIPLoudnessStats album;
+    memset(&album, 0, sizeof(album));
+    for (int i = 0; i < FF_ARRAY_ELEMS(tracks) - 1; i++) {
+        measure(&stats, cpu_flags, data + tracks[i], tracks[i + 1] - tracks[i]);
+        crip_loudness_merge(&album, &stats);
+    }
+    crip_loudness_results(&album, &res);
+    crip_loudness_results(&ref_stats, &ref);
+    check("album integrated", "merged", res.integrated, ref.integrated, 0.1);
+    check("album sample peak", "merged", res.sample_peak, ref.sample_peak, 0.0);
+    check("album true peak", "merged", res.true_peak, ref.true_peak, 0.01);
+
+    /* Too short for a single block */
+    memset(&stats, 0, sizeof(stats));
+    crip_loudness_results(&stats, &res);
+    check("empty integrated", "", res.integrated, -70.0, 0.0);
+    check("empty range", "", res.range, 0.0, 0.0);
+
+    if (fails) {
+        printf("%i check(s) failed\n", fails);
+        return 1;
+    }
+
+    printf("All loudness tests passed\n");
+    return 0;
+}
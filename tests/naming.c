@@ -142,6 +142,33 @@ int main(void)
                      "folder/Disc.flac");
     check_track_path("  {track}", t, "folder/1.flac");
 
+    /* Paths are remembered, but follow the tags they're made of */
+    check_track_path("{track} - {title}", t, "folder/1 - Title.flac");
+    check_track_path("{track} - {title}", t, "folder/1 - Title.flac");
+    av_dict_set(&t->meta, "title", "Other", 0);
+    check_track_path("{track} - {title}", t, "folder/1 - Other.flac");
+    av_dict_set(&ctx.meta, "album", "Album 2", 0);
+    ctx.settings.folder_name_scheme = "{album}";
+    check_track_path("{track} - {title}", t, "Album 2/1 - Other.flac");
+    ctx.settings.folder_name_scheme = "folder";
+
+    /* Invalid schemes stop where the error is */
+    check_track_path("{track} {title", t, "folder/1");
+    check_track_path("{track}{if #title# ?? #1#|disc|}", t, "folder/1");
+
+    /* Duplicate detection */
+    CRIPPathSet *set = crip_path_set_alloc();
+    int prev = -1;
+    if (!set || crip_path_set_add(set, "a/1.flac", 0, &prev) != 0 ||
+        crip_path_set_add(set, "a/2.flac", 1, &prev) != 0 ||
+        crip_path_set_add(set, "a/1.flac", 2, &prev) != 1 || prev != 0) {
+        printf("FAIL: path set\n");
+        fails++;
+    }
+    crip_path_set_free(&set);
+
+    crip_naming_free(&ctx);
+
     if (fails) {
         printf("%i check(s) failed\n", fails);
         return 1;
@@ -0,0 +1,128 @@
+/*
+ * This file is part of cyanrip.
+ *
+ * cyanrip is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * cyanrip is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with cyanrip; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include <stdio.h>
+#include <stdarg.h>
+
+#include <libavutil/time.h>
+
+#include "cyanrip_main.h"
+
+/* A box set disc ripped to four formats, with the default schemes. Paths are
+ * worked out once per track and format when they're first needed, again when
+ * they're all needed at once, and again after the metadata changed. */
+#define NB_TRACKS 99
+#define NB_ROUNDS 200
+
+void cyanrip_log(cyanrip_ctx *ctx, int verbose, const char *format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    vprintf(format, args);
+    va_end(args);
+}
+
+static cyanrip_ctx ctx;
+static const cyanrip_out_fmt fmts[] = {
+    { .name = "flac", .folder_suffix = "FLAC", .ext = "flac" },
+    { .name = "opus", .folder_suffix = "Opus", .ext = "opus" },
+    { .name = "mp3",  .folder_suffix = "MP3",  .ext = "mp3"  },
+    { .name = "wav",  .folder_suffix = "WAV",  .ext = "wav"  },
+};
+#define NB_FMTS (sizeof(fmts)/sizeof(fmts[0]))
+
+/* Returns the time taken per path, in nanoseconds */
+static double all_paths(int rounds, int retag)
+{
+    int64_t start = av_gettime_relative();
+
+    for (int r = 0; r < rounds; r++) {
+        for (int i = 0; i < NB_TRACKS; i++) {
+            if (retag)
+                av_dict_set(&ctx.tracks[i].meta, "title", r & 1 ? "Title B" : "Title A", 0);
+            for (int f = 0; f < NB_FMTS; f++)
+                av_free(crip_get_path(&ctx, CRIP_PATH_TRACK, 0, &fmts[f], &ctx.tracks[i]));
+        }
+    }
+
+    return (av_gettime_relative() - start)*1000.0/(rounds*NB_TRACKS*NB_FMTS);
+}
+
+/* Same file warnings, as done before ripping */
+static double collisions(int use_set)
+{
+    char *paths[NB_TRACKS];
+    int found = 0;
+
+    int64_t start = av_gettime_relative();
+
+    for (int r = 0; r < NB_ROUNDS; r++) {
+        for (int f = 0; f < NB_FMTS; f++) {
+            CRIPPathSet *set = use_set ? crip_path_set_alloc() : NULL;
+            for (int i = 0; i < NB_TRACKS; i++) {
+                int prev;
+                paths[i] = crip_get_path(&ctx, CRIP_PATH_TRACK, 0, &fmts[f], &ctx.tracks[i]);
+                if (set)
+                    found += crip_path_set_add(set, paths[i], i, &prev) > 0;
+            }
+            if (!use_set)
+                for (int i = 0; i < NB_TRACKS; i++)
+                    for (int j = i + 1; j < NB_TRACKS; j++)
+                        found += !strcmp(paths[i], paths[j]);
+            for (int i = 0; i < NB_TRACKS; i++)
+                av_free(paths[i]);
+            crip_path_set_free(&set);
+        }
+    }
+
+    if (found)
+        printf("found %i duplicates\n", found);
+
+    return (av_gettime_relative() - start)*1000.0/(NB_ROUNDS*NB_TRACKS*NB_FMTS);
+}
+
+int main(void)
+{
+    ctx.settings.sanitize_method = CRIP_SANITIZE_UNICODE;
+    ctx.settings.folder_name_scheme = "{album}{if #releasecomment# > #0# (|releasecomment|)} [{format}]";
+    ctx.settings.track_name_scheme = "{if #totaldiscs# > #1#|disc|.}{track} - {title}";
+    ctx.nb_tracks = NB_TRACKS;
+
+    av_dict_set(&ctx.meta, "album", "Some Album: The \"Deluxe\" Box", 0);
+    av_dict_set(&ctx.meta, "releasecomment", "Remastered", 0);
+    for (int i = 0; i < NB_TRACKS; i++) {
+        av_dict_set_int(&ctx.tracks[i].meta, "track", i + 1, 0);
+        av_dict_set(&ctx.tracks[i].meta, "title", "Title A", 0);
+        av_dict_set(&ctx.tracks[i].meta, "disc", "3", 0);
+        av_dict_set(&ctx.tracks[i].meta, "totaldiscs", "12", 0);
+    }
+
+    printf("%i tracks, %i formats\n", NB_TRACKS, (int)NB_FMTS);
+    printf("%-16s %8.1f ns/path\n", "first use", all_paths(1, 0));
+    printf("%-16s %8.1f ns/path\n", "unchanged", all_paths(NB_ROUNDS, 0));
+    printf("%-16s %8.1f ns/path\n", "retagged", all_paths(NB_ROUNDS, 1));
+    printf("%-16s %8.1f ns/path\n", "pairwise check", collisions(0));
+    printf("%-16s %8.1f ns/path\n", "path set check", collisions(1));
+
+    crip_naming_free(&ctx);
+    for (int i = 0; i < NB_TRACKS; i++)
+        av_dict_free(&ctx.tracks[i].meta);
+    av_dict_free(&ctx.meta);
+
+    return 0;
+}
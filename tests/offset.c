@@ -0,0 +1,109 @@
+/*
+ * This file is part of cyanrip.
+ *
+ * cyanrip is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * cyanrip is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with cyanrip; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <libavutil/intreadwrite.h>
+
+#include "offset.h"
+
+#define SAMPLES (4*588)
+
+static int fails = 0;
+
+static void check_int(const char *what, int got, int want)
+{
+    if (got != want) {
+        printf("FAIL: %s: got %i, want %i\n", what, got, want);
+        fails++;
+    }
+}
+
+/* The checksum of the sector at the given offset, the slow way */
+static uint32_t checksum_at(const uint8_t *data, int offset)
+{
+    const uint8_t *start = data + (SAMPLES + offset)*4;
+    uint32_t sum = 0;
+    for (int j = 0; j < CRIP_OFFSET_WINDOW; j++)
+        sum += AV_RL32(&start[j*4]) * (j + 1);
+    return sum;
+}
+
+static int search(const uint8_t *data, const uint32_t *checksums, int nb,
+                  int guess, int dir, int *offset)
+{
+    CRIPOffsetSearch *s;
+    if (crip_offset_search_alloc(&s, checksums, nb) < 0)
+        exit(1);
+    int found = crip_offset_search(s, data, SAMPLES, guess, dir, offset);
+    crip_offset_search_free(&s);
+    return found;
+}
+
+int main(void)
+{
+    static uint8_t data[2*SAMPLES*4];
+    static const int offsets[] = {
+        -SAMPLES, -SAMPLES + 1, -667, -1, 0, 1, 6, 1000,
+        SAMPLES - CRIP_OFFSET_WINDOW,
+    };
+    int offset;
+
+    srand(1);
+    for (int i = 0; i < sizeof(data); i++)
+        data[i] = rand();
+
+    /* Every offset in range gets found, the edges included */
+    for (int i = 0; i < sizeof(offsets)/sizeof(offsets[0]); i++) {
+        uint32_t checksums[] = { 0x12345678, checksum_at(data, offsets[i]), 0xDEADBEEF };
+        offset = 0x7FFFFFFF;
+        check_int("found", search(data, checksums, 3, 0, 1, &offset), 1);
+        check_int("offset", offset, offsets[i]);
+    }
+
+    uint32_t none[] = { 0x12345678, 0 };
+    check_int("nothing found", search(data, none, 2, 0, 1, &offset), 0);
+
+    /* When several offsets match, the guess, then the direction wins */
+    uint32_t several[] = { checksum_at(data, -30), checksum_at(data, 50),
+                           checksum_at(data, 40) };
+    search(data, several, 3, 0, 1, &offset);
+    check_int("positive direction", offset, 40);
+    search(data, several, 3, 0, -1, &offset);
+    check_int("negative direction", offset, -30);
+    search(data, several, 3, 50, -1, &offset);
+    check_int("guess", offset, 50);
+
+    /* Many entries, with duplicates */
+    uint32_t many[64];
+    for (int i = 0; i < 64; i++)
+        many[i] = rand() | 1;
+    many[17] = many[18] = checksum_at(data, -6);
+    check_int("many found", search(data, many, 64, 0, 1, &offset), 1);
+    check_int("many offset", offset, -6);
+
+    if (fails) {
+        printf("%i check(s) failed\n", fails);
+        return 1;
+    }
+
+    printf("All offset search tests passed\n");
+    return 0;
+}
@@ -0,0 +1,168 @@
+/*
+ * This file is part of cyanrip.
+ *
+ * cyanrip is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * cyanrip is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with cyanrip; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <libavutil/intreadwrite.h>
+
+#include "checksums.h"
+#include "pressing.h"
+
+/* Long enough to have a 450th sector with room around it */
+#define TRACK_SAMPLES (470*588)
+#define NB_TRACKS 3
+
+static int fails = 0;
+
+static void check_int(const char *what, int got, int want)
+{
+    if (got != want) {
+        printf("FAIL: %s: got %i, want %i\n", what, got, want);
+        fails++;
+    }
+}
+
+/* The whole disc, silence past either end */
+static uint32_t disc[NB_TRACKS*TRACK_SAMPLES];
+
+static uint32_t disc_sample(int64_t pos)
+{
+    return (pos < 0 || pos >= FF_ARRAY_ELEMS(disc)) ? 0 : disc[pos];
+}
+
+/* The checksums a pressing offset by d from this rip would have */
+static uint32_t v1_at(cyanrip_track *t, int idx, int d)
+{
+    uint32_t start = t->acurip_track_is_first ? 5*588 : 1;
+    uint32_t end = TRACK_SAMPLES - (t->acurip_track_is_last ? 5*588 : 0);
+    uint32_t sum = 0;
+    for (uint32_t i = start; i <= end; i++)
+        sum += i*disc_sample((int64_t)idx*TRACK_SAMPLES + i - 1 + d);
+    return sum;
+}
+
+static uint32_t v1_450_at(int idx, int d)
+{
+    uint32_t sum = 0;
+    for (uint32_t m = 1; m <= 588; m++)
+        sum += m*disc_sample((int64_t)idx*TRACK_SAMPLES + 450*588 + m - 1 + d);
+    return sum;
+}
+
+static void rip(cyanrip_ctx *ctx, const int *ripped)
+{
+    for (int i = 0; i < NB_TRACKS; i++) {
+        cyanrip_track *t = &ctx->tracks[i];
+        if (!ripped[i]) {
+            crip_pressing_free(&t->pressing);
+            continue;
+        }
+
+        cyanrip_checksum_ctx s;
+        crip_init_checksum_ctx(ctx, &s, t);
+        const uint8_t *data = (const uint8_t *)&disc[i*TRACK_SAMPLES];
+        for (int pos = 0; pos < TRACK_SAMPLES*4;) {
+            int bytes = FFMIN(8*CDIO_CD_FRAMESIZE_RAW, TRACK_SAMPLES*4 - pos);
+            crip_process_checksums(&s, data + pos, bytes);
+            pos += bytes;
+        }
+        crip_finalize_checksums(&s, t);
+    }
+
+    crip_pressing_search(ctx);
+}
+
+int main(void)
+{
+    static cyanrip_ctx ctx;
+    cyanrip_track *tracks = ctx.tracks;
+    static CRIPAccuDBEntry entries[NB_TRACKS][2];
+    static const int offsets[NB_TRACKS] = { -2000, 667, 2999 };
+    static const int all[NB_TRACKS] = { 1, 1, 1 };
+    static const int no_last[NB_TRACKS] = { 1, 1, 0 };
+
+    srand(0);
+    for (int i = 0; i < FF_ARRAY_ELEMS(disc); i++)
+        disc[i] = ((uint32_t)rand() << 16) ^ rand();
+
+    ctx.nb_tracks = NB_TRACKS;
+
+    for (int i = 0; i < NB_TRACKS; i++) {
+        cyanrip_track *t = &tracks[i];
+        t->number = i + 1;
+        t->nb_samples = TRACK_SAMPLES;
+        t->start_lsn = i*TRACK_SAMPLES/588;
+        t->end_lsn = (i + 1)*TRACK_SAMPLES/588 - 1;
+        t->acurip_track_is_first = !i;
+        t->acurip_track_is_last = i == NB_TRACKS - 1;
+        t->pt = i ? &tracks[i - 1] : NULL;
+        t->nt = i != NB_TRACKS - 1 ? &tracks[i + 1] : NULL;
+        t->ar_db_status = CYANRIP_ACCUDB_FOUND;
+        t->ar_db_entries = entries[i];
+        t->ar_db_nb_entries = 2;
+        t->ar_db_max_confidence = 10;
+
+        /* An unrelated pressing, and one offset from this rip */
+        entries[i][0] = (CRIPAccuDBEntry){ 3, 0x12345678, 0x9ABCDEF0 };
+        entries[i][1] = (CRIPAccuDBEntry){ 10, v1_at(t, i, offsets[i]),
+                                           v1_450_at(i, offsets[i]) };
+    }
+
+    /* Every track matches at its offset, going into its neighbours */
+    rip(&ctx, all);
+    for (int i = 0; i < NB_TRACKS; i++) {
+        check_int("v1 matches", tracks[i].nb_pressing_matches, 1);
+        check_int("v1 offset", tracks[i].pressing_matches[0].offset, offsets[i]);
+        check_int("v1 confidence", tracks[i].pressing_matches[0].confidence, 10);
+        check_int("v1 not partial", tracks[i].pressing_matches[0].partial, 0);
+    }
+
+    /* Without the next track, the samples past the end of track 2 are
+     * unknown, so only its 450th sector can match */
+    rip(&ctx, no_last);
+    check_int("first track unaffected", tracks[0].pressing_matches[0].offset, offsets[0]);
+    check_int("450 matches", tracks[1].nb_pressing_matches, 1);
+    check_int("450 offset", tracks[1].pressing_matches[0].offset, offsets[1]);
+    check_int("450 partial", tracks[1].pressing_matches[0].partial, 1);
+    check_int("not ripped", tracks[2].nb_pressing_matches, 0);
+
+    /* A v2-only submission also only matches by its 450th sector */
+    entries[0][1].checksum = 0x0BADF00D;
+    rip(&ctx, all);
+    check_int("v2 entry 450 match", tracks[0].nb_pressing_matches, 1);
+    check_int("v2 entry 450 offset", tracks[0].pressing_matches[0].offset, offsets[0]);
+    check_int("v2 entry partial", tracks[0].pressing_matches[0].partial, 1);
+
+    /* Nothing to do for tracks verified as they are */
+    entries[1][1].checksum = v1_at(&tracks[1], 1, 0);
+    rip(&ctx, all);
+    check_int("verified track", tracks[1].nb_pressing_matches, 0);
+
+    for (int i = 0; i < NB_TRACKS; i++)
+        crip_pressing_free(&tracks[i].pressing);
+
+    if (fails) {
+        printf("%i check(s) failed\n", fails);
+        return 1;
+    }
+
+    printf("All pressing offset tests passed\n");
+    return 0;
+}
@@ -0,0 +1,168 @@
+/*
+ * This file is part of cyanrip.
+ *
+ * cyanrip is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * cyanrip is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with cyanrip; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <libavutil/channel_layout.h>
+#include <libavutil/time.h>
+
+#include "cyanrip_encode.h"
+#include "fifo_frame.h"
+#include "frame_ring.h"
+
+/* One decoder feeding three encoders, as with -o flac,opus,mp3. Compares
+ * the mutex FIFO per encoder which was used before with the shared ring. */
+#define NB_READERS 3
+#define NB_FRAMES  20000
+
+typedef struct Reader {
+    AVBufferRef *queue;
+    int idx;
+    int nb_frames;
+    int64_t sum;
+} Reader;
+
+/* Stand-in for the encoders, only reads the samples */
+static int64_t consume(const AVFrame *f)
+{
+    int64_t sum = 0;
+    const int16_t *src = (const int16_t *)f->data[0];
+    for (int i = 0; i < f->nb_samples*2; i += 64)
+        sum += src[i];
+    return sum + f->pts;
+}
+
+static void *fifo_reader(void *arg)
+{
+    Reader *r = arg;
+    AVFrame *f;
+
+    while ((f = cr_frame_fifo_pop(r->queue))) {
+        r->sum += consume(f);
+        r->nb_frames++;
+        av_frame_free(&f);
+    }
+
+    return NULL;
+}
+
+static void *ring_reader(void *arg)
+{
+    Reader *r = arg;
+    const AVFrame *f;
+
+    while ((f = cr_frame_ring_peek(r->queue, r->idx))) {
+        r->sum += consume(f);
+        r->nb_frames++;
+        cr_frame_ring_release(r->queue, r->idx);
+    }
+
+    cr_frame_ring_remove_reader(r->queue, r->idx);
+    return NULL;
+}
+
+static int run(const char *name, int use_ring, AVFrame *frame)
+{
+    Reader r[NB_READERS] = { 0 };
+    pthread_t thread[NB_READERS];
+    AVBufferRef *ring = NULL;
+    int ret = 0;
+
+    if (use_ring) {
+        ring = cr_frame_ring_create(64);
+        if (!ring)
+            return AVERROR(ENOMEM);
+    }
+
+    for (int i = 0; i < NB_READERS; i++) {
+        if (use_ring) {
+            r[i].queue = av_buffer_ref(ring);
+            r[i].idx = cr_frame_ring_add_reader(ring);
+        } else {
+            r[i].queue = cr_frame_fifo_create(-1, FRAME_FIFO_BLOCK_NO_INPUT);
+        }
+        if (!r[i].queue)
+            return AVERROR(ENOMEM);
+    }
+
+    int64_t start = av_gettime_relative();
+
+    for (int i = 0; i < NB_READERS; i++)
+        pthread_create(&thread[i], NULL, use_ring ? ring_reader : fifo_reader, &r[i]);
+
+    for (int n = 0; n < NB_FRAMES && !ret; n++) {
+        frame->pts = n;
+        if (use_ring)
+            ret = cr_frame_ring_push(ring, frame);
+        else
+            for (int i = 0; i < NB_READERS && !ret; i++)
+                ret = cr_frame_fifo_push(r[i].queue, frame);
+    }
+
+    if (use_ring)
+        cr_frame_ring_push(ring, NULL);
+    else
+        for (int i = 0; i < NB_READERS; i++)
+            cr_frame_fifo_push(r[i].queue, NULL);
+
+    for (int i = 0; i < NB_READERS; i++)
+        pthread_join(thread[i], NULL);
+
+    int64_t time = av_gettime_relative() - start;
+
+    for (int i = 0; i < NB_READERS; i++) {
+        if (r[i].nb_frames != NB_FRAMES || r[i].sum != r[0].sum) {
+            printf("%s: reader %i got %i frames\n", name, i, r[i].nb_frames);
+            ret = AVERROR_BUG;
+        }
+        av_buffer_unref(&r[i].queue);
+    }
+    av_buffer_unref(&ring);
+
+    printf("%-12s %8.1f ns/frame\n", name, time*1000.0/NB_FRAMES);
+
+    return ret;
+}
+
+int main(void)
+{
+    AVFrame *frame = av_frame_alloc();
+    if (!frame)
+        return 1;
+
+    frame->format = AV_SAMPLE_FMT_S16;
+    frame->sample_rate = 44100;
+    frame->ch_layout = (AVChannelLayout)AV_CHANNEL_LAYOUT_STEREO;
+    frame->nb_samples = CRIP_FRAME_SAMPLES;
+    if (av_frame_get_buffer(frame, 0) < 0)
+        return 1;
+    for (int i = 0; i < frame->nb_samples*2; i++)
+        ((int16_t *)frame->data[0])[i] = i;
+
+    printf("%i frames of %i samples, %i readers\n",
+           NB_FRAMES, CRIP_FRAME_SAMPLES, NB_READERS);
+
+    int ret = run("mutex fifo", 0, frame);
+    if (!ret)
+        ret = run("frame ring", 1, frame);
+
+    av_frame_free(&frame);
+    return ret < 0;
+}
@@ -2,11 +2,17 @@
 # Rips the disc image fixtures and verifies the finished files.
 # Usage: rip_images.py <cyanrip-binary> <fixtures-dir> <scenario>
 
+import array
+import functools
 import hashlib
+import http.server
+import os
+import re
 import shutil
 import subprocess
 import sys
 import tempfile
+import threading
 from pathlib import Path
 
 CRIP = sys.argv[1]
@@ -24,9 +30,10 @@ def fail(msg):
     fails += 1
 
 
-def crip(*args):
+def crip(*args, env=None):
     r = subprocess.run([CRIP, *map(str, args)], stdout=subprocess.PIPE,
-                       stderr=subprocess.STDOUT, timeout=60)
+                       stderr=subprocess.STDOUT, timeout=60,
+                       env={**os.environ, **env} if env else None)
     return r.returncode, r.stdout.decode(errors="replace")
 
 
@@ -55,7 +62,9 @@ def pcm_md5(name, track):
 def expect(name, *specs):
     out = WORK / f"out_{name}"
     want = sorted(s.split(":")[0] for s in specs)
-    have = sorted(p.name for p in out.iterdir()) if out.is_dir() else []
+    # Every rip leaves a journal, checked by the resume scenario
+    have = sorted(p.name for p in out.iterdir()
+                  if p.suffix != ".journal") if out.is_dir() else []
     if have != want:
         fail(f"{name}: outputs {have} != expected {want}")
         return
@@ -147,6 +156,111 @@ def sc_filters():
         fail("-W did not disable deemphasis")
 
 
+def sc_repeat():
+    # Repeat ripping assembles tracks from voted sectors, which on a clean
+    # image must give exactly what a single rip does
+    rip("plain", "basic.cue", "-o", "pcm")
+    rip("repeat", "basic.cue", "-o", "pcm", "-Z", "2")
+    expect("repeat", "1.pcm", "2.pcm", "log.log", "sheet.cue")
+    for t in (1, 2):
+        if pcm_md5("repeat", t) != pcm_md5("plain", t):
+            fail(f"repeat: track {t} differs from a single rip")
+
+    log = (WORK / "repeat.log").read_text()
+    if log.count("all sectors matched 3 times") != 2:
+        fail("repeat: tracks were not accepted after matching 3 times")
+    if log.count("(after 3 rips, ") != 2:
+        fail("repeat: expected exactly 3 passes per track")
+
+
+def album_loudness(log):
+    m = re.search(r"Album Loudness Summary:\s+Integrated loudness:\s+I:\s+(\S+) LUFS", log)
+    return m.group(1) if m else None
+
+
+def sc_resume():
+    # A finished rip journals every track, so resuming restores them all
+    rip("resume", "basic.cue", "-o", "pcm")
+    journal = (WORK / "out_resume" / "log.journal").read_text()
+    if journal.count("\ndone ") != 2:
+        fail("resume: tracks missing from the journal")
+
+    first = pcm_md5("resume", 2)
+    album = album_loudness((WORK / "resume.log").read_text())
+    if album is None:
+        fail("resume: no album loudness in the log")
+    rip("resume", "basic.cue", "-o", "pcm", "-y", "all")
+    if (WORK / "resume.log").read_text().count("restored from the journal") != 2:
+        fail("resume: tracks were ripped again")
+    if pcm_md5("resume", 2) != first:
+        fail("resume: track 2 changed")
+
+    # A track whose file went missing gets ripped again
+    (WORK / "out_resume" / "2.pcm").unlink()
+    rip("resume", "basic.cue", "-o", "pcm", "-y", "all")
+    log = (WORK / "resume.log").read_text()
+    if log.count("restored from the journal") != 1:
+        fail("resume: track 1 was not restored")
+    if "Track 2 files are missing" not in log:
+        fail("resume: missing track 2 was not ripped again")
+    if pcm_md5("resume", 2) != first:
+        fail("resume: re-ripped track 2 differs")
+    if album_loudness(log) != album:
+        fail("resume: album loudness left out the restored track")
+
+    # Without -y, the journal only gets mentioned
+    rip("resume", "basic.cue", "-o", "pcm")
+    if "use -y to resume" not in (WORK / "resume.log").read_text():
+        fail("resume: no hint about an existing journal")
+
+
+def sc_multi():
+    # Two images ripped at once, each into its own album directory
+    rip("plain", "basic.cue", "-o", "pcm")
+    ec, log = crip("-d", f"{WORK / 'basic.cue'},{WORK / 'mixed.cue'}",
+                   "-N", "-A", "-U", "-s", "0", "-P", "0", "-o", "pcm",
+                   "-D", WORK / "out_multi" / "{album}", "-F", "{track}",
+                   "-L", "log", "-M", "sheet")
+    if ec != 0:
+        fail(f"multi: cyanrip exited with {ec} (log follows)")
+        print(log)
+        return
+
+    dirs = sorted((WORK / "out_multi").iterdir())
+    have = sorted(sorted(p.name for p in d.iterdir() if p.suffix != ".journal")
+                  for d in dirs)
+    want = sorted([["1.pcm", "2.pcm", "log.log", "sheet.cue"],
+                   ["2.pcm", "3.pcm", "log.log", "sheet.cue"]])
+    if have != want:
+        fail(f"multi: outputs {have} != expected {want}")
+        return
+
+    basic = next(d for d in dirs if (d / "1.pcm").exists())
+    for t in (1, 2):
+        data = (basic / f"{t}.pcm").read_bytes()
+        if hashlib.md5(data).hexdigest() != pcm_md5("plain", t):
+            fail(f"multi: track {t} differs from a single rip")
+
+    # Terminal lines say which drive they're from, log files don't
+    if "[basic.cue] " not in log or "[mixed.cue] " not in log:
+        fail("multi: terminal output is not prefixed with the drive")
+    if "[basic.cue]" in (basic / "log.log").read_text():
+        fail("multi: drive prefix ended up in the log file")
+    if "Drive summary:" not in log:
+        fail("multi: no drive summary")
+
+    # Offsets are either one for all drives, or one per drive
+    ec, _ = crip("-d", f"{WORK / 'basic.cue'},{WORK / 'mixed.cue'}", "-N",
+                 "-s", "0,0,0", "-I")
+    if ec != 1:
+        fail(f"multi: mismatched offset count not refused (exit {ec})")
+
+
+class QuietFiles(http.server.SimpleHTTPRequestHandler):
+    def log_message(self, *args):
+        pass
+
+
 def sc_art():
     # Album cover art: written out per format and embedded in every track
     rip("art", "basic.cue", "-C", f"Front={FIX / 'art.png'}")
@@ -164,6 +278,21 @@ def sc_art():
             if ptype != "Cover (front)":
                 fail(f"art: {f}.flac picture type {ptype!r}")
 
+    # The image goes through untouched, read from disk or downloaded
+    if (WORK / "out_art" / "Front.png").read_bytes() != (FIX / "art.png").read_bytes():
+        fail("art: Front.png differs from the source image")
+
+    srv = http.server.HTTPServer(("127.0.0.1", 0),
+                                 functools.partial(QuietFiles, directory=str(FIX)))
+    threading.Thread(target=srv.serve_forever, daemon=True).start()
+    rip("artdl", "basic.cue", "-C",
+        f"Front=http://127.0.0.1:{srv.server_port}/art.png")
+    srv.shutdown()
+    srv.server_close()
+    expect("artdl", "1.flac:4", "2.flac:4", "Front.png", "log.log", "sheet.cue")
+    if (WORK / "out_artdl" / "Front.png").read_bytes() != (FIX / "art.png").read_bytes():
+        fail("artdl: Front.png differs from the served image")
+
 
 def sc_cue_only():
     # -J generates and prints the CUE sheet without ripping anything
@@ -214,6 +343,357 @@ def sc_verify_log():
         fail("tampered log verified")
 
 
+def ogg_crcs_ok(data):
+    pos = 0
+    while pos < len(data):
+        n = data[pos + 26]
+        page = bytearray(data[pos:pos + 27 + n + sum(data[pos + 27:pos + 27 + n])])
+        stored = int.from_bytes(page[22:26], "little")
+        page[22:26] = bytes(4)
+        crc = 0
+        for b in page:
+            crc ^= b << 24
+            for _ in range(8):
+                crc = ((crc << 1) ^ (0x04C11DB7 if crc & 0x80000000 else 0)) & 0xFFFFFFFF
+        if crc != stored:
+            return False
+        pos += len(page)
+    return True
+
+
+def sc_replaygain():
+    # Files get written while ripping, with placeholder gains which are
+    # overwritten in place once the whole album has been measured
+    ec, log = crip("-d", WORK / "basic.cue", "-N", "-A", "-U", "-s", "0",
+                   "-P", "0", "-o", "flac,wavpack,opus",
+                   "-D", WORK / "out_rg" / "{format}", "-F", "{track}",
+                   "-L", "log", "-M", "sheet")
+    if ec != 0:
+        fail(f"replaygain: cyanrip exited with {ec} (log follows)")
+        print(log)
+        return
+
+    albums = set()
+    for folder, ext in (("FLAC", "flac"), ("WV", "wv"), ("OPUS", "opus")):
+        for t in (1, 2):
+            name = f"{folder}/{t}.{ext}"
+            data = (WORK / "out_rg" / folder / f"{t}.{ext}").read_bytes()
+            gains = dict(re.findall(rb"REPLAYGAIN_(TRACK|ALBUM)_GAIN[=\0]"
+                                    rb"([+-]\d\d\.\d\d) dB", data))
+            r128 = dict(re.findall(rb"R128_(TRACK|ALBUM)_GAIN[=\0]([+-]\d{5})",
+                                   data))
+            if sorted(gains) != [b"ALBUM", b"TRACK"] or sorted(r128) != sorted(gains):
+                fail(f"replaygain: {name} tags {gains} {r128}")
+                continue
+
+            for scope in gains:
+                if gains[scope] == b"+00.00" or r128[scope] == b"-01280":
+                    fail(f"replaygain: {name} {scope} gain left as a placeholder")
+                if abs(int(r128[scope]) / 256 + 5 - float(gains[scope])) > 0.01:
+                    fail(f"replaygain: {name} {scope} R128 gain doesn't match")
+            albums.add(gains[b"ALBUM"])
+
+            if ext == "opus" and not ogg_crcs_ok(data):
+                fail(f"replaygain: {name} has broken Ogg page CRCs")
+
+    if len(albums) != 1:
+        fail(f"replaygain: files have different album gains {albums}")
+
+
+
+def sc_mapped():
+    # Images are read straight from the file, check the data against it
+    S = 2352
+    audio = (FIX / "cdda.bin").read_bytes()
+
+    for name, img, tracks in (("bin", "basic.cue", (audio[:300*S], audio[300*S:])),
+                              ("nrg", "cdda.nrg", (audio[:225*S], audio[225*S:450*S]))):
+        rip(name, img, "-o", "pcm")
+        if "Image access:" not in (WORK / f"out_{name}" / "log.log").read_text():
+            fail(f"mapped: {img} was not mapped")
+        for t, want in enumerate(tracks, 1):
+            if pcm_md5(name, t) != hashlib.md5(want).hexdigest():
+                fail(f"mapped: {img} track {t} does not match the image")
+
+    # Offsets slice the mapping, reading past the end gives silence
+    ec, log = crip("-d", WORK / "basic.cue", "-N", "-A", "-U", "-s", "30",
+                   "-P", "0", "-o", "pcm", "-D", WORK / "out_offs",
+                   "-F", "{track}", "-L", "log", "-M", "sheet")
+    if ec != 0:
+        fail(f"mapped: offset rip exited with {ec}")
+        print(log)
+        return
+    tracks = (audio[120:300*S + 120], audio[300*S + 120:] + bytes(120))
+    for t, want in enumerate(tracks, 1):
+        if pcm_md5("offs", t) != hashlib.md5(want).hexdigest():
+            fail(f"mapped: offset track {t} does not match the image")
+
+
+def sc_parallel():
+    # Tracks of a mapped image processed at once must come out exactly as
+    # if ripped one by one, logs and album loudness included
+    for name, jobs in (("serial", "1"), ("parallel", "4")):
+        rip(name, "pregap.cue", "-p", "1=track", "-p", "2=track",
+            "-o", "pcm", "-j", jobs)
+
+    for t in range(5):
+        if pcm_md5("parallel", t) != pcm_md5("serial", t):
+            fail(f"parallel: track {t} differs")
+
+    sheets = [(WORK / f"out_{n}" / "sheet.cue").read_text()
+              for n in ("serial", "parallel")]
+    if sheets[0] != sheets[1]:
+        fail("parallel: CUE sheets differ")
+
+    logs = [(WORK / f"out_{n}" / "log.log").read_text()
+            for n in ("serial", "parallel")]
+    for what in (r"^Track \d+.*$", r"^.*LUFS.*$"):
+        if re.findall(what, logs[0], re.M) != re.findall(what, logs[1], re.M):
+            fail(f"parallel: logs differ in lines matching {what}")
+
+def sc_stream():
+    # Images which can't be mapped are read in one go, from the start of the
+    # first track to the end of the last, and split into tracks as they come
+    S = 2352
+    audio = (FIX / "cdda.bin").read_bytes()
+    shutil.copy(FIX / "cdda.bin", WORK / "stream.bin")
+    bin_path = WORK / "stream.bin"
+    (WORK / "stream.toc").write_text(f'CD_DA\n\nTRACK AUDIO\nFILE "{bin_path}" 0 00:04:00\n\n'
+                                     f'TRACK AUDIO\nFILE "{bin_path}" 00:04:00 00:04:00\n')
+
+    def swapped(data):
+        a = array.array("H", data)
+        a.byteswap()
+        return a.tobytes()
+
+    for offs, paranoia, tracks in (
+            (0, "0", (audio[:300*S], audio[300*S:])),
+            (30, "0", (audio[120:300*S + 120], audio[300*S + 120:] + bytes(120))),
+            (-30, "max", (bytes(120) + audio[:300*S - 120], audio[300*S - 120:-120]))):
+        name = f"stream{offs}"
+        ec, log = crip("-d", WORK / "stream.toc", "-N", "-A", "-U", "-s", offs,
+                       "-P", paranoia, "-o", "pcm", "-D", WORK / f"out_{name}",
+                       "-F", "{track}", "-L", "log", "-M", "sheet")
+        if ec != 0:
+            fail(f"stream: offset {offs} rip exited with {ec} (log follows)")
+            print(log)
+            continue
+        if "Image access:" in (WORK / f"out_{name}" / "log.log").read_text():
+            fail("stream: TOC image was mapped")
+        # Raw cdrdao audio may get taken as big-endian
+        for t, want in enumerate(tracks, 1):
+            if pcm_md5(name, t) not in (hashlib.md5(want).hexdigest(),
+                                        hashlib.md5(swapped(want)).hexdigest()):
+                fail(f"stream: offset {offs} track {t} does not match the image")
+
+
+def sc_batch():
+    # A directory of images ripped two at a time, one of them broken
+    batch = WORK / "batch"
+    batch.mkdir()
+    for name in ("basic", "mixed"):
+        shutil.copy(WORK / f"{name}.cue", batch)
+        shutil.copy(WORK / f"{name}.bin", batch)
+    (batch / "broken.cue").write_text('FILE "missing.bin" BINARY\n'
+                                      '  TRACK 01 AUDIO\n'
+                                      '    INDEX 01 00:00:00\n')
+
+    ec, log = crip("-i", batch, "-n", "2", "-N", "-A", "-U", "-s", "0", "-P", "0",
+                   "-o", "pcm", "-D", WORK / "out_batch" / "{album}", "-F", "{track}",
+                   "-L", "log", "-M", "sheet")
+    if ec == 0:
+        fail("batch: a broken image didn't make the batch fail")
+
+    dirs = sorted((WORK / "out_batch").iterdir())
+    have = sorted(sorted(p.name for p in d.iterdir() if p.suffix != ".journal")
+                  for d in dirs)
+    want = sorted([["1.pcm", "2.pcm", "log.log", "sheet.cue"],
+                   ["2.pcm", "3.pcm", "log.log", "sheet.cue"]])
+    if have != want:
+        fail(f"batch: outputs {have} != expected {want} (log follows)")
+        print(log)
+
+    rows = {}
+    for line in log.split("Batch summary:")[-1].splitlines():
+        f = line.split()
+        if len(f) > 2 and f[-1].endswith(".cue"):
+            rows[Path(f[-1]).name] = f[0]
+    if rows != {"basic.cue": "ok", "broken.cue": "failed", "mixed.cue": "ok"}:
+        fail(f"batch: summary statuses {rows} (log follows)")
+        print(log)
+    if "2 of 3 disc image(s) ripped without errors" not in log:
+        fail("batch: no summary total")
+
+    # Or a list of them, relative to where the list is
+    (batch / "list").write_text("# Just the one\n\nbasic.cue\n")
+    ec, log = crip("-i", batch / "list", "-N", "-A", "-U", "-s", "0", "-P", "0",
+                   "-o", "pcm", "-D", WORK / "out_list" / "{album}", "-F", "{track}")
+    if ec != 0 or "1 of 1 disc image(s) ripped without errors" not in log:
+        fail(f"batch: listed image not ripped (exit {ec}, log follows)")
+        print(log)
+
+    ec, _ = crip("-i", batch, "-d", WORK / "basic.cue", "-I")
+    if ec != 1:
+        fail(f"batch: -i with -d not refused (exit {ec})")
+
+
+def read_archive(path):
+    # The index is found through the footer at the very end
+    data = path.read_bytes()
+    if data[:8] != b"CRIPARC1" or data[-16:-8] != b"CRIPIDX1":
+        return data, None
+    pos = int.from_bytes(data[-8:], "little")
+    return data, data[pos:-16].decode().splitlines()
+
+
+def sc_archive():
+    # The whole disc as offset corrected FLAC hunks, with an index of them
+    S = 2352
+    audio = (FIX / "cdda.bin").read_bytes()
+    ffmpeg = shutil.which("ffmpeg")
+
+    for name, offs, jobs, want in (("arc", "0", "1", audio),
+                                   ("arcj", "0", "4", audio),
+                                   ("arcoffs", "30", "1", audio[120:] + bytes(120))):
+        ec, log = crip("-d", WORK / "basic.cue", "-N", "-A", "-U", "-s", offs,
+                       "-P", "0", "-o", "pcm", "-D", WORK / f"out_{name}",
+                       "-F", "{track}", "-L", "log", "-M", "sheet", "-j", jobs, "-w")
+        if ec != 0:
+            fail(f"archive: {name} rip exited with {ec} (log follows)")
+            print(log)
+            continue
+
+        data, index = read_archive(WORK / f"out_{name}" / "sheet.crimg")
+        if index is None:
+            fail(f"archive: {name} has no index")
+            continue
+
+        hunks = [l.split() for l in index if l.startswith("HUNK ")]
+        hunk_sectors = int(next(l.split()[1] for l in index
+                                if l.startswith("HUNK_SECTORS ")))
+        if len(hunks) != -(-len(audio) // (hunk_sectors*S)):
+            fail(f"archive: {name} has {len(hunks)} hunks")
+        for _, idx, pos, size, md5 in hunks:
+            idx, pos, size = int(idx), int(pos), int(size)
+            pcm = want[idx*hunk_sectors*S:(idx + 1)*hunk_sectors*S]
+            if md5 != hashlib.md5(pcm).hexdigest():
+                fail(f"archive: {name} hunk {idx} checksum does not match the disc")
+            if data[pos:pos + 4] != b"fLaC":
+                fail(f"archive: {name} hunk {idx} is not FLAC")
+            elif ffmpeg:
+                # Every hunk decodes on its own
+                r = subprocess.run([ffmpeg, "-v", "error", "-f", "flac", "-i", "-",
+                                    "-f", "s16le", "-"], input=data[pos:pos + size],
+                                   stdout=subprocess.PIPE, timeout=60)
+                if r.stdout != pcm:
+                    fail(f"archive: {name} hunk {idx} does not decode to the disc")
+
+        if [l for l in index if l.startswith("SECTORS ")] != ["SECTORS 0 600 read"]:
+            fail(f"archive: {name} sector states are wrong")
+        if [l for l in index if l.startswith("SAMPLES ")] != ["SAMPLES 1 0 176400",
+                                                              "SAMPLES 2 176400 176400"]:
+            fail(f"archive: {name} track ranges are wrong")
+        for t in (1, 2):
+            begin = (t - 1)*300*S
+            if pcm_md5(name, t) != hashlib.md5(want[begin:begin + 300*S]).hexdigest():
+                fail(f"archive: {name} track {t} does not match the archive")
+
+    # The data track is left as silence, marked as never read
+    rip("arcmixed", "mixed.cue", "-o", "pcm", "-w")
+    _, index = read_archive(WORK / "out_arcmixed" / "sheet.crimg")
+    if not index or not any(l.startswith("SECTORS 0 ") and l.endswith(" unread")
+                            for l in index):
+        fail("archive: data track sectors not marked unread")
+
+    ec, _ = crip("-d", WORK / "basic.cue", "-X", "burst", "-w", "-I")
+    if ec != 1:
+        fail(f"archive: -w with burst ripping not refused (exit {ec})")
+
+
+class ARServer(http.server.BaseHTTPRequestHandler):
+    # Answers any AccurateRip lookup with an entry made up from its name
+    requests = []
+    missing = False
+
+    def do_GET(self):
+        name = self.path.rsplit("/", 1)[-1]
+        ARServer.requests.append(name)
+        m = re.fullmatch(r"dBAR-(\d{3})-([0-9a-f]{8})-([0-9a-f]{8})-([0-9a-f]{8})\.bin", name)
+        if not m or ARServer.missing:
+            self.send_error(404)
+            return
+        tracks = int(m[1])
+        body = bytes([tracks]) + b"".join(int(v, 16).to_bytes(4, "little")
+                                          for v in m.groups()[1:])
+        body += (bytes([5]) + bytes(8))*tracks
+        self.send_response(200)
+        self.send_header("Content-Type", "application/octet-stream")
+        self.send_header("Content-Length", str(len(body)))
+        self.end_headers()
+        self.wfile.write(body)
+
+    def log_message(self, *args):
+        pass
+
+
+def sc_cache():
+    # Lookups are kept in the cache directory, and reused when offline
+    srv = http.server.HTTPServer(("127.0.0.1", 0), ARServer)
+    threading.Thread(target=srv.serve_forever, daemon=True).start()
+    env = {"CYANRIP_ACCURIP_URL": f"http://127.0.0.1:{srv.server_port}/ar"}
+    cache = WORK / "cache"
+
+    def lookup(name, img, *extra):
+        ec, log = crip("-d", WORK / img, "-N", "-U", "-s", "0", "-P", "0",
+                       "-o", "pcm", "-D", WORK / f"out_{name}", "-F", "{track}",
+                       "-L", "log", "-M", "sheet", "-g", cache, *extra, env=env)
+        if ec != 0:
+            fail(f"cache: {name} rip exited with {ec} (log follows)")
+            print(log)
+        m = re.search(r"AccurateRip:\s+(.*)", log)
+        return m[1].strip() if m else None, log
+
+    status, _ = lookup("cache_online", "basic.cue")
+    if status != "found" or len(ARServer.requests) != 1:
+        fail(f"cache: online lookup gave {status} in {len(ARServer.requests)} requests")
+    if not any(p.is_file() for p in (cache / "accuraterip").rglob("*")):
+        fail("cache: AccurateRip response not stored")
+
+    status, _ = lookup("cache_hit", "basic.cue")
+    if status != "found" or len(ARServer.requests) != 1:
+        fail(f"cache: cached lookup gave {status} in {len(ARServer.requests)} requests")
+
+    # The server not having a disc is cached as well
+    ARServer.missing = True
+    status, _ = lookup("cache_missing", "pregap.cue")
+    if status != "not found":
+        fail(f"cache: missing entry gave {status}")
+
+    srv.shutdown()
+    srv.server_close()
+
+    for name, img, want in (("cache_off", "basic.cue", "found"),
+                            ("cache_offmissing", "pregap.cue", "not found")):
+        status, _ = lookup(name, img, "-x")
+        if status != want:
+            fail(f"cache: offline {img} gave {status} instead of {want}")
+    if len(ARServer.requests) != 2:
+        fail(f"cache: offline rips made {len(ARServer.requests) - 2} requests")
+
+    # Nothing expires with -u 0, which would fail with the server gone
+    status, _ = lookup("cache_expired", "basic.cue", "-u", "0")
+    if status != "found":
+        fail(f"cache: -u 0 did not keep the entry ({status})")
+
+    status, log = lookup("cache_uncached", "mixed.cue", "-x")
+    if status != "error" or "offline" not in log:
+        fail(f"cache: uncached offline lookup gave {status}")
+
+    ec, _ = crip("-d", WORK / "basic.cue", "-x", "-I")
+    if ec != 1:
+        fail(f"cache: -x without -g not refused (exit {ec})")
+
+
 with tempfile.TemporaryDirectory() as tmpdir:
     WORK = Path(tmpdir)
 
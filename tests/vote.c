@@ -0,0 +1,143 @@
+/*
+ * This file is part of cyanrip.
+ *
+ * cyanrip is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * cyanrip is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with cyanrip; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include <cdio/paranoia/paranoia.h>
+
+#include "vote.h"
+
+#define FRAMES 64
+
+static int fails = 0;
+
+static void check_int(const char *what, int got, int want)
+{
+    if (got != want) {
+        printf("FAIL: %s: got %i, want %i\n", what, got, want);
+        fails++;
+    }
+}
+
+/* Sector contents, a different pattern per sector and variant */
+static const uint8_t *sector(int idx, int variant)
+{
+    static uint8_t buf[CDIO_CD_FRAMESIZE_RAW];
+    memset(buf, idx*7 + variant, sizeof(buf));
+    return buf;
+}
+
+static void check_sector(const char *what, CRIPVote *v, int idx, int variant)
+{
+    const uint8_t *got = crip_vote_data(v) + idx*CDIO_CD_FRAMESIZE_RAW;
+    if (memcmp(got, sector(idx, variant), CDIO_CD_FRAMESIZE_RAW)) {
+        printf("FAIL: %s: sector %i does not hold variant %i\n", what, idx, variant);
+        fails++;
+    }
+}
+
+int main(void)
+{
+    CRIPVote *v;
+    int start, len;
+
+    if (crip_vote_alloc(&v, FRAMES, 2) < 0)
+        return 1;
+
+    /* Nothing accepted, the whole track is a single run */
+    start = 0;
+    check_int("initial run length", crip_vote_next_run(v, &start), FRAMES);
+    check_int("initial run start", start, 0);
+
+    /* Two clean reads, except sector 10 which reads differently the
+     * second time, and sector 40 which paranoia flags */
+    for (int pass = 0; pass < 2; pass++)
+        for (int i = 0; i < FRAMES; i++)
+            crip_vote_add(v, i, sector(i, pass && i == 10), pass && i == 40);
+
+    check_int("disputed after 2 passes", crip_vote_disputed(v), 2);
+    check_sector("first read wins a tie", v, 10, 0);
+    check_sector("flagged read doesn't replace a vote", v, 40, 0);
+
+    /* The two disputed sectors are too far apart to merge */
+    start = 0;
+    len = crip_vote_next_run(v, &start);
+    check_int("first run start", start, 10);
+    check_int("first run length", len, 1);
+    start += len;
+    len = crip_vote_next_run(v, &start);
+    check_int("second run start", start, 40);
+    check_int("second run length", len, 1);
+    start += len;
+    check_int("no third run", crip_vote_next_run(v, &start), 0);
+
+    /* Sector 10 gets outvoted, sector 40 reads clean again */
+    crip_vote_add(v, 10, sector(10, 1), 0);
+    crip_vote_add(v, 10, sector(10, 1), 0);
+    crip_vote_add(v, 40, sector(40, 0), 0);
+    check_int("disputed after re-reads", crip_vote_disputed(v), 0);
+    check_sector("majority wins", v, 10, 1);
+    check_sector("flagged sector resolved", v, 40, 0);
+
+    crip_vote_free(&v);
+
+    /* Nearby disputed sectors are read as a single run */
+    if (crip_vote_alloc(&v, FRAMES, 1) < 0)
+        return 1;
+    for (int i = 0; i < FRAMES; i++)
+        if (i != 20 && i != 20 + CRIP_VOTE_MAX_GAP)
+            crip_vote_add(v, i, sector(i, 0), 0);
+
+    start = 0;
+    len = crip_vote_next_run(v, &start);
+    check_int("merged run start", start, 20);
+    check_int("merged run length", len, CRIP_VOTE_MAX_GAP + 1);
+
+    /* A sector with only flagged reads keeps the latest one */
+    crip_vote_add(v, 20, sector(20, 3), 1);
+    crip_vote_add(v, 20, sector(20, 4), 1);
+    check_sector("flagged fallback", v, 20, 4);
+    check_int("flagged reads don't vote", crip_vote_disputed(v), 2);
+
+    crip_vote_add(v, 28, sector(28, 1), 0);
+    check_int("single vote accepted", crip_vote_disputed(v), 1);
+
+    crip_vote_free(&v);
+
+    /* More differing reads than candidates, the leader must survive */
+    if (crip_vote_alloc(&v, 1, 3) < 0)
+        return 1;
+    crip_vote_add(v, 0, sector(0, 0), 0);
+    crip_vote_add(v, 0, sector(0, 0), 0);
+    for (int i = 1; i <= CRIP_VOTE_CANDIDATES + 2; i++)
+        crip_vote_add(v, 0, sector(0, i), 0);
+    check_sector("leader kept", v, 0, 0);
+    check_int("leader not yet accepted", crip_vote_disputed(v), 1);
+    crip_vote_add(v, 0, sector(0, 0), 0);
+    check_int("leader accepted", crip_vote_disputed(v), 0);
+    crip_vote_free(&v);
+
+    if (fails) {
+        printf("%i check(s) failed\n", fails);
+        return 1;
+    }
+
+    printf("All sector voting tests passed\n");
+    return 0;
+}